@@ -0,0 +1,190 @@
+#ifndef _GEARS_ALLOCATOR_HPP_
+#define _GEARS_ALLOCATOR_HPP_
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// blocks a thread takes from, or gives back to, a SharedPool at once.
+#define GR_THREAD_CACHE_BATCH 32
+// blocks a thread keeps before giving half of them back.
+#define GR_THREAD_CACHE_LIMIT 128
+
+typedef struct {
+    unsigned long long allocations; // calls to global operator new
+    unsigned long long frees;
+    unsigned long long bytes;       // total requested, not live
+} AllocationStats;
+
+namespace GearsEngine {
+    //===========
+    //bump allocator for data that lives for one frame. nothing is freed
+    //individually; reset() rewinds everything at once. when a frame needs
+    //more than the arena holds the extra comes from the heap, and the
+    //next reset() grows the arena so the following frames don't.
+    //===========
+    class FrameArena
+    {
+        private:
+            unsigned char *memory;
+            size_t capacity;
+            size_t head;
+
+            std::vector<void*> overflow;
+            size_t overflow_bytes;
+            size_t overflow_count;
+
+        public:
+            FrameArena( size_t capacity );
+            ~FrameArena();
+
+            void *allocate( size_t size, size_t alignment = 16 );
+
+            template<typename T>
+            T *allocate( size_t count )
+            {
+                return static_cast<T*>(allocate( sizeof(T) * count, alignof(T) ));
+            }
+
+            void reset();
+
+            size_t getUsedBytes();
+            size_t getCapacity();
+
+            //===========
+            //heap fallbacks since construction; stays flat once the arena
+            //has grown to the frame's needs.
+            //===========
+            size_t getOverflowCount();
+    };
+
+    //===========
+    //fixed-size blocks carved from pages, recycled through a free list.
+    //not thread-safe; see SharedPool.
+    //===========
+    class PoolAllocator
+    {
+        private:
+            size_t block_size;
+            size_t blocks_per_page;
+
+            void *free_list;
+            std::vector<unsigned char*> pages;
+            size_t live_count;
+
+        public:
+            PoolAllocator( size_t block_size, size_t blocks_per_page = 64 );
+            ~PoolAllocator();
+
+            void *allocate();
+            void  release( void *block );
+
+            size_t getBlockSize();
+            size_t getLiveCount();
+            size_t getPageCount();
+    };
+
+    //===========
+    //a PoolAllocator any thread can use. each thread keeps a small cache
+    //of blocks in front of it and only takes the lock to move a batch in
+    //or out, so steady-state allocation is lock-free. blocks may be
+    //released on a different thread than the one that got them.
+    //===========
+    class SharedPool
+    {
+        private:
+            PoolAllocator      pool;
+            std::mutex         mutex;
+            unsigned long long serial; // never reused, so stale caches can't match
+
+        public:
+            SharedPool( size_t block_size, size_t blocks_per_page = 64 );
+
+            void *allocate();
+            void  release( void *block );
+
+            size_t getBlockSize();
+    };
+
+    //===========
+    //global operator new/delete counters. only counts when the engine
+    //is built with GEARS_TRACK_ALLOCATIONS; otherwise all zeros. diff two
+    //snapshots around a frame to find the allocations in it.
+    //===========
+    AllocationStats getAllocationStats();
+    bool            isTrackingAllocations();
+}
+
+//===========
+//standard allocators on top of the above, for containers.
+//
+//ArenaAllocator hands out frame arena memory; deallocate is a no-op, so
+//the container must be gone (or forgotten) before the arena resets.
+//===========
+template<typename T>
+class ArenaAllocator
+{
+    public:
+        typedef T value_type;
+
+        GearsEngine::FrameArena *arena;
+
+        ArenaAllocator( GearsEngine::FrameArena *target ) : arena(target) {}
+
+        template<typename U>
+        ArenaAllocator( const ArenaAllocator<U> &other ) : arena(other.arena) {}
+
+        T *allocate( size_t n ) { return arena->allocate<T>( n ); }
+        void deallocate( T*, size_t ) {}
+
+        template<typename U>
+        bool operator==( const ArenaAllocator<U> &other ) const { return arena == other.arena; }
+        template<typename U>
+        bool operator!=( const ArenaAllocator<U> &other ) const { return arena != other.arena; }
+};
+
+//===========
+//PoolStlAllocator takes single objects, i.e. node-based container nodes,
+//from one SharedPool per node type; anything bigger goes to the heap.
+//===========
+template<typename T>
+class PoolStlAllocator
+{
+    private:
+        static GearsEngine::SharedPool &pool()
+        {
+            static GearsEngine::SharedPool instance( sizeof(T) < sizeof(void*) ? sizeof(void*) : sizeof(T) );
+            return instance;
+        }
+
+    public:
+        typedef T value_type;
+
+        PoolStlAllocator() {}
+
+        template<typename U>
+        PoolStlAllocator( const PoolStlAllocator<U>& ) {}
+
+        T *allocate( size_t n )
+        {
+            if (n == 1 && alignof(T) <= alignof(std::max_align_t))
+                return static_cast<T*>(pool().allocate());
+            return static_cast<T*>(::operator new( n * sizeof(T) ));
+        }
+
+        void deallocate( T *p, size_t n )
+        {
+            if (n == 1 && alignof(T) <= alignof(std::max_align_t))
+                pool().release( p );
+            else
+                ::operator delete( p );
+        }
+
+        template<typename U>
+        bool operator==( const PoolStlAllocator<U>& ) const { return true; }
+        template<typename U>
+        bool operator!=( const PoolStlAllocator<U>& ) const { return false; }
+};
+
+#endif // _GEARS_ALLOCATOR_HPP_
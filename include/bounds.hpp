@@ -0,0 +1,170 @@
+#ifndef _GEARS_BOUNDS_HPP_
+#define _GEARS_BOUNDS_HPP_
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+
+//===========
+//axis-aligned bounding box, in whatever space the caller keeps it in.
+//===========
+typedef struct {
+    glm::vec3 min;
+    glm::vec3 max;
+} AABB;
+
+//===========
+//six planes (left, right, bottom, top, near, far) as (normal, distance);
+//a point p is inside a plane when dot(normal, p) + distance >= 0.
+//===========
+typedef struct {
+    glm::vec4 planes[6];
+} Frustum;
+
+typedef struct {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float     length; // hits farther than this along direction are ignored
+} Ray;
+
+typedef enum {
+    GR_OUTSIDE = 0,
+    GR_INTERSECTING,
+    GR_INSIDE
+} Containment;
+
+namespace GearsEngine {
+    inline AABB mergeBounds( const AABB &a, const AABB &b )
+    {
+        AABB merged;
+        merged.min = glm::min( a.min, b.min );
+        merged.max = glm::max( a.max, b.max );
+        return merged;
+    }
+
+    inline float surfaceArea( const AABB &box )
+    {
+        glm::vec3 d = box.max - box.min;
+        return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+    }
+
+    inline bool contains( const AABB &outer, const AABB &inner )
+    {
+        return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y &&
+               outer.min.z <= inner.min.z && outer.max.x >= inner.max.x &&
+               outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+    }
+
+    inline bool overlaps( const AABB &a, const AABB &b )
+    {
+        return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+               a.min.y <= b.max.y && a.max.y >= b.min.y &&
+               a.min.z <= b.max.z && a.max.z >= b.min.z;
+    }
+
+    //===========
+    //world-space bounds of a box transformed by m.
+    //===========
+    inline AABB transformBounds( const AABB &box, const glm::mat4 &m )
+    {
+        glm::vec3 center = (box.min + box.max) * 0.5f;
+        glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+        glm::vec4 c = m * glm::vec4( center, 1.0f );
+        glm::vec3 e;
+        for (int i = 0; i < 3; ++i)
+            e[i] = std::fabs(m[0][i])*extent.x + std::fabs(m[1][i])*extent.y + std::fabs(m[2][i])*extent.z;
+
+        AABB out;
+        out.min = glm::vec3( c.x, c.y, c.z ) - e;
+        out.max = glm::vec3( c.x, c.y, c.z ) + e;
+        return out;
+    }
+
+    inline Frustum extractFrustum( const glm::mat4 &view_projection )
+    {
+        const glm::mat4 &m = view_projection;
+        glm::vec4 row0( m[0][0], m[1][0], m[2][0], m[3][0] );
+        glm::vec4 row1( m[0][1], m[1][1], m[2][1], m[3][1] );
+        glm::vec4 row2( m[0][2], m[1][2], m[2][2], m[3][2] );
+        glm::vec4 row3( m[0][3], m[1][3], m[2][3], m[3][3] );
+
+        Frustum frustum;
+        frustum.planes[0] = row3 + row0;
+        frustum.planes[1] = row3 - row0;
+        frustum.planes[2] = row3 + row1;
+        frustum.planes[3] = row3 - row1;
+        frustum.planes[4] = row3 + row2;
+        frustum.planes[5] = row3 - row2;
+
+        for (int p = 0; p < 6; ++p) {
+            glm::vec4 &plane = frustum.planes[p];
+            float len = std::sqrt( plane.x*plane.x + plane.y*plane.y + plane.z*plane.z );
+            if (len > 0.0f)
+                plane = plane * (1.0f / len);
+        }
+
+        return frustum;
+    }
+
+    inline Containment classify( const Frustum &frustum, const AABB &box )
+    {
+        Containment result = GR_INSIDE;
+
+        for (int p = 0; p < 6; ++p) {
+            const glm::vec4 &plane = frustum.planes[p];
+
+            // farthest corner along the normal, and the one opposite it.
+            glm::vec3 positive(
+                    plane.x >= 0.0f ? box.max.x : box.min.x,
+                    plane.y >= 0.0f ? box.max.y : box.min.y,
+                    plane.z >= 0.0f ? box.max.z : box.min.z );
+            glm::vec3 negative(
+                    plane.x >= 0.0f ? box.min.x : box.max.x,
+                    plane.y >= 0.0f ? box.min.y : box.max.y,
+                    plane.z >= 0.0f ? box.min.z : box.max.z );
+
+            glm::vec3 normal( plane.x, plane.y, plane.z );
+            if (glm::dot(normal, positive) + plane.w < 0.0f)
+                return GR_OUTSIDE;
+            if (glm::dot(normal, negative) + plane.w < 0.0f)
+                result = GR_INTERSECTING;
+        }
+
+        return result;
+    }
+
+    //===========
+    //slab test; on a hit, distance holds the entry point along the ray
+    //(zero when the origin is already inside the box).
+    //===========
+    inline bool intersects( const Ray &ray, const AABB &box, float &distance )
+    {
+        float t_min = 0.0f;
+        float t_max = ray.length;
+
+        for (int i = 0; i < 3; ++i) {
+            if (std::fabs(ray.direction[i]) < 1e-12f) {
+                if (ray.origin[i] < box.min[i] || ray.origin[i] > box.max[i])
+                    return false;
+                continue;
+            }
+
+            float inv = 1.0f / ray.direction[i];
+            float t0 = (box.min[i] - ray.origin[i]) * inv;
+            float t1 = (box.max[i] - ray.origin[i]) * inv;
+            if (t0 > t1)
+                std::swap( t0, t1 );
+
+            t_min = std::max( t_min, t0 );
+            t_max = std::min( t_max, t1 );
+            if (t_min > t_max)
+                return false;
+        }
+
+        distance = t_min;
+        return true;
+    }
+}
+
+#endif // _GEARS_BOUNDS_HPP_
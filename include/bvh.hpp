@@ -0,0 +1,108 @@
+#ifndef _GEARS_BVH_HPP_
+#define _GEARS_BVH_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "bounds.hpp"
+
+#define GR_NULL_PROXY (-1)
+
+namespace GearsEngine {
+    //===========
+    //dynamic bounding volume hierarchy over scene objects. every leaf holds
+    //one object index and a fattened box, so small movements don't touch
+    //the tree at all; bigger ones reinsert the leaf and rebalance the path
+    //to the root with tree rotations. static content can be bulk-built with
+    //the surface area heuristic.
+    //===========
+    class AABBTree
+    {
+        private:
+            typedef struct {
+                AABB   bounds;
+                AABB   tight;  // leaves only: the object's own box, unfattened
+                GLint  parent; // next free node while on the free list
+                GLint  child1;
+                GLint  child2;
+                GLint  height; // 0 for leaves, -1 for free nodes
+                GLuint object;
+            } TreeNode;
+
+            std::vector<TreeNode> nodes;
+            GLint root;
+            GLint free_list;
+            GLuint leaf_count;
+
+            GLfloat margin;
+            GLfloat displacement_scale;
+
+            std::vector<GLint> stack;
+
+            GLint allocateNode();
+            void  freeNode( GLint node );
+
+            void  insertLeaf( GLint leaf );
+            void  removeLeaf( GLint leaf );
+            void  refit( GLint node );
+            GLint balance( GLint node );
+
+            GLint buildRange( std::vector<GLint> &leaves, GLuint begin, GLuint end );
+            void  collectLeaves( GLint node, std::vector<GLuint> &result );
+
+        public:
+            //===========
+            //fat_margin is added to every side of an inserted box;
+            //displacement_factor scales the move() displacement that the fat
+            //box is stretched by in the direction of travel.
+            //===========
+            AABBTree( GLfloat fat_margin = 0.1f, GLfloat displacement_factor = 2.0f );
+
+            void clear();
+
+            //===========
+            //returns a proxy id for the object; keep it for move()/remove().
+            //===========
+            GLint insert( const AABB &bounds, GLuint object );
+            void  remove( GLint proxy );
+
+            //===========
+            //returns true only if the leaf had to be reinserted.
+            //===========
+            bool move( GLint proxy, const AABB &bounds, glm::vec3 displacement );
+
+            //===========
+            //replace the tree contents with a top-down SAH build over the
+            //given boxes (objects[i] belongs to bounds[i]); the proxy of
+            //each object is written to proxies. dynamic objects can still
+            //be inserted afterwards.
+            //===========
+            void build(
+                    const std::vector<AABB>   &bounds,
+                    const std::vector<GLuint> &objects,
+                    std::vector<GLint>        &proxies
+            );
+
+            const AABB &getFatBounds( GLint proxy );
+            GLuint      getObject( GLint proxy );
+            GLuint      getObjectCount();
+            GLint       getHeight();
+
+            //===========
+            //queries append the indices of every object whose fat bounds
+            //pass the test; result is not cleared first.
+            //===========
+            void queryFrustum( const Frustum &frustum, std::vector<GLuint> &result );
+            void queryBox( const AABB &box, std::vector<GLuint> &result );
+            void queryRay( const Ray &ray, std::vector<GLuint> &result );
+
+            //===========
+            //nearest object whose own bounds, not the fat ones, the ray
+            //enters. false when nothing is hit; otherwise the object and
+            //the entry distance go to whichever pointers aren't NULL.
+            //===========
+            bool pick( const Ray &ray, GLuint *object, GLfloat *distance );
+    };
+}
+
+#endif // _GEARS_BVH_HPP_
@@ -0,0 +1,113 @@
+#ifndef _GEARS_DYNAMIC_RESOLUTION_HPP_
+#define _GEARS_DYNAMIC_RESOLUTION_HPP_
+
+#include <GL/glew.h>
+
+// timer queries in flight; results are read this many frames late at most.
+#define GR_RESOLUTION_QUERIES 4
+
+typedef struct {
+    GLfloat scale;          // of the output size, per axis
+    GLsizei width, height;  // what the scene renders at
+    GLsizei output_width, output_height;
+
+    double  gpu_time;       // last measured scene time, ms
+    double  smoothed_time;  // what the controller goes by, ms
+    double  target_time;    // ms
+
+    bool    is_adaptive;    // false: the scale only changes through setScale()
+    bool    is_measuring;   // false without timer queries
+    GLuint  pending_queries;
+    GLuint  frames_since_change;
+} ResolutionState;
+
+namespace GearsEngine {
+    //===========
+    //renders the scene into an offscreen target at a fraction of the
+    //output size and stretches it over the output with a linear blit.
+    //the fraction follows the GPU time of the scene, measured with timer
+    //queries: when a frame runs over the target time the scale drops,
+    //and when there's headroom again it creeps back up. GPU cost goes
+    //roughly with the pixel count, so steps follow the square root of
+    //the time ratio, a bounded step at a time.
+    //
+    //the target is allocated at the full output size and the scene uses
+    //its lower left corner, so changing the scale never reallocates.
+    //hand it to Renderer::setDynamicResolution(), or call beginScene(),
+    //endScene() and present() around the scene yourself. GL thread only.
+    //===========
+    class DynamicResolution
+    {
+        private:
+            GLuint  framebuffer;
+            GLuint  color_texture;
+            GLuint  depth_texture;
+            GLsizei output_width, output_height;
+
+            GLfloat scale;
+            GLfloat min_scale, max_scale;
+            bool    is_adaptive;
+            bool    is_in_scene;
+
+            // the caller's scissor, put back by endScene().
+            GLboolean was_scissored;
+            GLint     scissor_box[4];
+
+            GLuint queries[GR_RESOLUTION_QUERIES];
+            GLuint oldest_query;
+            GLuint pending_queries;
+            bool   is_timing; // a query is open for this scene
+            bool   has_timer_query;
+
+            double target_time;
+            double gpu_time;
+            double smoothed_time;
+            GLuint frames_since_change;
+
+            void releaseTarget();
+            void collectQueries();
+            void adjustScale( double milliseconds );
+            void getSceneSize( GLsizei &width, GLsizei &height );
+
+        public:
+            DynamicResolution();
+            ~DynamicResolution();
+
+            //===========
+            //make the target for an output of width by height; again
+            //whenever the window changes size. needs a current context.
+            //===========
+            bool initialize( GLsizei width, GLsizei height );
+
+            //===========
+            //defaults: 16.6ms, scale between 0.5 and 1, adaptive.
+            //===========
+            void setTargetFrameTime( double milliseconds );
+            void setScaleRange( GLfloat min, GLfloat max );
+            void setAdaptive( bool enabled );
+            void setScale( GLfloat new_scale );
+
+            //===========
+            //bind the target and set the viewport and scissor to the
+            //scaled size, first adjusting the scale from whatever timer
+            //results have come in.
+            //===========
+            void beginScene();
+            void endScene();
+            bool isInScene();
+
+            //===========
+            //upscale the last scene onto target (0 for the window) and
+            //leave it bound with the viewport at the output size.
+            //===========
+            void present( GLuint target );
+
+            GLuint getFramebuffer();
+            GLuint getColorTexture();
+            GLuint getDepthTexture();
+
+            ResolutionState getState();
+    };
+}
+
+#endif // _GEARS_DYNAMIC_RESOLUTION_HPP_
@@ -0,0 +1,148 @@
+#ifndef _GEARS_ENTITY_HPP_
+#define _GEARS_ENTITY_HPP_
+
+#include <cstddef>
+#include <map>
+#include <vector>
+#include "job_system.hpp"
+
+#define GR_MAX_COMPONENT_TYPES 64
+#define GR_CHUNK_BYTES         (16 * 1024)
+
+#define GR_COMPONENT_BIT(type) (1ULL << (type))
+
+typedef unsigned int       ComponentType;
+typedef unsigned long long ComponentMask;
+
+typedef struct {
+    unsigned int index;
+    unsigned int generation;
+} Entity;
+
+//===========
+//one chunk of entities sharing an archetype. components[type] points at a
+//tightly packed array of count components of that type, or is NULL when
+//the archetype doesn't have it.
+//===========
+typedef struct {
+    unsigned int  count;
+    const Entity *entities;
+    void         *components[GR_MAX_COMPONENT_TYPES];
+} ChunkView;
+
+typedef void (*ChunkKernel)( ChunkView *chunk, void *userdata );
+
+namespace GearsEngine {
+    //===========
+    //archetype based entity/component storage. every distinct set of
+    //component types gets a table whose rows are split into fixed size
+    //chunks, and each chunk stores every component type as its own
+    //contiguous array. components are plain data: they are moved with
+    //memcpy and start out zeroed.
+    //===========
+    class EntityWorld
+    {
+        private:
+            typedef struct {
+                std::vector<unsigned char> data;
+                std::vector<Entity>        entities;
+            } Chunk;
+
+            typedef struct {
+                ComponentMask mask;
+                std::vector<ComponentType> types;
+                std::vector<size_t>        offsets; // array offset in a chunk, per entry of types
+                unsigned int               capacity;
+                size_t                     chunk_bytes;
+                std::vector<Chunk>         chunks;
+
+                // archetype reached by adding/removing one type, cached.
+                std::map<ComponentType, unsigned int> add_edges;
+                std::map<ComponentType, unsigned int> remove_edges;
+            } Archetype;
+
+            typedef struct {
+                unsigned int generation;
+                unsigned int archetype;
+                unsigned int chunk;
+                unsigned int row;
+                bool         is_alive;
+            } EntityRecord;
+
+            std::vector<size_t>       component_sizes;
+            std::vector<Archetype>    archetypes;
+            std::map<ComponentMask, unsigned int> archetype_index;
+
+            std::vector<EntityRecord> records;
+            std::vector<unsigned int> free_records;
+            unsigned int              entity_count;
+
+            std::vector<ChunkView>    query_views;
+
+            unsigned int findArchetype( ComponentMask mask );
+            unsigned int allocateRow( unsigned int archetype, Entity entity );
+            void         releaseRow( unsigned int archetype, unsigned int chunk, unsigned int row );
+            void        *componentAt( unsigned int archetype, unsigned int chunk, unsigned int row, ComponentType type );
+            void         moveEntity( Entity entity, unsigned int target );
+
+            static void  chunkKernel( unsigned int begin, unsigned int end, void *query );
+
+        public:
+            EntityWorld();
+
+            //===========
+            //component types are plain data of a fixed size; the returned
+            //id is what every other call takes.
+            //===========
+            ComponentType registerComponent( size_t size );
+
+            template<typename T>
+            ComponentType registerComponent() { return registerComponent( sizeof(T) ); }
+
+            //===========
+            //create directly in the archetype for mask, so building an entity
+            //doesn't walk through every intermediate archetype.
+            //===========
+            Entity createEntity( ComponentMask mask = 0 );
+            void   destroyEntity( Entity entity );
+            bool   isAlive( Entity entity );
+
+            //===========
+            //data may be NULL to add a zeroed component; returns the storage,
+            //which stays valid until the next structural change.
+            //===========
+            void *addComponent( Entity entity, ComponentType type, const void *data );
+            void  removeComponent( Entity entity, ComponentType type );
+            bool  hasComponent( Entity entity, ComponentType type );
+            void *getComponent( Entity entity, ComponentType type );
+
+            template<typename T>
+            T *getComponent( Entity entity, ComponentType type )
+            {
+                return static_cast<T*>(getComponent( entity, type ));
+            }
+
+            unsigned int getEntityCount();
+            unsigned int getArchetypeCount();
+
+            //===========
+            //run kernel over every chunk whose archetype has all of the
+            //required types. entities must not be created, destroyed or
+            //change components while a query runs.
+            //===========
+            void query( ComponentMask required, ChunkKernel kernel, void *userdata );
+
+            //===========
+            //same, with the chunks spread over the job system; the kernel
+            //runs concurrently on different chunks.
+            //===========
+            void queryParallel(
+                    ComponentMask required,
+                    ChunkKernel kernel,
+                    void *userdata,
+                    JobSystem *jobs
+            );
+    };
+}
+
+#endif // _GEARS_ENTITY_HPP_
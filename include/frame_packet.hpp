@@ -0,0 +1,118 @@
+#ifndef _GEARS_FRAME_PACKET_HPP_
+#define _GEARS_FRAME_PACKET_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+typedef struct {
+    GLint   location;
+    GLenum  type;   // GL_FLOAT, GL_FLOAT_VEC4, GL_FLOAT_MAT4 or GL_UNSIGNED_INT
+    GLsizei count;
+    GLuint  offset; // first float in FramePacket::uniform_data
+} UniformValue;
+
+typedef struct {
+    GLuint  program;
+    GLuint  vbo;
+    GLuint  ebo;
+    int     vap;
+    GLsizei element_count;
+
+    // where the packet camera goes in this program; -1 skips it.
+    GLint   view_location;
+    GLint   projection_location;
+
+    GLuint  first_uniform; // range in FramePacket::uniforms
+    GLuint  uniform_count;
+} DrawItem;
+
+//===========
+//everything the render thread needs for one frame. the game thread fills
+//it in, and once submitted it isn't touched again until it comes back
+//through the mailbox.
+//===========
+typedef struct {
+    unsigned long long frame;
+    unsigned long long input_time; // performance counter when its input was sampled
+
+    GLclampf  clear_color[4];
+    glm::mat4 view;
+    glm::mat4 projection;
+
+    std::vector<DrawItem>     draws;
+    std::vector<UniformValue> uniforms;
+    std::vector<GLfloat>      uniform_data;
+} FramePacket;
+
+namespace GearsEngine {
+    //===========
+    //empty a packet for reuse; keeps the vectors' capacity.
+    //===========
+    void resetFramePacket( FramePacket *packet );
+
+    //===========
+    //append a uniform for the next addDrawItem() to pick up. the
+    //unsigned one has a name of its own, so an int literal isn't
+    //ambiguous between it and the float one.
+    //===========
+    void pushUniform( FramePacket *packet, GLint location, const glm::mat4 &value );
+    void pushUniform( FramePacket *packet, GLint location, const glm::vec4 &value );
+    void pushUniform( FramePacket *packet, GLint location, GLfloat value );
+    void pushUniformUint( FramePacket *packet, GLint location, GLuint value );
+
+    //===========
+    //record a draw that uses every uniform pushed since the previous one.
+    //===========
+    void addDrawItem( FramePacket *packet, DrawItem item );
+
+    //===========
+    //two packet slots shared by one producer (game thread) and one
+    //consumer (render thread): while one slot is rendered the other is
+    //being filled. the producer waits when both slots are still in use,
+    //so simulation runs at most one frame ahead.
+    //===========
+    class FrameMailbox
+    {
+        private:
+            typedef enum {
+                SLOT_FREE = 0,
+                SLOT_WRITING,
+                SLOT_READY,
+                SLOT_READING
+            } SlotState;
+
+            FramePacket slots[2];
+            SlotState   states[2];
+
+            unsigned long long next_frame;
+            bool is_closed;
+
+            std::mutex              mutex;
+            std::condition_variable changed;
+
+        public:
+            FrameMailbox();
+
+            //===========
+            //producer side. beginWrite() returns a reset packet, or NULL
+            //once the mailbox is closed.
+            //===========
+            FramePacket *beginWrite();
+            void         endWrite( FramePacket *packet );
+
+            //===========
+            //consumer side; packets come out in submission order.
+            //beginRead() returns NULL once closed and drained.
+            //===========
+            FramePacket *beginRead();
+            void         endRead( FramePacket *packet );
+
+            void close();
+            void reopen();
+    };
+}
+
+#endif // _GEARS_FRAME_PACKET_HPP_
@@ -0,0 +1,169 @@
+#ifndef _GEARS_FRAME_READBACK_HPP_
+#define _GEARS_FRAME_READBACK_HPP_
+
+#include <GL/glew.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// pack buffers in rotation; a capture reaches the callback about this
+// many frames after it was taken.
+#define GR_READBACK_BUFFERS 3
+
+typedef enum {
+    GR_READBACK_RGBA = 0,
+    GR_READBACK_RGB,
+    GR_READBACK_LUMINANCE  // Rec. 709 luma, one byte per pixel
+} ReadbackFormat;
+
+//===========
+//a captured frame as handed to the callback: tightly packed rows, top
+//to bottom. pixels are only valid until the callback returns.
+//===========
+typedef struct {
+    GLsizei width, height;
+    ReadbackFormat format;
+    GLsizei stride; // bytes per row
+
+    const unsigned char *pixels;
+    unsigned long long   frame; // endFrame() count when it was captured
+} ReadbackImage;
+
+typedef void (*ReadbackCallback)( const ReadbackImage *image, void *userdata );
+
+namespace GearsEngine {
+    //===========
+    //frame capture without the stall of a plain glReadPixels. a capture
+    //reads the framebuffer into one of GR_READBACK_BUFFERS pixel pack
+    //buffers and puts a fence behind it, so the copy happens on the GPU
+    //whenever it gets there. later frames check the fences without
+    //waiting, map the buffers that are done and hand the mapping to a
+    //worker thread, which flips, downscales and converts the pixels and
+    //calls back. the buffer is unmapped on the frame after the worker is
+    //through with it. when every buffer is busy the capture is dropped
+    //rather than waited for.
+    //
+    //hand it to Renderer::setFrameReadback() to have it run at the end
+    //of every frame, or call endFrame() yourself after the last draw.
+    //GL thread only, except for the callback, which runs on the worker.
+    //===========
+    class FrameReadback
+    {
+        private:
+            typedef enum {
+                SLOT_FREE = 0,
+                SLOT_PENDING,    // read issued, fence not signalled yet
+                SLOT_PROCESSING, // mapped, with the worker
+                SLOT_DONE        // worker finished, still mapped
+            } SlotState;
+
+            typedef struct {
+                GLuint  buffer;
+                GLsync  fence;
+                GLsizei width, height;
+                unsigned long long frame;
+
+                // settings as they were at the capture
+                ReadbackCallback callback;
+                void            *userdata;
+                ReadbackFormat   format;
+                GLuint           downscale;
+
+                const unsigned char *pixels;
+                std::atomic<int>     state;
+            } Slot;
+
+            Slot    slots[GR_READBACK_BUFFERS];
+            GLuint  next_slot;     // where the next capture goes
+            GLuint  pending_count; // slots behind next_slot waiting on a fence
+            GLsizei width, height;
+            GLuint  source;
+
+            ReadbackCallback callback;
+            void            *userdata;
+            ReadbackFormat   format;
+            GLuint           downscale;
+            GLuint           interval;
+            bool             is_requested;
+            bool             is_initialized;
+
+            unsigned long long frame;
+            std::atomic<unsigned long long> captured_count, delivered_count, dropped_count;
+
+            std::thread             worker;
+            std::mutex              mutex;
+            std::condition_variable work_changed;
+            std::condition_variable work_finished;
+            std::deque<GLuint>      work; // slots for the worker, oldest first
+            bool                    is_busy;
+            bool                    is_shutting_down;
+
+            std::vector<unsigned char> output; // the worker's
+
+            void releaseBuffers();
+            void drain();
+            void capture();
+            void collect( bool wait );
+            void workerLoop();
+            void process( Slot &slot );
+
+        public:
+            FrameReadback();
+            ~FrameReadback();
+
+            //===========
+            //make the pack buffers for captures of width by height; again
+            //whenever the window changes size, which drops captures not
+            //delivered yet. starts the worker. needs a current context.
+            //GL errors go to the diagnostics with everything else's, not
+            //to the result.
+            //===========
+            bool initialize( GLsizei width, GLsizei height );
+
+            void setCallback( ReadbackCallback new_callback, void *new_userdata );
+
+            //===========
+            //framebuffer to read; 0, the default, reads the back buffer.
+            //===========
+            void setSource( GLuint framebuffer );
+
+            //===========
+            //box filter the image down by an integer factor before
+            //converting; 1, the default, keeps the full size.
+            //===========
+            void setDownscale( GLuint factor );
+            void setFormat( ReadbackFormat new_format );
+
+            //===========
+            //capture every frames-th frame. 0, the default, only captures
+            //when requestCapture() asks.
+            //===========
+            void setInterval( GLuint frames );
+            void requestCapture();
+
+            //===========
+            //after the frame's last draw, before the swap: capture if one
+            //is due and deliver whatever has finished. never waits on the
+            //GPU or the worker.
+            //===========
+            void endFrame();
+
+            //===========
+            //block until every capture taken so far has been delivered.
+            //===========
+            void flush();
+
+            unsigned long long getCapturedCount();
+            unsigned long long getDeliveredCount();
+
+            //===========
+            //captures skipped because every buffer was still busy.
+            //===========
+            unsigned long long getDroppedCount();
+    };
+}
+
+#endif // _GEARS_FRAME_READBACK_HPP_
@@ -0,0 +1,190 @@
+#ifndef _GEARS_GL_CAPTURE_HPP_
+#define _GEARS_GL_CAPTURE_HPP_
+
+#include <GL/glew.h>
+#include <fstream>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "renderer.hpp"
+
+// "GRTR" in the first four bytes of a trace.
+#define GR_TRACE_MAGIC   0x52545247
+#define GR_TRACE_VERSION 1
+
+//===========
+//a trace is a header (magic, version, viewport width and height) and a
+//sequence of records: a one byte TraceOp, the payload size as a 32-bit
+//integer, then the payload. everything is in host byte order.
+//===========
+typedef enum {
+    GR_TRACE_GENERATE_VAO = 1,
+    GR_TRACE_GENERATE_VBO,
+    GR_TRACE_GENERATE_EBO,
+    GR_TRACE_DESTROY_VAO,
+    GR_TRACE_DESTROY_VBO,
+    GR_TRACE_DESTROY_EBO,
+    GR_TRACE_VAP_CONFIGURATION,
+    GR_TRACE_LINK_VAP_MODULE,
+    GR_TRACE_SHADER_PROGRAM,
+    GR_TRACE_INITIALIZE_VERTEX_BUFFER,
+    GR_TRACE_INITIALIZE_ELEMENT_BUFFER,
+    GR_TRACE_UPDATE_VERTEX_BUFFER,
+    GR_TRACE_UPDATE_ELEMENT_BUFFER,
+    GR_TRACE_BIND_VERTEX_BUFFER,
+    GR_TRACE_ACTIVE_VERTEX_ARRAY,
+    GR_TRACE_ACTIVE_SHADER_PROGRAM,
+    GR_TRACE_BIND_UNIFORM_BLOCK,
+    GR_TRACE_UNIFORM_LOCATION,
+    GR_TRACE_FRAME_UNIFORMS,
+    GR_TRACE_DRAW_UNIFORMS,
+    GR_TRACE_UNIFORM_UINT,
+    GR_TRACE_UNIFORM_FLOAT,
+    GR_TRACE_UNIFORM_MATRIX,
+    GR_TRACE_CLEAR,
+    GR_TRACE_DRAW,
+    GR_TRACE_EXECUTE,
+    GR_TRACE_END_FRAME,
+    GR_TRACE_DESTROY_PROGRAM
+} TraceOp;
+
+namespace GearsEngine {
+    //===========
+    //writes what a Renderer does to a trace file: resources with their
+    //contents, state changes, uniform uploads and draws. the renderer
+    //calls into it; see Renderer::startCapture(). GL names are written
+    //as they were at capture time and remapped on replay.
+    //===========
+    class GLCapture
+    {
+        private:
+            std::ofstream file;
+            std::vector<unsigned char> record;
+
+            unsigned long long frame_count;
+            unsigned long long byte_count;
+
+            void begin( TraceOp op );
+            void put( const void *data, size_t size );
+            void putUint( GLuint value );
+            void putInt( GLint value );
+            void putFloat( GLfloat value );
+            void putString( const std::string &value );
+            void putBlob( const void *data, size_t size );
+            void end();
+
+        public:
+            GLCapture();
+            ~GLCapture();
+
+            bool open( const std::string &path, GLint width, GLint height );
+            void close();
+            bool isOpen();
+
+            void recordGenerate( TraceOp op, const std::string &identifier, GLuint uid );
+            void recordDestroy( TraceOp op, const std::string &identifier );
+
+            void recordVAPConfiguration( const VAPconfig &configuration );
+            void recordLinkVAPModule();
+
+            void recordShaderProgram(
+                    const ShaderProgram &program,
+                    const VertexShader *vertex_shader,
+                    const FragmentShader *fragment_shader
+            );
+
+            void recordInitializeVertexBuffer( const VertexBuffer &vbo, const ElementBuffer &ebo, int vap );
+            void recordInitializeElementBuffer( const ElementBuffer &ebo );
+            void recordUpdateBuffer( TraceOp op, GLuint uid, GLintptr offset, GLsizeiptr size, const GLvoid *data );
+            void recordBindVertexBuffer( GLuint vbo, GLuint ebo, int vap );
+
+            void recordActive( TraceOp op, GLuint uid );
+            void recordBindUniformBlock( GLuint program, const std::string &block, GLuint binding );
+            void recordUniformLocation( GLuint program, const std::string &uniform, GLint location );
+
+            void recordUniformBlock( TraceOp op, const GLvoid *data, GLsizeiptr size );
+            void recordUniform( GLuint program, GLint location, GLuint value );
+            void recordUniform( GLuint program, GLint location, GLfloat value );
+            void recordUniform( GLuint program, GLint location, const GLfloat *matrices, GLsizei count, GLboolean transpose );
+
+            void recordClear( GLclampf r, GLclampf g, GLclampf b, GLclampf a );
+            void recordDraw( RenderType mode );
+            void recordExecute( const FramePacket *packet );
+            void recordEndFrame();
+
+            unsigned long long getFrameCount();
+            unsigned long long getByteCount();
+    };
+
+    //===========
+    //plays a trace back into a Renderer, a frame at a time, as fast as the
+    //driver takes it. the renderer should be fresh and sized like the
+    //capture (getWidth(), getHeight()); the names it hands out are mapped
+    //onto the ones in the trace, and so are uniform locations.
+    //===========
+    class GLReplay
+    {
+        private:
+            typedef std::pair<GLuint, GLint> ProgramLocation;
+
+            std::ifstream file;
+            GLint width, height;
+
+            std::vector<unsigned char> record;
+            size_t cursor;
+            bool   is_valid;
+
+            unsigned long long frame;
+            int vap_count; // VAP modules linked so far
+
+            // captured name -> replayed name, one namespace each.
+            std::map<GLuint, GLuint> vao_names;
+            std::map<GLuint, GLuint> buffer_names;
+            std::map<GLuint, GLuint> program_names;
+            std::map<ProgramLocation, GLint> locations;
+
+            // shader sources and buffer contents the renderer may point at.
+            std::list<std::string> strings;
+            std::list< std::vector<unsigned char> > blobs;
+
+            std::vector<unsigned char> scratch;
+            std::vector<GLuint>        program_scratch;
+            FramePacket packet;
+
+            bool   readRecord( TraceOp &op );
+            void   get( void *data, size_t size );
+            GLuint getUint();
+            GLint  getInt();
+            GLfloat getFloat();
+            std::string getString();
+            size_t getBlob( std::vector<unsigned char> &blob );
+            bool   isComplete(); // nothing read past the end of the record
+            bool   isModule( int vap );
+
+            GLuint mapName( const std::map<GLuint, GLuint> &names, GLuint captured );
+            GLint  mapLocation( GLuint program, GLint location );
+
+            void replayRecord( TraceOp op, Renderer *renderer );
+            void replayExecute( Renderer *renderer );
+            bool isPacketValid();
+
+        public:
+            GLReplay();
+
+            bool  open( const std::string &path );
+            GLint getWidth();
+            GLint getHeight();
+
+            //===========
+            //replay up to and including the next end of frame. false once
+            //the trace runs out, or at a record that doesn't parse.
+            //===========
+            bool replayFrame( Renderer *renderer );
+
+            unsigned long long getFrame();
+    };
+}
+
+#endif // _GEARS_GL_CAPTURE_HPP_
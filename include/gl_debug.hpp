@@ -0,0 +1,105 @@
+#ifndef _GEARS_GL_DEBUG_HPP_
+#define _GEARS_GL_DEBUG_HPP_
+
+#include <GL/glew.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+typedef enum {
+    GR_DEBUG_OFF = 0,
+    GR_DEBUG_ASYNC, // driver reports through glDebugMessageCallback, no stalls
+    GR_DEBUG_SYNC   // synchronous debug output, or glGetError after each call without KHR_debug
+} DebugMode;
+
+typedef struct {
+    GLenum        source;
+    GLenum        type;
+    GLenum        severity;
+    GLuint        id;
+    const GLchar *text;
+    const char   *call; // engine call that raised it, NULL for driver messages
+} DebugMessage;
+
+typedef void (*DebugSink)( const DebugMessage *message, void *userdata );
+
+namespace GearsEngine {
+    //===========
+    //routes GL driver messages to sinks. messages can be filtered at the
+    //driver with setFilter()/muteMessage(), and every route only sees
+    //messages at or above its severity that match its source and type.
+    //in async mode the driver may call from any thread, so sinks have to
+    //be thread-safe; routing itself is serialized.
+    //===========
+    class GLDiagnostics
+    {
+        private:
+            typedef struct {
+                GLenum    source;   // GL_DONT_CARE for all
+                GLenum    type;     // GL_DONT_CARE for all
+                GLenum    min_severity;
+                DebugSink sink;
+                void     *userdata;
+            } DebugRoute;
+
+            DebugMode mode;
+            bool      has_khr_debug;
+
+            std::mutex              route_mutex;
+            std::vector<DebugRoute> routes;
+
+            std::atomic<GLuint> message_counts[4];
+
+            void drainErrors( const char *call );
+
+            static void APIENTRY callback(
+                    GLenum source, GLenum type, GLuint id, GLenum severity,
+                    GLsizei length, const GLchar *message, const void *diagnostics
+            );
+
+        public:
+            GLDiagnostics();
+            ~GLDiagnostics();
+
+            //===========
+            //needs a current context. async silently degrades to off, and
+            //sync to glGetError checks only, when KHR_debug is missing.
+            //===========
+            void      setMode( DebugMode new_mode );
+            DebugMode getMode();
+
+            void addRoute( GLenum source, GLenum type, GLenum min_severity, DebugSink sink, void *userdata );
+            void clearRoutes();
+
+            //===========
+            //driver side filtering; GL_DONT_CARE matches everything.
+            //===========
+            void setFilter( GLenum source, GLenum type, GLenum severity, bool enabled );
+            void muteMessage( GLenum source, GLenum type, GLuint id );
+
+            void dispatch( const DebugMessage *message );
+
+            //===========
+            //only does work in sync mode without KHR_debug; the per-call
+            //check that replaces assert(glGetError() == GL_NO_ERROR).
+            //with KHR_debug the callback has already reported the error.
+            //===========
+            void check( const char *call )
+            {
+                if (mode == GR_DEBUG_SYNC && !has_khr_debug)
+                    drainErrors( call );
+            }
+
+            //===========
+            //messages seen so far at a GL_DEBUG_SEVERITY_* level.
+            //===========
+            GLuint getMessageCount( GLenum severity );
+
+            //===========
+            //the default sink: one line per message on std::cerr.
+            //===========
+            static void logSink( const DebugMessage *message, void *userdata );
+    };
+}
+
+#endif // _GEARS_GL_DEBUG_HPP_
@@ -2,22 +2,152 @@
 #define _GEARS_GL_OBJECT_HPP_
 
 #include <GL/glew.h>
+#include <deque>
+#include <vector>
+
+typedef void (*GenerateNames)( GLsizei n, GLuint *names );
+typedef void (*DeleteNames)( GLsizei n, const GLuint *names );
+
+namespace GearsEngine {
+    //===========
+    //hands out GL object names generated in batches, and defers deleting
+    //released names until a fence shows the GPU is done with the frames
+    //that could still reference them. only use from the GL thread.
+    //===========
+    class GLNamePool
+    {
+        private:
+            typedef struct {
+                GLsync              fence;
+                std::vector<GLuint> names;
+            } RetiredNames;
+
+            GenerateNames generate_names;
+            DeleteNames   delete_names;
+            GLsizei       batch_size;
+
+            std::vector<GLuint>      free_names;
+            std::vector<GLuint>      released_names;
+            std::deque<RetiredNames> retired;
+
+        public:
+            GLNamePool( GenerateNames generate, DeleteNames destroy, GLsizei batch );
+
+            GLuint acquire();
+            void   release( GLuint name );
+
+            //===========
+            //put everything released since the last call behind a new fence.
+            //===========
+            void retire();
+
+            //===========
+            //delete the names whose fence has signalled; with wait set,
+            //block until all of them have.
+            //===========
+            void collect( bool wait );
+
+            //===========
+            //delete every name the pool still holds, fenced or not. for
+            //context teardown.
+            //===========
+            void purge();
+
+            //===========
+            //switch how new names are made; names generated the old way
+            //but never handed out are deleted right away.
+            //===========
+            void setGenerator( GenerateNames generate );
+
+            GLuint getFreeCount();
+            GLuint getPendingCount();
+    };
+
+    //===========
+    //call once per frame after the last draw: fences this frame's releases
+    //in every pool and deletes what earlier frames released.
+    //===========
+    void retireGLObjects();
+    void purgeGLObjects();
+
+    //===========
+    //direct state access calls need objects that already exist, which
+    //glGen* names don't until first bound; with this set the VAO, buffer
+    //and framebuffer pools use glCreate* instead.
+    //===========
+    void useCreatedGLNames( bool enabled );
+
+    //===========
+    //compile and link a program from a vertex and a fragment shader, or
+    //from one compute shader. returns 0 when it doesn't link; the compile
+    //and link logs reach the diagnostics through KHR_debug.
+    //===========
+    GLuint buildGLProgram( const GLchar *vertex_source, const GLchar *fragment_source );
+    GLuint buildGLComputeProgram( const GLchar *compute_source );
+}
+
+typedef struct
+{
+    typedef GLuint value_type;
+    static value_type Create();
+    static void Destroy(value_type);
+    static GearsEngine::GLNamePool &Pool();
+} vaoTraits;
+
+typedef struct
+{
+    typedef GLuint value_type;
+    static value_type Create();
+    static void Destroy(value_type);
+    static GearsEngine::GLNamePool &Pool();
+} bufferTraits;
+
+typedef struct
+{
+    typedef GLuint value_type;
+    static value_type Create();
+    static void Destroy(value_type);
+    static GearsEngine::GLNamePool &Pool();
+} textureTraits;
 
 typedef struct
 {
     typedef GLuint value_type;
     static value_type Create();
     static void Destroy(value_type);
-} vaoTraits, vboTraits;
+    static GearsEngine::GLNamePool &Pool();
+} framebufferTraits;
 
+typedef bufferTraits vboTraits;
+typedef bufferTraits eboTraits;
+
+//===========
+//owns one GL name. move-only: copying would end up destroying the name
+//twice.
+//===========
 template<typename T>
 class glObject
 {
     public:
         glObject() : m_obj(T::Create()) {}
-        ~glObject() {T::Destroy(m_obj);}
+        ~glObject() {if (m_obj) T::Destroy(m_obj);}
+
+        glObject( glObject &&other ) : m_obj(other.m_obj) {other.m_obj = 0;}
+
+        glObject &operator=( glObject &&other )
+        {
+            if (this != &other) {
+                if (m_obj) T::Destroy(m_obj);
+                m_obj = other.m_obj;
+                other.m_obj = 0;
+            }
+            return *this;
+        }
+
+        glObject( const glObject& ) = delete;
+        glObject &operator=( const glObject& ) = delete;
 
-        operator typename T::value_type() {return m_obj;}
+        operator typename T::value_type() const {return m_obj;}
 
     private:
         typename T::value_type m_obj;
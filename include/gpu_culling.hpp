@@ -0,0 +1,127 @@
+#ifndef _GEARS_GPU_CULLING_HPP_
+#define _GEARS_GPU_CULLING_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "bounds.hpp"
+
+// vertex attribute carrying the culled instance's index; the vertex
+// shader reads as "layout (location = 15) in uint instance_id;".
+#define GR_CULL_INSTANCE_ATTRIBUTE 15
+
+// shader storage binding of the instance array while drawing.
+#define GR_CULL_INSTANCE_BINDING 0
+
+//===========
+//std430 layout: the vertex shader declares the same struct,
+//  struct Instance { mat4 model; vec4 bounds_min; vec4 bounds_max; uvec4 mesh; };
+//with bounds in model space and the mesh index in mesh.x.
+//===========
+typedef struct {
+    glm::mat4 model;
+    glm::vec4 bounds_min;
+    glm::vec4 bounds_max;
+    GLuint    mesh;
+    GLuint    padding[3];
+} GPUInstance;
+
+typedef struct {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint  base_vertex;
+    GLuint base_instance;
+} DrawElementsIndirectCommand;
+
+namespace GearsEngine {
+    //===========
+    //culling on the GPU: instances (transform plus model-space bounds)
+    //live in a shader storage buffer, a compute shader tests each one
+    //against the frustum and the previous frame's depth pyramid, and the
+    //survivors are appended per mesh into indirect draw commands. the CPU
+    //cost per frame doesn't depend on the instance count.
+    //
+    //all meshes share one vertex/element buffer pair; a mesh is a range
+    //of it. draw through Renderer::drawIndirect() with that pair bound.
+    //===========
+    class GPUCuller
+    {
+        private:
+            GLuint cull_program;
+            GLuint compact_program;
+            GLuint pyramid_program;
+
+            GLuint instance_buffer;
+            GLuint command_template; // commands with zero instances, copied in each frame
+            GLuint command_buffer;
+            GLuint draw_buffer;      // compacted commands
+            GLuint parameter_buffer; // draw count
+            GLuint visible_buffer;   // instance ids, grouped by mesh
+
+            GLuint  pyramid;
+            GLsizei pyramid_width, pyramid_height;
+            GLint   pyramid_levels;
+            bool    has_pyramid;
+            glm::mat4 pyramid_view_projection;
+
+            std::vector<DrawElementsIndirectCommand> meshes;
+            std::vector<GPUInstance> instances;
+            GLuint max_instances;
+
+            GLuint dirty_begin, dirty_end; // instances to upload
+            bool   are_commands_dirty;
+
+            bool is_supported;
+            bool has_draw_count;
+
+            void uploadInstances();
+            void uploadCommands();
+
+        public:
+            GPUCuller();
+            ~GPUCuller();
+
+            //===========
+            //build the programs and buffers. false when the context lacks
+            //compute shaders, storage buffers or indirect multi-draw.
+            //===========
+            bool initialize( GLuint max_instances );
+            bool isSupported();
+
+            GLuint addMesh( GLuint index_count, GLuint first_index, GLint base_vertex );
+
+            //===========
+            //returns the instance index, or max_instances when full.
+            //===========
+            GLuint addInstance( GLuint mesh, const glm::mat4 &model, const AABB &bounds );
+            void   setTransform( GLuint instance, const glm::mat4 &model );
+
+            //===========
+            //reduce a depth texture of the frame just drawn into the
+            //max-depth pyramid used for next frame's occlusion test.
+            //view_projection is the camera that frame was drawn with. the
+            //depth texture is read with texelFetch, so it must be complete
+            //(a non-mipmap min filter).
+            //===========
+            void buildDepthPyramid( GLuint depth_texture, GLsizei width, GLsizei height, const glm::mat4 &view_projection );
+
+            //===========
+            //run the culling pass for this frame.
+            //===========
+            void cull( const glm::mat4 &view_projection );
+
+            //===========
+            //issue the draws; the VAO and program must be bound. the
+            //instance attribute is only enabled for these draws. use
+            //Renderer::drawIndirect() rather than calling this directly.
+            //===========
+            void submit();
+
+            GLuint getMeshCount();
+            GLuint getInstanceCount();
+            GLuint getVisibleBuffer();
+    };
+}
+
+#endif // _GEARS_GPU_CULLING_HPP_
@@ -0,0 +1,98 @@
+#ifndef _GEARS_INPUT_TRACE_HPP_
+#define _GEARS_INPUT_TRACE_HPP_
+
+#include <SDL2/SDL.h>
+#include <fstream>
+#include <string>
+
+// "GRIN" in the first four bytes of an input trace.
+#define GR_INPUT_MAGIC   0x4E495247
+#define GR_INPUT_VERSION 1
+
+//===========
+//an input trace is a header (magic, version, sizeof(SDL_Event)) and a
+//sequence of records: the time since recording started in nanoseconds
+//as a 64-bit integer, then the SDL_Event as it came out of the queue.
+//everything is in host byte order, and only builds against the same
+//SDL_Event layout can read each other's traces.
+//===========
+typedef enum {
+    GR_REPLAY_REAL_TIME = 0, // events come back as far apart as they were recorded
+    GR_REPLAY_FIXED_STEP     // every frame advances the clock by the same step
+} ReplayMode;
+
+namespace GearsEngine {
+    //===========
+    //writes the events a Window dispatches to an input trace. events
+    //that carry pointers (dropped files, user and window manager events)
+    //can't be replayed, so they're left out.
+    //===========
+    class InputRecorder
+    {
+        private:
+            std::ofstream file;
+            Uint64 start;
+            unsigned long long event_count;
+
+        public:
+            InputRecorder();
+            ~InputRecorder();
+
+            bool open( const std::string &path );
+            void close();
+            bool isOpen();
+
+            void record( const SDL_Event &event, Uint64 counter );
+
+            //===========
+            //push what's been recorded so far to the file, so a run that
+            //never closes the recorder still leaves a whole trace.
+            //===========
+            void flush();
+
+            unsigned long long getEventCount();
+    };
+
+    //===========
+    //reads an input trace back on a clock of its own. advance() moves
+    //the clock once per frame, to the time since open() in real time
+    //mode or by one step in fixed step mode; poll() then hands out the
+    //events recorded up to that time, oldest first.
+    //===========
+    class InputPlayer
+    {
+        private:
+            std::ifstream file;
+            ReplayMode mode;
+            double     step;   // seconds per frame, fixed step only
+            Uint64     start;
+            Uint64     clock;  // nanoseconds since the start of the trace
+            unsigned long long frame;
+
+            Uint64    next_time;
+            SDL_Event next_event;
+            bool      has_next;
+
+            void readNext();
+
+        public:
+            InputPlayer();
+
+            bool open( const std::string &path, ReplayMode replay_mode, double fixed_step );
+            void close();
+            bool isOpen();
+
+            void advance( Uint64 counter );
+            bool poll( SDL_Event *event );
+
+            //===========
+            //every event has been handed out.
+            //===========
+            bool isFinished();
+
+            ReplayMode getMode();
+            double     getStep();
+    };
+}
+
+#endif // _GEARS_INPUT_TRACE_HPP_
@@ -0,0 +1,75 @@
+#ifndef _GEARS_JOB_SYSTEM_HPP_
+#define _GEARS_JOB_SYSTEM_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a kernel processes the half-open item range [begin, end).
+typedef void (*JobKernel)( unsigned int begin, unsigned int end, void *userdata );
+
+namespace GearsEngine {
+    class JobSystem
+    {
+        private:
+            std::vector<std::thread> workers;
+
+            std::mutex              mutex;
+            std::condition_variable wake_workers;
+            std::condition_variable batches_finished;
+
+            JobKernel kernel;
+            void     *userdata;
+
+            unsigned int item_count;
+            unsigned int batch_size;
+            unsigned int generation;
+            unsigned int active_workers;
+
+            unsigned int              batch_count;
+            std::atomic<unsigned int> next_batch;
+            std::atomic<unsigned int> remaining_batches;
+
+            bool is_shutting_down;
+
+            // what one parallelFor hands out, copied under the lock so a
+            // worker never mixes the parameters of two dispatches.
+            typedef struct {
+                JobKernel    kernel;
+                void        *userdata;
+                unsigned int item_count;
+                unsigned int batch_size;
+                unsigned int batch_count;
+            } Dispatch;
+
+            void workerLoop();
+            Dispatch getDispatch();
+            void     runBatches( const Dispatch &dispatch );
+
+        public:
+            //===========
+            //worker_count of zero picks one worker per hardware thread,
+            //minus the thread that calls parallelFor.
+            //===========
+            JobSystem( unsigned int worker_count = 0 );
+            ~JobSystem();
+
+            unsigned int getWorkerCount();
+
+            //===========
+            //split [0, count) into batches and run kernel over them on the
+            //workers and the calling thread; returns once every batch is
+            //done. only one parallelFor may be in flight at a time.
+            //===========
+            void parallelFor(
+                    unsigned int count,
+                    unsigned int batch,
+                    JobKernel job_kernel,
+                    void *job_userdata
+            );
+    };
+}
+
+#endif // _GEARS_JOB_SYSTEM_HPP_
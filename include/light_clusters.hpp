@@ -0,0 +1,181 @@
+#ifndef _GEARS_LIGHT_CLUSTERS_HPP_
+#define _GEARS_LIGHT_CLUSTERS_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include <vector>
+#include "renderer.hpp"
+#include "job_system.hpp"
+
+// the grid: screen tiles across and down, exponential depth slices.
+// tiles per slice are kept a multiple of 8, the widest SIMD kernel.
+#define GR_CLUSTER_X 16
+#define GR_CLUSTER_Y 8
+#define GR_CLUSTER_Z 24
+
+// lights one cluster can list; more than that and the farthest in index
+// order are dropped from it.
+#define GR_CLUSTER_MAX_LIGHTS 128
+
+// uniform block binding of the grid parameters, next to the frame and
+// draw blocks.
+#define GR_CLUSTER_UNIFORM_BINDING 2
+
+// texture units of the light, grid and index buffers, kept clear of the
+// low units materials use.
+#define GR_CLUSTER_LIGHT_UNIT 13
+#define GR_CLUSTER_GRID_UNIT  14
+#define GR_CLUSTER_INDEX_UNIT 15
+
+//===========
+//a point light in world space; it reaches radius units and nothing
+//beyond, however the shader chooses to fall off.
+//===========
+typedef struct {
+    glm::vec3 position;
+    GLfloat   radius;
+    glm::vec3 color;
+    GLfloat   intensity;
+} PointLight;
+
+namespace GearsEngine {
+    //===========
+    //clustered forward lighting. the view frustum is cut into a grid of
+    //GR_CLUSTER_X by GR_CLUSTER_Y screen tiles and GR_CLUSTER_Z slices,
+    //spaced exponentially in depth, and every cluster gets the list of
+    //lights whose sphere touches its view-space bounds. a fragment finds
+    //its cluster from gl_FragCoord alone and only shades those lights,
+    //so the cost follows the lights actually nearby rather than the
+    //light count.
+    //
+    //update() does the assignment on the CPU, one job per slice: each
+    //slice only looks at lights overlapping its depth range and tests
+    //those against all its clusters at once with SSE or AVX sphere/box
+    //tests. the lists are then packed back to back into one index
+    //buffer, with an offset and count per cluster. bind() uploads the
+    //lights, grid and indices as texture buffers, so anything from GL
+    //3.3 on can read them.
+    //
+    //fragment shaders paste getShaderSource() after their #version line
+    //and loop like this:
+    //
+    //  uvec2 cluster = grClusterLights();
+    //  for (uint i = 0u; i < cluster.y; ++i) {
+    //      vec4 position_radius, color_intensity;
+    //      grGetLight( grClusterLight( cluster.x + i ), position_radius, color_intensity );
+    //      ...
+    //  }
+    //
+    //call prepareProgram() once per program. the projection must be a
+    //perspective one, with the default depth range. update() needs no
+    //context; bind() is for the GL thread. jobs may be NULL to run
+    //serially.
+    //===========
+    class LightClusters
+    {
+        private:
+            // std140, as the shader's LightClusters block
+            typedef struct {
+                GLuint  grid[4];  // tiles across, down, slices, light count
+                GLfloat tile[4];  // tile width, height in pixels, slice scale, bias
+                GLfloat depth[4]; // projection [2][2] and [3][2]
+            } ClusterUniforms;
+
+            JobSystem *jobs;
+
+            std::vector<PointLight> lights;
+            std::vector<glm::vec4>  view_lights; // view-space center, radius
+            GLuint max_lights;
+            GLuint max_indices;
+
+            // view-space bounds per cluster, structure of arrays
+            std::vector<GLfloat> min_x, min_y, min_z;
+            std::vector<GLfloat> max_x, max_y, max_z;
+            GLfloat slice_depths[GR_CLUSTER_Z + 1];
+
+            glm::mat4 projection;
+            GLsizei   width, height;
+
+            // per cluster: GR_CLUSTER_MAX_LIGHTS entries of scratch, filled
+            // by the slice jobs, then packed into indices
+            std::vector<GLushort> scratch;
+            std::vector<GLuint>   counts;
+            std::vector<GLuint>   grid;    // offset, count per cluster
+            std::vector<GLushort> indices;
+            GLuint                index_count;
+            std::atomic<GLuint>   dropped;
+
+            ClusterUniforms uniforms;
+
+            GLuint light_buffer, grid_buffer, index_buffer, uniform_buffer;
+            GLuint light_texture, grid_texture, index_texture;
+            bool   is_dirty;
+            bool   is_initialized;
+
+            void buildBounds();
+            void assignSlice( GLuint slice );
+
+            static void assignKernel( unsigned int begin, unsigned int end, void *clusters );
+
+        public:
+            //===========
+            //room for max_lights lights (at most 65535) and max_indices
+            //list entries across all clusters.
+            //===========
+            LightClusters( GLuint max_lights, JobSystem *job_system, GLuint max_indices = 1 << 18 );
+            ~LightClusters();
+
+            //===========
+            //make the texture buffers and the uniform block. needs a
+            //current context. GL errors show up in the diagnostics, not
+            //in the result.
+            //===========
+            bool initialize();
+
+            //===========
+            //returns the light's index, or the light count unchanged when
+            //max_lights are already in.
+            //===========
+            GLuint addLight( const PointLight &light );
+            void   setLight( GLuint index, const PointLight &light );
+            const PointLight &getLight( GLuint index );
+            void   clearLights();
+
+            //===========
+            //assign the lights to clusters for a camera rendering to a
+            //target of width by height pixels.
+            //===========
+            void update( const glm::mat4 &view, const glm::mat4 &projection, GLsizei width, GLsizei height );
+
+            //===========
+            //upload what the last update() produced, if it hasn't been,
+            //and bind the buffers to their units and the uniform block.
+            //===========
+            void bind();
+
+            //===========
+            //point a program's samplers at the cluster units and its
+            //LightClusters block at GR_CLUSTER_UNIFORM_BINDING. leaves
+            //the program in use.
+            //===========
+            void prepareProgram( Renderer *renderer, const ShaderProgram &program );
+
+            //===========
+            //GLSL 3.30 declarations and lookup functions for fragment
+            //shaders.
+            //===========
+            static const GLchar *getShaderSource();
+
+            GLuint getLightCount();
+
+            //===========
+            //list entries the last update() produced, and those it had
+            //to leave out because a cluster or the index buffer was full.
+            //===========
+            GLuint getIndexCount();
+            GLuint getDroppedCount();
+    };
+}
+
+#endif // _GEARS_LIGHT_CLUSTERS_HPP_
@@ -0,0 +1,131 @@
+#ifndef _GEARS_OCCLUSION_HPP_
+#define _GEARS_OCCLUSION_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <atomic>
+#include <vector>
+#include "bounds.hpp"
+#include "job_system.hpp"
+
+// the depth buffer is split into square tiles; each tile is rasterized by
+// exactly one job, so tiles never need locking.
+#define GR_OCCLUSION_TILE_SIZE 32
+
+typedef struct {
+    const GLfloat *positions; // xyz at the start of every vertex
+    GLsizei        stride;    // bytes between vertices, like VAPconfig
+    GLuint         vertex_count;
+
+    const GLuint  *indices;
+    GLuint         index_count;
+
+    glm::mat4      model;
+} Occluder;
+
+typedef struct {
+    GLuint occluders;
+    GLuint triangles_rasterized;
+
+    GLuint objects_tested;
+    GLuint objects_rejected;  // hidden behind the occluders
+    GLuint objects_offscreen; // outside the depth buffer entirely
+} OcclusionStats;
+
+namespace GearsEngine {
+    class OcclusionCuller
+    {
+        private:
+            // screen-space triangle, already divided through by w.
+            typedef struct {
+                GLfloat x[3];
+                GLfloat y[3];
+                GLfloat z[3];
+                bool    is_valid;
+            } ScreenTriangle;
+
+            typedef struct {
+                GLuint width;
+                GLuint height;
+                std::vector<GLfloat> depth;
+            } DepthLevel;
+
+            JobSystem *jobs;
+
+            GLuint width, height;
+            GLuint tiles_x, tiles_y;
+
+            glm::mat4 view_projection;
+
+            std::vector<Occluder>           occluders;
+            std::vector<GLuint>             first_triangle;
+            std::vector<ScreenTriangle>     triangles;
+            std::vector< std::vector<GLuint> > tile_bins;
+
+            // level 0 is the full resolution depth buffer, every further
+            // level keeps the farthest depth of the 2x2 texels below it.
+            std::vector<DepthLevel> pyramid;
+
+            GLuint debug_texture;
+
+            GLuint triangles_rasterized;
+            std::atomic<GLuint> objects_tested;
+            std::atomic<GLuint> objects_rejected;
+            std::atomic<GLuint> objects_offscreen;
+
+            void setupTriangles( GLuint begin, GLuint end );
+            void binTriangles();
+            void rasterizeTile( GLuint tile );
+            void buildPyramid();
+
+            static void setupKernel( unsigned int begin, unsigned int end, void *culler );
+            static void rasterKernel( unsigned int begin, unsigned int end, void *culler );
+
+        public:
+            //===========
+            //width/height are the occlusion buffer resolution; they are
+            //rounded up to whole tiles. jobs may be NULL to run serially.
+            //===========
+            OcclusionCuller( GLuint buffer_width, GLuint buffer_height, JobSystem *job_system );
+            ~OcclusionCuller();
+
+            GLuint getWidth();
+            GLuint getHeight();
+            GLuint getLevelCount();
+
+            //===========
+            //start a new frame: drops last frame's occluders and counters.
+            //===========
+            void beginFrame( const glm::mat4 &new_view_projection );
+
+            //===========
+            //the vertex/index data is only referenced, it has to stay alive
+            //until rasterizeOccluders() returns.
+            //===========
+            void addOccluder( Occluder occluder );
+
+            //===========
+            //render every occluder into the depth buffer and build the
+            //hierarchical-z pyramid from it.
+            //===========
+            void rasterizeOccluders();
+
+            //===========
+            //false when the world-space box is hidden behind the occluders.
+            //safe to call from several threads at once.
+            //===========
+            bool isVisible( const AABB &bounds );
+
+            OcclusionStats getStats();
+
+            //===========
+            //debug view: write a pyramid level as 8-bit greyscale (near is
+            //bright) into pixels, or upload it into a GL_R8 texture which is
+            //returned so it can be drawn over the scene.
+            //===========
+            void   getDebugImage( GLuint level, std::vector<GLubyte> &pixels );
+            GLuint updateDebugTexture( GLuint level );
+    };
+}
+
+#endif // _GEARS_OCCLUSION_HPP_
@@ -0,0 +1,184 @@
+#ifndef _GEARS_PARTICLES_HPP_
+#define _GEARS_PARTICLES_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "job_system.hpp"
+
+// particles per block. blocks are the unit of a job and of compaction;
+// a multiple of the widest SIMD kernel.
+#define GR_PARTICLE_BLOCK 4096
+
+// frames of instance data the CPU may write ahead of the GPU.
+#define GR_PARTICLE_FRAMES 3
+
+// point attractors a system applies at most.
+#define GR_PARTICLE_ATTRACTORS 8
+
+//===========
+//where and how particles are born. spreads are half ranges around the
+//base value, drawn uniformly. color is RGBA8 packed little endian, red
+//in the low byte; alpha fades to zero over a particle's life.
+//===========
+typedef struct {
+    glm::vec3 position;
+    glm::vec3 position_spread;
+    glm::vec3 velocity;
+    glm::vec3 velocity_spread;
+
+    GLfloat rate;      // particles per second, 0 for bursts only
+    GLfloat lifetime;  // seconds
+    GLfloat lifetime_spread;
+    GLfloat size;      // half the quad's edge, world units
+    GLfloat growth;    // size change per second
+    GLuint  color;
+
+    bool    is_enabled;
+} ParticleEmitter;
+
+typedef enum {
+    GR_FORCE_ACCELERATION = 0, // vector is the acceleration: gravity, wind
+    GR_FORCE_DRAG,             // strength is the fraction of velocity lost per second
+    GR_FORCE_ATTRACTOR         // pulls toward vector, by strength / distance^2; negative pushes
+} ForceType;
+
+typedef struct {
+    ForceType type;
+    glm::vec3 vector;
+    GLfloat   strength;
+} ParticleForce;
+
+namespace GearsEngine {
+    //===========
+    //a pool of particles kept as structure of arrays, in blocks of
+    //GR_PARTICLE_BLOCK. update() spawns from the emitters, then runs one
+    //job per block: forces and integration with SSE or AVX kernels,
+    //after which the block's dead particles are squeezed out with a
+    //branchless copy-and-advance pass, so every block stays dense and
+    //no work is spent on the dead.
+    //
+    //draw() writes the live particles straight into a mapped instance
+    //buffer, again one job per block, each at its prefix offset, and
+    //draws them as camera-facing quads in a single instanced call. the
+    //buffer holds GR_PARTICLE_FRAMES frames and each is fenced, so the
+    //CPU never writes what the GPU is still reading.
+    //
+    //update() needs no context; draw() is for the GL thread. both use
+    //the job system, so they mustn't run at the same time on threads of
+    //their own. jobs may be NULL to run serially.
+    //===========
+    class ParticleSystem
+    {
+        private:
+            typedef struct {
+                glm::vec3 acceleration;
+                GLfloat   damping; // velocity kept over the step
+                GLuint    attractor_count;
+                glm::vec4 attractors[GR_PARTICLE_ATTRACTORS]; // position, strength
+                GLfloat   step;
+            } StepConstants;
+
+            JobSystem *jobs;
+
+            GLuint capacity;   // whole blocks
+            GLuint block_count;
+
+            // per particle, block after block
+            std::vector<GLfloat> position_x, position_y, position_z;
+            std::vector<GLfloat> velocity_x, velocity_y, velocity_z;
+            std::vector<GLfloat> ages, lifetimes;
+            std::vector<GLfloat> sizes, growths;
+            std::vector<GLuint>  colors;
+
+            std::vector<GLuint> live_counts;   // per block
+            std::vector<GLuint> first_instance; // per block, in the frame being drawn
+            GLuint live_count;
+            GLuint fill_block; // where spawning looks for room first
+
+            std::vector<ParticleEmitter> emitters;
+            std::vector<GLdouble>        emitter_debt; // fractional particles owed
+            std::vector<ParticleForce>   forces;
+
+            StepConstants constants;
+            GLuint random_state;
+
+            GLuint program;
+            GLint  view_location, projection_location;
+            GLuint vao;
+            GLuint quad_buffer;
+            GLuint instance_buffer;
+            GLsizeiptr segment_size;
+            GLubyte *mapped;    // persistent mapping, NULL when each frame maps its own
+            GLubyte *instances; // the segment being written by draw()
+            GLuint   segment;
+            GLsync   fences[GR_PARTICLE_FRAMES];
+            bool     is_initialized;
+
+            GLfloat random();
+            void spawn( const ParticleEmitter &emitter, GLuint count );
+            void simulateBlock( GLuint block );
+            void compactBlock( GLuint block );
+            void writeBlock( GLuint block );
+
+            static void updateKernel( unsigned int begin, unsigned int end, void *system );
+            static void writeKernel( unsigned int begin, unsigned int end, void *system );
+
+        public:
+            //===========
+            //room for capacity particles, rounded up to whole blocks.
+            //===========
+            ParticleSystem( GLuint max_particles, JobSystem *job_system );
+            ~ParticleSystem();
+
+            //===========
+            //build the program, quad and instance buffers. false without
+            //instanced arrays or when the shaders don't build. needs a
+            //current context.
+            //===========
+            bool initialize();
+
+            GLuint addEmitter( const ParticleEmitter &emitter );
+            void   setEmitter( GLuint index, const ParticleEmitter &emitter );
+            const ParticleEmitter &getEmitter( GLuint index );
+
+            //===========
+            //spawn count particles from an emitter right away, enabled or
+            //not. spawns past the capacity are dropped.
+            //===========
+            void burst( GLuint emitter, GLuint count );
+
+            GLuint addForce( const ParticleForce &force );
+            void   setForce( GLuint index, const ParticleForce &force );
+            void   clearForces();
+
+            //===========
+            //advance dt seconds: spawn, apply forces, integrate, age and
+            //drop whatever died.
+            //===========
+            void update( GLfloat dt );
+
+            //===========
+            //stream the live particles to the GPU and draw them, alpha
+            //blended without depth writes; the caller's blend and depth
+            //state is restored after. use Renderer::drawParticles()
+            //rather than calling this directly.
+            //===========
+            void draw( const glm::mat4 &view, const glm::mat4 &projection );
+
+            //===========
+            //kill every particle.
+            //===========
+            void clear();
+
+            GLuint getCount();
+            GLuint getCapacity();
+
+            //===========
+            //bytes of instance data per particle streamed by draw().
+            //===========
+            static GLsizeiptr getInstanceSize();
+    };
+}
+
+#endif // _GEARS_PARTICLES_HPP_
@@ -0,0 +1,152 @@
+#ifndef _GEARS_RENDER_GRAPH_HPP_
+#define _GEARS_RENDER_GRAPH_HPP_
+
+#include <GL/glew.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "gl_object.hpp"
+
+typedef GLuint RenderResource;
+
+typedef struct {
+    GLsizei width;
+    GLsizei height;
+    GLenum  format; // sized internal format: GL_RGBA8, GL_DEPTH24_STENCIL8...
+} AttachmentDesc;
+
+namespace GearsEngine {
+    class Renderer;
+    class RenderGraph;
+}
+
+typedef void (*PassExecute)(
+        GearsEngine::Renderer *renderer,
+        GearsEngine::RenderGraph *graph,
+        void *userdata
+);
+
+namespace GearsEngine {
+    //===========
+    //a frame described as passes that read and write attachments. on
+    //compile() passes whose results nobody uses are dropped, the rest are
+    //ordered by their dependencies, and transient attachments whose
+    //lifetimes don't overlap share one texture. execute() binds each
+    //pass's framebuffer, clears, runs the pass, and tells the driver which
+    //attachment contents it can skip loading or storing.
+    //===========
+    class RenderGraph
+    {
+        private:
+            typedef struct {
+                std::string    name;
+                AttachmentDesc desc;
+
+                bool   is_transient;
+                bool   is_backbuffer;
+                bool   is_output;
+                GLuint texture; // imported texture or the aliased one; 0 for the backbuffer
+
+                int    first_use; // positions in the compiled order
+                int    last_use;
+            } GraphResource;
+
+            typedef struct {
+                std::string name;
+                PassExecute execute;
+                void       *userdata;
+
+                std::vector<RenderResource> reads;
+                std::vector<RenderResource> writes;
+
+                bool    has_clear;
+                GLfloat clear_color[4];
+                GLfloat clear_depth;
+                bool    has_side_effect;
+
+                // filled in by compile().
+                GLuint  framebuffer;
+                GLsizei width, height;
+                GLsizei color_count;
+                std::vector<GLenum> discard_before;
+                std::vector<GLenum> discard_after;
+                std::vector<GLuint> release_textures;
+            } GraphPass;
+
+            typedef struct {
+                AttachmentDesc desc;
+                glObject<textureTraits> texture;
+                int last_use; // position of the last pass using it this frame
+            } PhysicalTexture;
+
+            typedef std::map< std::vector<GLuint>, glObject<framebufferTraits> > FramebufferCache;
+
+            std::vector<GraphResource> resources;
+            std::vector<GraphPass>     passes;
+            std::vector<GLuint>        order;
+
+            std::vector<PhysicalTexture> physical_textures;
+            FramebufferCache             framebuffers;
+
+            GLsizei backbuffer_width, backbuffer_height;
+            bool    is_compiled;
+            bool    has_invalidate;
+            bool    has_texture_storage;
+
+            void cullPasses( std::vector<bool> &alive );
+            int  findWriter( RenderResource resource, GLuint before, const std::vector<bool> &alive );
+            bool sortPasses( const std::vector<bool> &alive );
+            void assignTextures();
+            bool buildFramebuffers();
+
+        public:
+            RenderGraph();
+
+            //===========
+            //forget every pass and resource but keep the textures and
+            //framebuffers made so far, so a graph rebuilt each frame
+            //doesn't reallocate.
+            //===========
+            void reset();
+
+            //===========
+            //resources. transient attachments live only inside the graph;
+            //imported ones and the backbuffer are always kept.
+            //===========
+            RenderResource createAttachment( std::string name, AttachmentDesc desc );
+            RenderResource importTexture( std::string name, GLuint texture, AttachmentDesc desc );
+            RenderResource importBackbuffer( GLsizei width, GLsizei height );
+
+            //===========
+            //keep the passes that produce a transient attachment even if no
+            //other pass reads it, e.g. when it's read back later.
+            //===========
+            void markOutput( RenderResource resource );
+
+            //===========
+            //passes. a pass writing the backbuffer can't write anything else.
+            //===========
+            GLuint addPass( std::string name, PassExecute execute, void *userdata );
+            void   addRead( GLuint pass, RenderResource resource );
+            void   addWrite( GLuint pass, RenderResource resource );
+            void   setClear( GLuint pass, GLfloat r, GLfloat g, GLfloat b, GLfloat a, GLfloat depth );
+            void   setSideEffect( GLuint pass );
+
+            //===========
+            //false on a dependency cycle or an incomplete framebuffer.
+            //===========
+            bool compile();
+            void execute( Renderer *renderer );
+
+            //===========
+            //for use inside a pass: the texture behind a resource.
+            //===========
+            GLuint getTexture( RenderResource resource );
+
+            GLuint getPassCount();
+            GLuint getCulledPassCount();
+            GLuint getTextureCount();
+    };
+}
+
+#endif // _GEARS_RENDER_GRAPH_HPP_
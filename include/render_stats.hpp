@@ -0,0 +1,149 @@
+#ifndef _GEARS_RENDER_STATS_HPP_
+#define _GEARS_RENDER_STATS_HPP_
+
+#include <GL/glew.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// frames the rolling window keeps.
+#define GR_STATS_HISTORY 240
+
+typedef enum {
+    GR_STAT_DRAW_CALLS = 0,
+    GR_STAT_TRIANGLES,
+    GR_STAT_PROGRAM_BINDS,
+    GR_STAT_VAO_BINDS,
+    GR_STAT_BUFFER_BINDS,   // vertex and element buffers attached for drawing
+    GR_STAT_UNIFORM_UPLOADS,
+    GR_STAT_UPLOADED_BYTES, // buffer data, sub data and uniform blocks
+    GR_STAT_LIVE_BUFFERS,   // gauge: vertex and element buffers alive
+    GR_STAT_BUFFER_BYTES,   // gauge: estimated buffer memory on the GPU
+    GR_STAT_COUNT
+} RenderStat;
+
+typedef enum {
+    GR_STATS_PROMETHEUS = 0, // node_exporter textfile collector format
+    GR_STATS_JSON
+} StatsFormat;
+
+typedef struct {
+    GLuint64 values[GR_STAT_COUNT];
+} FrameStats;
+
+//===========
+//one stat over the frames in the window. counters are per frame; gauges
+//are sampled at the end of each frame.
+//===========
+typedef struct {
+    GLuint64 last;
+    GLuint64 min;
+    GLuint64 max;
+    double   mean;
+    GLuint64 p50, p95, p99;
+    GLuint   frames; // how many frames the summary covers
+} StatSummary;
+
+namespace GearsEngine {
+    //===========
+    //per-frame renderer counters and a rolling window of the last
+    //GR_STATS_HISTORY frames. the renderer counts as it goes and closes
+    //the frame in endFrame(); every few frames a copy of the window goes
+    //to a writer thread, which writes it to the sinks, replacing each
+    //file whole, so a collector never reads a half written one and the
+    //frame never waits on the disk. counting is for the GL thread only;
+    //the queries and sinks may be used from any thread.
+    //===========
+    class RenderStats
+    {
+        private:
+            typedef struct {
+                std::string path;
+                StatsFormat format;
+            } StatsSink;
+
+            typedef struct {
+                FrameStats frames[GR_STATS_HISTORY];
+                GLuint     head;
+                GLuint     size;
+                unsigned long long frame_count;
+                GLuint64   totals[GR_STAT_COUNT]; // every frame's counters since the start
+            } StatsWindow;
+
+            FrameStats current;
+
+            std::mutex  history_mutex;
+            StatsWindow history;
+
+            std::vector<StatsSink> sinks;
+            GLuint sink_interval;
+
+            std::vector<GLuint64> scratch;
+
+            // the writer thread, started with the first sink; it only
+            // ever writes the latest window handed to it.
+            std::thread             writer;
+            std::mutex              writer_mutex;
+            std::condition_variable writer_wake;
+            StatsWindow             pending;
+            std::vector<StatsSink>  pending_sinks;
+            bool                    has_pending;
+            bool                    is_shutting_down;
+
+            // held while any sink file is written, from whichever thread.
+            std::mutex file_mutex;
+
+            void writerLoop();
+            bool writeNow( const std::vector<StatsSink> &targets );
+
+            static StatSummary summarizeWindow( const StatsWindow &window, RenderStat stat, std::vector<GLuint64> &scratch );
+            static bool        writeSink( const StatsSink &sink, const StatsWindow &window, std::vector<GLuint64> &scratch );
+
+        public:
+            RenderStats();
+            ~RenderStats();
+
+            inline void add( RenderStat stat, GLuint64 amount ) { current.values[stat] += amount; }
+            inline void set( RenderStat stat, GLuint64 value ) { current.values[stat] = value; }
+
+            //===========
+            //close the frame: push it into the window and start counting
+            //the next. gauges carry over, counters start at zero.
+            //===========
+            void endFrame();
+
+            //===========
+            //frames_ago 0 is the last finished frame. zeros past the
+            //window.
+            //===========
+            FrameStats  getFrame( GLuint frames_ago );
+            StatSummary summarize( RenderStat stat );
+
+            unsigned long long getFrameCount();
+
+            //===========
+            //snake_case name of a stat, as it appears in the sinks.
+            //===========
+            static const char *getName( RenderStat stat );
+            static bool        isGauge( RenderStat stat );
+
+            //===========
+            //write the window to path every setSinkInterval() frames
+            //(60 by default), off the calling thread. the first write
+            //happens here, so false means the file can't be written.
+            //===========
+            bool addSink( const std::string &path, StatsFormat format );
+            void clearSinks();
+            void setSinkInterval( GLuint frames );
+
+            //===========
+            //write every sink now, on the calling thread. false if any
+            //of them failed.
+            //===========
+            bool flushSinks();
+    };
+}
+
+#endif // _GEARS_RENDER_STATS_HPP_
@@ -0,0 +1,75 @@
+#ifndef _GEARS_RENDER_THREAD_HPP_
+#define _GEARS_RENDER_THREAD_HPP_
+
+#include <GL/glew.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "window.hpp"
+#include "renderer.hpp"
+#include "frame_packet.hpp"
+
+typedef void (*RenderSetup)( GearsEngine::Renderer *renderer, void *userdata );
+
+namespace GearsEngine {
+    //===========
+    //opt-in threaded rendering. start() moves the window's GL context to
+    //a thread of its own, which creates the Renderer and then draws the
+    //frame packets the game thread submits, so simulating frame N+1
+    //overlaps rendering frame N.
+    //
+    //while it runs, the Renderer belongs to the render thread: GL
+    //resources are created in the setup callback, and the game thread
+    //only fills in packets and keeps calling window->pollEvents().
+    //===========
+    class RenderThread
+    {
+        private:
+            RenderWindow *window;
+            Renderer     *renderer;
+
+            FrameMailbox mailbox;
+            std::thread  thread;
+
+            RenderSetup setup_function;
+            void       *setup_userdata;
+
+            std::mutex              ready_mutex;
+            std::condition_variable ready_changed;
+            bool                    is_ready;
+
+            std::atomic<unsigned long long> frames_rendered;
+
+            void run();
+
+        public:
+            RenderThread( RenderWindow *window );
+            ~RenderThread();
+
+            //===========
+            //returns once the setup callback has finished on the render
+            //thread, so whatever it wrote to userdata can be read.
+            //===========
+            void start( RenderSetup setup, void *userdata );
+
+            //===========
+            //draws what is already queued, then hands the context back to
+            //the calling thread.
+            //===========
+            void stop();
+
+            bool isRunning();
+
+            //===========
+            //game thread: get a packet to fill in, then submit it. blocks
+            //while the render thread is more than a frame behind.
+            //===========
+            FramePacket *beginFrame();
+            void         submitFrame( FramePacket *packet );
+
+            unsigned long long getFramesRendered();
+    };
+}
+
+#endif // _GEARS_RENDER_THREAD_HPP_
@@ -6,6 +6,12 @@
 #include <map>
 #include <vector>
 #include "window.hpp"
+#include "bounds.hpp"
+#include "gl_object.hpp"
+#include "gl_debug.hpp"
+#include "frame_packet.hpp"
+#include "uniform_buffer.hpp"
+#include "render_stats.hpp"
 
 typedef enum {
     GR_RENDER_ELEMENTS = 0,
@@ -56,10 +62,46 @@ typedef std::map<std::string, VertexBuffer>  VBOMap;
 typedef std::map<std::string, ElementBuffer> EBOMap;
 typedef std::map<std::string, ShaderProgram> PGMMap;
 
+// the renderer owns the GL names behind every identifier.
+typedef std::map<std::string, glObject<vaoTraits> >    VAONameMap;
+typedef std::map<std::string, glObject<bufferTraits> > BufferNameMap;
+
 typedef std::vector<VAPconfig> VAPMap;
 typedef std::vector<VAPMap>    VAPMod;
 
+//===========
+//a VAP module reduced to its vertex format: attributes read from a
+//binding point per stride and base offset, at an offset relative to
+//that base below the stride, so one VAO per layout can serve every
+//buffer with that format, interleaved or planar.
+//===========
+typedef struct {
+    size_t  hash;
+    VAPMap  attributes;
+    std::vector<GLsizei>  binding_strides; // stride of each binding point
+    std::vector<GLintptr> binding_offsets; // where each binding point starts in the buffer
+    std::vector<GLuint>   attribute_bindings; // binding point per attribute
+    std::vector<GLuint>   relative_offsets; // per attribute, from its binding's start
+    GLuint  vao; // built on first bind, 0 until then
+} VertexLayout;
+
+typedef std::vector<VertexLayout>   LayoutCache;
+typedef std::multimap<size_t, GLuint> LayoutIndex;
+
 namespace GearsEngine {
+    class OcclusionCuller;
+    class GPUCuller;
+    class GLCapture;
+    class DynamicResolution;
+    class FrameReadback;
+    class ParticleSystem;
+    class SpriteBatch;
+
+    //===========
+    //bytes per component of a vertex attribute type.
+    //===========
+    GLsizei attributeTypeSize( GLenum type );
+
     class Renderer
     {
         private:
@@ -71,52 +113,235 @@ namespace GearsEngine {
             VAPMod vap_modules;
             VAPMap vap_configurations;
 
+            // modules with the same attribute setup share one layout.
+            LayoutCache         vertex_layouts;
+            LayoutIndex         layout_index;
+            std::vector<GLuint> vap_layouts;
+            std::vector< glObject<vaoTraits> > layout_vaos;
+
+            bool   has_attrib_binding;
+            bool   has_dsa;
+            GLuint bound_vao;
+
+            GLuint internLayout( const VAPMap &attributes );
+            void   buildLayoutVAO( VertexLayout &layout );
+            void   specifyLegacyAttributes( int vap );
+            void   attachVertexBuffer( const VertexBuffer &vbo, const ElementBuffer &ebo, int vap );
+            void   prepareDraw();
+            void   drawElements( GLsizei count );
+            void   trackBufferSize( GLuint uid, GLsizeiptr size );
+
             VAOMap vertex_arrays;
             VBOMap vertex_buffers;
             EBOMap element_buffers;
             PGMMap shader_programs;
 
+            VAONameMap    vao_names;
+            BufferNameMap vbo_names;
+            BufferNameMap ebo_names;
+
+            OcclusionCuller *occlusion_culler;
+            GLCapture       *capture;
+            DynamicResolution *dynamic_resolution;
+            FrameReadback     *readback;
+
+            GLDiagnostics diagnostics;
+
+            RenderStats stats;
+            std::map<GLuint, GLsizeiptr> buffer_sizes; // by GL name
+            GLuint64    buffer_bytes; // sum of buffer_sizes and the uniform ring
+
+            UniformRing uniform_ring;
+
         public:
             Renderer( Window *window );
+            ~Renderer();
+
+            //===========
+            //debug builds start in GR_DEBUG_SYNC, release builds in
+            //GR_DEBUG_ASYNC; both log low severity and up to std::cerr.
+            //===========
+            GLDiagnostics &getDiagnostics();
+
+            //===========
+            //draw calls, binds, uploads and buffer memory, per frame and
+            //over a rolling window; see RenderStats for the sinks.
+            //===========
+            RenderStats &getStats();
 
             void addVAPConfiguration( VAPconfig new_configuration );
             int  linkVAPModule();
 
             VAPconfig getVAPConfiguration( unsigned int index );
 
-            VertexArray   generateVAO( std::string identifier );
-            VertexBuffer  generateVBO( std::string identifier );
-            ElementBuffer generateEBO( std::string identifier );
+            //===========
+            //the attributes a linked module was made of.
+            //===========
+            const VAPMap &getVAPModule( int vap );
+
+            //===========
+            //index of the interned layout a module uses, and how many
+            //distinct layouts exist.
+            //===========
+            GLuint getVertexLayout( int vap );
+            GLuint getVertexLayoutCount();
+
+            VertexArray   generateVAO( const std::string &identifier );
+            VertexBuffer  generateVBO( const std::string &identifier );
+            ElementBuffer generateEBO( const std::string &identifier );
 
-            VertexArray   getVAO( std::string identifier );
-            VertexBuffer  getVBO( std::string identifier );
-            ElementBuffer getEBO( std::string identifier );
+            //===========
+            //release the GL name behind an identifier. the name is deleted
+            //once the GPU has finished the frames that might still use it.
+            //===========
+            void destroyVAO( const std::string &identifier );
+            void destroyVBO( const std::string &identifier );
+            void destroyEBO( const std::string &identifier );
+
+            VertexArray   getVAO( const std::string &identifier );
+            VertexBuffer  getVBO( const std::string &identifier );
+            ElementBuffer getEBO( const std::string &identifier );
 
             ShaderProgram createShaderProgram(
-                    std::string identifier,
+                    const std::string &identifier,
                     VertexShader *vertex_shader,
                     FragmentShader *fragment_shader
             );
 
+            //===========
+            //delete a program and forget its identifier; if it was the
+            //active one, draws have no program until the next is set.
+            //===========
+            void destroyShaderProgram( const std::string &identifier );
+
+            //===========
+            //uniform blocks. setFrameUniforms() fills the block bound at
+            //GR_FRAME_UNIFORM_BINDING, typically the camera, once per
+            //frame; setDrawUniforms() fills GR_DRAW_UNIFORM_BINDING before
+            //each draw. blocks use the std140 layout and are copied, so
+            //the data can go right after the call. false when the frame
+            //ran out of uniform space.
+            //===========
+            bool setFrameUniforms( const GLvoid *data, GLsizeiptr size );
+            bool setDrawUniforms( const GLvoid *data, GLsizeiptr size );
+            void bindUniformBlock( const ShaderProgram &program, const std::string &block, GLuint binding );
+
             void  setUniform( GLuint v0, GLint location );
             void  setUniform( GLfloat v0, GLint location );
             void  setUniform( const GLfloat *v0, GLsizei count, GLboolean transpose, GLuint location );
-            GLint getUniform( std::string uniform, ShaderProgram program );
+            GLint getUniform( const std::string &uniform, const ShaderProgram &program );
 
-            void setActiveVertexArray( VertexArray vao );
+            void setActiveVertexArray( const VertexArray &vao );
 
             void initializeVertexBuffer( 
-                    VertexBuffer vbo,
-                    ElementBuffer ebo,
+                    const VertexBuffer &vbo,
+                    const ElementBuffer &ebo,
+                    int vap
+            );
+
+            void initializeElementBuffer( const ElementBuffer &ebo );
+
+            //===========
+            //overwrite part of an already initialized buffer. never
+            //changes any binding the draw path relies on.
+            //===========
+            void updateVertexBuffer( const VertexBuffer &vbo, GLintptr offset, GLsizeiptr size, const GLvoid *data );
+            void updateElementBuffer( const ElementBuffer &ebo, GLintptr offset, GLsizeiptr size, const GLvoid *data );
+
+            //===========
+            //true when resources are created and edited through GL 4.5
+            //direct state access instead of bind-to-edit.
+            //===========
+            bool isUsingDSA();
+
+            //===========
+            //make a mesh current for draw(). meshes sharing a layout share
+            //its VAO, so switching between them only rebinds buffers.
+            //===========
+            void bindVertexBuffer(
+                    const VertexBuffer &vbo,
+                    const ElementBuffer &ebo,
                     int vap
             );
 
-            void initializeElementBuffer( ElementBuffer ebo );
+            void setActiveShaderProgram( const ShaderProgram &shader_program );
 
-            void setActiveShaderProgram( ShaderProgram shader_program );
+            //===========
+            //the program draws use: the last one set, or the last one
+            //created since. uid 0 when there is none.
+            //===========
+            ShaderProgram getActiveShaderProgram();
+
+            //===========
+            //call after the last draw of a frame.
+            //===========
+            void endFrame();
 
             void clear( GLclampf r, GLclampf g, GLclampf b, GLclampf a );
             void draw( RenderType mode );
+
+            //===========
+            //clear and draw everything a frame packet lists. used by the
+            //render thread, but works the same on the main thread.
+            //===========
+            void execute( const FramePacket *packet );
+
+            //===========
+            //occlusion culling: once a culler is set, draw() with bounds
+            //skips the submission when the box is hidden. the culler stays
+            //owned by the caller; NULL turns culling off again.
+            //===========
+            void setOcclusionCuller( OcclusionCuller *culler );
+            bool draw( RenderType mode, AABB bounds );
+
+            //===========
+            //draw what a GPUCuller's last cull() left visible, with the
+            //current mesh buffers and program. the vertex shader gets the
+            //instance index at GR_CULL_INSTANCE_ATTRIBUTE.
+            //===========
+            void drawIndirect( GPUCuller *culler );
+
+            //===========
+            //stream and draw a particle system's live particles with its
+            //own program and quads; the current program and buffers are
+            //left alone.
+            //===========
+            void drawParticles( ParticleSystem *particles, const glm::mat4 &view, const glm::mat4 &projection );
+
+            //===========
+            //draw every quad a SpriteBatch has queued, over whatever is
+            //in the target; typically last, for the HUD.
+            //===========
+            void drawSprites( SpriteBatch *sprites );
+
+            //===========
+            //dynamic resolution: once set, the first clear() of a frame
+            //starts the scene in the scaler's offscreen target and
+            //endFrame() upscales it to the window. owned by the caller;
+            //NULL renders at full size again. a RenderGraph drawing to
+            //the backbuffer bypasses it. changing it mid-scene upscales
+            //what the scene has so far and carries on in the window.
+            //===========
+            void setDynamicResolution( DynamicResolution *resolution );
+
+            //===========
+            //frame capture: once set, endFrame() hands the finished frame
+            //to the readback after the upscale, so it sees what the
+            //window shows. owned by the caller; NULL stops capturing.
+            //===========
+            void setFrameReadback( FrameReadback *frame_readback );
+
+            //===========
+            //write every renderer call from here on to a trace that
+            //GLReplay (and gears_replay) can play back. setting
+            //GEARS_CAPTURE to a path starts a capture from construction.
+            //buffers filled before the capture starts come out empty,
+            //and drawIndirect(), drawParticles() and drawSprites() aren't
+            //recorded.
+            //===========
+            bool startCapture( const std::string &path );
+            void stopCapture();
+            bool isCapturing();
     };
 }
 
@@ -0,0 +1,90 @@
+#ifndef _GEARS_SHADER_VARIANT_HPP_
+#define _GEARS_SHADER_VARIANT_HPP_
+
+#include <GL/glew.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "renderer.hpp"
+
+#define GR_MAX_SHADER_KEYWORDS 64
+
+// one bit per keyword, in the order the keywords were added.
+typedef unsigned long long VariantKey;
+
+namespace GearsEngine {
+    //===========
+    //one uber-shader source specialized by feature keywords: every enabled
+    //keyword becomes a "#define NAME 1" right after the #version line, so
+    //each variant compiles without the branches it doesn't need.
+    //
+    //variants compile on first use and stay cached by keyword mask. the
+    //masks used at runtime can be saved and handed to prewarm() on the
+    //next start to keep compiles out of the frame. GL thread only.
+    //===========
+    class ShaderVariants
+    {
+        private:
+            typedef std::unordered_map<VariantKey, ShaderProgram> VariantCache;
+
+            Renderer   *renderer;
+            std::string identifier;
+            std::string vertex_source;
+            std::string fragment_source;
+
+            std::vector<std::string> keywords;
+            VariantCache             variants;
+            std::vector<VariantKey>  used_variants;
+
+            // the renderer keeps pointers to a program's sources, so the
+            // specialized ones live as long as the variants do.
+            std::list<std::string> sources;
+
+            std::string specialize( const std::string &source, VariantKey key );
+            std::string describe( VariantKey key );
+            ShaderProgram compile( VariantKey key );
+
+        public:
+            ShaderVariants(
+                    Renderer *renderer,
+                    std::string identifier,
+                    const GLchar *vertex_source,
+                    const GLchar *fragment_source
+            );
+
+            //===========
+            //register a keyword; returns its bit, or 0 once all
+            //GR_MAX_SHADER_KEYWORDS are taken. adding one twice returns
+            //the same bit.
+            //===========
+            VariantKey addKeyword( std::string name );
+            VariantKey getKeyword( std::string name );
+
+            //===========
+            //the program for a keyword mask, compiled now if it's the first
+            //request. a variant that fails to build has uid 0, is reported
+            //through the renderer's diagnostics and isn't retried.
+            //compiling leaves the renderer's active program as it was.
+            //===========
+            ShaderProgram getVariant( VariantKey key );
+
+            bool   isCompiled( VariantKey key );
+            GLuint getVariantCount();
+
+            //===========
+            //compile ahead of time instead of on first use.
+            //===========
+            void prewarm( const std::vector<VariantKey> &keys );
+
+            //===========
+            //the usage list, one variant per line as keyword names ("-"
+            //for none), so it survives keywords being added or reordered.
+            //===========
+            const std::vector<VariantKey> &getUsedVariants();
+            bool saveUsage( std::string path );
+            bool prewarm( std::string path );
+    };
+}
+
+#endif // _GEARS_SHADER_VARIANT_HPP_
@@ -0,0 +1,297 @@
+#ifndef _GEARS_SPRITE_BATCH_HPP_
+#define _GEARS_SPRITE_BATCH_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+// frames of vertex data the CPU may write ahead of the GPU.
+#define GR_SPRITE_FRAMES 3
+
+// empty texels left around every glyph, so filtering never bleeds.
+#define GR_GLYPH_PADDING 1
+
+// atlas pages a GlyphCache packs glyphs into before it evicts the oldest.
+#define GR_GLYPH_PAGES 4
+
+//===========
+//one glyph as a font rasterizes it: 8-bit coverage, rows top to bottom.
+//bearings go from the pen position on the baseline to the bitmap's top
+//left corner, with y up.
+//===========
+typedef struct {
+    GLsizei width, height;
+    GLint   bearing_x, bearing_y;
+    GLfloat advance;
+
+    const unsigned char *pixels;
+    GLsizei pitch; // bytes per row
+} GlyphBitmap;
+
+//===========
+//fills bitmap for codepoint at pixel_size; the pixels only have to stay
+//valid until the call returns. false when the font has no such glyph.
+//wraps whatever does the actual rasterizing (stb_truetype, FreeType,
+//SDL_ttf, a baked bitmap font).
+//===========
+typedef bool (*GlyphRasterizer)( GLuint codepoint, GLuint pixel_size, GlyphBitmap *bitmap, void *userdata );
+
+typedef struct {
+    GLuint  texture;        // the atlas page it's on
+    GLfloat u0, v0, u1, v1; // in that page
+    GLsizei width, height;
+    GLint   bearing_x, bearing_y;
+    GLfloat advance;
+} Glyph;
+
+namespace GearsEngine {
+    //===========
+    //rectangle packer that only tracks the top edge of what's been
+    //placed (the skyline). each rectangle goes where its top ends up
+    //lowest, preferring the narrower gap on ties. can't free single
+    //rectangles; clear() starts over.
+    //===========
+    class SkylineAtlas
+    {
+        private:
+            typedef struct {
+                GLint x, y;
+                GLint width;
+            } SkylineNode;
+
+            GLint width, height;
+            std::vector<SkylineNode> skyline;
+            GLuint64 used_area;
+
+            GLint fitAt( GLuint node, GLint rectangle_width, GLint rectangle_height );
+
+        public:
+            SkylineAtlas( GLint atlas_width, GLint atlas_height );
+
+            //===========
+            //false when there's no room left for it.
+            //===========
+            bool insert( GLint rectangle_width, GLint rectangle_height, GLint &x, GLint &y );
+            void clear();
+
+            //===========
+            //fraction of the area covered by rectangles.
+            //===========
+            GLfloat getOccupancy();
+    };
+
+    //===========
+    //glyphs rasterized on first use and packed into a single-channel
+    //atlas texture, shared by every font and size. the texture swizzles
+    //red into alpha, so glyphs draw as white shapes tinted by the quad
+    //color. GL thread only.
+    //
+    //when the atlas fills, new glyphs go to another page, up to
+    //GR_GLYPH_PAGES, and every glyph stays cached across frames. only
+    //once the last page is full too does the cache refuse new glyphs;
+    //after whatever uses them has been drawn, evict() frees the oldest
+    //page for packing. SpriteBatch does that itself after a flush.
+    //===========
+    class GlyphCache
+    {
+        private:
+            typedef struct {
+                GlyphRasterizer rasterizer;
+                void           *userdata;
+            } Font;
+
+            std::vector<GLuint> pages; // textures, allocated as they're first needed
+            GLuint  page;              // the one being packed
+            GLuint  used_pages;        // holding glyphs, filled in ring order
+            bool    is_full;
+            GLsizei size;
+            SkylineAtlas packer;
+
+            GLuint createPage();
+
+            std::vector<Font>        fonts;
+            std::map<GLuint64, Glyph> glyphs; // font, pixel size, codepoint
+            std::vector<unsigned char> scratch;
+
+        public:
+            GlyphCache( GLsizei atlas_size = 1024 );
+            ~GlyphCache();
+
+            //===========
+            //allocate the first atlas page. needs a current context.
+            //===========
+            bool initialize();
+
+            GLuint addFont( GlyphRasterizer rasterizer, void *userdata );
+
+            //===========
+            //the glyph, rasterizing and packing it if it's new. glyphs a
+            //font lacks come back empty, with no advance. NULL when every
+            //page is full: evict() a page, after drawing whatever still
+            //uses it, and ask again.
+            //===========
+            const Glyph *getGlyph( GLuint font, GLuint pixel_size, GLuint codepoint );
+
+            //===========
+            //width of the longest line of text, in pixels. NULL glyphs
+            //count as empty.
+            //===========
+            GLfloat measureText( GLuint font, GLuint pixel_size, const std::string &text );
+
+            //===========
+            //forget every glyph and pack from the first page again; the
+            //pages stay allocated for reuse.
+            //===========
+            void reset();
+
+            //===========
+            //drop the glyphs on the oldest page and pack new ones there.
+            //does nothing unless the cache is full.
+            //===========
+            void evict();
+
+            //===========
+            //true once a glyph didn't fit any page: time for an evict()
+            //after the next draw.
+            //===========
+            bool isFull();
+
+            GLuint  getTexture( GLuint page = 0 );
+            GLuint  getPageCount();
+            GLuint  getGlyphCount();
+
+            //===========
+            //of the page being packed.
+            //===========
+            GLfloat getOccupancy();
+    };
+
+    //===========
+    //2D quads (sprites, solid rectangles, glyphs) in pixel coordinates,
+    //origin top left. draws are only queued; flush() sorts them by
+    //layer, then texture, writes them to a streamed vertex buffer and
+    //issues one draw per run of quads sharing a texture. layers are
+    //painted in ascending order; within a layer, quads on the same
+    //texture keep their order, but quads on different textures may be
+    //reordered, so don't overlap those in one layer.
+    //
+    //the vertex buffer holds GR_SPRITE_FRAMES segments of max_quads
+    //each, fenced like the uniform ring. more quads than a segment holds
+    //take several segments. GL thread only.
+    //===========
+    class SpriteBatch
+    {
+        private:
+            typedef struct {
+                GLfloat x0, y0, x1, y1;
+                GLfloat u0, v0, u1, v1;
+                GLuint  color;
+                GLuint  texture;
+            } SpriteQuad;
+
+            typedef struct {
+                GLuint64 key; // biased layer, then texture
+                GLuint   quad;
+            } SortKey;
+
+            struct SortOrder {
+                bool operator()( const SortKey &a, const SortKey &b ) const
+                {
+                    return a.key < b.key || (a.key == b.key && a.quad < b.quad);
+                }
+            };
+
+            std::vector<SpriteQuad>  quads;
+            std::vector<SortKey>     keys;
+            std::vector<GlyphCache*> filled; // evicted from after the next flush()
+
+            glm::mat4 projection;
+
+            GLuint max_quads;
+            GLuint program;
+            GLint  projection_location;
+            GLuint vao;
+            GLuint vertex_buffer;
+            GLuint index_buffer;
+            GLuint white_texture;
+
+            GLsizeiptr segment_size;
+            GLubyte   *mapped; // persistent mapping, NULL when each flush maps its own
+            GLuint     segment;
+            GLsync     fences[GR_SPRITE_FRAMES];
+            bool       is_initialized;
+
+            GLuint draw_count; // since begin()
+            GLuint quad_count;
+
+            void   queue( GLuint texture, GLint layer, const SpriteQuad &quad );
+            GLuint drawRange( GLuint first, GLuint count );
+            void   dropQueued();
+
+        public:
+            SpriteBatch();
+            ~SpriteBatch();
+
+            //===========
+            //build the program and buffers for up to max_quads per
+            //segment. needs a current context.
+            //===========
+            bool initialize( GLuint max_quads = 16384 );
+
+            //===========
+            //start a frame on a target of width by height pixels. drops
+            //anything still queued.
+            //===========
+            void begin( GLsizei width, GLsizei height );
+
+            //===========
+            //rect is x, y, width, height in pixels; uv is u0, v0, u1, v1.
+            //colors are RGBA8 packed little endian, red in the low byte,
+            //and multiply the texture.
+            //===========
+            void drawSprite( GLuint texture, const glm::vec4 &rect, const glm::vec4 &uv, GLuint color, GLint layer );
+            void drawRect( const glm::vec4 &rect, GLuint color, GLint layer );
+
+            //===========
+            //queue text with its first baseline at pen; '\n' starts a new
+            //line. returns the width of the longest line. glyphs that
+            //don't fit any page of the cache are left out; the flush that
+            //draws the rest then evicts the cache's oldest page, so it has
+            //to outlive that flush.
+            //===========
+            GLfloat drawText(
+                    GlyphCache *glyphs,
+                    GLuint font,
+                    GLuint pixel_size,
+                    const std::string &text,
+                    const glm::vec2 &pen,
+                    GLuint color,
+                    GLint layer
+            );
+
+            //===========
+            //draw everything queued; returns the draw calls it took. the
+            //depth test is off while it draws; the caller's depth and
+            //blend state is restored after. use Renderer::drawSprites()
+            //rather than calling this directly.
+            //===========
+            GLuint flush();
+
+            GLuint getQueuedCount();
+
+            //===========
+            //draw calls and quads since begin().
+            //===========
+            GLuint getDrawCount();
+            GLuint getQuadCount();
+
+            //===========
+            //bytes of vertex data per quad streamed by flush().
+            //===========
+            static GLsizeiptr getQuadSize();
+    };
+}
+
+#endif // _GEARS_SPRITE_BATCH_HPP_
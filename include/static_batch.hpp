@@ -0,0 +1,137 @@
+#ifndef _GEARS_STATIC_BATCH_HPP_
+#define _GEARS_STATIC_BATCH_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include "bounds.hpp"
+#include "frame_packet.hpp"
+#include "renderer.hpp"
+
+// the attribute baking treats as the vertex position: 3 or 4 GL_FLOATs.
+#define GR_BAKE_POSITION_ATTRIBUTE 0
+
+//===========
+//a mesh that never moves. vertices are interleaved as the VAP module
+//describes them, and only have to stay valid until bake().
+//===========
+typedef struct {
+    const GLvoid *vertices;
+    GLuint        vertex_count;
+    const GLuint *indices;
+    GLuint        index_count;
+
+    glm::mat4 model;
+
+    GLuint  program;
+    int     vap;
+
+    // as in DrawItem; chunks are already in world space, so the model
+    // matrix, if the program has one, is sent as identity.
+    GLint   model_location;
+    GLint   view_location;
+    GLint   projection_location;
+} StaticMesh;
+
+typedef struct {
+    GLuint        program;
+    int           vap;
+    VertexBuffer  vbo;
+    ElementBuffer ebo;
+    GLsizei       element_count;
+
+    AABB   bounds; // world space
+    GLuint mesh_count;
+
+    GLint  model_location;
+    GLint  view_location;
+    GLint  projection_location;
+} StaticChunk;
+
+namespace GearsEngine {
+    //===========
+    //merges static meshes into a few large world-space buffers. meshes
+    //are grouped by program and vertex layout, have their positions (and
+    //normals, see setNormalAttribute()) transformed by their model matrix,
+    //are ordered along a Morton curve through the group's bounds and then
+    //cut into chunks of limited vertex count and extent, so every chunk
+    //is one draw over a compact piece of the world with bounds for
+    //culling.
+    //===========
+    class StaticBatcher
+    {
+        private:
+            typedef struct {
+                GLuint mesh;
+                AABB   bounds;
+                std::vector<unsigned char> vertices; // world space
+            } BakedMesh;
+
+            std::vector<StaticMesh>  meshes;
+            std::vector<StaticChunk> chunks;
+
+            GLuint  max_chunk_vertices;
+            GLfloat max_chunk_extent;
+            GLint   normal_attribute;
+
+            GLuint baked_mesh_count;
+
+            bool bakeMesh( const StaticMesh &mesh, const VAPMap &layout, GLsizei stride, BakedMesh &baked );
+            void bakeGroup( Renderer *renderer, const std::string &prefix, const std::vector<GLuint> &group );
+            void uploadChunk(
+                    Renderer *renderer,
+                    const std::string &prefix,
+                    const std::vector<BakedMesh> &baked,
+                    const std::vector<GLuint> &order,
+                    GLuint begin, GLuint end,
+                    GLsizei stride
+            );
+
+        public:
+            //===========
+            //a chunk closes when the next mesh would take it past
+            //max_vertices, or stretch its bounds past max_extent on any
+            //axis (0 for no limit).
+            //===========
+            StaticBatcher( GLuint max_vertices = 65536, GLfloat max_extent = 32.0f );
+
+            //===========
+            //the attribute holding normals, transformed by the inverse
+            //transpose of the model matrix and renormalized. -1, the
+            //default, leaves every attribute but the position alone.
+            //===========
+            void setNormalAttribute( GLint index );
+
+            //===========
+            //queue a mesh for the next bake(); returns its index.
+            //===========
+            GLuint add( const StaticMesh &mesh );
+
+            //===========
+            //bake everything queued and upload it through the renderer,
+            //as buffers named prefix_VBO_n and prefix_EBO_n. meshes with
+            //a layout that isn't interleaved, or without a float position,
+            //are left out and make it return false. the queue is empty
+            //afterwards; chunks from earlier bakes are kept.
+            //===========
+            bool bake( Renderer *renderer, const std::string &prefix );
+
+            //===========
+            //add a draw for every chunk the frustum doesn't reject.
+            //returns how many were added.
+            //===========
+            GLuint submit( FramePacket *packet, const Frustum &frustum );
+
+            //===========
+            //destroy every chunk's buffers.
+            //===========
+            void clear( Renderer *renderer );
+
+            const std::vector<StaticChunk> &getChunks();
+            GLuint getChunkCount();
+            GLuint getBakedMeshCount();
+    };
+}
+
+#endif // _GEARS_STATIC_BATCH_HPP_
@@ -0,0 +1,162 @@
+#ifndef _GEARS_TRANSFORM_HPP_
+#define _GEARS_TRANSFORM_HPP_
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#define GR_NULL_TRANSFORM (-1)
+
+//===========
+//std140 layout, so a camera's matrices upload as one block.
+//===========
+typedef struct {
+    glm::mat4 view;
+    glm::mat4 projection;
+} CameraMatrices;
+
+namespace GearsEngine {
+    //===========
+    //parent/child transforms kept in flat arrays sorted by depth, so every
+    //parent comes before its children. setters only flag the node; the
+    //world matrices are brought up to date by update(), one linear pass
+    //that recomputes the flagged nodes and everything below them and
+    //leaves the rest alone.
+    //
+    //nodes are referred to by handle. handles are reused after destroy(),
+    //like AABBTree proxies.
+    //===========
+    class TransformHierarchy
+    {
+        private:
+            // handle -> slot, GR_NULL_TRANSFORM while free
+            std::vector<GLint> slots;
+            std::vector<GLint> free_handles;
+
+            // per slot, in depth order
+            std::vector<GLint>         handles;
+            std::vector<GLint>         parents; // slot of the parent
+            std::vector<GLuint>        depths;
+            std::vector<glm::vec3>     positions;
+            std::vector<glm::vec3>     rotations;
+            std::vector<glm::vec3>     scales;
+            std::vector<glm::mat4>     locals;
+            std::vector<glm::mat4>     worlds;
+            std::vector<unsigned char> flags;
+
+            bool   is_dirty;      // something was flagged since the last update()
+            bool   needs_sort;    // nodes were added, removed or moved
+            GLuint changed_count; // worlds the last update() recomputed
+
+            void markLocal( GLint handle );
+            void sortSlots();
+
+        public:
+            TransformHierarchy();
+
+            void clear();
+
+            //===========
+            //new node with an identity local transform; parent may be
+            //GR_NULL_TRANSFORM for a root.
+            //===========
+            GLint create( GLint parent = GR_NULL_TRANSFORM );
+
+            //===========
+            //destroys the node and everything below it.
+            //===========
+            void destroy( GLint handle );
+
+            //===========
+            //false, and nothing changes, when parent is the node itself or
+            //one of its descendants.
+            //===========
+            bool  setParent( GLint handle, GLint parent );
+            GLint getParent( GLint handle );
+
+            //===========
+            //local transform: translate * rotate (y, then x, then z, in
+            //radians) * scale.
+            //===========
+            void setPosition( GLint handle, const glm::vec3 &position );
+            void setRotation( GLint handle, const glm::vec3 &rotation );
+            void setScale( GLint handle, const glm::vec3 &scale );
+
+            const glm::vec3 &getPosition( GLint handle );
+            const glm::vec3 &getRotation( GLint handle );
+            const glm::vec3 &getScale( GLint handle );
+
+            //===========
+            //bring every flagged world matrix, and its descendants', up to
+            //date. returns how many were recomputed.
+            //===========
+            GLuint update();
+
+            //===========
+            //valid as of the last update().
+            //===========
+            const glm::mat4 &getWorldMatrix( GLint handle );
+            const glm::mat4 &getLocalMatrix( GLint handle );
+
+            //===========
+            //true when the last update() recomputed the node's world
+            //matrix, i.e. it needs uploading again.
+            //===========
+            bool hasChanged( GLint handle );
+
+            //===========
+            //all world matrices, contiguous in slot order, for uploading in
+            //one go; getSlot() says where a node is. slots are only stable
+            //between structural changes.
+            //===========
+            const glm::mat4 *getWorldMatrices();
+            GLint            getSlot( GLint handle );
+
+            GLuint getCount();
+            GLuint getChangedCount();
+    };
+
+    //===========
+    //view and projection, recomputed only when their inputs change. the
+    //revision goes up whenever either does, so a caller holding on to an
+    //uploaded copy can tell when it's stale.
+    //===========
+    class Camera
+    {
+        private:
+            glm::vec3 position;
+            glm::vec3 rotation; // pitch around x, then yaw around y, in radians
+
+            GLfloat fovy, aspect, near_plane, far_plane;
+
+            CameraMatrices matrices;
+            glm::mat4      view_projection;
+
+            bool   is_view_dirty;
+            bool   is_projection_dirty;
+            GLuint revision;
+
+            void refresh();
+
+        public:
+            Camera();
+
+            void setPosition( const glm::vec3 &position );
+            void setRotation( const glm::vec3 &rotation );
+            void setPerspective( GLfloat fovy, GLfloat aspect, GLfloat near_plane, GLfloat far_plane );
+            void setAspect( GLfloat aspect );
+
+            const glm::mat4 &getView();
+            const glm::mat4 &getProjection();
+            const glm::mat4 &getViewProjection();
+
+            //===========
+            //view and projection as one std140 block.
+            //===========
+            const CameraMatrices &getMatrices();
+
+            GLuint getRevision();
+    };
+}
+
+#endif // _GEARS_TRANSFORM_HPP_
@@ -0,0 +1,83 @@
+#ifndef _GEARS_UNIFORM_BUFFER_HPP_
+#define _GEARS_UNIFORM_BUFFER_HPP_
+
+#include <GL/glew.h>
+#include <vector>
+
+// frames the CPU may write ahead of the GPU.
+#define GR_UNIFORM_FRAMES 3
+
+// binding points the renderer uses for its two blocks.
+#define GR_FRAME_UNIFORM_BINDING 0
+#define GR_DRAW_UNIFORM_BINDING  1
+
+namespace GearsEngine {
+    //===========
+    //one large uniform buffer split into a segment per frame in flight.
+    //push() copies a block into the current frame's segment at the next
+    //aligned offset, and bindRange() points a binding at it, so per-draw
+    //data costs a copy and a range bind instead of a string of uniform
+    //calls. a segment is only written again once the fence from its
+    //last use has signalled. GL thread only.
+    //===========
+    class UniformRing
+    {
+        private:
+            typedef struct {
+                GLintptr   offset;
+                GLsizeiptr size;
+            } BoundRange;
+
+            GLuint     buffer;
+            GLsizeiptr segment_size;
+            GLint      alignment;
+
+            GLubyte *mapped; // persistent mapping, NULL when writes go through glBufferSubData
+
+            GLuint   segment;
+            GLintptr head;
+            GLsync   fences[GR_UNIFORM_FRAMES];
+
+            std::vector<BoundRange> bound;
+
+        public:
+            UniformRing();
+            ~UniformRing();
+
+            //===========
+            //allocate the buffer; segment_bytes is the most a single frame
+            //can push. needs a current context.
+            //===========
+            void initialize( GLsizeiptr segment_bytes );
+
+            //===========
+            //give the buffer back and drop the fences, ahead of the
+            //destructor; for owners that purge the name pools on the way
+            //out.
+            //===========
+            void release();
+
+            //===========
+            //copy a block in and return its offset in the buffer, or -1
+            //when this frame's segment is full.
+            //===========
+            GLintptr push( const GLvoid *data, GLsizeiptr size );
+
+            //===========
+            //glBindBufferRange, skipped when the binding already points
+            //there.
+            //===========
+            void bindRange( GLuint binding, GLintptr offset, GLsizeiptr size );
+
+            //===========
+            //fence this frame's segment and move on to the next one,
+            //waiting if the GPU is still reading it.
+            //===========
+            void endFrame();
+
+            GLint      getAlignment();
+            GLsizeiptr getUsedBytes();
+    };
+}
+
+#endif // _GEARS_UNIFORM_BUFFER_HPP_
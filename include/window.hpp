@@ -1,8 +1,15 @@
 #ifndef _GEARS_WINDOW_HPP_
 #define _GEARS_WINDOW_HPP_
 
+#include <GL/glew.h>
 #include <SDL2/SDL.h>
+#include <atomic>
+#include <deque>
 #include <map>
+#include <mutex>
+#include <string>
+#include "allocator.hpp"
+#include "input_trace.hpp"
 
 typedef enum {
     KEY_DOWN,
@@ -21,8 +28,34 @@ typedef std::map<KeyMode, Data>   KMDMap;
 typedef std::map<SDL_Keycode, KMAMap> KeyActionMap;
 typedef std::map<SDL_Keycode, KMDMap> KeyDataMap;
 
+// key presses shouldn't hit the general heap mid-frame.
+typedef std::map<SDL_Keycode, Uint8, std::less<SDL_Keycode>,
+                 PoolStlAllocator< std::pair<const SDL_Keycode, Uint8> > > KeyStateMap;
+
 typedef unsigned int Uint;
 
+typedef enum {
+    GR_PRESENT_UNCAPPED = 0,  // swap interval 0: no waiting, may tear
+    GR_PRESENT_VSYNC,         // swap interval 1
+    GR_PRESENT_ADAPTIVE_VSYNC // swap interval -1: tears only when a frame is late
+} PresentMode;
+
+//===========
+//time from the pollEvents() that sampled a frame's input to the GPU
+//finishing that frame, in milliseconds: input age, CPU frame time and
+//GPU time together. measured through the latency limiter's fences, so
+//all zero while it's off. a fence is only checked at a swap, so a frame
+//that finished on its own counts as finishing at the next swap: an
+//upper bound, high by up to one frame. frames the limiter has to wait
+//for are timed as they finish.
+//===========
+typedef struct {
+    double last;
+    double average; // moving average over roughly the last 16 frames
+    double peak;    // since the first frame or resetPresentLatency()
+    GLuint frames_in_flight;
+} PresentLatency;
+
 namespace GearsEngine {
     class Window {
         private:
@@ -32,11 +65,22 @@ namespace GearsEngine {
             KeyActionMap key_actions;
             KeyDataMap   key_usrdata;
 
-            std::map<SDL_Keycode, Uint8> key_states;
+            KeyStateMap key_states;
+
+            InputRecorder input_recorder;
+            InputPlayer   input_player;
+            Uint64        last_dispatch;
+            double        frame_delta;
+
+            void dispatchEvent( const SDL_Event &event );
 
         public:
-            SDL_Window *getWindowHandle();
-            SDL_Event  *getWindowEvent();
+            Window();
+            virtual ~Window();
+
+            SDL_Window   *getWindowHandle();
+            SDL_Event    *getWindowEvent();
+            SDL_GLContext getGLContext();
 
             void setKeyState( SDL_KeyboardEvent event );
             bool isPressed( SDL_Keycode code );
@@ -79,7 +123,7 @@ namespace GearsEngine {
             //===========
             //create the window
             //===========
-            void create();
+            virtual void create();
 
             //===========
             //closes the window
@@ -91,6 +135,43 @@ namespace GearsEngine {
             void invokeAction( SDL_Event event );
             void invokeKeyboardAction( SDL_Keycode trigger, KeyMode mode );
 
+            //===========
+            //one frame's worth of events to the actions: the SDL queue,
+            //or the input trace being replayed instead. also takes the
+            //frame time; see getFrameDelta().
+            //===========
+            void dispatchEvents();
+
+            //===========
+            //write every event dispatchEvents() hands out to an input
+            //trace. setting GEARS_INPUT_RECORD to a path starts one from
+            //create().
+            //===========
+            bool startRecording( const std::string &path );
+            void stopRecording();
+            bool isRecording();
+
+            //===========
+            //dispatch a recorded trace instead of the live queue, which
+            //is drained with only SDL_QUIT let through. in real time mode
+            //events come back as far apart as they happened; in fixed
+            //step mode every frame counts as step seconds, however long
+            //it really took, so a run goes as fast as it can and comes
+            //out the same every time. the window closes when the trace
+            //runs out. GEARS_INPUT_REPLAY=path starts one from create(),
+            //in fixed step mode when GEARS_INPUT_STEP gives the seconds.
+            //===========
+            bool startReplay( const std::string &path, ReplayMode mode, double step = 1.0 / 60.0 );
+            void stopReplay();
+            bool isReplaying();
+
+            //===========
+            //seconds between the last two dispatchEvents(), or the
+            //step during a fixed step replay. simulations that advance
+            //by this replay the same way they were recorded.
+            //===========
+            double getFrameDelta();
+
             //===========
             //update the window's current state
             //===========
@@ -98,8 +179,9 @@ namespace GearsEngine {
 
 
         private:
-            SDL_Window *window;
-            SDL_Event   event;
+            SDL_Window   *window;
+            SDL_Event     event;
+            SDL_GLContext gl_context;
 
             const char *title; // the window's current title.
             int width, height;
@@ -122,10 +204,71 @@ namespace GearsEngine {
     class RenderWindow : public Window {
         public:
             RenderWindow();
+            ~RenderWindow();
+            void create();
             void update();
 
+            //===========
+            //the two halves of update(). events have to be pumped on the
+            //thread that created the window; with a render thread the
+            //swap happens there instead.
+            //
+            //swapBuffers() takes the frame to be built from the input of
+            //the last pollEvents(); when that isn't so, pass the
+            //getInputTime() the frame was started with. update() passes
+            //the poll before its own, since that is what the frame it
+            //swaps was built from.
+            //===========
+            void   pollEvents();
+            void   swapBuffers();
+            void   swapBuffers( Uint64 input_time );
+            Uint64 getInputTime();
+
+            //===========
+            //uncapped by default. can be changed at any time; the mode is
+            //applied on the thread that swaps, before its next swap. a
+            //driver without adaptive vsync gets plain vsync instead.
+            //===========
+            void        setPresentMode( PresentMode mode );
+            PresentMode getPresentMode();
+
+            //===========
+            //latency limiter: after each swap a fence goes in, and the
+            //swap waits until no more than frames are still unfinished
+            //on the GPU, so the driver can't queue frames ahead. 0, the
+            //default, turns it off. needs GL sync objects, i.e. a
+            //Renderer on the context.
+            //===========
+            void   setMaxFramesInFlight( GLuint frames );
+            GLuint getMaxFramesInFlight();
+
+            PresentLatency getPresentLatency();
+
+            //===========
+            //start the average and the peak over from the next frame.
+            //===========
+            void resetPresentLatency();
+
         private:
-            SDL_GLContext *context;
+            typedef struct {
+                GLsync fence;
+                Uint64 started; // performance counter when the frame's input was sampled
+            } FrameFence;
+
+            std::atomic<int>  requested_mode;
+            PresentMode       present_mode;
+            bool              is_mode_pending;
+
+            std::atomic<GLuint> max_frames_in_flight;
+            std::deque<FrameFence> frame_fences;
+
+            std::atomic<Uint64> input_sampled;
+            std::mutex          latency_mutex;
+            PresentLatency      latency;
+            bool                has_latency_sample;
+
+            void applyPresentMode();
+            void retireFence( bool is_finished );
     };
 }
 
@@ -0,0 +1,281 @@
+#include "allocator.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace GearsEngine;
+
+static size_t
+alignUp( size_t value, size_t alignment )
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+FrameArena::FrameArena( size_t bytes )
+{
+    capacity = bytes;
+    memory = static_cast<unsigned char*>(std::malloc( capacity ));
+    head = 0;
+
+    overflow_bytes = 0;
+    overflow_count = 0;
+}
+
+FrameArena::~FrameArena()
+{
+    reset();
+    std::free( memory );
+}
+
+void *
+FrameArena::allocate( size_t size, size_t alignment )
+{
+    uintptr_t base = reinterpret_cast<uintptr_t>(memory);
+    size_t offset = alignUp( base + head, alignment ) - base;
+
+    if (memory != NULL && offset + size <= capacity) {
+        head = offset + size;
+        return memory + offset;
+    }
+
+    void *block = std::malloc( size + alignment );
+    overflow.push_back( block );
+    overflow_bytes += size + alignment;
+    ++overflow_count;
+
+    uintptr_t address = reinterpret_cast<uintptr_t>(block);
+    return reinterpret_cast<void*>(alignUp( address, alignment ));
+}
+
+void
+FrameArena::reset()
+{
+    for (size_t o = 0; o < overflow.size(); ++o)
+        std::free( overflow[o] );
+    overflow.clear();
+
+    // make room for everything this frame used, so the next one fits.
+    if (overflow_bytes > 0) {
+        capacity = alignUp( capacity + overflow_bytes, 4096 );
+        std::free( memory );
+        memory = static_cast<unsigned char*>(std::malloc( capacity ));
+        overflow_bytes = 0;
+    }
+
+    head = 0;
+}
+
+size_t
+FrameArena::getUsedBytes() { return head + overflow_bytes; }
+
+size_t
+FrameArena::getCapacity() { return capacity; }
+
+size_t
+FrameArena::getOverflowCount() { return overflow_count; }
+
+PoolAllocator::PoolAllocator( size_t size, size_t per_page )
+{
+    // every free block holds the free-list link, and every block has to
+    // suit any type that fits it.
+    block_size = alignUp( size < sizeof(void*) ? sizeof(void*) : size, alignof(std::max_align_t) );
+    blocks_per_page = (per_page > 0) ? per_page : 1;
+
+    free_list = NULL;
+    live_count = 0;
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    for (size_t p = 0; p < pages.size(); ++p)
+        std::free( pages[p] );
+}
+
+void *
+PoolAllocator::allocate()
+{
+    if (free_list == NULL) {
+        unsigned char *page = static_cast<unsigned char*>(std::malloc( block_size * blocks_per_page ));
+        pages.push_back( page );
+
+        // thread the new page onto the free list back to front, so blocks
+        // come out in address order.
+        for (size_t b = blocks_per_page; b-- > 0; ) {
+            void *block = page + b * block_size;
+            *static_cast<void**>(block) = free_list;
+            free_list = block;
+        }
+    }
+
+    void *block = free_list;
+    free_list = *static_cast<void**>(block);
+    ++live_count;
+
+    return block;
+}
+
+void
+PoolAllocator::release( void *block )
+{
+    if (block == NULL)
+        return;
+
+    *static_cast<void**>(block) = free_list;
+    free_list = block;
+    --live_count;
+}
+
+size_t
+PoolAllocator::getBlockSize() { return block_size; }
+
+size_t
+PoolAllocator::getLiveCount() { return live_count; }
+
+size_t
+PoolAllocator::getPageCount() { return pages.size(); }
+
+typedef struct {
+    unsigned long long serial;
+    void  *head;
+    size_t count;
+} ThreadCache;
+
+static std::atomic<unsigned long long> next_pool_serial( 1 );
+
+// a thread's cache for one pool, created on first use. entries of pools
+// that are gone just sit there: their serial never comes back.
+static ThreadCache &
+threadCache( unsigned long long serial )
+{
+    static thread_local std::vector<ThreadCache> caches;
+
+    for (size_t c = 0; c < caches.size(); ++c)
+        if (caches[c].serial == serial)
+            return caches[c];
+
+    ThreadCache cache = { serial, NULL, 0 };
+    caches.push_back( cache );
+
+    return caches.back();
+}
+
+SharedPool::SharedPool( size_t block_size, size_t blocks_per_page )
+    : pool( block_size, blocks_per_page )
+{
+    serial = next_pool_serial++;
+}
+
+void *
+SharedPool::allocate()
+{
+    ThreadCache &cache = threadCache( serial );
+
+    if (cache.head == NULL) {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        for (int b = 0; b < GR_THREAD_CACHE_BATCH; ++b) {
+            void *block = pool.allocate();
+            *static_cast<void**>(block) = cache.head;
+            cache.head = block;
+        }
+        cache.count = GR_THREAD_CACHE_BATCH;
+    }
+
+    void *block = cache.head;
+    cache.head = *static_cast<void**>(block);
+    --cache.count;
+
+    return block;
+}
+
+void
+SharedPool::release( void *block )
+{
+    if (block == NULL)
+        return;
+
+    ThreadCache &cache = threadCache( serial );
+
+    *static_cast<void**>(block) = cache.head;
+    cache.head = block;
+    ++cache.count;
+
+    if (cache.count <= GR_THREAD_CACHE_LIMIT)
+        return;
+
+    std::lock_guard<std::mutex> lock( mutex );
+
+    while (cache.count > GR_THREAD_CACHE_LIMIT / 2) {
+        void *spill = cache.head;
+        cache.head = *static_cast<void**>(spill);
+        --cache.count;
+
+        pool.release( spill );
+    }
+}
+
+size_t
+SharedPool::getBlockSize() { return pool.getBlockSize(); }
+
+#ifdef GEARS_TRACK_ALLOCATIONS
+
+static std::atomic<unsigned long long> heap_allocations( 0 );
+static std::atomic<unsigned long long> heap_frees( 0 );
+static std::atomic<unsigned long long> heap_bytes( 0 );
+
+// replacing these in the engine library replaces them for the whole
+// program, as long as anything from this file is linked in.
+void *
+operator new( size_t size )
+{
+    ++heap_allocations;
+    heap_bytes += size;
+
+    void *block = std::malloc( size ? size : 1 );
+    if (block == NULL)
+        throw std::bad_alloc();
+
+    return block;
+}
+
+void
+operator delete( void *block ) noexcept
+{
+    if (block != NULL)
+        ++heap_frees;
+    std::free( block );
+}
+
+void
+operator delete( void *block, size_t ) noexcept
+{
+    operator delete( block );
+}
+
+AllocationStats
+GearsEngine::getAllocationStats()
+{
+    AllocationStats stats;
+    stats.allocations = heap_allocations;
+    stats.frees = heap_frees;
+    stats.bytes = heap_bytes;
+
+    return stats;
+}
+
+bool
+GearsEngine::isTrackingAllocations() { return true; }
+
+#else
+
+AllocationStats
+GearsEngine::getAllocationStats()
+{
+    AllocationStats stats = { 0, 0, 0 };
+    return stats;
+}
+
+bool
+GearsEngine::isTrackingAllocations() { return false; }
+
+#endif // GEARS_TRACK_ALLOCATIONS
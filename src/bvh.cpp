@@ -0,0 +1,560 @@
+#include "bvh.hpp"
+#include <cassert>
+
+using namespace GearsEngine;
+
+// centroids are sorted into this many buckets per SAH split.
+static const GLuint SAH_BINS = 12;
+
+AABBTree::AABBTree( GLfloat fat_margin, GLfloat displacement_factor )
+{
+    margin = fat_margin;
+    displacement_scale = displacement_factor;
+
+    clear();
+}
+
+void
+AABBTree::clear()
+{
+    nodes.clear();
+    root = GR_NULL_PROXY;
+    free_list = GR_NULL_PROXY;
+    leaf_count = 0;
+}
+
+GLint
+AABBTree::allocateNode()
+{
+    GLint node;
+
+    if (free_list != GR_NULL_PROXY) {
+        node = free_list;
+        free_list = nodes[node].parent;
+    } else {
+        node = nodes.size();
+        nodes.push_back( TreeNode() );
+    }
+
+    nodes[node].parent = GR_NULL_PROXY;
+    nodes[node].child1 = GR_NULL_PROXY;
+    nodes[node].child2 = GR_NULL_PROXY;
+    nodes[node].height = 0;
+    nodes[node].object = 0;
+
+    return node;
+}
+
+void
+AABBTree::freeNode( GLint node )
+{
+    nodes[node].parent = free_list;
+    nodes[node].height = -1;
+    free_list = node;
+}
+
+GLint
+AABBTree::insert( const AABB &bounds, GLuint object )
+{
+    GLint leaf = allocateNode();
+
+    nodes[leaf].bounds.min = bounds.min - glm::vec3( margin );
+    nodes[leaf].bounds.max = bounds.max + glm::vec3( margin );
+    nodes[leaf].tight = bounds;
+    nodes[leaf].object = object;
+
+    insertLeaf( leaf );
+    ++leaf_count;
+
+    return leaf;
+}
+
+void
+AABBTree::remove( GLint proxy )
+{
+    assert( proxy >= 0 && proxy < (GLint)nodes.size() && nodes[proxy].height == 0 );
+
+    removeLeaf( proxy );
+    freeNode( proxy );
+    --leaf_count;
+}
+
+bool
+AABBTree::move( GLint proxy, const AABB &bounds, glm::vec3 displacement )
+{
+    assert( proxy >= 0 && proxy < (GLint)nodes.size() && nodes[proxy].height == 0 );
+
+    nodes[proxy].tight = bounds;
+
+    if (contains(nodes[proxy].bounds, bounds))
+        return false;
+
+    removeLeaf( proxy );
+
+    // stretch the fat box along the direction of travel so the next few
+    // moves land inside it too.
+    AABB fat;
+    fat.min = bounds.min - glm::vec3( margin );
+    fat.max = bounds.max + glm::vec3( margin );
+
+    glm::vec3 d = displacement * displacement_scale;
+    for (int i = 0; i < 3; ++i) {
+        if (d[i] < 0.0f) fat.min[i] += d[i];
+        else             fat.max[i] += d[i];
+    }
+
+    nodes[proxy].bounds = fat;
+    insertLeaf( proxy );
+
+    return true;
+}
+
+void
+AABBTree::insertLeaf( GLint leaf )
+{
+    if (root == GR_NULL_PROXY) {
+        root = leaf;
+        nodes[root].parent = GR_NULL_PROXY;
+        return;
+    }
+
+    // walk down towards the sibling with the cheapest surface area growth.
+    AABB leaf_bounds = nodes[leaf].bounds;
+    GLint index = root;
+
+    while (nodes[index].height > 0) {
+        GLint child1 = nodes[index].child1;
+        GLint child2 = nodes[index].child2;
+
+        GLfloat area = surfaceArea( nodes[index].bounds );
+        GLfloat combined_area = surfaceArea( mergeBounds(nodes[index].bounds, leaf_bounds) );
+
+        // cost of pairing the leaf with this node right here.
+        GLfloat cost = 2.0f * combined_area;
+        // cost that every deeper choice pays for growing this node.
+        GLfloat inheritance = 2.0f * (combined_area - area);
+
+        GLfloat cost1 = surfaceArea( mergeBounds(leaf_bounds, nodes[child1].bounds) ) + inheritance;
+        if (nodes[child1].height > 0)
+            cost1 -= surfaceArea( nodes[child1].bounds );
+
+        GLfloat cost2 = surfaceArea( mergeBounds(leaf_bounds, nodes[child2].bounds) ) + inheritance;
+        if (nodes[child2].height > 0)
+            cost2 -= surfaceArea( nodes[child2].bounds );
+
+        if (cost < cost1 && cost < cost2)
+            break;
+
+        index = (cost1 < cost2) ? child1 : child2;
+    }
+
+    GLint sibling = index;
+    GLint old_parent = nodes[sibling].parent;
+    GLint new_parent = allocateNode();
+
+    nodes[new_parent].parent = old_parent;
+    nodes[new_parent].bounds = mergeBounds( leaf_bounds, nodes[sibling].bounds );
+    nodes[new_parent].height = nodes[sibling].height + 1;
+    nodes[new_parent].child1 = sibling;
+    nodes[new_parent].child2 = leaf;
+
+    nodes[sibling].parent = new_parent;
+    nodes[leaf].parent = new_parent;
+
+    if (old_parent != GR_NULL_PROXY) {
+        if (nodes[old_parent].child1 == sibling)
+            nodes[old_parent].child1 = new_parent;
+        else nodes[old_parent].child2 = new_parent;
+    } else root = new_parent;
+
+    refit( nodes[leaf].parent );
+}
+
+void
+AABBTree::removeLeaf( GLint leaf )
+{
+    if (leaf == root) {
+        root = GR_NULL_PROXY;
+        return;
+    }
+
+    GLint parent = nodes[leaf].parent;
+    GLint grand_parent = nodes[parent].parent;
+    GLint sibling = (nodes[parent].child1 == leaf) ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grand_parent != GR_NULL_PROXY) {
+        if (nodes[grand_parent].child1 == parent)
+            nodes[grand_parent].child1 = sibling;
+        else nodes[grand_parent].child2 = sibling;
+
+        nodes[sibling].parent = grand_parent;
+        freeNode( parent );
+
+        refit( grand_parent );
+    } else {
+        root = sibling;
+        nodes[sibling].parent = GR_NULL_PROXY;
+        freeNode( parent );
+    }
+}
+
+void
+AABBTree::refit( GLint node )
+{
+    while (node != GR_NULL_PROXY) {
+        node = balance( node );
+
+        GLint child1 = nodes[node].child1;
+        GLint child2 = nodes[node].child2;
+
+        nodes[node].height = 1 + std::max( nodes[child1].height, nodes[child2].height );
+        nodes[node].bounds = mergeBounds( nodes[child1].bounds, nodes[child2].bounds );
+
+        node = nodes[node].parent;
+    }
+}
+
+//===========
+//rotate the taller grandchild of a into a's place when a's subtrees differ
+//in height by more than one; returns the node now at a's position.
+//===========
+GLint
+AABBTree::balance( GLint a )
+{
+    if (nodes[a].height < 2)
+        return a;
+
+    GLint b = nodes[a].child1;
+    GLint c = nodes[a].child2;
+    GLint diff = nodes[c].height - nodes[b].height;
+
+    if (diff > 1 || diff < -1) {
+        // promote the taller child of a, called up; its taller child stays
+        // beneath it and the shorter one moves down to a.
+        GLint up    = (diff > 1) ? c : b;
+        GLint other = (diff > 1) ? b : c;
+
+        GLint f = nodes[up].child1;
+        GLint g = nodes[up].child2;
+
+        nodes[up].child1 = a;
+        nodes[up].parent = nodes[a].parent;
+        nodes[a].parent = up;
+
+        if (nodes[up].parent != GR_NULL_PROXY) {
+            if (nodes[nodes[up].parent].child1 == a)
+                nodes[nodes[up].parent].child1 = up;
+            else nodes[nodes[up].parent].child2 = up;
+        } else root = up;
+
+        GLint keep = (nodes[f].height > nodes[g].height) ? f : g;
+        GLint give = (keep == f) ? g : f;
+
+        nodes[up].child2 = keep;
+        if (diff > 1) nodes[a].child2 = give;
+        else          nodes[a].child1 = give;
+        nodes[give].parent = a;
+
+        nodes[a].bounds = mergeBounds( nodes[other].bounds, nodes[give].bounds );
+        nodes[a].height = 1 + std::max( nodes[other].height, nodes[give].height );
+
+        nodes[up].bounds = mergeBounds( nodes[a].bounds, nodes[keep].bounds );
+        nodes[up].height = 1 + std::max( nodes[a].height, nodes[keep].height );
+
+        return up;
+    }
+
+    return a;
+}
+
+void
+AABBTree::build(
+        const std::vector<AABB>   &bounds,
+        const std::vector<GLuint> &objects,
+        std::vector<GLint>        &proxies )
+{
+    clear();
+    proxies.resize( bounds.size() );
+
+    if (bounds.empty())
+        return;
+
+    std::vector<GLint> leaves( bounds.size() );
+    for (GLuint i = 0; i < bounds.size(); ++i) {
+        GLint leaf = allocateNode();
+
+        nodes[leaf].bounds.min = bounds[i].min - glm::vec3( margin );
+        nodes[leaf].bounds.max = bounds[i].max + glm::vec3( margin );
+        nodes[leaf].tight = bounds[i];
+        nodes[leaf].object = (i < objects.size()) ? objects[i] : i;
+
+        leaves[i] = leaf;
+        proxies[i] = leaf;
+    }
+
+    leaf_count = bounds.size();
+    root = buildRange( leaves, 0, leaves.size() );
+    nodes[root].parent = GR_NULL_PROXY;
+}
+
+GLint
+AABBTree::buildRange( std::vector<GLint> &leaves, GLuint begin, GLuint end )
+{
+    if (end - begin == 1)
+        return leaves[begin];
+
+    AABB centroid_bounds;
+    centroid_bounds.min = centroid_bounds.max =
+        (nodes[leaves[begin]].bounds.min + nodes[leaves[begin]].bounds.max) * 0.5f;
+
+    for (GLuint i = begin + 1; i < end; ++i) {
+        glm::vec3 c = (nodes[leaves[i]].bounds.min + nodes[leaves[i]].bounds.max) * 0.5f;
+        centroid_bounds.min = glm::min( centroid_bounds.min, c );
+        centroid_bounds.max = glm::max( centroid_bounds.max, c );
+    }
+
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = 0;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    GLuint mid = begin + (end - begin) / 2;
+
+    if (extent[axis] > 0.0f) {
+        GLuint bin_count[SAH_BINS];
+        AABB   bin_bounds[SAH_BINS];
+        for (GLuint b = 0; b < SAH_BINS; ++b)
+            bin_count[b] = 0;
+
+        GLfloat scale = SAH_BINS / extent[axis];
+        std::vector<GLuint> bin_of( end - begin );
+
+        for (GLuint i = begin; i < end; ++i) {
+            const AABB &box = nodes[leaves[i]].bounds;
+            GLfloat c = (box.min[axis] + box.max[axis]) * 0.5f;
+            GLuint b = std::min( static_cast<GLuint>((c - centroid_bounds.min[axis]) * scale), SAH_BINS - 1 );
+
+            bin_bounds[b] = bin_count[b] ? mergeBounds( bin_bounds[b], box ) : box;
+            ++bin_count[b];
+            bin_of[i - begin] = b;
+        }
+
+        // sweep from the right to get the cost of every split plane, then
+        // from the left to find the cheapest one.
+        GLfloat right_area[SAH_BINS];
+        GLuint  right_count[SAH_BINS];
+        AABB    accumulated;
+        GLuint  count = 0;
+
+        for (GLint b = SAH_BINS - 1; b > 0; --b) {
+            if (bin_count[b])
+                accumulated = count ? mergeBounds( accumulated, bin_bounds[b] ) : bin_bounds[b];
+            count += bin_count[b];
+            right_area[b] = count ? surfaceArea( accumulated ) : 0.0f;
+            right_count[b] = count;
+        }
+
+        GLfloat best_cost = 1e30f;
+        GLuint  best_split = 0;
+        count = 0;
+
+        for (GLuint b = 0; b + 1 < SAH_BINS; ++b) {
+            if (bin_count[b])
+                accumulated = count ? mergeBounds( accumulated, bin_bounds[b] ) : bin_bounds[b];
+            count += bin_count[b];
+
+            if (count == 0 || right_count[b+1] == 0)
+                continue;
+
+            GLfloat cost = count * surfaceArea( accumulated ) + right_count[b+1] * right_area[b+1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        if (best_cost < 1e30f) {
+            std::vector<GLint> left, right;
+            for (GLuint i = begin; i < end; ++i) {
+                if (bin_of[i - begin] <= best_split)
+                    left.push_back( leaves[i] );
+                else right.push_back( leaves[i] );
+            }
+
+            std::copy( left.begin(), left.end(), leaves.begin() + begin );
+            std::copy( right.begin(), right.end(), leaves.begin() + begin + left.size() );
+            mid = begin + left.size();
+        }
+    }
+
+    GLint child1 = buildRange( leaves, begin, mid );
+    GLint child2 = buildRange( leaves, mid, end );
+
+    GLint node = allocateNode();
+    nodes[node].child1 = child1;
+    nodes[node].child2 = child2;
+    nodes[node].bounds = mergeBounds( nodes[child1].bounds, nodes[child2].bounds );
+    nodes[node].height = 1 + std::max( nodes[child1].height, nodes[child2].height );
+
+    nodes[child1].parent = node;
+    nodes[child2].parent = node;
+
+    return node;
+}
+
+const AABB &
+AABBTree::getFatBounds( GLint proxy ) { return nodes[proxy].bounds; }
+
+GLuint
+AABBTree::getObject( GLint proxy ) { return nodes[proxy].object; }
+
+GLuint
+AABBTree::getObjectCount() { return leaf_count; }
+
+GLint
+AABBTree::getHeight()
+{
+    return (root == GR_NULL_PROXY) ? 0 : nodes[root].height;
+}
+
+void
+AABBTree::collectLeaves( GLint node, std::vector<GLuint> &result )
+{
+    GLuint base = stack.size();
+    stack.push_back( node );
+
+    while (stack.size() > base) {
+        GLint index = stack.back();
+        stack.pop_back();
+
+        if (nodes[index].height == 0) {
+            result.push_back( nodes[index].object );
+        } else {
+            stack.push_back( nodes[index].child1 );
+            stack.push_back( nodes[index].child2 );
+        }
+    }
+}
+
+void
+AABBTree::queryFrustum( const Frustum &frustum, std::vector<GLuint> &result )
+{
+    if (root == GR_NULL_PROXY)
+        return;
+
+    stack.clear();
+    stack.push_back( root );
+
+    while (!stack.empty()) {
+        GLint index = stack.back();
+        stack.pop_back();
+
+        Containment c = classify( frustum, nodes[index].bounds );
+        if (c == GR_OUTSIDE)
+            continue;
+
+        // a node completely inside needs no more plane tests below it.
+        if (c == GR_INSIDE || nodes[index].height == 0) {
+            collectLeaves( index, result );
+            continue;
+        }
+
+        stack.push_back( nodes[index].child1 );
+        stack.push_back( nodes[index].child2 );
+    }
+}
+
+void
+AABBTree::queryBox( const AABB &box, std::vector<GLuint> &result )
+{
+    if (root == GR_NULL_PROXY)
+        return;
+
+    stack.clear();
+    stack.push_back( root );
+
+    while (!stack.empty()) {
+        GLint index = stack.back();
+        stack.pop_back();
+
+        if (!overlaps(nodes[index].bounds, box))
+            continue;
+
+        if (nodes[index].height == 0) {
+            result.push_back( nodes[index].object );
+        } else {
+            stack.push_back( nodes[index].child1 );
+            stack.push_back( nodes[index].child2 );
+        }
+    }
+}
+
+void
+AABBTree::queryRay( const Ray &ray, std::vector<GLuint> &result )
+{
+    if (root == GR_NULL_PROXY)
+        return;
+
+    stack.clear();
+    stack.push_back( root );
+
+    while (!stack.empty()) {
+        GLint index = stack.back();
+        stack.pop_back();
+
+        GLfloat distance;
+        if (!intersects(ray, nodes[index].bounds, distance))
+            continue;
+
+        if (nodes[index].height == 0) {
+            result.push_back( nodes[index].object );
+        } else {
+            stack.push_back( nodes[index].child1 );
+            stack.push_back( nodes[index].child2 );
+        }
+    }
+}
+
+bool
+AABBTree::pick( const Ray &ray, GLuint *object, GLfloat *distance )
+{
+    GLint   nearest = GR_NULL_PROXY;
+    GLfloat nearest_distance = ray.length;
+
+    if (root == GR_NULL_PROXY)
+        return false;
+
+    stack.clear();
+    stack.push_back( root );
+
+    while (!stack.empty()) {
+        GLint index = stack.back();
+        stack.pop_back();
+
+        // the fat boxes only prune; a hit counts against the object's
+        // own box, or picks would land in the margin around it.
+        const AABB &box = (nodes[index].height == 0) ? nodes[index].tight : nodes[index].bounds;
+
+        GLfloat entry;
+        if (!intersects(ray, box, entry) || entry > nearest_distance)
+            continue;
+
+        if (nodes[index].height == 0) {
+            nearest = index;
+            nearest_distance = entry;
+        } else {
+            stack.push_back( nodes[index].child1 );
+            stack.push_back( nodes[index].child2 );
+        }
+    }
+
+    if (nearest == GR_NULL_PROXY)
+        return false;
+
+    if (object != NULL)
+        *object = nodes[nearest].object;
+    if (distance != NULL)
+        *distance = nearest_distance;
+
+    return true;
+}
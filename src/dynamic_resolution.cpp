@@ -0,0 +1,302 @@
+#include "dynamic_resolution.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace GearsEngine;
+
+// aim this far under the target, so ordinary noise doesn't cost a step.
+static const double  TIME_HEADROOM = 0.9;
+// only scale up once the scene is this far under the aim.
+static const double  UPSCALE_THRESHOLD = 0.8;
+static const double  TIME_SMOOTHING = 0.25;
+
+static const GLfloat MAX_STEP = 0.1f;
+// scales are kept on a grid, so sizes don't creep by a pixel a frame.
+static const GLfloat SCALE_QUANTUM = 1.0f / 32.0f;
+
+static void
+allocateTexture( GLuint texture, GLenum format, GLsizei width, GLsizei height )
+{
+    glBindTexture( GL_TEXTURE_2D, texture );
+
+    if (GLEW_ARB_texture_storage || GLEW_VERSION_4_2) {
+        glTexStorage2D( GL_TEXTURE_2D, 1, format, width, height );
+    } else if (format == GL_DEPTH24_STENCIL8) {
+        glTexImage2D( GL_TEXTURE_2D, 0, format, width, height, 0,
+                      GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL );
+    } else {
+        glTexImage2D( GL_TEXTURE_2D, 0, format, width, height, 0,
+                      GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    }
+
+    // linear, so the target can be sampled for a shader upscale too.
+    GLint filter = (format == GL_DEPTH24_STENCIL8) ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    glBindTexture( GL_TEXTURE_2D, 0 );
+}
+
+DynamicResolution::DynamicResolution()
+{
+    framebuffer = 0;
+    color_texture = 0;
+    depth_texture = 0;
+    output_width = output_height = 0;
+
+    scale = 1.0f;
+    min_scale = 0.5f;
+    max_scale = 1.0f;
+    is_adaptive = true;
+    is_in_scene = false;
+
+    was_scissored = GL_FALSE;
+    for (int i = 0; i < 4; ++i)
+        scissor_box[i] = 0;
+
+    for (int q = 0; q < GR_RESOLUTION_QUERIES; ++q)
+        queries[q] = 0;
+    oldest_query = 0;
+    pending_queries = 0;
+    is_timing = false;
+    has_timer_query = false;
+
+    target_time = 1000.0 / 60.0;
+    gpu_time = 0.0;
+    smoothed_time = 0.0;
+    frames_since_change = 0;
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    releaseTarget();
+
+    if (queries[0] != 0)
+        glDeleteQueries( GR_RESOLUTION_QUERIES, queries );
+}
+
+void
+DynamicResolution::releaseTarget()
+{
+    if (framebuffer != 0)   framebufferTraits::Destroy( framebuffer );
+    if (color_texture != 0) textureTraits::Destroy( color_texture );
+    if (depth_texture != 0) textureTraits::Destroy( depth_texture );
+
+    framebuffer = color_texture = depth_texture = 0;
+}
+
+bool
+DynamicResolution::initialize( GLsizei width, GLsizei height )
+{
+    releaseTarget();
+
+    output_width = std::max<GLsizei>( width, 1 );
+    output_height = std::max<GLsizei>( height, 1 );
+
+    color_texture = textureTraits::Create();
+    allocateTexture( color_texture, GL_RGBA8, output_width, output_height );
+
+    depth_texture = textureTraits::Create();
+    allocateTexture( depth_texture, GL_DEPTH24_STENCIL8, output_width, output_height );
+
+    framebuffer = framebufferTraits::Create();
+    glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture, 0 );
+    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth_texture, 0 );
+
+    GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+    has_timer_query = GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+    if (has_timer_query && queries[0] == 0)
+        glGenQueries( GR_RESOLUTION_QUERIES, queries );
+
+    return status == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void
+DynamicResolution::setTargetFrameTime( double milliseconds ) { target_time = milliseconds; }
+
+void
+DynamicResolution::setScaleRange( GLfloat min, GLfloat max )
+{
+    min_scale = std::max( std::min( min, max ), SCALE_QUANTUM );
+    max_scale = std::min( std::max( min, max ), 1.0f );
+    scale = std::min( std::max( scale, min_scale ), max_scale );
+}
+
+void
+DynamicResolution::setAdaptive( bool enabled ) { is_adaptive = enabled; }
+
+void
+DynamicResolution::setScale( GLfloat new_scale )
+{
+    scale = std::min( std::max( new_scale, min_scale ), max_scale );
+    frames_since_change = 0;
+}
+
+void
+DynamicResolution::getSceneSize( GLsizei &width, GLsizei &height )
+{
+    width = std::max<GLsizei>( (GLsizei)(output_width * scale + 0.5f), 1 );
+    height = std::max<GLsizei>( (GLsizei)(output_height * scale + 0.5f), 1 );
+}
+
+void
+DynamicResolution::collectQueries()
+{
+    // oldest first, and only what's ready: never wait on the GPU here.
+    while (pending_queries > 0) {
+        GLuint query = queries[oldest_query];
+
+        GLint is_available = 0;
+        glGetQueryObjectiv( query, GL_QUERY_RESULT_AVAILABLE, &is_available );
+        if (!is_available)
+            break;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v( query, GL_QUERY_RESULT, &elapsed );
+
+        oldest_query = (oldest_query + 1) % GR_RESOLUTION_QUERIES;
+        --pending_queries;
+
+        adjustScale( elapsed / 1.0e6 );
+    }
+}
+
+void
+DynamicResolution::adjustScale( double milliseconds )
+{
+    gpu_time = milliseconds;
+    if (smoothed_time == 0.0)
+        smoothed_time = milliseconds;
+    else
+        smoothed_time += (milliseconds - smoothed_time) * TIME_SMOOTHING;
+
+    ++frames_since_change;
+
+    // results trail by the queries in flight; wait until they are all
+    // from frames at the current scale.
+    if (!is_adaptive || frames_since_change <= GR_RESOLUTION_QUERIES)
+        return;
+
+    double ratio = std::max( smoothed_time / (target_time * TIME_HEADROOM), 0.01 );
+    if (ratio <= 1.0 && ratio >= UPSCALE_THRESHOLD)
+        return;
+
+    GLfloat wanted = scale / (GLfloat)std::sqrt( ratio );
+    wanted = std::min( std::max( wanted, scale - MAX_STEP ), scale + MAX_STEP );
+    wanted = std::floor( wanted / SCALE_QUANTUM + 0.5f ) * SCALE_QUANTUM;
+
+    // rounding must not swallow a step the timings asked for.
+    if (ratio > 1.0 && wanted >= scale)
+        wanted = scale - SCALE_QUANTUM;
+    else if (ratio < 1.0 && wanted <= scale)
+        wanted = scale + SCALE_QUANTUM;
+
+    wanted = std::min( std::max( wanted, min_scale ), max_scale );
+
+    if (wanted != scale) {
+        scale = wanted;
+        frames_since_change = 0;
+    }
+}
+
+void
+DynamicResolution::beginScene()
+{
+    if (has_timer_query)
+        collectQueries();
+
+    GLsizei width, height;
+    getSceneSize( width, height );
+
+    glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+    glViewport( 0, 0, width, height );
+
+    // clears respect the scissor; nothing outside the scaled corner is
+    // touched.
+    was_scissored = glIsEnabled( GL_SCISSOR_TEST );
+    glGetIntegerv( GL_SCISSOR_BOX, scissor_box );
+    glScissor( 0, 0, width, height );
+    glEnable( GL_SCISSOR_TEST );
+
+    // with every query still in flight this frame goes untimed rather
+    // than waiting for one.
+    is_timing = has_timer_query && pending_queries < GR_RESOLUTION_QUERIES;
+    if (is_timing)
+        glBeginQuery( GL_TIME_ELAPSED, queries[(oldest_query + pending_queries) % GR_RESOLUTION_QUERIES] );
+
+    is_in_scene = true;
+}
+
+void
+DynamicResolution::endScene()
+{
+    if (is_timing) {
+        glEndQuery( GL_TIME_ELAPSED );
+        ++pending_queries;
+        is_timing = false;
+    }
+
+    glScissor( scissor_box[0], scissor_box[1], scissor_box[2], scissor_box[3] );
+    if (!was_scissored)
+        glDisable( GL_SCISSOR_TEST );
+    is_in_scene = false;
+}
+
+bool
+DynamicResolution::isInScene() { return is_in_scene; }
+
+void
+DynamicResolution::present( GLuint target )
+{
+    GLsizei width, height;
+    getSceneSize( width, height );
+
+    glBindFramebuffer( GL_READ_FRAMEBUFFER, framebuffer );
+    glBindFramebuffer( GL_DRAW_FRAMEBUFFER, target );
+
+    glBlitFramebuffer(
+            0, 0, width, height,
+            0, 0, output_width, output_height,
+            GL_COLOR_BUFFER_BIT,
+            (width == output_width && height == output_height) ? GL_NEAREST : GL_LINEAR
+    );
+
+    glBindFramebuffer( GL_FRAMEBUFFER, target );
+    glViewport( 0, 0, output_width, output_height );
+}
+
+GLuint
+DynamicResolution::getFramebuffer() { return framebuffer; }
+
+GLuint
+DynamicResolution::getColorTexture() { return color_texture; }
+
+GLuint
+DynamicResolution::getDepthTexture() { return depth_texture; }
+
+ResolutionState
+DynamicResolution::getState()
+{
+    ResolutionState state;
+    state.scale = scale;
+    getSceneSize( state.width, state.height );
+    state.output_width = output_width;
+    state.output_height = output_height;
+
+    state.gpu_time = gpu_time;
+    state.smoothed_time = smoothed_time;
+    state.target_time = target_time;
+
+    state.is_adaptive = is_adaptive;
+    state.is_measuring = has_timer_query;
+    state.pending_queries = pending_queries;
+    state.frames_since_change = frames_since_change;
+
+    return state;
+}
@@ -0,0 +1,385 @@
+#include "entity.hpp"
+#include <cassert>
+#include <cstring>
+
+using namespace GearsEngine;
+
+// component arrays inside a chunk start on this boundary so SIMD loads of
+// float components line up.
+static const size_t ARRAY_ALIGNMENT = 16;
+
+typedef struct {
+    std::vector<ChunkView> *views;
+    ChunkKernel             kernel;
+    void                   *userdata;
+} ParallelQuery;
+
+static size_t
+alignUp( size_t value, size_t alignment )
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+EntityWorld::EntityWorld()
+{
+    entity_count = 0;
+
+    // the empty archetype always exists, so createEntity() with no
+    // components never has to allocate one.
+    findArchetype( 0 );
+}
+
+ComponentType
+EntityWorld::registerComponent( size_t size )
+{
+    assert( component_sizes.size() < GR_MAX_COMPONENT_TYPES );
+
+    component_sizes.push_back( size );
+    return component_sizes.size() - 1;
+}
+
+unsigned int
+EntityWorld::findArchetype( ComponentMask mask )
+{
+    std::map<ComponentMask, unsigned int>::iterator found = archetype_index.find( mask );
+    if (found != archetype_index.end())
+        return found->second;
+
+    Archetype archetype;
+    archetype.mask = mask;
+
+    size_t row_size = 0;
+    for (ComponentType t = 0; t < component_sizes.size(); ++t) {
+        if (mask & GR_COMPONENT_BIT(t)) {
+            archetype.types.push_back( t );
+            row_size += component_sizes[t];
+        }
+    }
+
+    if (row_size > 0) {
+        size_t padding = archetype.types.size() * ARRAY_ALIGNMENT;
+        archetype.capacity = (GR_CHUNK_BYTES > row_size + padding)
+                           ? (GR_CHUNK_BYTES - padding) / row_size : 1;
+    } else archetype.capacity = GR_CHUNK_BYTES / sizeof(Entity);
+
+    size_t offset = 0;
+    for (unsigned int i = 0; i < archetype.types.size(); ++i) {
+        offset = alignUp( offset, ARRAY_ALIGNMENT );
+        archetype.offsets.push_back( offset );
+        offset += archetype.capacity * component_sizes[archetype.types[i]];
+    }
+    archetype.chunk_bytes = offset;
+
+    archetypes.push_back( archetype );
+    archetype_index[mask] = archetypes.size() - 1;
+
+    return archetypes.size() - 1;
+}
+
+void *
+EntityWorld::componentAt(
+        unsigned int archetype,
+        unsigned int chunk,
+        unsigned int row,
+        ComponentType type )
+{
+    Archetype &a = archetypes[archetype];
+
+    for (unsigned int i = 0; i < a.types.size(); ++i) {
+        if (a.types[i] == type)
+            return &a.chunks[chunk].data[a.offsets[i] + row * component_sizes[type]];
+    }
+
+    return NULL;
+}
+
+unsigned int
+EntityWorld::allocateRow( unsigned int archetype, Entity entity )
+{
+    Archetype &a = archetypes[archetype];
+
+    if (a.chunks.empty() || a.chunks.back().entities.size() >= a.capacity) {
+        a.chunks.push_back( Chunk() );
+        a.chunks.back().data.assign( a.chunk_bytes, 0 );
+        a.chunks.back().entities.reserve( a.capacity );
+    }
+
+    unsigned int chunk = a.chunks.size() - 1;
+    unsigned int row = a.chunks[chunk].entities.size();
+    a.chunks[chunk].entities.push_back( entity );
+
+    // the slot may still hold a removed entity's data.
+    for (unsigned int i = 0; i < a.types.size(); ++i) {
+        size_t size = component_sizes[a.types[i]];
+        std::memset( &a.chunks[chunk].data[a.offsets[i] + row * size], 0, size );
+    }
+
+    EntityRecord &record = records[entity.index];
+    record.archetype = archetype;
+    record.chunk = chunk;
+    record.row = row;
+
+    return chunk;
+}
+
+void
+EntityWorld::releaseRow( unsigned int archetype, unsigned int chunk, unsigned int row )
+{
+    Archetype &a = archetypes[archetype];
+
+    // every chunk but the last is kept full: the archetype's last row moves
+    // into the hole.
+    unsigned int last_chunk = a.chunks.size() - 1;
+    unsigned int last_row = a.chunks[last_chunk].entities.size() - 1;
+
+    if (chunk != last_chunk || row != last_row) {
+        for (unsigned int i = 0; i < a.types.size(); ++i) {
+            size_t size = component_sizes[a.types[i]];
+            std::memcpy(
+                    &a.chunks[chunk].data[a.offsets[i] + row * size],
+                    &a.chunks[last_chunk].data[a.offsets[i] + last_row * size],
+                    size
+            );
+        }
+
+        Entity moved = a.chunks[last_chunk].entities[last_row];
+        a.chunks[chunk].entities[row] = moved;
+        records[moved.index].chunk = chunk;
+        records[moved.index].row = row;
+    }
+
+    a.chunks[last_chunk].entities.pop_back();
+    if (a.chunks[last_chunk].entities.empty())
+        a.chunks.pop_back();
+}
+
+void
+EntityWorld::moveEntity( Entity entity, unsigned int target )
+{
+    EntityRecord old = records[entity.index];
+
+    allocateRow( target, entity );
+    EntityRecord &now = records[entity.index];
+
+    Archetype &to = archetypes[target];
+    Archetype &from = archetypes[old.archetype];
+
+    for (unsigned int i = 0; i < to.types.size(); ++i) {
+        ComponentType type = to.types[i];
+        if (!(from.mask & GR_COMPONENT_BIT(type)))
+            continue;
+
+        std::memcpy(
+                componentAt( target, now.chunk, now.row, type ),
+                componentAt( old.archetype, old.chunk, old.row, type ),
+                component_sizes[type]
+        );
+    }
+
+    releaseRow( old.archetype, old.chunk, old.row );
+}
+
+Entity
+EntityWorld::createEntity( ComponentMask mask )
+{
+    Entity entity;
+
+    if (!free_records.empty()) {
+        entity.index = free_records.back();
+        free_records.pop_back();
+    } else {
+        entity.index = records.size();
+
+        EntityRecord record;
+        record.generation = 0;
+        records.push_back( record );
+    }
+
+    entity.generation = records[entity.index].generation;
+    records[entity.index].is_alive = true;
+
+    allocateRow( findArchetype(mask), entity );
+    ++entity_count;
+
+    return entity;
+}
+
+void
+EntityWorld::destroyEntity( Entity entity )
+{
+    if (!isAlive(entity))
+        return;
+
+    EntityRecord &record = records[entity.index];
+    releaseRow( record.archetype, record.chunk, record.row );
+
+    record.is_alive = false;
+    ++record.generation;
+    free_records.push_back( entity.index );
+
+    --entity_count;
+}
+
+bool
+EntityWorld::isAlive( Entity entity )
+{
+    return entity.index < records.size() &&
+           records[entity.index].is_alive &&
+           records[entity.index].generation == entity.generation;
+}
+
+void *
+EntityWorld::addComponent( Entity entity, ComponentType type, const void *data )
+{
+    if (!isAlive(entity) || type >= component_sizes.size())
+        return NULL;
+
+    unsigned int source = records[entity.index].archetype;
+
+    if (!(archetypes[source].mask & GR_COMPONENT_BIT(type))) {
+        unsigned int target;
+        std::map<ComponentType, unsigned int>::iterator edge =
+            archetypes[source].add_edges.find( type );
+
+        if (edge != archetypes[source].add_edges.end()) {
+            target = edge->second;
+        } else {
+            target = findArchetype( archetypes[source].mask | GR_COMPONENT_BIT(type) );
+            archetypes[source].add_edges[type] = target;
+            archetypes[target].remove_edges[type] = source;
+        }
+
+        moveEntity( entity, target );
+    }
+
+    EntityRecord &record = records[entity.index];
+    void *storage = componentAt( record.archetype, record.chunk, record.row, type );
+
+    if (data != NULL)
+        std::memcpy( storage, data, component_sizes[type] );
+
+    return storage;
+}
+
+void
+EntityWorld::removeComponent( Entity entity, ComponentType type )
+{
+    if (!hasComponent(entity, type))
+        return;
+
+    unsigned int source = records[entity.index].archetype;
+    unsigned int target;
+    std::map<ComponentType, unsigned int>::iterator edge =
+        archetypes[source].remove_edges.find( type );
+
+    if (edge != archetypes[source].remove_edges.end()) {
+        target = edge->second;
+    } else {
+        target = findArchetype( archetypes[source].mask & ~GR_COMPONENT_BIT(type) );
+        archetypes[source].remove_edges[type] = target;
+        archetypes[target].add_edges[type] = source;
+    }
+
+    moveEntity( entity, target );
+}
+
+bool
+EntityWorld::hasComponent( Entity entity, ComponentType type )
+{
+    // registered types only, the same test addComponent() makes, so this
+    // and getComponent() agree on every id.
+    return isAlive(entity) && type < component_sizes.size() &&
+           (archetypes[records[entity.index].archetype].mask & GR_COMPONENT_BIT(type));
+}
+
+void *
+EntityWorld::getComponent( Entity entity, ComponentType type )
+{
+    if (!hasComponent(entity, type))
+        return NULL;
+
+    EntityRecord &record = records[entity.index];
+    return componentAt( record.archetype, record.chunk, record.row, type );
+}
+
+unsigned int
+EntityWorld::getEntityCount() { return entity_count; }
+
+unsigned int
+EntityWorld::getArchetypeCount() { return archetypes.size(); }
+
+void
+EntityWorld::query( ComponentMask required, ChunkKernel kernel, void *userdata )
+{
+    ChunkView view;
+
+    for (unsigned int a = 0; a < archetypes.size(); ++a) {
+        Archetype &archetype = archetypes[a];
+        if ((archetype.mask & required) != required)
+            continue;
+
+        for (unsigned int c = 0; c < archetype.chunks.size(); ++c) {
+            Chunk &chunk = archetype.chunks[c];
+
+            std::memset( view.components, 0, sizeof(view.components) );
+            for (unsigned int i = 0; i < archetype.types.size(); ++i)
+                view.components[archetype.types[i]] = &chunk.data[archetype.offsets[i]];
+
+            view.count = chunk.entities.size();
+            view.entities = &chunk.entities[0];
+
+            kernel( &view, userdata );
+        }
+    }
+}
+
+void
+EntityWorld::chunkKernel( unsigned int begin, unsigned int end, void *query )
+{
+    ParallelQuery *q = static_cast<ParallelQuery*>(query);
+
+    for (unsigned int c = begin; c < end; ++c)
+        q->kernel( &(*q->views)[c], q->userdata );
+}
+
+void
+EntityWorld::queryParallel(
+        ComponentMask required,
+        ChunkKernel kernel,
+        void *userdata,
+        JobSystem *jobs )
+{
+    if (jobs == NULL) {
+        query( required, kernel, userdata );
+        return;
+    }
+
+    query_views.clear();
+
+    for (unsigned int a = 0; a < archetypes.size(); ++a) {
+        Archetype &archetype = archetypes[a];
+        if ((archetype.mask & required) != required)
+            continue;
+
+        for (unsigned int c = 0; c < archetype.chunks.size(); ++c) {
+            Chunk &chunk = archetype.chunks[c];
+            ChunkView view;
+
+            std::memset( view.components, 0, sizeof(view.components) );
+            for (unsigned int i = 0; i < archetype.types.size(); ++i)
+                view.components[archetype.types[i]] = &chunk.data[archetype.offsets[i]];
+
+            view.count = chunk.entities.size();
+            view.entities = &chunk.entities[0];
+
+            query_views.push_back( view );
+        }
+    }
+
+    ParallelQuery q;
+    q.views = &query_views;
+    q.kernel = kernel;
+    q.userdata = userdata;
+
+    jobs->parallelFor( query_views.size(), 1, &chunkKernel, &q );
+}
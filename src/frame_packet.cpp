@@ -0,0 +1,174 @@
+#include "frame_packet.hpp"
+#include <cstring>
+
+using namespace GearsEngine;
+
+static void
+appendUniform(
+        FramePacket *packet,
+        GLint location,
+        GLenum type,
+        const GLfloat *data,
+        GLuint float_count )
+{
+    UniformValue value;
+    value.location = location;
+    value.type = type;
+    value.count = 1;
+    value.offset = packet->uniform_data.size();
+
+    packet->uniform_data.insert( packet->uniform_data.end(), data, data + float_count );
+    packet->uniforms.push_back( value );
+}
+
+void
+GearsEngine::resetFramePacket( FramePacket *packet )
+{
+    packet->draws.clear();
+    packet->uniforms.clear();
+    packet->uniform_data.clear();
+    packet->input_time = 0;
+
+    for (int c = 0; c < 4; ++c)
+        packet->clear_color[c] = 0.0f;
+
+    packet->view = glm::mat4();
+    packet->projection = glm::mat4();
+}
+
+void
+GearsEngine::pushUniform( FramePacket *packet, GLint location, const glm::mat4 &value )
+{
+    appendUniform( packet, location, GL_FLOAT_MAT4, &value[0][0], 16 );
+}
+
+void
+GearsEngine::pushUniform( FramePacket *packet, GLint location, const glm::vec4 &value )
+{
+    appendUniform( packet, location, GL_FLOAT_VEC4, &value[0], 4 );
+}
+
+void
+GearsEngine::pushUniform( FramePacket *packet, GLint location, GLfloat value )
+{
+    appendUniform( packet, location, GL_FLOAT, &value, 1 );
+}
+
+void
+GearsEngine::pushUniformUint( FramePacket *packet, GLint location, GLuint value )
+{
+    // stored bit-for-bit in the float blob.
+    GLfloat bits;
+    std::memcpy( &bits, &value, sizeof(bits) );
+    appendUniform( packet, location, GL_UNSIGNED_INT, &bits, 1 );
+}
+
+void
+GearsEngine::addDrawItem( FramePacket *packet, DrawItem item )
+{
+    GLuint used = 0;
+    if (!packet->draws.empty())
+        used = packet->draws.back().first_uniform + packet->draws.back().uniform_count;
+
+    item.first_uniform = used;
+    item.uniform_count = packet->uniforms.size() - used;
+
+    packet->draws.push_back( item );
+}
+
+FrameMailbox::FrameMailbox()
+{
+    states[0] = states[1] = SLOT_FREE;
+    next_frame = 0;
+    is_closed = false;
+}
+
+FramePacket *
+FrameMailbox::beginWrite()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+
+    for (;;) {
+        if (is_closed)
+            return NULL;
+
+        for (int s = 0; s < 2; ++s) {
+            if (states[s] == SLOT_FREE) {
+                states[s] = SLOT_WRITING;
+                lock.unlock();
+
+                resetFramePacket( &slots[s] );
+                return &slots[s];
+            }
+        }
+
+        changed.wait( lock );
+    }
+}
+
+void
+FrameMailbox::endWrite( FramePacket *packet )
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+
+        int s = packet - slots;
+        packet->frame = next_frame++;
+        states[s] = SLOT_READY;
+    }
+    changed.notify_all();
+}
+
+FramePacket *
+FrameMailbox::beginRead()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+
+    for (;;) {
+        int oldest = -1;
+        for (int s = 0; s < 2; ++s) {
+            if (states[s] == SLOT_READY &&
+                (oldest < 0 || slots[s].frame < slots[oldest].frame))
+                oldest = s;
+        }
+
+        if (oldest >= 0) {
+            states[oldest] = SLOT_READING;
+            return &slots[oldest];
+        }
+
+        if (is_closed)
+            return NULL;
+
+        changed.wait( lock );
+    }
+}
+
+void
+FrameMailbox::endRead( FramePacket *packet )
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        states[packet - slots] = SLOT_FREE;
+    }
+    changed.notify_all();
+}
+
+void
+FrameMailbox::close()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        is_closed = true;
+    }
+    changed.notify_all();
+}
+
+void
+FrameMailbox::reopen()
+{
+    std::lock_guard<std::mutex> lock( mutex );
+
+    states[0] = states[1] = SLOT_FREE;
+    is_closed = false;
+}
@@ -0,0 +1,411 @@
+#include "frame_readback.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace GearsEngine;
+
+// how long flush() waits on a single fence before giving up on it.
+static const GLuint64 FLUSH_TIMEOUT = 1000000000ull;
+
+// Rec. 709 luma weights in 8.8 fixed point; they sum to 256.
+static const GLuint LUMA_RED = 54, LUMA_GREEN = 183, LUMA_BLUE = 19;
+
+static GLuint
+getChannelCount( ReadbackFormat format )
+{
+    switch (format) {
+        case GR_READBACK_RGB:       return 3;
+        case GR_READBACK_LUMINANCE: return 1;
+        default:                    return 4;
+    }
+}
+
+static void
+writePixel( unsigned char *destination, ReadbackFormat format, GLuint r, GLuint g, GLuint b, GLuint a )
+{
+    switch (format) {
+        case GR_READBACK_LUMINANCE:
+            destination[0] = (unsigned char)((r * LUMA_RED + g * LUMA_GREEN + b * LUMA_BLUE + 128) >> 8);
+            break;
+        case GR_READBACK_RGB:
+            destination[0] = (unsigned char)r;
+            destination[1] = (unsigned char)g;
+            destination[2] = (unsigned char)b;
+            break;
+        default:
+            destination[0] = (unsigned char)r;
+            destination[1] = (unsigned char)g;
+            destination[2] = (unsigned char)b;
+            destination[3] = (unsigned char)a;
+            break;
+    }
+}
+
+FrameReadback::FrameReadback()
+{
+    for (GLuint s = 0; s < GR_READBACK_BUFFERS; ++s) {
+        slots[s].buffer = 0;
+        slots[s].fence = 0;
+        slots[s].width = slots[s].height = 0;
+        slots[s].frame = 0;
+        slots[s].callback = NULL;
+        slots[s].userdata = NULL;
+        slots[s].format = GR_READBACK_RGBA;
+        slots[s].downscale = 1;
+        slots[s].pixels = NULL;
+        slots[s].state = SLOT_FREE;
+    }
+
+    next_slot = 0;
+    pending_count = 0;
+    width = height = 0;
+    source = 0;
+
+    callback = NULL;
+    userdata = NULL;
+    format = GR_READBACK_RGBA;
+    downscale = 1;
+    interval = 0;
+    is_requested = false;
+    is_initialized = false;
+
+    frame = 0;
+    captured_count = delivered_count = dropped_count = 0;
+
+    is_busy = false;
+    is_shutting_down = false;
+}
+
+FrameReadback::~FrameReadback()
+{
+    if (is_initialized)
+        drain();
+
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            is_shutting_down = true;
+        }
+        work_changed.notify_all();
+        worker.join();
+    }
+
+    releaseBuffers();
+}
+
+void
+FrameReadback::releaseBuffers()
+{
+    for (GLuint s = 0; s < GR_READBACK_BUFFERS; ++s) {
+        if (slots[s].buffer != 0)
+            bufferTraits::Destroy( slots[s].buffer );
+        slots[s].buffer = 0;
+    }
+
+    is_initialized = false;
+}
+
+bool
+FrameReadback::initialize( GLsizei new_width, GLsizei new_height )
+{
+    if (is_initialized)
+        drain();
+    releaseBuffers();
+
+    width = std::max<GLsizei>( new_width, 1 );
+    height = std::max<GLsizei>( new_height, 1 );
+
+    // the read always packs RGBA8, whatever comes out of the worker.
+    GLsizeiptr size = (GLsizeiptr)width * height * 4;
+
+    for (GLuint s = 0; s < GR_READBACK_BUFFERS; ++s) {
+        slots[s].buffer = bufferTraits::Create();
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slots[s].buffer );
+        glBufferData( GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ );
+    }
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+    next_slot = 0;
+    pending_count = 0;
+
+    if (!worker.joinable())
+        worker = std::thread( &FrameReadback::workerLoop, this );
+
+    is_initialized = true;
+    return true;
+}
+
+void
+FrameReadback::setCallback( ReadbackCallback new_callback, void *new_userdata )
+{
+    callback = new_callback;
+    userdata = new_userdata;
+}
+
+void
+FrameReadback::setSource( GLuint framebuffer ) { source = framebuffer; }
+
+void
+FrameReadback::setDownscale( GLuint factor ) { downscale = std::max<GLuint>( factor, 1 ); }
+
+void
+FrameReadback::setFormat( ReadbackFormat new_format ) { format = new_format; }
+
+void
+FrameReadback::setInterval( GLuint frames ) { interval = frames; }
+
+void
+FrameReadback::requestCapture() { is_requested = true; }
+
+void
+FrameReadback::endFrame()
+{
+    if (!is_initialized)
+        return;
+
+    ++frame;
+
+    // first, so buffers the worker let go of can take this frame.
+    collect( false );
+
+    if (is_requested || (interval > 0 && frame % interval == 0))
+        capture();
+
+    is_requested = false;
+}
+
+void
+FrameReadback::capture()
+{
+    Slot &slot = slots[next_slot];
+    if (slot.state != SLOT_FREE) {
+        ++dropped_count;
+        return;
+    }
+
+    // the read binding is the caller's; it gets it back afterwards.
+    GLint read_framebuffer = 0;
+    glGetIntegerv( GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer );
+
+    glBindFramebuffer( GL_READ_FRAMEBUFFER, source );
+    glReadBuffer( (source == 0) ? GL_BACK : GL_COLOR_ATTACHMENT0 );
+
+    // with a pack buffer bound the read only queues a copy; the pointer
+    // is an offset into the buffer.
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.buffer );
+    glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+    glReadPixels( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+
+    glBindFramebuffer( GL_READ_FRAMEBUFFER, read_framebuffer );
+
+    slot.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    slot.width = width;
+    slot.height = height;
+    slot.frame = frame;
+    slot.callback = callback;
+    slot.userdata = userdata;
+    slot.format = format;
+    slot.downscale = downscale;
+    slot.state = SLOT_PENDING;
+
+    next_slot = (next_slot + 1) % GR_READBACK_BUFFERS;
+    ++pending_count;
+    ++captured_count;
+}
+
+void
+FrameReadback::collect( bool wait )
+{
+    for (GLuint s = 0; s < GR_READBACK_BUFFERS; ++s) {
+        if (slots[s].state != SLOT_DONE)
+            continue;
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slots[s].buffer );
+        glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+        slots[s].pixels = NULL;
+        slots[s].state = SLOT_FREE;
+    }
+
+    // fences signal in order; stop at the first one that hasn't.
+    while (pending_count > 0) {
+        Slot &slot = slots[(next_slot + GR_READBACK_BUFFERS - pending_count) % GR_READBACK_BUFFERS];
+
+        GLenum result = glClientWaitSync( slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? FLUSH_TIMEOUT : 0 );
+        if (result == GL_TIMEOUT_EXPIRED)
+            break;
+
+        glDeleteSync( slot.fence );
+        slot.fence = 0;
+        --pending_count;
+
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, slot.buffer );
+        slot.pixels = (const unsigned char*)glMapBufferRange(
+                GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)slot.width * slot.height * 4, GL_MAP_READ_BIT );
+
+        if (result == GL_WAIT_FAILED || slot.pixels == NULL) {
+            if (slot.pixels != NULL)
+                glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+            slot.pixels = NULL;
+            slot.state = SLOT_FREE;
+            ++dropped_count;
+            continue;
+        }
+
+        slot.state = SLOT_PROCESSING;
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            work.push_back( (GLuint)(&slot - slots) );
+        }
+        work_changed.notify_one();
+    }
+
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+}
+
+void
+FrameReadback::flush()
+{
+    if (!is_initialized)
+        return;
+
+    collect( true );
+
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+        while (!work.empty() || is_busy)
+            work_finished.wait( lock );
+    }
+
+    collect( false );
+}
+
+void
+FrameReadback::drain()
+{
+    flush();
+
+    // whatever flush() gave up on never gets delivered.
+    for (GLuint s = 0; s < GR_READBACK_BUFFERS; ++s) {
+        if (slots[s].fence != 0)
+            glDeleteSync( slots[s].fence );
+        slots[s].fence = 0;
+        slots[s].state = SLOT_FREE;
+    }
+
+    dropped_count += pending_count;
+    pending_count = 0;
+}
+
+void
+FrameReadback::workerLoop()
+{
+    std::unique_lock<std::mutex> lock( mutex );
+
+    for (;;) {
+        while (work.empty() && !is_shutting_down)
+            work_changed.wait( lock );
+
+        if (work.empty())
+            return;
+
+        GLuint s = work.front();
+        work.pop_front();
+        is_busy = true;
+
+        lock.unlock();
+        process( slots[s] );
+        lock.lock();
+
+        is_busy = false;
+        work_finished.notify_all();
+    }
+}
+
+void
+FrameReadback::process( Slot &slot )
+{
+    // the factor can't leave an image with no pixels.
+    GLuint factor = std::min<GLuint>( slot.downscale, (GLuint)std::min( slot.width, slot.height ) );
+    GLsizei image_width = slot.width / factor;
+    GLsizei image_height = slot.height / factor;
+
+    GLuint channels = getChannelCount( slot.format );
+    GLsizei stride = image_width * channels;
+    output.resize( (size_t)stride * image_height );
+
+    const GLsizei source_stride = slot.width * 4;
+    std::vector<GLuint> sums;
+    if (factor > 1)
+        sums.resize( (size_t)image_width * 4 );
+
+    // GL rows go bottom to top; the image goes top to bottom.
+    for (GLsizei y = 0; y < image_height; ++y) {
+        unsigned char *row = &output[(size_t)y * stride];
+        GLsizei bottom = slot.height - (y + 1) * factor;
+
+        if (factor == 1) {
+            const unsigned char *in = slot.pixels + (size_t)bottom * source_stride;
+
+            if (slot.format == GR_READBACK_RGBA) {
+                std::memcpy( row, in, stride );
+                continue;
+            }
+
+            for (GLsizei x = 0; x < image_width; ++x, in += 4)
+                writePixel( row + x * channels, slot.format, in[0], in[1], in[2], in[3] );
+            continue;
+        }
+
+        // box filter: sum each block of factor by factor texels a source
+        // row at a time, so reads stay sequential.
+        std::fill( sums.begin(), sums.end(), 0 );
+        for (GLuint r = 0; r < factor; ++r) {
+            const unsigned char *in = slot.pixels + (size_t)(bottom + r) * source_stride;
+
+            for (GLsizei x = 0; x < image_width; ++x) {
+                GLuint *sum = &sums[x * 4];
+                for (GLuint c = 0; c < factor; ++c, in += 4) {
+                    sum[0] += in[0];
+                    sum[1] += in[1];
+                    sum[2] += in[2];
+                    sum[3] += in[3];
+                }
+            }
+        }
+
+        GLuint area = factor * factor, half = area / 2;
+        for (GLsizei x = 0; x < image_width; ++x) {
+            const GLuint *sum = &sums[x * 4];
+            writePixel( row + x * channels, slot.format,
+                        (sum[0] + half) / area, (sum[1] + half) / area,
+                        (sum[2] + half) / area, (sum[3] + half) / area );
+        }
+    }
+
+    if (slot.callback != NULL) {
+        ReadbackImage image;
+        image.width = image_width;
+        image.height = image_height;
+        image.format = slot.format;
+        image.stride = stride;
+        image.pixels = output.empty() ? NULL : &output[0];
+        image.frame = slot.frame;
+
+        slot.callback( &image, slot.userdata );
+    }
+
+    ++delivered_count;
+    slot.state = SLOT_DONE;
+}
+
+unsigned long long
+FrameReadback::getCapturedCount() { return captured_count; }
+
+unsigned long long
+FrameReadback::getDeliveredCount() { return delivered_count; }
+
+unsigned long long
+FrameReadback::getDroppedCount() { return dropped_count; }
@@ -0,0 +1,907 @@
+#include "gl_capture.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+using namespace GearsEngine;
+
+// a record bigger than this is taken as a corrupt size field.
+static const GLuint MAX_RECORD_BYTES = 256 * 1024 * 1024;
+
+GLCapture::GLCapture()
+{
+    frame_count = 0;
+    byte_count = 0;
+}
+
+GLCapture::~GLCapture()
+{
+    close();
+}
+
+bool
+GLCapture::open( const std::string &path, GLint width, GLint height )
+{
+    file.open( path.c_str(), std::ios::binary | std::ios::trunc );
+    if (!file.is_open())
+        return false;
+
+    GLuint header[4] = { GR_TRACE_MAGIC, GR_TRACE_VERSION, (GLuint)width, (GLuint)height };
+    file.write( reinterpret_cast<const char*>(header), sizeof(header) );
+
+    frame_count = 0;
+    byte_count = sizeof(header);
+
+    return file.good();
+}
+
+void
+GLCapture::close()
+{
+    if (file.is_open())
+        file.close();
+}
+
+bool
+GLCapture::isOpen() { return file.is_open(); }
+
+void
+GLCapture::begin( TraceOp op )
+{
+    record.clear();
+    record.push_back( (unsigned char)op );
+
+    // payload size, patched in by end().
+    record.resize( 1 + sizeof(GLuint) );
+}
+
+void
+GLCapture::put( const void *data, size_t size )
+{
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    record.insert( record.end(), bytes, bytes + size );
+}
+
+void
+GLCapture::putUint( GLuint value ) { put( &value, sizeof(value) ); }
+
+void
+GLCapture::putInt( GLint value ) { put( &value, sizeof(value) ); }
+
+void
+GLCapture::putFloat( GLfloat value ) { put( &value, sizeof(value) ); }
+
+void
+GLCapture::putString( const std::string &value )
+{
+    putUint( value.size() );
+    put( value.data(), value.size() );
+}
+
+void
+GLCapture::putBlob( const void *data, size_t size )
+{
+    if (data == NULL)
+        size = 0;
+
+    putUint( size );
+    put( data, size );
+}
+
+void
+GLCapture::end()
+{
+    GLuint payload = record.size() - 1 - sizeof(GLuint);
+    std::memcpy( &record[1], &payload, sizeof(payload) );
+
+    file.write( reinterpret_cast<const char*>(&record[0]), record.size() );
+    byte_count += record.size();
+}
+
+void
+GLCapture::recordGenerate( TraceOp op, const std::string &identifier, GLuint uid )
+{
+    begin( op );
+    putString( identifier );
+    putUint( uid );
+    end();
+}
+
+void
+GLCapture::recordDestroy( TraceOp op, const std::string &identifier )
+{
+    begin( op );
+    putString( identifier );
+    end();
+}
+
+void
+GLCapture::recordVAPConfiguration( const VAPconfig &configuration )
+{
+    begin( GR_TRACE_VAP_CONFIGURATION );
+    putUint( configuration.index );
+    putInt( configuration.size );
+    putUint( configuration.type );
+    putUint( configuration.normalized );
+    putInt( configuration.stride );
+    putUint( (GLuint)(uintptr_t)configuration.pointer );
+    end();
+}
+
+void
+GLCapture::recordLinkVAPModule()
+{
+    begin( GR_TRACE_LINK_VAP_MODULE );
+    end();
+}
+
+void
+GLCapture::recordShaderProgram(
+        const ShaderProgram &program,
+        const VertexShader *vertex_shader,
+        const FragmentShader *fragment_shader )
+{
+    begin( GR_TRACE_SHADER_PROGRAM );
+    putString( program.identifier );
+    putUint( program.uid );
+    putString( vertex_shader->source_code );
+    putString( fragment_shader->source_code );
+    end();
+}
+
+void
+GLCapture::recordInitializeVertexBuffer( const VertexBuffer &vbo, const ElementBuffer &ebo, int vap )
+{
+    begin( GR_TRACE_INITIALIZE_VERTEX_BUFFER );
+    putString( vbo.identifier );
+    putUint( vbo.uid );
+    putBlob( vbo.data, vbo.size );
+    putString( ebo.identifier );
+    putUint( ebo.uid );
+    putBlob( ebo.data, ebo.uid > 0 ? ebo.size : 0 );
+    putInt( vap );
+    end();
+}
+
+void
+GLCapture::recordInitializeElementBuffer( const ElementBuffer &ebo )
+{
+    begin( GR_TRACE_INITIALIZE_ELEMENT_BUFFER );
+    putString( ebo.identifier );
+    putUint( ebo.uid );
+    putBlob( ebo.data, ebo.size );
+    end();
+}
+
+void
+GLCapture::recordUpdateBuffer( TraceOp op, GLuint uid, GLintptr offset, GLsizeiptr size, const GLvoid *data )
+{
+    begin( op );
+    putUint( uid );
+    putUint( offset );
+    putBlob( data, size );
+    end();
+}
+
+void
+GLCapture::recordBindVertexBuffer( GLuint vbo, GLuint ebo, int vap )
+{
+    begin( GR_TRACE_BIND_VERTEX_BUFFER );
+    putUint( vbo );
+    putUint( ebo );
+    putInt( vap );
+    end();
+}
+
+void
+GLCapture::recordActive( TraceOp op, GLuint uid )
+{
+    begin( op );
+    putUint( uid );
+    end();
+}
+
+void
+GLCapture::recordBindUniformBlock( GLuint program, const std::string &block, GLuint binding )
+{
+    begin( GR_TRACE_BIND_UNIFORM_BLOCK );
+    putUint( program );
+    putString( block );
+    putUint( binding );
+    end();
+}
+
+void
+GLCapture::recordUniformLocation( GLuint program, const std::string &uniform, GLint location )
+{
+    begin( GR_TRACE_UNIFORM_LOCATION );
+    putUint( program );
+    putString( uniform );
+    putInt( location );
+    end();
+}
+
+void
+GLCapture::recordUniformBlock( TraceOp op, const GLvoid *data, GLsizeiptr size )
+{
+    begin( op );
+    putBlob( data, size );
+    end();
+}
+
+void
+GLCapture::recordUniform( GLuint program, GLint location, GLuint value )
+{
+    begin( GR_TRACE_UNIFORM_UINT );
+    putUint( program );
+    putInt( location );
+    putUint( value );
+    end();
+}
+
+void
+GLCapture::recordUniform( GLuint program, GLint location, GLfloat value )
+{
+    begin( GR_TRACE_UNIFORM_FLOAT );
+    putUint( program );
+    putInt( location );
+    putFloat( value );
+    end();
+}
+
+void
+GLCapture::recordUniform( GLuint program, GLint location, const GLfloat *matrices, GLsizei count, GLboolean transpose )
+{
+    begin( GR_TRACE_UNIFORM_MATRIX );
+    putUint( program );
+    putInt( location );
+    putUint( transpose );
+    putBlob( matrices, count * 16 * sizeof(GLfloat) );
+    end();
+}
+
+void
+GLCapture::recordClear( GLclampf r, GLclampf g, GLclampf b, GLclampf a )
+{
+    begin( GR_TRACE_CLEAR );
+    putFloat( r );
+    putFloat( g );
+    putFloat( b );
+    putFloat( a );
+    end();
+}
+
+void
+GLCapture::recordDraw( RenderType mode )
+{
+    begin( GR_TRACE_DRAW );
+    putUint( mode );
+    end();
+}
+
+void
+GLCapture::recordExecute( const FramePacket *packet )
+{
+    begin( GR_TRACE_EXECUTE );
+
+    for (int c = 0; c < 4; ++c)
+        putFloat( packet->clear_color[c] );
+    put( &packet->view[0][0], 16 * sizeof(GLfloat) );
+    put( &packet->projection[0][0], 16 * sizeof(GLfloat) );
+
+    // the structs are plain data, but their padding isn't worth keeping
+    // stable across compilers; write them field by field.
+    putUint( packet->draws.size() );
+    for (GLuint d = 0; d < packet->draws.size(); ++d) {
+        const DrawItem &item = packet->draws[d];
+
+        putUint( item.program );
+        putUint( item.vbo );
+        putUint( item.ebo );
+        putInt( item.vap );
+        putInt( item.element_count );
+        putInt( item.view_location );
+        putInt( item.projection_location );
+        putUint( item.first_uniform );
+        putUint( item.uniform_count );
+    }
+
+    putUint( packet->uniforms.size() );
+    for (GLuint u = 0; u < packet->uniforms.size(); ++u) {
+        const UniformValue &value = packet->uniforms[u];
+
+        putInt( value.location );
+        putUint( value.type );
+        putInt( value.count );
+        putUint( value.offset );
+    }
+
+    putBlob( packet->uniform_data.empty() ? NULL : &packet->uniform_data[0],
+             packet->uniform_data.size() * sizeof(GLfloat) );
+
+    end();
+}
+
+void
+GLCapture::recordEndFrame()
+{
+    begin( GR_TRACE_END_FRAME );
+    end();
+
+    // a frame is the unit of replay; make sure a crash keeps whole ones.
+    file.flush();
+    ++frame_count;
+}
+
+unsigned long long
+GLCapture::getFrameCount() { return frame_count; }
+
+unsigned long long
+GLCapture::getByteCount() { return byte_count; }
+
+GLReplay::GLReplay()
+{
+    width = height = 0;
+    cursor = 0;
+    is_valid = false;
+    frame = 0;
+    vap_count = 0;
+}
+
+bool
+GLReplay::open( const std::string &path )
+{
+    file.open( path.c_str(), std::ios::binary );
+    if (!file.is_open())
+        return false;
+
+    GLuint header[4];
+    file.read( reinterpret_cast<char*>(header), sizeof(header) );
+
+    is_valid = file.good() && header[0] == GR_TRACE_MAGIC && header[1] == GR_TRACE_VERSION;
+    width = (GLint)header[2];
+    height = (GLint)header[3];
+
+    return is_valid;
+}
+
+GLint
+GLReplay::getWidth() { return width; }
+
+GLint
+GLReplay::getHeight() { return height; }
+
+unsigned long long
+GLReplay::getFrame() { return frame; }
+
+bool
+GLReplay::readRecord( TraceOp &op )
+{
+    unsigned char code = 0;
+    GLuint size = 0;
+
+    file.read( reinterpret_cast<char*>(&code), 1 );
+    file.read( reinterpret_cast<char*>(&size), sizeof(size) );
+    if (!file.good() || size > MAX_RECORD_BYTES)
+        return false;
+
+    // an op this build doesn't know means the trace is damaged.
+    if (code < GR_TRACE_GENERATE_VAO || code > GR_TRACE_DESTROY_PROGRAM)
+        return false;
+
+    record.resize( size );
+    if (size > 0)
+        file.read( reinterpret_cast<char*>(&record[0]), size );
+    if (!file.good())
+        return false;
+
+    op = (TraceOp)code;
+    cursor = 0;
+
+    return true;
+}
+
+void
+GLReplay::get( void *data, size_t size )
+{
+    // a short record reads as zeros; nothing acts on it, since the
+    // record is checked with isComplete() before it's replayed.
+    if (cursor + size > record.size()) {
+        std::memset( data, 0, size );
+        cursor = record.size() + 1;
+        return;
+    }
+
+    std::memcpy( data, &record[cursor], size );
+    cursor += size;
+}
+
+GLuint
+GLReplay::getUint()
+{
+    GLuint value;
+    get( &value, sizeof(value) );
+    return value;
+}
+
+GLint
+GLReplay::getInt()
+{
+    GLint value;
+    get( &value, sizeof(value) );
+    return value;
+}
+
+GLfloat
+GLReplay::getFloat()
+{
+    GLfloat value;
+    get( &value, sizeof(value) );
+    return value;
+}
+
+std::string
+GLReplay::getString()
+{
+    GLuint size = getUint();
+    if (cursor > record.size() || size > record.size() - cursor) {
+        cursor = record.size() + 1;
+        return std::string();
+    }
+
+    if (size == 0)
+        return std::string();
+
+    std::string value( reinterpret_cast<const char*>(&record[cursor]), size );
+    cursor += size;
+
+    return value;
+}
+
+size_t
+GLReplay::getBlob( std::vector<unsigned char> &blob )
+{
+    GLuint size = getUint();
+    blob.clear();
+
+    // past a short read the cursor is already beyond the record, so it
+    // mustn't be used to index it.
+    if (cursor > record.size() || size > record.size() - cursor) {
+        cursor = record.size() + 1;
+        return 0;
+    }
+
+    if (size == 0)
+        return 0;
+
+    blob.assign( &record[cursor], &record[cursor] + size );
+    cursor += size;
+
+    return size;
+}
+
+bool
+GLReplay::isComplete() { return cursor <= record.size(); }
+
+bool
+GLReplay::isModule( int vap ) { return vap >= 0 && vap < vap_count; }
+
+GLuint
+GLReplay::mapName( const std::map<GLuint, GLuint> &names, GLuint captured )
+{
+    if (captured == 0)
+        return 0;
+
+    std::map<GLuint, GLuint>::const_iterator name = names.find( captured );
+    return (name != names.end()) ? name->second : 0;
+}
+
+GLint
+GLReplay::mapLocation( GLuint program, GLint location )
+{
+    // a location never looked up through the renderer is used as is,
+    // which holds on the driver it was captured with.
+    std::map<ProgramLocation, GLint>::iterator mapped =
+        locations.find( ProgramLocation( program, location ) );
+
+    return (mapped != locations.end()) ? mapped->second : location;
+}
+
+void
+GLReplay::replayRecord( TraceOp op, Renderer *renderer )
+{
+    // every case reads its whole record first; a record that ran short
+    // reaches the renderer with nothing, not with zeroed fields.
+    switch (op) {
+        case GR_TRACE_GENERATE_VAO:
+        case GR_TRACE_GENERATE_VBO:
+        case GR_TRACE_GENERATE_EBO: {
+            std::string identifier = getString();
+            GLuint captured = getUint();
+            if (!isComplete())
+                break;
+
+            if (op == GR_TRACE_GENERATE_VAO)
+                vao_names[captured] = renderer->generateVAO( identifier ).uid;
+            else if (op == GR_TRACE_GENERATE_VBO)
+                buffer_names[captured] = renderer->generateVBO( identifier ).uid;
+            else
+                buffer_names[captured] = renderer->generateEBO( identifier ).uid;
+            break;
+        }
+
+        case GR_TRACE_DESTROY_VAO:
+        case GR_TRACE_DESTROY_VBO:
+        case GR_TRACE_DESTROY_EBO:
+        case GR_TRACE_DESTROY_PROGRAM: {
+            std::string identifier = getString();
+            if (!isComplete())
+                break;
+
+            switch (op) {
+                case GR_TRACE_DESTROY_VAO: renderer->destroyVAO( identifier ); break;
+                case GR_TRACE_DESTROY_VBO: renderer->destroyVBO( identifier ); break;
+                case GR_TRACE_DESTROY_EBO: renderer->destroyEBO( identifier ); break;
+                default:                   renderer->destroyShaderProgram( identifier ); break;
+            }
+            break;
+        }
+
+        case GR_TRACE_VAP_CONFIGURATION: {
+            VAPconfig configuration;
+            configuration.index = getUint();
+            configuration.size = getInt();
+            configuration.type = getUint();
+            configuration.normalized = (GLboolean)getUint();
+            configuration.stride = getInt();
+            configuration.pointer = (const GLvoid*)(uintptr_t)getUint();
+            if (!isComplete())
+                break;
+
+            renderer->addVAPConfiguration( configuration );
+            break;
+        }
+        case GR_TRACE_LINK_VAP_MODULE:
+            renderer->linkVAPModule();
+            ++vap_count;
+            break;
+
+        case GR_TRACE_SHADER_PROGRAM: {
+            std::string identifier = getString();
+            GLuint captured = getUint();
+            std::string vertex_source = getString();
+            std::string fragment_source = getString();
+            if (!isComplete())
+                break;
+
+            // the program keeps pointers to its sources.
+            strings.push_back( vertex_source );
+            VertexShader vertex_shader;
+            vertex_shader.source_code = strings.back().c_str();
+
+            strings.push_back( fragment_source );
+            FragmentShader fragment_shader;
+            fragment_shader.source_code = strings.back().c_str();
+
+            program_names[captured] =
+                renderer->createShaderProgram( identifier, &vertex_shader, &fragment_shader ).uid;
+            break;
+        }
+
+        case GR_TRACE_INITIALIZE_VERTEX_BUFFER: {
+            VertexBuffer vbo;
+            ElementBuffer ebo;
+            std::vector<unsigned char> vertices, indices;
+
+            vbo.identifier = getString();
+            vbo.uid = mapName( buffer_names, getUint() );
+            vbo.size = getBlob( vertices );
+
+            ebo.identifier = getString();
+            ebo.uid = mapName( buffer_names, getUint() );
+            ebo.size = getBlob( indices );
+
+            int vap = getInt();
+            if (!isComplete() || !isModule( vap ))
+                break;
+
+            // the renderer keeps the data pointers, as it does for the
+            // application; the blobs live as long as the replay.
+            blobs.push_back( std::vector<unsigned char>() );
+            blobs.back().swap( vertices );
+            vbo.data = blobs.back().empty() ? NULL : &blobs.back()[0];
+
+            blobs.push_back( std::vector<unsigned char>() );
+            blobs.back().swap( indices );
+            ebo.data = blobs.back().empty() ? NULL : &blobs.back()[0];
+
+            renderer->initializeVertexBuffer( vbo, ebo, vap );
+            break;
+        }
+        case GR_TRACE_INITIALIZE_ELEMENT_BUFFER: {
+            ElementBuffer ebo;
+            std::vector<unsigned char> indices;
+
+            ebo.identifier = getString();
+            ebo.uid = mapName( buffer_names, getUint() );
+            ebo.size = getBlob( indices );
+            if (!isComplete())
+                break;
+
+            blobs.push_back( std::vector<unsigned char>() );
+            blobs.back().swap( indices );
+            ebo.data = blobs.back().empty() ? NULL : &blobs.back()[0];
+
+            renderer->initializeElementBuffer( ebo );
+            break;
+        }
+        case GR_TRACE_UPDATE_VERTEX_BUFFER:
+        case GR_TRACE_UPDATE_ELEMENT_BUFFER: {
+            VertexBuffer buffer;
+            buffer.uid = mapName( buffer_names, getUint() );
+            GLintptr offset = getUint();
+            GLsizeiptr size = getBlob( scratch );
+
+            if (!isComplete() || size == 0)
+                break;
+
+            if (op == GR_TRACE_UPDATE_VERTEX_BUFFER)
+                renderer->updateVertexBuffer( buffer, offset, size, &scratch[0] );
+            else
+                renderer->updateElementBuffer( buffer, offset, size, &scratch[0] );
+            break;
+        }
+
+        case GR_TRACE_BIND_VERTEX_BUFFER: {
+            VertexBuffer vbo;
+            ElementBuffer ebo;
+            vbo.uid = mapName( buffer_names, getUint() );
+            ebo.uid = mapName( buffer_names, getUint() );
+            int vap = getInt();
+            if (!isComplete() || !isModule( vap ))
+                break;
+
+            renderer->bindVertexBuffer( vbo, ebo, vap );
+            break;
+        }
+
+        case GR_TRACE_ACTIVE_VERTEX_ARRAY: {
+            VertexArray vao;
+            vao.uid = mapName( vao_names, getUint() );
+            if (!isComplete())
+                break;
+
+            renderer->setActiveVertexArray( vao );
+            break;
+        }
+        case GR_TRACE_ACTIVE_SHADER_PROGRAM: {
+            ShaderProgram program;
+            program.uid = mapName( program_names, getUint() );
+            if (!isComplete())
+                break;
+
+            renderer->setActiveShaderProgram( program );
+            break;
+        }
+
+        case GR_TRACE_BIND_UNIFORM_BLOCK: {
+            ShaderProgram program;
+            program.uid = mapName( program_names, getUint() );
+            std::string block = getString();
+            GLuint binding = getUint();
+            if (!isComplete())
+                break;
+
+            renderer->bindUniformBlock( program, block, binding );
+            break;
+        }
+        case GR_TRACE_UNIFORM_LOCATION: {
+            GLuint captured = getUint();
+            std::string uniform = getString();
+            GLint location = getInt();
+            if (!isComplete())
+                break;
+
+            ShaderProgram program;
+            program.uid = mapName( program_names, captured );
+            locations[ProgramLocation( captured, location )] = renderer->getUniform( uniform, program );
+            break;
+        }
+
+        case GR_TRACE_FRAME_UNIFORMS:
+        case GR_TRACE_DRAW_UNIFORMS: {
+            GLsizeiptr size = getBlob( scratch );
+            if (!isComplete() || size == 0)
+                break;
+
+            if (op == GR_TRACE_FRAME_UNIFORMS)
+                renderer->setFrameUniforms( &scratch[0], size );
+            else
+                renderer->setDrawUniforms( &scratch[0], size );
+            break;
+        }
+        case GR_TRACE_UNIFORM_UINT: {
+            GLuint program = getUint();
+            GLint location = getInt();
+            GLuint value = getUint();
+            if (!isComplete())
+                break;
+
+            renderer->setUniform( value, mapLocation( program, location ) );
+            break;
+        }
+        case GR_TRACE_UNIFORM_FLOAT: {
+            GLuint program = getUint();
+            GLint location = getInt();
+            GLfloat value = getFloat();
+            if (!isComplete())
+                break;
+
+            renderer->setUniform( value, mapLocation( program, location ) );
+            break;
+        }
+        case GR_TRACE_UNIFORM_MATRIX: {
+            GLuint program = getUint();
+            GLint location = getInt();
+            GLboolean transpose = (GLboolean)getUint();
+            GLsizei count = getBlob( scratch ) / (16 * sizeof(GLfloat));
+            if (!isComplete() || count == 0)
+                break;
+
+            renderer->setUniform( reinterpret_cast<const GLfloat*>(&scratch[0]), count, transpose,
+                                  mapLocation( program, location ) );
+            break;
+        }
+
+        case GR_TRACE_CLEAR: {
+            GLclampf color[4];
+            for (int c = 0; c < 4; ++c)
+                color[c] = getFloat();
+            if (!isComplete())
+                break;
+
+            renderer->clear( color[0], color[1], color[2], color[3] );
+            break;
+        }
+        case GR_TRACE_DRAW: {
+            RenderType mode = (RenderType)getUint();
+            if (!isComplete())
+                break;
+
+            renderer->draw( mode );
+            break;
+        }
+        case GR_TRACE_EXECUTE:
+            replayExecute( renderer );
+            break;
+
+        case GR_TRACE_END_FRAME:
+            renderer->endFrame();
+            break;
+    }
+}
+
+void
+GLReplay::replayExecute( Renderer *renderer )
+{
+    resetFramePacket( &packet );
+    packet.frame = frame;
+
+    for (int c = 0; c < 4; ++c)
+        packet.clear_color[c] = getFloat();
+    get( &packet.view[0][0], 16 * sizeof(GLfloat) );
+    get( &packet.projection[0][0], 16 * sizeof(GLfloat) );
+
+    // uniform locations belong to the program as captured; keep it per
+    // draw until the uniforms are read.
+    std::vector<GLuint> &captured_programs = program_scratch;
+    captured_programs.clear();
+
+    GLuint draw_count = getUint();
+    for (GLuint d = 0; d < draw_count && cursor <= record.size(); ++d) {
+        DrawItem item;
+        GLuint program = getUint();
+
+        item.program = mapName( program_names, program );
+        item.vbo = mapName( buffer_names, getUint() );
+        item.ebo = mapName( buffer_names, getUint() );
+        item.vap = getInt();
+        item.element_count = getInt();
+        item.view_location = mapLocation( program, getInt() );
+        item.projection_location = mapLocation( program, getInt() );
+        item.first_uniform = getUint();
+        item.uniform_count = getUint();
+
+        packet.draws.push_back( item );
+        captured_programs.push_back( program );
+    }
+
+    GLuint uniform_count = getUint();
+    for (GLuint u = 0; u < uniform_count && cursor <= record.size(); ++u) {
+        UniformValue value;
+        value.location = getInt();
+        value.type = getUint();
+        value.count = getInt();
+        value.offset = getUint();
+
+        packet.uniforms.push_back( value );
+    }
+
+    size_t floats = getBlob( scratch ) / sizeof(GLfloat);
+    packet.uniform_data.resize( floats );
+    if (floats > 0)
+        std::memcpy( &packet.uniform_data[0], &scratch[0], floats * sizeof(GLfloat) );
+
+    // Renderer::execute() trusts the packet's ranges; a frame whose
+    // ranges don't hold is dropped rather than read out of bounds.
+    if (!isComplete() || !isPacketValid())
+        return;
+
+    for (GLuint d = 0; d < packet.draws.size(); ++d) {
+        const DrawItem &item = packet.draws[d];
+
+        for (GLuint u = item.first_uniform; u < item.first_uniform + item.uniform_count; ++u)
+            packet.uniforms[u].location = mapLocation( captured_programs[d], packet.uniforms[u].location );
+    }
+
+    renderer->execute( &packet );
+}
+
+bool
+GLReplay::isPacketValid()
+{
+    for (GLuint d = 0; d < packet.draws.size(); ++d) {
+        const DrawItem &item = packet.draws[d];
+
+        if (!isModule( item.vap ))
+            return false;
+
+        if (item.first_uniform > packet.uniforms.size() ||
+            item.uniform_count > packet.uniforms.size() - item.first_uniform)
+            return false;
+    }
+
+    for (GLuint u = 0; u < packet.uniforms.size(); ++u) {
+        const UniformValue &value = packet.uniforms[u];
+        GLuint64 components = 0;
+
+        switch (value.type) {
+            case GL_FLOAT_MAT4:   components = 16; break;
+            case GL_FLOAT_VEC4:   components = 4; break;
+            case GL_FLOAT:
+            case GL_UNSIGNED_INT: components = 1; break;
+            default:              return false;
+        }
+
+        if (value.count < 1 ||
+            (GLuint64)value.offset + (GLuint64)value.count * components > packet.uniform_data.size())
+            return false;
+    }
+
+    return true;
+}
+
+bool
+GLReplay::replayFrame( Renderer *renderer )
+{
+    if (!is_valid)
+        return false;
+
+    TraceOp op;
+    while (readRecord( op )) {
+        replayRecord( op, renderer );
+
+        if (!isComplete()) {
+            is_valid = false;
+            return false;
+        }
+
+        if (op == GR_TRACE_END_FRAME) {
+            ++frame;
+            return true;
+        }
+    }
+
+    is_valid = false;
+    return false;
+}
@@ -0,0 +1,223 @@
+#include "gl_debug.hpp"
+#include <iostream>
+
+using namespace GearsEngine;
+
+static unsigned int
+severityRank( GLenum severity )
+{
+    switch (severity) {
+        case GL_DEBUG_SEVERITY_HIGH:   return 3;
+        case GL_DEBUG_SEVERITY_MEDIUM: return 2;
+        case GL_DEBUG_SEVERITY_LOW:    return 1;
+        default:                       return 0;
+    }
+}
+
+static const char *
+sourceName( GLenum source )
+{
+    switch (source) {
+        case GL_DEBUG_SOURCE_API:             return "api";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window-system";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader-compiler";
+        case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third-party";
+        case GL_DEBUG_SOURCE_APPLICATION:     return "application";
+        default:                              return "other";
+    }
+}
+
+static const char *
+typeName( GLenum type )
+{
+    switch (type) {
+        case GL_DEBUG_TYPE_ERROR:               return "error";
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined";
+        case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+        case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+        case GL_DEBUG_TYPE_MARKER:              return "marker";
+        default:                                return "other";
+    }
+}
+
+static const char *
+errorName( GLenum error )
+{
+    switch (error) {
+        case GL_INVALID_ENUM:                  return "GL_INVALID_ENUM";
+        case GL_INVALID_VALUE:                 return "GL_INVALID_VALUE";
+        case GL_INVALID_OPERATION:             return "GL_INVALID_OPERATION";
+        case GL_INVALID_FRAMEBUFFER_OPERATION: return "GL_INVALID_FRAMEBUFFER_OPERATION";
+        case GL_OUT_OF_MEMORY:                 return "GL_OUT_OF_MEMORY";
+        default:                               return "unknown GL error";
+    }
+}
+
+GLDiagnostics::GLDiagnostics()
+{
+    mode = GR_DEBUG_OFF;
+    has_khr_debug = false;
+
+    for (int s = 0; s < 4; ++s)
+        message_counts[s] = 0;
+}
+
+GLDiagnostics::~GLDiagnostics()
+{
+    if (has_khr_debug && mode != GR_DEBUG_OFF)
+        glDebugMessageCallback( NULL, NULL );
+}
+
+void
+GLDiagnostics::setMode( DebugMode new_mode )
+{
+    has_khr_debug = GLEW_KHR_debug || GLEW_VERSION_4_3;
+    mode = new_mode;
+
+    if (!has_khr_debug) {
+        if (mode == GR_DEBUG_ASYNC)
+            mode = GR_DEBUG_OFF;
+        return;
+    }
+
+    switch (mode) {
+        case GR_DEBUG_OFF:
+            glDebugMessageCallback( NULL, NULL );
+            glDisable( GL_DEBUG_OUTPUT );
+            break;
+
+        case GR_DEBUG_ASYNC:
+            glEnable( GL_DEBUG_OUTPUT );
+            glDisable( GL_DEBUG_OUTPUT_SYNCHRONOUS );
+            glDebugMessageCallback( &callback, this );
+            break;
+
+        case GR_DEBUG_SYNC:
+            glEnable( GL_DEBUG_OUTPUT );
+            glEnable( GL_DEBUG_OUTPUT_SYNCHRONOUS );
+            glDebugMessageCallback( &callback, this );
+            break;
+    }
+}
+
+DebugMode
+GLDiagnostics::getMode() { return mode; }
+
+void
+GLDiagnostics::addRoute(
+        GLenum source,
+        GLenum type,
+        GLenum min_severity,
+        DebugSink sink,
+        void *userdata )
+{
+    DebugRoute route;
+    route.source = source;
+    route.type = type;
+    route.min_severity = min_severity;
+    route.sink = sink;
+    route.userdata = userdata;
+
+    std::lock_guard<std::mutex> lock( route_mutex );
+    routes.push_back( route );
+}
+
+void
+GLDiagnostics::clearRoutes()
+{
+    std::lock_guard<std::mutex> lock( route_mutex );
+    routes.clear();
+}
+
+void
+GLDiagnostics::setFilter( GLenum source, GLenum type, GLenum severity, bool enabled )
+{
+    if (has_khr_debug)
+        glDebugMessageControl( source, type, severity, 0, NULL, enabled ? GL_TRUE : GL_FALSE );
+}
+
+void
+GLDiagnostics::muteMessage( GLenum source, GLenum type, GLuint id )
+{
+    if (has_khr_debug)
+        glDebugMessageControl( source, type, GL_DONT_CARE, 1, &id, GL_FALSE );
+}
+
+void
+GLDiagnostics::dispatch( const DebugMessage *message )
+{
+    ++message_counts[severityRank( message->severity )];
+
+    std::lock_guard<std::mutex> lock( route_mutex );
+
+    for (unsigned int r = 0; r < routes.size(); ++r) {
+        const DebugRoute &route = routes[r];
+
+        if (route.source != GL_DONT_CARE && route.source != message->source)
+            continue;
+        if (route.type != GL_DONT_CARE && route.type != message->type)
+            continue;
+        if (severityRank(message->severity) < severityRank(route.min_severity))
+            continue;
+
+        route.sink( message, route.userdata );
+    }
+}
+
+void
+GLDiagnostics::drainErrors( const char *call )
+{
+    // without KHR_debug this is the only place errors surface at all.
+    for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError()) {
+        DebugMessage message;
+        message.source = GL_DEBUG_SOURCE_API;
+        message.type = GL_DEBUG_TYPE_ERROR;
+        message.severity = GL_DEBUG_SEVERITY_HIGH;
+        message.id = error;
+        message.text = errorName( error );
+        message.call = call;
+
+        dispatch( &message );
+    }
+}
+
+void APIENTRY
+GLDiagnostics::callback(
+        GLenum source,
+        GLenum type,
+        GLuint id,
+        GLenum severity,
+        GLsizei,
+        const GLchar *text,
+        const void *diagnostics )
+{
+    DebugMessage message;
+    message.source = source;
+    message.type = type;
+    message.severity = severity;
+    message.id = id;
+    message.text = text;
+    message.call = NULL;
+
+    const_cast<GLDiagnostics*>(static_cast<const GLDiagnostics*>(diagnostics))->dispatch( &message );
+}
+
+GLuint
+GLDiagnostics::getMessageCount( GLenum severity )
+{
+    return message_counts[severityRank( severity )];
+}
+
+void
+GLDiagnostics::logSink( const DebugMessage *message, void* )
+{
+    static std::mutex log_mutex;
+    std::lock_guard<std::mutex> lock( log_mutex );
+
+    std::cerr << "[gl " << sourceName(message->source) << '/' << typeName(message->type)
+              << " #" << message->id << "] ";
+    if (message->call != NULL)
+        std::cerr << message->call << ": ";
+    std::cerr << message->text << '\n';
+}
@@ -1,3 +1,241 @@
 #include "gl_object.hpp"
 
+using namespace GearsEngine;
 
+// names generated per driver call when a pool runs dry.
+static const GLsizei NAME_BATCH = 32;
+
+static void genVertexArrays( GLsizei n, GLuint *names )       { glGenVertexArrays( n, names ); }
+static void delVertexArrays( GLsizei n, const GLuint *names ) { glDeleteVertexArrays( n, names ); }
+static void genBuffers( GLsizei n, GLuint *names )            { glGenBuffers( n, names ); }
+static void delBuffers( GLsizei n, const GLuint *names )      { glDeleteBuffers( n, names ); }
+static void newVertexArrays( GLsizei n, GLuint *names )       { glCreateVertexArrays( n, names ); }
+static void newBuffers( GLsizei n, GLuint *names )            { glCreateBuffers( n, names ); }
+static void newFramebuffers( GLsizei n, GLuint *names )       { glCreateFramebuffers( n, names ); }
+static void genTextures( GLsizei n, GLuint *names )           { glGenTextures( n, names ); }
+static void delTextures( GLsizei n, const GLuint *names )     { glDeleteTextures( n, names ); }
+static void genFramebuffers( GLsizei n, GLuint *names )       { glGenFramebuffers( n, names ); }
+static void delFramebuffers( GLsizei n, const GLuint *names ) { glDeleteFramebuffers( n, names ); }
+
+static GLuint
+linkProgram( const GLenum *stages, const GLchar **sources, GLuint count )
+{
+    GLuint program = glCreateProgram();
+
+    for (GLuint s = 0; s < count; ++s) {
+        GLuint shader = glCreateShader( stages[s] );
+        glShaderSource( shader, 1, &sources[s], NULL );
+        glCompileShader( shader );
+
+        // deleting an attached shader only flags it; it goes with the program.
+        glAttachShader( program, shader );
+        glDeleteShader( shader );
+    }
+
+    glLinkProgram( program );
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv( program, GL_LINK_STATUS, &linked );
+    if (linked != GL_TRUE) {
+        glDeleteProgram( program );
+        return 0;
+    }
+
+    return program;
+}
+
+GLNamePool::GLNamePool( GenerateNames generate, DeleteNames destroy, GLsizei batch )
+{
+    generate_names = generate;
+    delete_names = destroy;
+    batch_size = (batch > 0) ? batch : 1;
+}
+
+GLuint
+GLNamePool::acquire()
+{
+    if (free_names.empty()) {
+        free_names.resize( batch_size );
+        generate_names( batch_size, &free_names[0] );
+    }
+
+    GLuint name = free_names.back();
+    free_names.pop_back();
+
+    return name;
+}
+
+void
+GLNamePool::release( GLuint name )
+{
+    if (name != 0)
+        released_names.push_back( name );
+}
+
+void
+GLNamePool::retire()
+{
+    if (released_names.empty())
+        return;
+
+    RetiredNames batch;
+    batch.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    batch.names.swap( released_names );
+
+    retired.push_back( batch );
+}
+
+void
+GLNamePool::collect( bool wait )
+{
+    while (!retired.empty()) {
+        RetiredNames &oldest = retired.front();
+
+        GLuint64 timeout = wait ? 1000000000ull : 0;
+        GLenum status = glClientWaitSync( oldest.fence, 0, timeout );
+
+        // fences signal in submission order, so the first pending one
+        // means everything behind it is still pending as well.
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            if (!wait || status == GL_WAIT_FAILED)
+                break;
+            continue;
+        }
+
+        delete_names( oldest.names.size(), &oldest.names[0] );
+        glDeleteSync( oldest.fence );
+        retired.pop_front();
+    }
+}
+
+void
+GLNamePool::purge()
+{
+    while (!retired.empty()) {
+        delete_names( retired.front().names.size(), &retired.front().names[0] );
+        glDeleteSync( retired.front().fence );
+        retired.pop_front();
+    }
+
+    if (!released_names.empty())
+        delete_names( released_names.size(), &released_names[0] );
+    if (!free_names.empty())
+        delete_names( free_names.size(), &free_names[0] );
+
+    released_names.clear();
+    free_names.clear();
+}
+
+void
+GLNamePool::setGenerator( GenerateNames generate )
+{
+    if (generate == generate_names)
+        return;
+
+    if (!free_names.empty())
+        delete_names( free_names.size(), &free_names[0] );
+
+    free_names.clear();
+    generate_names = generate;
+}
+
+GLuint
+GLNamePool::getFreeCount() { return free_names.size(); }
+
+GLuint
+GLNamePool::getPendingCount()
+{
+    GLuint count = released_names.size();
+    for (GLuint r = 0; r < retired.size(); ++r)
+        count += retired[r].names.size();
+
+    return count;
+}
+
+void
+GearsEngine::retireGLObjects()
+{
+    GLNamePool *pools[] = {
+        &vaoTraits::Pool(), &bufferTraits::Pool(),
+        &textureTraits::Pool(), &framebufferTraits::Pool()
+    };
+
+    for (unsigned int p = 0; p < sizeof(pools)/sizeof(pools[0]); ++p) {
+        pools[p]->collect( false );
+        pools[p]->retire();
+    }
+}
+
+void
+GearsEngine::purgeGLObjects()
+{
+    vaoTraits::Pool().purge();
+    bufferTraits::Pool().purge();
+    textureTraits::Pool().purge();
+    framebufferTraits::Pool().purge();
+}
+
+void
+GearsEngine::useCreatedGLNames( bool enabled )
+{
+    vaoTraits::Pool().setGenerator( enabled ? &newVertexArrays : &genVertexArrays );
+    bufferTraits::Pool().setGenerator( enabled ? &newBuffers : &genBuffers );
+    framebufferTraits::Pool().setGenerator( enabled ? &newFramebuffers : &genFramebuffers );
+}
+
+GLuint
+GearsEngine::buildGLProgram( const GLchar *vertex_source, const GLchar *fragment_source )
+{
+    GLenum stages[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    const GLchar *sources[] = { vertex_source, fragment_source };
+
+    return linkProgram( stages, sources, 2 );
+}
+
+GLuint
+GearsEngine::buildGLComputeProgram( const GLchar *compute_source )
+{
+    GLenum stage = GL_COMPUTE_SHADER;
+
+    return linkProgram( &stage, &compute_source, 1 );
+}
+
+GLNamePool &
+vaoTraits::Pool()
+{
+    static GLNamePool pool( &genVertexArrays, &delVertexArrays, NAME_BATCH );
+    return pool;
+}
+
+GLNamePool &
+bufferTraits::Pool()
+{
+    static GLNamePool pool( &genBuffers, &delBuffers, NAME_BATCH );
+    return pool;
+}
+
+GLNamePool &
+textureTraits::Pool()
+{
+    static GLNamePool pool( &genTextures, &delTextures, NAME_BATCH );
+    return pool;
+}
+
+GLNamePool &
+framebufferTraits::Pool()
+{
+    static GLNamePool pool( &genFramebuffers, &delFramebuffers, NAME_BATCH );
+    return pool;
+}
+
+vaoTraits::value_type vaoTraits::Create()                 { return Pool().acquire(); }
+void                  vaoTraits::Destroy( value_type obj ) { Pool().release( obj ); }
+
+bufferTraits::value_type bufferTraits::Create()                 { return Pool().acquire(); }
+void                     bufferTraits::Destroy( value_type obj ) { Pool().release( obj ); }
+
+textureTraits::value_type textureTraits::Create()                 { return Pool().acquire(); }
+void                      textureTraits::Destroy( value_type obj ) { Pool().release( obj ); }
+
+framebufferTraits::value_type framebufferTraits::Create()                 { return Pool().acquire(); }
+void                          framebufferTraits::Destroy( value_type obj ) { Pool().release( obj ); }
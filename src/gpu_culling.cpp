@@ -0,0 +1,451 @@
+#include "gpu_culling.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+
+using namespace GearsEngine;
+
+static const GLchar *cull_source =
+    "#version 430\n"
+    "layout (local_size_x = 64) in;\n"
+    "struct Instance { mat4 model; vec4 bounds_min; vec4 bounds_max; uvec4 mesh; };\n"
+    "struct Command { uint count; uint instance_count; uint first_index; int base_vertex; uint base_instance; };\n"
+    "layout (std430, binding = 0) readonly buffer Instances { Instance instances[]; };\n"
+    "layout (std430, binding = 1) buffer Commands { Command commands[]; };\n"
+    "layout (std430, binding = 2) writeonly buffer Visible { uint visible[]; };\n"
+    "layout (location = 0) uniform vec4 frustum[6];\n"
+    "layout (location = 6) uniform uint instance_count;\n"
+    "layout (location = 7) uniform mat4 previous_view_projection;\n"
+    "layout (location = 8) uniform int pyramid_levels;\n"
+    "layout (location = 9) uniform vec2 pyramid_size;\n"
+    "layout (binding = 0) uniform sampler2D pyramid;\n"
+    "bool occluded( vec3 lo, vec3 hi )\n"
+    "{\n"
+    "    vec2 rect_min = vec2( 1.0 ), rect_max = vec2( 0.0 );\n"
+    "    float nearest = 1.0;\n"
+    "    for (int i = 0; i < 8; ++i) {\n"
+    "        vec3 corner = vec3( (i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y, (i & 4) != 0 ? hi.z : lo.z );\n"
+    "        vec4 clip = previous_view_projection * vec4( corner, 1.0 );\n"
+    "        if (clip.w <= 0.0)\n"
+    "            return false;\n"
+    "        vec3 window = clip.xyz / clip.w * 0.5 + 0.5;\n"
+    "        rect_min = min( rect_min, window.xy );\n"
+    "        rect_max = max( rect_max, window.xy );\n"
+    "        nearest = min( nearest, window.z );\n"
+    "    }\n"
+    "    rect_min = clamp( rect_min, 0.0, 1.0 );\n"
+    "    rect_max = clamp( rect_max, 0.0, 1.0 );\n"
+    "    vec2 extent = (rect_max - rect_min) * pyramid_size;\n"
+    "    float level = min( ceil(log2(max(max(extent.x, extent.y), 1.0))), float(pyramid_levels - 1) );\n"
+    "    float farthest = max( max(textureLod(pyramid, rect_min, level).r, textureLod(pyramid, vec2(rect_max.x, rect_min.y), level).r),\n"
+    "                          max(textureLod(pyramid, vec2(rect_min.x, rect_max.y), level).r, textureLod(pyramid, rect_max, level).r) );\n"
+    "    return nearest > farthest;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "    uint id = gl_GlobalInvocationID.x;\n"
+    "    if (id >= instance_count)\n"
+    "        return;\n"
+    "    Instance instance = instances[id];\n"
+    "    vec3 center = (instance.bounds_min.xyz + instance.bounds_max.xyz) * 0.5;\n"
+    "    vec3 extent = (instance.bounds_max.xyz - instance.bounds_min.xyz) * 0.5;\n"
+    "    center = (instance.model * vec4( center, 1.0 )).xyz;\n"
+    "    mat3 axes = mat3( instance.model );\n"
+    "    extent = abs(axes[0]) * extent.x + abs(axes[1]) * extent.y + abs(axes[2]) * extent.z;\n"
+    "    for (int p = 0; p < 6; ++p) {\n"
+    "        if (dot(frustum[p].xyz, center) + dot(abs(frustum[p].xyz), extent) + frustum[p].w < 0.0)\n"
+    "            return;\n"
+    "    }\n"
+    "    if (pyramid_levels > 0 && occluded( center - extent, center + extent ))\n"
+    "        return;\n"
+    "    uint mesh = instance.mesh.x;\n"
+    "    uint slot = atomicAdd( commands[mesh].instance_count, 1u );\n"
+    "    visible[commands[mesh].base_instance + slot] = id;\n"
+    "}\n"
+;
+
+// packs the non-empty commands to the front and writes their count; one
+// invocation, as the mesh count is small.
+static const GLchar *compact_source =
+    "#version 430\n"
+    "layout (local_size_x = 1) in;\n"
+    "struct Command { uint count; uint instance_count; uint first_index; int base_vertex; uint base_instance; };\n"
+    "layout (std430, binding = 1) readonly buffer Commands { Command commands[]; };\n"
+    "layout (std430, binding = 3) writeonly buffer Draws { Command draws[]; };\n"
+    "layout (std430, binding = 4) writeonly buffer Parameters { uint draw_count; };\n"
+    "layout (location = 0) uniform uint mesh_count;\n"
+    "void main()\n"
+    "{\n"
+    "    uint count = 0u;\n"
+    "    for (uint m = 0u; m < mesh_count; ++m)\n"
+    "        if (commands[m].instance_count > 0u)\n"
+    "            draws[count++] = commands[m];\n"
+    "    draw_count = count;\n"
+    "}\n"
+;
+
+// one pyramid level: the max over each step x step block of the source,
+// with an odd last row/column folded into the edge texels.
+static const GLchar *pyramid_source =
+    "#version 430\n"
+    "layout (local_size_x = 8, local_size_y = 8) in;\n"
+    "layout (binding = 0) uniform sampler2D source;\n"
+    "layout (r32f, binding = 0) writeonly uniform image2D destination;\n"
+    "layout (location = 0) uniform int source_level;\n"
+    "layout (location = 1) uniform int step;\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 size = imageSize( destination );\n"
+    "    ivec2 texel = ivec2( gl_GlobalInvocationID.xy );\n"
+    "    if (texel.x >= size.x || texel.y >= size.y)\n"
+    "        return;\n"
+    "    ivec2 source_size = textureSize( source, source_level );\n"
+    "    ivec2 first = texel * step;\n"
+    "    ivec2 last = min( first + step - 1, source_size - 1 );\n"
+    "    if (texel.x == size.x - 1) last.x = source_size.x - 1;\n"
+    "    if (texel.y == size.y - 1) last.y = source_size.y - 1;\n"
+    "    float depth = 0.0;\n"
+    "    for (int y = first.y; y <= last.y; ++y)\n"
+    "        for (int x = first.x; x <= last.x; ++x)\n"
+    "            depth = max( depth, texelFetch(source, ivec2(x, y), source_level).r );\n"
+    "    imageStore( destination, texel, vec4(depth) );\n"
+    "}\n"
+;
+
+GPUCuller::GPUCuller()
+{
+    cull_program = compact_program = pyramid_program = 0;
+
+    instance_buffer = command_template = command_buffer = 0;
+    draw_buffer = parameter_buffer = visible_buffer = 0;
+
+    pyramid = 0;
+    pyramid_width = pyramid_height = 0;
+    pyramid_levels = 0;
+    has_pyramid = false;
+
+    max_instances = 0;
+    dirty_begin = dirty_end = 0;
+    are_commands_dirty = false;
+
+    is_supported = false;
+    has_draw_count = false;
+}
+
+GPUCuller::~GPUCuller()
+{
+    if (cull_program != 0)    glDeleteProgram( cull_program );
+    if (compact_program != 0) glDeleteProgram( compact_program );
+    if (pyramid_program != 0) glDeleteProgram( pyramid_program );
+
+    GLuint buffers[] = {
+        instance_buffer, command_template, command_buffer,
+        draw_buffer, parameter_buffer, visible_buffer
+    };
+    for (unsigned int b = 0; b < sizeof(buffers)/sizeof(buffers[0]); ++b)
+        if (buffers[b] != 0)
+            bufferTraits::Destroy( buffers[b] );
+
+    if (pyramid != 0)
+        textureTraits::Destroy( pyramid );
+}
+
+bool
+GPUCuller::initialize( GLuint capacity )
+{
+    // the shaders are GLSL 4.30; llvmpipe has had 4.5 for years.
+    is_supported = GLEW_VERSION_4_3;
+    if (!is_supported)
+        return false;
+
+    has_draw_count = GLEW_VERSION_4_6 || GLEW_ARB_indirect_parameters;
+
+    cull_program = buildGLComputeProgram( cull_source );
+    compact_program = buildGLComputeProgram( compact_source );
+    pyramid_program = buildGLComputeProgram( pyramid_source );
+
+    if (cull_program == 0 || compact_program == 0 || pyramid_program == 0) {
+        is_supported = false;
+        return false;
+    }
+
+    max_instances = capacity;
+    instances.reserve( max_instances );
+
+    instance_buffer = bufferTraits::Create();
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, instance_buffer );
+    glBufferData( GL_SHADER_STORAGE_BUFFER, max_instances * sizeof(GPUInstance), NULL, GL_DYNAMIC_DRAW );
+
+    visible_buffer = bufferTraits::Create();
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, visible_buffer );
+    glBufferData( GL_SHADER_STORAGE_BUFFER, max_instances * sizeof(GLuint), NULL, GL_DYNAMIC_COPY );
+
+    parameter_buffer = bufferTraits::Create();
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, parameter_buffer );
+    glBufferData( GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_COPY );
+
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+
+    command_template = bufferTraits::Create();
+    command_buffer = bufferTraits::Create();
+    draw_buffer = bufferTraits::Create();
+
+    return true;
+}
+
+bool
+GPUCuller::isSupported() { return is_supported; }
+
+GLuint
+GPUCuller::addMesh( GLuint index_count, GLuint first_index, GLint base_vertex )
+{
+    DrawElementsIndirectCommand mesh;
+    mesh.count = index_count;
+    mesh.instance_count = 0; // how many instances use it, until uploadCommands()
+    mesh.first_index = first_index;
+    mesh.base_vertex = base_vertex;
+    mesh.base_instance = 0;
+
+    meshes.push_back( mesh );
+    are_commands_dirty = true;
+
+    return meshes.size() - 1;
+}
+
+GLuint
+GPUCuller::addInstance( GLuint mesh, const glm::mat4 &model, const AABB &bounds )
+{
+    if (instances.size() >= max_instances || mesh >= meshes.size())
+        return max_instances;
+
+    GPUInstance instance;
+    instance.model = model;
+    instance.bounds_min = glm::vec4( bounds.min, 1.0f );
+    instance.bounds_max = glm::vec4( bounds.max, 1.0f );
+    instance.mesh = mesh;
+    instance.padding[0] = instance.padding[1] = instance.padding[2] = 0;
+
+    GLuint index = instances.size();
+    instances.push_back( instance );
+
+    ++meshes[mesh].instance_count;
+    are_commands_dirty = true;
+
+    if (dirty_begin == dirty_end)
+        dirty_begin = index;
+    dirty_end = index + 1;
+
+    return index;
+}
+
+void
+GPUCuller::setTransform( GLuint instance, const glm::mat4 &model )
+{
+    instances[instance].model = model;
+
+    if (dirty_begin == dirty_end) {
+        dirty_begin = instance;
+        dirty_end = instance + 1;
+    } else {
+        if (instance < dirty_begin) dirty_begin = instance;
+        if (instance >= dirty_end)  dirty_end = instance + 1;
+    }
+}
+
+void
+GPUCuller::uploadInstances()
+{
+    if (dirty_begin == dirty_end)
+        return;
+
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, instance_buffer );
+    glBufferSubData(
+            GL_SHADER_STORAGE_BUFFER,
+            dirty_begin * sizeof(GPUInstance),
+            (dirty_end - dirty_begin) * sizeof(GPUInstance),
+            &instances[dirty_begin]
+    );
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+
+    dirty_begin = dirty_end = 0;
+}
+
+void
+GPUCuller::uploadCommands()
+{
+    if (!are_commands_dirty)
+        return;
+
+    // each mesh gets a slice of the visible list as big as its instance
+    // count; the template starts every frame at zero instances.
+    std::vector<DrawElementsIndirectCommand> commands( meshes );
+    GLuint base = 0;
+    for (GLuint m = 0; m < commands.size(); ++m) {
+        commands[m].base_instance = base;
+        base += commands[m].instance_count;
+        commands[m].instance_count = 0;
+    }
+
+    GLsizeiptr size = commands.size() * sizeof(DrawElementsIndirectCommand);
+
+    glBindBuffer( GL_COPY_WRITE_BUFFER, command_template );
+    glBufferData( GL_COPY_WRITE_BUFFER, size, &commands[0], GL_STATIC_DRAW );
+    glBindBuffer( GL_COPY_WRITE_BUFFER, command_buffer );
+    glBufferData( GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_COPY );
+    glBindBuffer( GL_COPY_WRITE_BUFFER, draw_buffer );
+    glBufferData( GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_COPY );
+    glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+
+    are_commands_dirty = false;
+}
+
+void
+GPUCuller::buildDepthPyramid(
+        GLuint depth_texture,
+        GLsizei width,
+        GLsizei height,
+        const glm::mat4 &view_projection )
+{
+    if (!is_supported)
+        return;
+
+    if (width != pyramid_width || height != pyramid_height) {
+        // texture storage is immutable, so a new size needs a new texture.
+        if (pyramid != 0)
+            textureTraits::Destroy( pyramid );
+
+        pyramid_width = width;
+        pyramid_height = height;
+        pyramid_levels = 1;
+        while ((width >> pyramid_levels) > 0 || (height >> pyramid_levels) > 0)
+            ++pyramid_levels;
+
+        pyramid = textureTraits::Create();
+        glBindTexture( GL_TEXTURE_2D, pyramid );
+        glTexStorage2D( GL_TEXTURE_2D, pyramid_levels, GL_R32F, width, height );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    }
+
+    glUseProgram( pyramid_program );
+    glActiveTexture( GL_TEXTURE0 );
+
+    for (GLint level = 0; level < pyramid_levels; ++level) {
+        GLsizei level_width = std::max( width >> level, 1 );
+        GLsizei level_height = std::max( height >> level, 1 );
+
+        // level 0 copies the depth buffer, the rest halve the level above.
+        glBindTexture( GL_TEXTURE_2D, level == 0 ? depth_texture : pyramid );
+        glUniform1i( 0, level == 0 ? 0 : level - 1 );
+        glUniform1i( 1, level == 0 ? 1 : 2 );
+
+        glBindImageTexture( 0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F );
+        glDispatchCompute( (level_width + 7) / 8, (level_height + 7) / 8, 1 );
+        glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
+    }
+
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    pyramid_view_projection = view_projection;
+    has_pyramid = true;
+}
+
+void
+GPUCuller::cull( const glm::mat4 &view_projection )
+{
+    if (!is_supported || meshes.empty())
+        return;
+
+    uploadCommands();
+    uploadInstances();
+
+    glBindBuffer( GL_COPY_READ_BUFFER, command_template );
+    glBindBuffer( GL_COPY_WRITE_BUFFER, command_buffer );
+    glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                         meshes.size() * sizeof(DrawElementsIndirectCommand) );
+    glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+    glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+
+    Frustum frustum = extractFrustum( view_projection );
+
+    glUseProgram( cull_program );
+    glUniform4fv( 0, 6, &frustum.planes[0][0] );
+    glUniform1ui( 6, instances.size() );
+    glUniformMatrix4fv( 7, 1, GL_FALSE, &pyramid_view_projection[0][0] );
+    glUniform1i( 8, has_pyramid ? pyramid_levels : 0 );
+    glUniform2f( 9, (GLfloat)pyramid_width, (GLfloat)pyramid_height );
+
+    glActiveTexture( GL_TEXTURE0 );
+    glBindTexture( GL_TEXTURE_2D, has_pyramid ? pyramid : 0 );
+
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, instance_buffer );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, command_buffer );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 2, visible_buffer );
+
+    glDispatchCompute( (instances.size() + 63) / 64, 1, 1 );
+
+    if (has_draw_count) {
+        glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT );
+
+        glUseProgram( compact_program );
+        glUniform1ui( 0, meshes.size() );
+
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 3, draw_buffer );
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 4, parameter_buffer );
+        glDispatchCompute( 1, 1, 1 );
+    }
+
+    glBindTexture( GL_TEXTURE_2D, 0 );
+    glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT );
+}
+
+void
+GPUCuller::submit()
+{
+    if (!is_supported || meshes.empty())
+        return;
+
+    // the visible list feeds an instanced attribute; base_instance offsets
+    // it to each mesh's slice.
+    glBindBuffer( GL_ARRAY_BUFFER, visible_buffer );
+    glVertexAttribIPointer( GR_CULL_INSTANCE_ATTRIBUTE, 1, GL_UNSIGNED_INT, 0, (GLvoid*)0 );
+    glVertexAttribDivisor( GR_CULL_INSTANCE_ATTRIBUTE, 1 );
+    glEnableVertexAttribArray( GR_CULL_INSTANCE_ATTRIBUTE );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, GR_CULL_INSTANCE_BINDING, instance_buffer );
+
+    if (has_draw_count) {
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, draw_buffer );
+        glBindBuffer( GL_PARAMETER_BUFFER_ARB, parameter_buffer );
+
+        if (GLEW_VERSION_4_6)
+            glMultiDrawElementsIndirectCount( GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, meshes.size(), 0 );
+        else
+            glMultiDrawElementsIndirectCountARB( GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, meshes.size(), 0 );
+
+        glBindBuffer( GL_PARAMETER_BUFFER_ARB, 0 );
+    } else {
+        // without a GPU-side count every mesh is drawn; the ones with no
+        // visible instances cost next to nothing.
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, command_buffer );
+        glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, 0, meshes.size(), 0 );
+    }
+
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
+
+    // the VAO is the layout's, shared with every plain draw of that
+    // format; leave it as it was.
+    glDisableVertexAttribArray( GR_CULL_INSTANCE_ATTRIBUTE );
+    glVertexAttribDivisor( GR_CULL_INSTANCE_ATTRIBUTE, 0 );
+}
+
+GLuint
+GPUCuller::getMeshCount() { return meshes.size(); }
+
+GLuint
+GPUCuller::getInstanceCount() { return instances.size(); }
+
+GLuint
+GPUCuller::getVisibleBuffer() { return visible_buffer; }
@@ -0,0 +1,181 @@
+#include "input_trace.hpp"
+
+using namespace GearsEngine;
+
+static Uint64
+toNanoseconds( Uint64 ticks )
+{
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    return (ticks / frequency) * 1000000000ull + (ticks % frequency) * 1000000000ull / frequency;
+}
+
+static bool
+isReplayable( const SDL_Event &event )
+{
+    if (event.type >= SDL_USEREVENT)
+        return false;
+
+    switch (event.type) {
+        case SDL_DROPFILE:
+        case SDL_DROPTEXT:
+        case SDL_SYSWMEVENT:
+            return false;
+        default:
+            return true;
+    }
+}
+
+InputRecorder::InputRecorder()
+{
+    start = 0;
+    event_count = 0;
+}
+
+InputRecorder::~InputRecorder()
+{
+    close();
+}
+
+bool
+InputRecorder::open( const std::string &path )
+{
+    close();
+
+    file.open( path.c_str(), std::ios::binary | std::ios::trunc );
+    if (!file.is_open())
+        return false;
+
+    Uint32 header[3] = { GR_INPUT_MAGIC, GR_INPUT_VERSION, (Uint32)sizeof(SDL_Event) };
+    file.write( reinterpret_cast<const char*>(header), sizeof(header) );
+
+    start = SDL_GetPerformanceCounter();
+    event_count = 0;
+
+    return file.good();
+}
+
+void
+InputRecorder::close()
+{
+    if (file.is_open())
+        file.close();
+}
+
+bool
+InputRecorder::isOpen() { return file.is_open(); }
+
+void
+InputRecorder::record( const SDL_Event &event, Uint64 counter )
+{
+    if (!file.is_open() || !isReplayable( event ))
+        return;
+
+    Uint64 time = toNanoseconds( counter - start );
+    file.write( reinterpret_cast<const char*>(&time), sizeof(time) );
+    file.write( reinterpret_cast<const char*>(&event), sizeof(event) );
+    ++event_count;
+}
+
+void
+InputRecorder::flush()
+{
+    if (file.is_open())
+        file.flush();
+}
+
+unsigned long long
+InputRecorder::getEventCount() { return event_count; }
+
+InputPlayer::InputPlayer()
+{
+    mode = GR_REPLAY_REAL_TIME;
+    step = 0.0;
+    start = 0;
+    clock = 0;
+    frame = 0;
+
+    next_time = 0;
+    has_next = false;
+}
+
+bool
+InputPlayer::open( const std::string &path, ReplayMode replay_mode, double fixed_step )
+{
+    close();
+
+    file.open( path.c_str(), std::ios::binary );
+    if (!file.is_open())
+        return false;
+
+    Uint32 header[3] = { 0, 0, 0 };
+    file.read( reinterpret_cast<char*>(header), sizeof(header) );
+
+    if (!file.good() || header[0] != GR_INPUT_MAGIC || header[1] != GR_INPUT_VERSION ||
+            header[2] != sizeof(SDL_Event)) {
+        file.close();
+        return false;
+    }
+
+    mode = replay_mode;
+    step = (fixed_step > 0.0) ? fixed_step : 1.0 / 60.0;
+    start = SDL_GetPerformanceCounter();
+    clock = 0;
+    frame = 0;
+
+    readNext();
+    return true;
+}
+
+void
+InputPlayer::close()
+{
+    if (file.is_open())
+        file.close();
+
+    has_next = false;
+}
+
+bool
+InputPlayer::isOpen() { return file.is_open(); }
+
+void
+InputPlayer::readNext()
+{
+    file.read( reinterpret_cast<char*>(&next_time), sizeof(next_time) );
+    file.read( reinterpret_cast<char*>(&next_event), sizeof(next_event) );
+
+    // a record cut short, at the end of a trace that was still being
+    // written, is as good as the end.
+    has_next = file.good();
+}
+
+void
+InputPlayer::advance( Uint64 counter )
+{
+    // the first frame sees time zero either way, as recording did.
+    if (mode == GR_REPLAY_FIXED_STEP)
+        clock = (Uint64)(frame * step * 1.0e9);
+    else clock = toNanoseconds( counter - start );
+
+    ++frame;
+}
+
+bool
+InputPlayer::poll( SDL_Event *event )
+{
+    if (!has_next || next_time > clock)
+        return false;
+
+    *event = next_event;
+    readNext();
+    return true;
+}
+
+bool
+InputPlayer::isFinished() { return !has_next; }
+
+ReplayMode
+InputPlayer::getMode() { return mode; }
+
+double
+InputPlayer::getStep() { return step; }
@@ -0,0 +1,157 @@
+#include "job_system.hpp"
+
+using namespace GearsEngine;
+
+JobSystem::JobSystem( unsigned int worker_count )
+{
+    kernel = NULL;
+    userdata = NULL;
+    item_count = 0;
+    batch_size = 1;
+    generation = 0;
+    active_workers = 0;
+    is_shutting_down = false;
+
+    batch_count = 0;
+    next_batch = 0;
+    remaining_batches = 0;
+
+    if (worker_count == 0) {
+        unsigned int hardware = std::thread::hardware_concurrency();
+        worker_count = (hardware > 1) ? hardware - 1 : 0;
+    }
+
+    for (unsigned int w = 0; w < worker_count; ++w)
+        workers.push_back( std::thread(&JobSystem::workerLoop, this) );
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex );
+        is_shutting_down = true;
+    }
+    wake_workers.notify_all();
+
+    for (unsigned int w = 0; w < workers.size(); ++w)
+        workers[w].join();
+}
+
+unsigned int
+JobSystem::getWorkerCount() { return workers.size(); }
+
+void
+JobSystem::parallelFor(
+        unsigned int count,
+        unsigned int batch,
+        JobKernel job_kernel,
+        void *job_userdata )
+{
+    if (count == 0)
+        return;
+
+    if (batch == 0)
+        batch = 1;
+
+    // nothing to share the work with, so don't pay for the hand-off.
+    if (workers.empty() || count <= batch) {
+        job_kernel( 0, count, job_userdata );
+        return;
+    }
+
+    Dispatch dispatch;
+    {
+        std::unique_lock<std::mutex> lock( mutex );
+
+        // a worker that woke too late for the last dispatch may still be
+        // on its way out of runBatches; let it leave before the counters
+        // are reset underneath it.
+        while (active_workers > 0)
+            batches_finished.wait( lock );
+
+        kernel = job_kernel;
+        userdata = job_userdata;
+        item_count = count;
+        batch_size = batch;
+
+        batch_count = (count + batch - 1) / batch;
+        remaining_batches = batch_count;
+        next_batch = 0;
+
+        ++generation;
+        dispatch = getDispatch();
+    }
+    wake_workers.notify_all();
+
+    runBatches( dispatch );
+
+    // wait for the workers to leave runBatches as well, so none of them can
+    // pick up a batch index belonging to the next dispatch.
+    std::unique_lock<std::mutex> lock( mutex );
+    while (remaining_batches.load() > 0 || active_workers > 0)
+        batches_finished.wait( lock );
+}
+
+JobSystem::Dispatch
+JobSystem::getDispatch()
+{
+    Dispatch dispatch;
+    dispatch.kernel = kernel;
+    dispatch.userdata = userdata;
+    dispatch.item_count = item_count;
+    dispatch.batch_size = batch_size;
+    dispatch.batch_count = batch_count;
+    return dispatch;
+}
+
+void
+JobSystem::runBatches( const Dispatch &dispatch )
+{
+    for (;;) {
+        unsigned int b = next_batch.fetch_add( 1 );
+        if (b >= dispatch.batch_count)
+            break;
+
+        unsigned int begin = b * dispatch.batch_size;
+        unsigned int end   = begin + dispatch.batch_size;
+        if (end > dispatch.item_count)
+            end = dispatch.item_count;
+
+        dispatch.kernel( begin, end, dispatch.userdata );
+
+        if (remaining_batches.fetch_sub( 1 ) == 1) {
+            std::lock_guard<std::mutex> lock( mutex );
+            batches_finished.notify_all();
+        }
+    }
+}
+
+void
+JobSystem::workerLoop()
+{
+    unsigned int seen_generation = 0;
+
+    for (;;) {
+        Dispatch dispatch;
+        {
+            std::unique_lock<std::mutex> lock( mutex );
+            while (!is_shutting_down && seen_generation == generation)
+                wake_workers.wait( lock );
+
+            if (is_shutting_down)
+                return;
+
+            seen_generation = generation;
+            dispatch = getDispatch();
+            ++active_workers;
+        }
+
+        runBatches( dispatch );
+
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            --active_workers;
+        }
+        batches_finished.notify_all();
+    }
+}
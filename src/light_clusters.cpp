@@ -0,0 +1,444 @@
+#include "light_clusters.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+using namespace GearsEngine;
+
+static const GLuint TILE_COUNT = GR_CLUSTER_X * GR_CLUSTER_Y;
+static const GLuint CLUSTER_COUNT = TILE_COUNT * GR_CLUSTER_Z;
+
+// light indices are 16 bits in the index buffer.
+static const GLuint MAX_LIGHT_LIMIT = 65535;
+
+// stands in for the far plane of an infinite projection, as a multiple
+// of the near plane.
+static const GLfloat INFINITE_FAR_RATIO = 10000.0f;
+
+static const GLchar *shader_source =
+    "uniform samplerBuffer  gr_cluster_light_buffer;\n"
+    "uniform usamplerBuffer gr_cluster_grid_buffer;\n"
+    "uniform usamplerBuffer gr_cluster_index_buffer;\n"
+    "layout (std140) uniform LightClusters {\n"
+    "    uvec4 gr_cluster_grid;\n"  // tiles across, down, slices, light count
+    "    vec4  gr_cluster_tile;\n"  // tile size in pixels, slice scale, bias
+    "    vec4  gr_cluster_depth;\n" // projection [2][2], [3][2]
+    "};\n"
+    "uvec2 grClusterLights()\n"
+    "{\n"
+    "    float depth = gr_cluster_depth.y / (gl_FragCoord.z * 2.0 - 1.0 + gr_cluster_depth.x);\n"
+    "    float slice = clamp( log( depth ) * gr_cluster_tile.z + gr_cluster_tile.w,\n"
+    "                         0.0, float( gr_cluster_grid.z - 1u ) );\n"
+    "    uvec2 tile = min( uvec2( gl_FragCoord.xy / gr_cluster_tile.xy ), gr_cluster_grid.xy - 1u );\n"
+    "    uint cluster = (uint( slice ) * gr_cluster_grid.y + tile.y) * gr_cluster_grid.x + tile.x;\n"
+    "    return texelFetch( gr_cluster_grid_buffer, int( cluster ) ).xy;\n"
+    "}\n"
+    "uint grClusterLight( uint entry )\n"
+    "{\n"
+    "    return texelFetch( gr_cluster_index_buffer, int( entry ) ).x;\n"
+    "}\n"
+    "void grGetLight( uint light, out vec4 position_radius, out vec4 color_intensity )\n"
+    "{\n"
+    "    position_radius = texelFetch( gr_cluster_light_buffer, int( light ) * 2 );\n"
+    "    color_intensity = texelFetch( gr_cluster_light_buffer, int( light ) * 2 + 1 );\n"
+    "}\n"
+;
+
+LightClusters::LightClusters( GLuint light_capacity, JobSystem *job_system, GLuint index_capacity )
+{
+    jobs = job_system;
+
+    max_lights = std::min( std::max<GLuint>( light_capacity, 1 ), MAX_LIGHT_LIMIT );
+    max_indices = std::max<GLuint>( index_capacity, 1 );
+    lights.reserve( max_lights );
+    view_lights.reserve( max_lights );
+    indices.resize( max_indices );
+
+    min_x.resize( CLUSTER_COUNT ); min_y.resize( CLUSTER_COUNT ); min_z.resize( CLUSTER_COUNT );
+    max_x.resize( CLUSTER_COUNT ); max_y.resize( CLUSTER_COUNT ); max_z.resize( CLUSTER_COUNT );
+    for (GLuint s = 0; s <= GR_CLUSTER_Z; ++s)
+        slice_depths[s] = 0.0f;
+
+    projection = glm::mat4( 0.0f );
+    width = height = 0;
+
+    scratch.resize( (size_t)CLUSTER_COUNT * GR_CLUSTER_MAX_LIGHTS );
+    counts.resize( CLUSTER_COUNT, 0 );
+    grid.resize( CLUSTER_COUNT * 2, 0 );
+    index_count = 0;
+    dropped = 0;
+
+    std::memset( &uniforms, 0, sizeof(uniforms) );
+    uniforms.grid[0] = GR_CLUSTER_X;
+    uniforms.grid[1] = GR_CLUSTER_Y;
+    uniforms.grid[2] = GR_CLUSTER_Z;
+
+    light_buffer = grid_buffer = index_buffer = uniform_buffer = 0;
+    light_texture = grid_texture = index_texture = 0;
+    is_dirty = false;
+    is_initialized = false;
+}
+
+LightClusters::~LightClusters()
+{
+    if (light_texture != 0)  textureTraits::Destroy( light_texture );
+    if (grid_texture != 0)   textureTraits::Destroy( grid_texture );
+    if (index_texture != 0)  textureTraits::Destroy( index_texture );
+
+    if (light_buffer != 0)   bufferTraits::Destroy( light_buffer );
+    if (grid_buffer != 0)    bufferTraits::Destroy( grid_buffer );
+    if (index_buffer != 0)   bufferTraits::Destroy( index_buffer );
+    if (uniform_buffer != 0) bufferTraits::Destroy( uniform_buffer );
+}
+
+static GLuint
+createTextureBuffer( GLenum format, GLuint buffer )
+{
+    GLuint texture = textureTraits::Create();
+    glBindTexture( GL_TEXTURE_BUFFER, texture );
+    glTexBuffer( GL_TEXTURE_BUFFER, format, buffer );
+    glBindTexture( GL_TEXTURE_BUFFER, 0 );
+    return texture;
+}
+
+bool
+LightClusters::initialize()
+{
+    if (is_initialized)
+        return true;
+
+    light_buffer = bufferTraits::Create();
+    glBindBuffer( GL_TEXTURE_BUFFER, light_buffer );
+    glBufferData( GL_TEXTURE_BUFFER, max_lights * sizeof(PointLight), NULL, GL_STREAM_DRAW );
+
+    grid_buffer = bufferTraits::Create();
+    glBindBuffer( GL_TEXTURE_BUFFER, grid_buffer );
+    glBufferData( GL_TEXTURE_BUFFER, grid.size() * sizeof(GLuint), &grid[0], GL_STREAM_DRAW );
+
+    index_buffer = bufferTraits::Create();
+    glBindBuffer( GL_TEXTURE_BUFFER, index_buffer );
+    glBufferData( GL_TEXTURE_BUFFER, max_indices * sizeof(GLushort), NULL, GL_STREAM_DRAW );
+    glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+
+    // a light is two texels: position and radius, color and intensity.
+    light_texture = createTextureBuffer( GL_RGBA32F, light_buffer );
+    grid_texture = createTextureBuffer( GL_RG32UI, grid_buffer );
+    index_texture = createTextureBuffer( GL_R16UI, index_buffer );
+
+    uniform_buffer = bufferTraits::Create();
+    glBindBuffer( GL_UNIFORM_BUFFER, uniform_buffer );
+    glBufferData( GL_UNIFORM_BUFFER, sizeof(ClusterUniforms), &uniforms, GL_DYNAMIC_DRAW );
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+    is_initialized = true;
+    return true;
+}
+
+GLuint
+LightClusters::addLight( const PointLight &light )
+{
+    if (lights.size() >= max_lights)
+        return lights.size();
+
+    lights.push_back( light );
+    return lights.size() - 1;
+}
+
+void
+LightClusters::setLight( GLuint index, const PointLight &light )
+{
+    if (index < lights.size())
+        lights[index] = light;
+}
+
+const PointLight &
+LightClusters::getLight( GLuint index ) { return lights[index]; }
+
+void
+LightClusters::clearLights() { lights.clear(); }
+
+void
+LightClusters::buildBounds()
+{
+    GLfloat p22 = projection[2][2], p32 = projection[3][2];
+
+    // planes from the projection: depth = p32 / (ndc z + p22) at ndc
+    // z of -1 and 1.
+    GLfloat near_depth = p32 / (p22 - 1.0f);
+    GLfloat far_depth = p32 / (p22 + 1.0f);
+    if (!(far_depth > near_depth) || !std::isfinite( far_depth ))
+        far_depth = near_depth * INFINITE_FAR_RATIO;
+
+    GLfloat depth_ratio = std::log( far_depth / near_depth );
+    for (GLuint s = 0; s <= GR_CLUSTER_Z; ++s)
+        slice_depths[s] = near_depth * std::exp( depth_ratio * s / GR_CLUSTER_Z );
+
+    GLfloat tile_width = (GLfloat)((width + GR_CLUSTER_X - 1) / GR_CLUSTER_X);
+    GLfloat tile_height = (GLfloat)((height + GR_CLUSTER_Y - 1) / GR_CLUSTER_Y);
+
+    // slice = log(depth) * scale + bias
+    uniforms.tile[0] = tile_width;
+    uniforms.tile[1] = tile_height;
+    uniforms.tile[2] = GR_CLUSTER_Z / depth_ratio;
+    uniforms.tile[3] = -GR_CLUSTER_Z * std::log( near_depth ) / depth_ratio;
+    uniforms.depth[0] = p22;
+    uniforms.depth[1] = p32;
+
+    // tile corners as view-space directions at depth 1; the bounds of
+    // a cluster are those scaled to its slice's near and far depths.
+    glm::mat4 inverse = glm::inverse( projection );
+    glm::vec3 corners[GR_CLUSTER_Y + 1][GR_CLUSTER_X + 1];
+
+    for (GLuint y = 0; y <= GR_CLUSTER_Y; ++y) {
+        for (GLuint x = 0; x <= GR_CLUSTER_X; ++x) {
+            GLfloat ndc_x = std::min( x * tile_width / width, 1.0f ) * 2.0f - 1.0f;
+            GLfloat ndc_y = std::min( y * tile_height / height, 1.0f ) * 2.0f - 1.0f;
+
+            glm::vec4 point = inverse * glm::vec4( ndc_x, ndc_y, -1.0f, 1.0f );
+            glm::vec3 eye = glm::vec3( point ) / point.w;
+            corners[y][x] = eye / -eye.z;
+        }
+    }
+
+    for (GLuint s = 0; s < GR_CLUSTER_Z; ++s) {
+        GLfloat d0 = slice_depths[s], d1 = slice_depths[s + 1];
+
+        for (GLuint y = 0; y < GR_CLUSTER_Y; ++y) {
+            for (GLuint x = 0; x < GR_CLUSTER_X; ++x) {
+                GLuint c = s * TILE_COUNT + y * GR_CLUSTER_X + x;
+                const glm::vec3 *quad[4] = {
+                    &corners[y][x], &corners[y][x + 1], &corners[y + 1][x], &corners[y + 1][x + 1]
+                };
+
+                glm::vec3 low = *quad[0] * d0, high = low;
+                for (GLuint k = 0; k < 4; ++k) {
+                    low = glm::min( low, glm::min( *quad[k] * d0, *quad[k] * d1 ) );
+                    high = glm::max( high, glm::max( *quad[k] * d0, *quad[k] * d1 ) );
+                }
+
+                min_x[c] = low.x;  min_y[c] = low.y;  min_z[c] = low.z;
+                max_x[c] = high.x; max_y[c] = high.y; max_z[c] = high.z;
+            }
+        }
+    }
+}
+
+void
+LightClusters::update( const glm::mat4 &view, const glm::mat4 &new_projection, GLsizei new_width, GLsizei new_height )
+{
+    new_width = std::max<GLsizei>( new_width, 1 );
+    new_height = std::max<GLsizei>( new_height, 1 );
+
+    if (new_projection != projection || new_width != width || new_height != height) {
+        projection = new_projection;
+        width = new_width;
+        height = new_height;
+        buildBounds();
+    }
+
+    view_lights.resize( lights.size() );
+    for (GLuint i = 0; i < lights.size(); ++i) {
+        glm::vec4 center = view * glm::vec4( lights[i].position, 1.0f );
+        view_lights[i] = glm::vec4( glm::vec3( center ), lights[i].radius );
+    }
+
+    dropped = 0;
+    if (jobs != NULL) {
+        jobs->parallelFor( GR_CLUSTER_Z, 1, &assignKernel, this );
+    } else assignKernel( 0, GR_CLUSTER_Z, this );
+
+    // pack the lists back to back, in cluster order.
+    GLuint offset = 0, lost = 0;
+    for (GLuint c = 0; c < CLUSTER_COUNT; ++c) {
+        GLuint count = std::min( counts[c], max_indices - offset );
+        lost += counts[c] - count;
+
+        if (count > 0)
+            std::memcpy( &indices[offset], &scratch[(size_t)c * GR_CLUSTER_MAX_LIGHTS], count * sizeof(GLushort) );
+
+        grid[c * 2] = offset;
+        grid[c * 2 + 1] = count;
+        offset += count;
+    }
+
+    index_count = offset;
+    dropped += lost;
+    uniforms.grid[3] = lights.size();
+    is_dirty = true;
+}
+
+void
+LightClusters::assignKernel( unsigned int begin, unsigned int end, void *clusters )
+{
+    LightClusters *self = (LightClusters*)clusters;
+    for (unsigned int slice = begin; slice < end; ++slice)
+        self->assignSlice( slice );
+}
+
+void
+LightClusters::assignSlice( GLuint slice )
+{
+    const GLuint base = slice * TILE_COUNT;
+    const GLfloat near_depth = slice_depths[slice], far_depth = slice_depths[slice + 1];
+
+    GLuint   *count = &counts[base];
+    GLushort *lists = &scratch[(size_t)base * GR_CLUSTER_MAX_LIGHTS];
+    const GLfloat *x0 = &min_x[base], *y0 = &min_y[base], *z0 = &min_z[base];
+    const GLfloat *x1 = &max_x[base], *y1 = &max_y[base], *z1 = &max_z[base];
+
+    std::fill( count, count + TILE_COUNT, 0 );
+    GLuint lost = 0;
+
+    for (GLuint i = 0; i < view_lights.size(); ++i) {
+        const glm::vec4 &light = view_lights[i];
+
+        // cheap reject on depth first; most lights miss most slices.
+        GLfloat depth = -light.z;
+        if (depth + light.w < near_depth || depth - light.w > far_depth)
+            continue;
+
+        // sphere against box: the squared distance from the center to
+        // the box, per axis the overshoot past either face.
+        GLuint hits[TILE_COUNT];
+        GLuint hit_count = 0;
+
+#if defined(__AVX__)
+        const __m256 cx = _mm256_set1_ps( light.x ), cy = _mm256_set1_ps( light.y ), cz = _mm256_set1_ps( light.z );
+        const __m256 r2 = _mm256_set1_ps( light.w * light.w );
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (GLuint t = 0; t < TILE_COUNT; t += 8) {
+            __m256 dx = _mm256_add_ps( _mm256_max_ps( _mm256_sub_ps( _mm256_loadu_ps(x0 + t), cx ), zero ),
+                                       _mm256_max_ps( _mm256_sub_ps( cx, _mm256_loadu_ps(x1 + t) ), zero ) );
+            __m256 dy = _mm256_add_ps( _mm256_max_ps( _mm256_sub_ps( _mm256_loadu_ps(y0 + t), cy ), zero ),
+                                       _mm256_max_ps( _mm256_sub_ps( cy, _mm256_loadu_ps(y1 + t) ), zero ) );
+            __m256 dz = _mm256_add_ps( _mm256_max_ps( _mm256_sub_ps( _mm256_loadu_ps(z0 + t), cz ), zero ),
+                                       _mm256_max_ps( _mm256_sub_ps( cz, _mm256_loadu_ps(z1 + t) ), zero ) );
+            __m256 d2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy) ),
+                                       _mm256_mul_ps(dz, dz) );
+
+            int mask = _mm256_movemask_ps( _mm256_cmp_ps( d2, r2, _CMP_LE_OQ ) );
+            for (; mask != 0; mask &= mask - 1)
+                hits[hit_count++] = t + __builtin_ctz( mask );
+        }
+#elif defined(__SSE2__)
+        const __m128 cx = _mm_set1_ps( light.x ), cy = _mm_set1_ps( light.y ), cz = _mm_set1_ps( light.z );
+        const __m128 r2 = _mm_set1_ps( light.w * light.w );
+        const __m128 zero = _mm_setzero_ps();
+
+        for (GLuint t = 0; t < TILE_COUNT; t += 4) {
+            __m128 dx = _mm_add_ps( _mm_max_ps( _mm_sub_ps( _mm_loadu_ps(x0 + t), cx ), zero ),
+                                    _mm_max_ps( _mm_sub_ps( cx, _mm_loadu_ps(x1 + t) ), zero ) );
+            __m128 dy = _mm_add_ps( _mm_max_ps( _mm_sub_ps( _mm_loadu_ps(y0 + t), cy ), zero ),
+                                    _mm_max_ps( _mm_sub_ps( cy, _mm_loadu_ps(y1 + t) ), zero ) );
+            __m128 dz = _mm_add_ps( _mm_max_ps( _mm_sub_ps( _mm_loadu_ps(z0 + t), cz ), zero ),
+                                    _mm_max_ps( _mm_sub_ps( cz, _mm_loadu_ps(z1 + t) ), zero ) );
+            __m128 d2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy) ), _mm_mul_ps(dz, dz) );
+
+            int mask = _mm_movemask_ps( _mm_cmple_ps( d2, r2 ) );
+            for (; mask != 0; mask &= mask - 1)
+                hits[hit_count++] = t + __builtin_ctz( mask );
+        }
+#else
+        for (GLuint t = 0; t < TILE_COUNT; ++t) {
+            GLfloat dx = std::max( x0[t] - light.x, 0.0f ) + std::max( light.x - x1[t], 0.0f );
+            GLfloat dy = std::max( y0[t] - light.y, 0.0f ) + std::max( light.y - y1[t], 0.0f );
+            GLfloat dz = std::max( z0[t] - light.z, 0.0f ) + std::max( light.z - z1[t], 0.0f );
+
+            if (dx*dx + dy*dy + dz*dz <= light.w * light.w)
+                hits[hit_count++] = t;
+        }
+#endif
+
+        for (GLuint h = 0; h < hit_count; ++h) {
+            GLuint t = hits[h];
+            if (count[t] < GR_CLUSTER_MAX_LIGHTS)
+                lists[(size_t)t * GR_CLUSTER_MAX_LIGHTS + count[t]++] = (GLushort)i;
+            else ++lost;
+        }
+    }
+
+    if (lost > 0)
+        dropped += lost;
+}
+
+void
+LightClusters::bind()
+{
+    if (!is_initialized)
+        return;
+
+    if (is_dirty) {
+        // orphan, then fill: the driver hands out fresh storage while
+        // the last frame's draws still read the old.
+        glBindBuffer( GL_TEXTURE_BUFFER, light_buffer );
+        glBufferData( GL_TEXTURE_BUFFER, max_lights * sizeof(PointLight), NULL, GL_STREAM_DRAW );
+        if (!lights.empty())
+            glBufferSubData( GL_TEXTURE_BUFFER, 0, lights.size() * sizeof(PointLight), &lights[0] );
+
+        glBindBuffer( GL_TEXTURE_BUFFER, grid_buffer );
+        glBufferData( GL_TEXTURE_BUFFER, grid.size() * sizeof(GLuint), &grid[0], GL_STREAM_DRAW );
+
+        glBindBuffer( GL_TEXTURE_BUFFER, index_buffer );
+        glBufferData( GL_TEXTURE_BUFFER, max_indices * sizeof(GLushort), NULL, GL_STREAM_DRAW );
+        if (index_count > 0)
+            glBufferSubData( GL_TEXTURE_BUFFER, 0, index_count * sizeof(GLushort), &indices[0] );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+
+        glBindBuffer( GL_UNIFORM_BUFFER, uniform_buffer );
+        glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof(ClusterUniforms), &uniforms );
+        glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+        is_dirty = false;
+    }
+
+    glActiveTexture( GL_TEXTURE0 + GR_CLUSTER_LIGHT_UNIT );
+    glBindTexture( GL_TEXTURE_BUFFER, light_texture );
+    glActiveTexture( GL_TEXTURE0 + GR_CLUSTER_GRID_UNIT );
+    glBindTexture( GL_TEXTURE_BUFFER, grid_texture );
+    glActiveTexture( GL_TEXTURE0 + GR_CLUSTER_INDEX_UNIT );
+    glBindTexture( GL_TEXTURE_BUFFER, index_texture );
+    glActiveTexture( GL_TEXTURE0 );
+
+    glBindBufferBase( GL_UNIFORM_BUFFER, GR_CLUSTER_UNIFORM_BINDING, uniform_buffer );
+}
+
+void
+LightClusters::prepareProgram( Renderer *renderer, const ShaderProgram &program )
+{
+    glUseProgram( program.uid );
+
+    GLint location = glGetUniformLocation( program.uid, "gr_cluster_light_buffer" );
+    if (location >= 0)
+        glUniform1i( location, GR_CLUSTER_LIGHT_UNIT );
+
+    location = glGetUniformLocation( program.uid, "gr_cluster_grid_buffer" );
+    if (location >= 0)
+        glUniform1i( location, GR_CLUSTER_GRID_UNIT );
+
+    location = glGetUniformLocation( program.uid, "gr_cluster_index_buffer" );
+    if (location >= 0)
+        glUniform1i( location, GR_CLUSTER_INDEX_UNIT );
+
+    renderer->bindUniformBlock( program, "LightClusters", GR_CLUSTER_UNIFORM_BINDING );
+}
+
+const GLchar *
+LightClusters::getShaderSource() { return shader_source; }
+
+GLuint
+LightClusters::getLightCount() { return lights.size(); }
+
+GLuint
+LightClusters::getIndexCount() { return index_count; }
+
+GLuint
+LightClusters::getDroppedCount() { return dropped; }
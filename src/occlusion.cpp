@@ -0,0 +1,504 @@
+#include "occlusion.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+using namespace GearsEngine;
+
+// anything closer to the eye than this in clip-space w is treated as
+// crossing the near plane.
+static const GLfloat NEAR_W = 1e-5f;
+
+// occluder meshes get transformed this many at a time per job.
+static const unsigned int OCCLUDER_BATCH = 4;
+
+OcclusionCuller::OcclusionCuller(
+        GLuint buffer_width,
+        GLuint buffer_height,
+        JobSystem *job_system )
+{
+    jobs = job_system;
+
+    tiles_x = (buffer_width  + GR_OCCLUSION_TILE_SIZE - 1) / GR_OCCLUSION_TILE_SIZE;
+    tiles_y = (buffer_height + GR_OCCLUSION_TILE_SIZE - 1) / GR_OCCLUSION_TILE_SIZE;
+    if (tiles_x == 0) tiles_x = 1;
+    if (tiles_y == 0) tiles_y = 1;
+
+    width  = tiles_x * GR_OCCLUSION_TILE_SIZE;
+    height = tiles_y * GR_OCCLUSION_TILE_SIZE;
+
+    tile_bins.resize( tiles_x * tiles_y );
+
+    GLuint level_width = width, level_height = height;
+    for (;;) {
+        DepthLevel level;
+        level.width = level_width;
+        level.height = level_height;
+        level.depth.assign( level_width * level_height, 1.0f );
+        pyramid.push_back( level );
+
+        if (level_width == 1 && level_height == 1)
+            break;
+
+        level_width  = (level_width  + 1) / 2;
+        level_height = (level_height + 1) / 2;
+    }
+
+    debug_texture = 0;
+    triangles_rasterized = 0;
+    objects_tested = 0;
+    objects_rejected = 0;
+    objects_offscreen = 0;
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+    if (debug_texture != 0)
+        textureTraits::Destroy( debug_texture );
+}
+
+GLuint OcclusionCuller::getWidth()      { return width; }
+GLuint OcclusionCuller::getHeight()     { return height; }
+GLuint OcclusionCuller::getLevelCount() { return pyramid.size(); }
+
+void
+OcclusionCuller::beginFrame( const glm::mat4 &new_view_projection )
+{
+    view_projection = new_view_projection;
+
+    occluders.clear();
+    triangles_rasterized = 0;
+    objects_tested = 0;
+    objects_rejected = 0;
+    objects_offscreen = 0;
+}
+
+void
+OcclusionCuller::addOccluder( Occluder occluder )
+{
+    if (occluder.positions == NULL || occluder.indices == NULL)
+        return;
+
+    if (occluder.stride == 0)
+        occluder.stride = 3 * sizeof(GLfloat);
+
+    occluders.push_back( occluder );
+}
+
+void
+OcclusionCuller::rasterizeOccluders()
+{
+    // triangle slots are laid out up front so the setup jobs can write
+    // their output without synchronizing.
+    first_triangle.resize( occluders.size() + 1 );
+    first_triangle[0] = 0;
+    for (GLuint o = 0; o < occluders.size(); ++o)
+        first_triangle[o+1] = first_triangle[o] + occluders[o].index_count / 3;
+
+    triangles.resize( first_triangle[occluders.size()] );
+
+    if (jobs != NULL) {
+        jobs->parallelFor( occluders.size(), OCCLUDER_BATCH, &setupKernel, this );
+    } else setupTriangles( 0, occluders.size() );
+
+    binTriangles();
+
+    std::vector<GLfloat> &depth = pyramid[0].depth;
+    std::fill( depth.begin(), depth.end(), 1.0f );
+
+    if (jobs != NULL) {
+        jobs->parallelFor( tile_bins.size(), 1, &rasterKernel, this );
+    } else rasterKernel( 0, tile_bins.size(), this );
+
+    buildPyramid();
+}
+
+void
+OcclusionCuller::setupKernel( unsigned int begin, unsigned int end, void *culler )
+{
+    static_cast<OcclusionCuller*>(culler)->setupTriangles( begin, end );
+}
+
+void
+OcclusionCuller::rasterKernel( unsigned int begin, unsigned int end, void *culler )
+{
+    OcclusionCuller *self = static_cast<OcclusionCuller*>(culler);
+    for (unsigned int tile = begin; tile < end; ++tile)
+        self->rasterizeTile( tile );
+}
+
+void
+OcclusionCuller::setupTriangles( GLuint begin, GLuint end )
+{
+    std::vector<glm::vec4> clip;
+
+    for (GLuint o = begin; o < end; ++o) {
+        const Occluder &occluder = occluders[o];
+        glm::mat4 mvp = view_projection * occluder.model;
+
+        clip.resize( occluder.vertex_count );
+        const GLubyte *vertex = reinterpret_cast<const GLubyte*>(occluder.positions);
+        for (GLuint v = 0; v < occluder.vertex_count; ++v) {
+            const GLfloat *p = reinterpret_cast<const GLfloat*>(vertex);
+            clip[v] = mvp * glm::vec4( p[0], p[1], p[2], 1.0f );
+            vertex += occluder.stride;
+        }
+
+        ScreenTriangle *out = &triangles[first_triangle[o]];
+        for (GLuint t = 0; t < occluder.index_count / 3; ++t) {
+            ScreenTriangle &tri = out[t];
+            tri.is_valid = true;
+
+            for (int c = 0; c < 3; ++c) {
+                GLuint index = occluder.indices[t*3 + c];
+                if (index >= occluder.vertex_count || clip[index].w <= NEAR_W) {
+                    // dropping an occluder triangle only ever makes the test
+                    // more conservative, so near-clipped ones are skipped.
+                    tri.is_valid = false;
+                    break;
+                }
+
+                GLfloat inv_w = 1.0f / clip[index].w;
+                tri.x[c] = (clip[index].x * inv_w * 0.5f + 0.5f) * width;
+                tri.y[c] = (clip[index].y * inv_w * 0.5f + 0.5f) * height;
+                tri.z[c] =  clip[index].z * inv_w * 0.5f + 0.5f;
+            }
+        }
+    }
+}
+
+void
+OcclusionCuller::binTriangles()
+{
+    for (GLuint b = 0; b < tile_bins.size(); ++b)
+        tile_bins[b].clear();
+
+    for (GLuint t = 0; t < triangles.size(); ++t) {
+        const ScreenTriangle &tri = triangles[t];
+        if (!tri.is_valid)
+            continue;
+
+        GLfloat min_x = std::min( tri.x[0], std::min(tri.x[1], tri.x[2]) );
+        GLfloat max_x = std::max( tri.x[0], std::max(tri.x[1], tri.x[2]) );
+        GLfloat min_y = std::min( tri.y[0], std::min(tri.y[1], tri.y[2]) );
+        GLfloat max_y = std::max( tri.y[0], std::max(tri.y[1], tri.y[2]) );
+
+        if (max_x < 0.0f || max_y < 0.0f || min_x >= width || min_y >= height)
+            continue;
+
+        GLuint tx0 = static_cast<GLuint>(std::max( min_x, 0.0f )) / GR_OCCLUSION_TILE_SIZE;
+        GLuint ty0 = static_cast<GLuint>(std::max( min_y, 0.0f )) / GR_OCCLUSION_TILE_SIZE;
+        GLuint tx1 = std::min( static_cast<GLuint>(max_x) / GR_OCCLUSION_TILE_SIZE, tiles_x - 1 );
+        GLuint ty1 = std::min( static_cast<GLuint>(max_y) / GR_OCCLUSION_TILE_SIZE, tiles_y - 1 );
+
+        for (GLuint ty = ty0; ty <= ty1; ++ty)
+            for (GLuint tx = tx0; tx <= tx1; ++tx)
+                tile_bins[ty*tiles_x + tx].push_back( t );
+
+        ++triangles_rasterized;
+    }
+}
+
+void
+OcclusionCuller::rasterizeTile( GLuint tile )
+{
+    const std::vector<GLuint> &bin = tile_bins[tile];
+    GLfloat *depth = &pyramid[0].depth[0];
+
+    GLint tile_x0 = (tile % tiles_x) * GR_OCCLUSION_TILE_SIZE;
+    GLint tile_y0 = (tile / tiles_x) * GR_OCCLUSION_TILE_SIZE;
+    GLint tile_x1 = tile_x0 + GR_OCCLUSION_TILE_SIZE - 1;
+    GLint tile_y1 = tile_y0 + GR_OCCLUSION_TILE_SIZE - 1;
+
+    for (GLuint b = 0; b < bin.size(); ++b) {
+        const ScreenTriangle &tri = triangles[bin[b]];
+
+        GLfloat x0 = tri.x[0], y0 = tri.y[0], z0 = tri.z[0];
+        GLfloat x1 = tri.x[1], y1 = tri.y[1], z1 = tri.z[1];
+        GLfloat x2 = tri.x[2], y2 = tri.y[2], z2 = tri.z[2];
+
+        GLfloat area = (x1 - x0)*(y2 - y0) - (x2 - x0)*(y1 - y0);
+        if (std::fabs(area) < 1e-8f)
+            continue;
+
+        // occluders are rasterized double-sided, so wind everything the
+        // same way.
+        if (area < 0.0f) {
+            std::swap( x1, x2 ); std::swap( y1, y2 ); std::swap( z1, z2 );
+            area = -area;
+        }
+
+        // edge functions e = a*x + b*y + c, one per vertex, each positive
+        // inside and equal to the vertex' barycentric weight times area.
+        GLfloat a0 = y1 - y2, b0 = x2 - x1, c0 = x1*y2 - x2*y1;
+        GLfloat a1 = y2 - y0, b1 = x0 - x2, c1 = x2*y0 - x0*y2;
+        GLfloat a2 = y0 - y1, b2 = x1 - x0, c2 = x0*y1 - x1*y0;
+
+        // depth is linear in screen space after the divide.
+        GLfloat inv_area = 1.0f / area;
+        GLfloat za = (a0*z0 + a1*z1 + a2*z2) * inv_area;
+        GLfloat zb = (b0*z0 + b1*z1 + b2*z2) * inv_area;
+        GLfloat zc = (c0*z0 + c1*z1 + c2*z2) * inv_area;
+
+        GLint min_x = std::max( tile_x0, static_cast<GLint>(std::floor(std::min(x0, std::min(x1, x2)))) );
+        GLint max_x = std::min( tile_x1, static_cast<GLint>(std::ceil (std::max(x0, std::max(x1, x2)))) );
+        GLint min_y = std::max( tile_y0, static_cast<GLint>(std::floor(std::min(y0, std::min(y1, y2)))) );
+        GLint max_y = std::min( tile_y1, static_cast<GLint>(std::ceil (std::max(y0, std::max(y1, y2)))) );
+
+        if (min_x > max_x || min_y > max_y)
+            continue;
+
+#if defined(__AVX__)
+        min_x &= ~7;
+
+        const __m256 step = _mm256_setr_ps( 0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f );
+        const __m256 zero = _mm256_setzero_ps();
+
+        for (GLint y = min_y; y <= max_y; ++y) {
+            GLfloat fy = y + 0.5f;
+            GLfloat *row = depth + y*width;
+
+            for (GLint x = min_x; x <= max_x; x += 8) {
+                __m256 fx = _mm256_add_ps( _mm256_set1_ps((GLfloat)x), step );
+
+                __m256 e0 = _mm256_add_ps( _mm256_mul_ps(_mm256_set1_ps(a0), fx), _mm256_set1_ps(b0*fy + c0) );
+                __m256 e1 = _mm256_add_ps( _mm256_mul_ps(_mm256_set1_ps(a1), fx), _mm256_set1_ps(b1*fy + c1) );
+                __m256 e2 = _mm256_add_ps( _mm256_mul_ps(_mm256_set1_ps(a2), fx), _mm256_set1_ps(b2*fy + c2) );
+
+                __m256 inside = _mm256_and_ps(
+                        _mm256_and_ps( _mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ) ),
+                        _mm256_cmp_ps( e2, zero, _CMP_GE_OQ )
+                );
+
+                __m256 z = _mm256_add_ps( _mm256_mul_ps(_mm256_set1_ps(za), fx), _mm256_set1_ps(zb*fy + zc) );
+                __m256 d = _mm256_loadu_ps( row + x );
+                _mm256_storeu_ps( row + x, _mm256_blendv_ps(d, _mm256_min_ps(d, z), inside) );
+            }
+        }
+#elif defined(__SSE2__)
+        min_x &= ~3;
+
+        const __m128 step = _mm_setr_ps( 0.5f, 1.5f, 2.5f, 3.5f );
+        const __m128 zero = _mm_setzero_ps();
+
+        for (GLint y = min_y; y <= max_y; ++y) {
+            GLfloat fy = y + 0.5f;
+            GLfloat *row = depth + y*width;
+
+            for (GLint x = min_x; x <= max_x; x += 4) {
+                __m128 fx = _mm_add_ps( _mm_set1_ps((GLfloat)x), step );
+
+                __m128 e0 = _mm_add_ps( _mm_mul_ps(_mm_set1_ps(a0), fx), _mm_set1_ps(b0*fy + c0) );
+                __m128 e1 = _mm_add_ps( _mm_mul_ps(_mm_set1_ps(a1), fx), _mm_set1_ps(b1*fy + c1) );
+                __m128 e2 = _mm_add_ps( _mm_mul_ps(_mm_set1_ps(a2), fx), _mm_set1_ps(b2*fy + c2) );
+
+                __m128 inside = _mm_and_ps(
+                        _mm_and_ps( _mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero) ),
+                        _mm_cmpge_ps( e2, zero )
+                );
+
+                __m128 z = _mm_add_ps( _mm_mul_ps(_mm_set1_ps(za), fx), _mm_set1_ps(zb*fy + zc) );
+                __m128 d = _mm_loadu_ps( row + x );
+                __m128 nearer = _mm_min_ps( d, z );
+
+                _mm_storeu_ps( row + x,
+                        _mm_or_ps( _mm_and_ps(inside, nearer), _mm_andnot_ps(inside, d) ) );
+            }
+        }
+#else
+        for (GLint y = min_y; y <= max_y; ++y) {
+            GLfloat fy = y + 0.5f;
+            GLfloat *row = depth + y*width;
+
+            for (GLint x = min_x; x <= max_x; ++x) {
+                GLfloat fx = x + 0.5f;
+
+                if (a0*fx + b0*fy + c0 < 0.0f ||
+                    a1*fx + b1*fy + c1 < 0.0f ||
+                    a2*fx + b2*fy + c2 < 0.0f)
+                    continue;
+
+                GLfloat z = za*fx + zb*fy + zc;
+                if (z < row[x])
+                    row[x] = z;
+            }
+        }
+#endif
+    }
+}
+
+void
+OcclusionCuller::buildPyramid()
+{
+    for (GLuint l = 1; l < pyramid.size(); ++l) {
+        const DepthLevel &src = pyramid[l-1];
+        DepthLevel &dst = pyramid[l];
+
+        for (GLuint y = 0; y < dst.height; ++y) {
+            const GLfloat *row0 = &src.depth[(2*y) * src.width];
+            const GLfloat *row1 = &src.depth[std::min(2*y + 1, src.height - 1) * src.width];
+            GLfloat *out = &dst.depth[y * dst.width];
+
+            GLuint x = 0;
+#if defined(__SSE2__)
+            // eight source texels collapse into four farthest depths.
+            for (; 2*x + 8 <= src.width; x += 4) {
+                __m128 lo = _mm_max_ps( _mm_loadu_ps(row0 + 2*x),     _mm_loadu_ps(row1 + 2*x) );
+                __m128 hi = _mm_max_ps( _mm_loadu_ps(row0 + 2*x + 4), _mm_loadu_ps(row1 + 2*x + 4) );
+
+                __m128 even = _mm_shuffle_ps( lo, hi, _MM_SHUFFLE(2, 0, 2, 0) );
+                __m128 odd  = _mm_shuffle_ps( lo, hi, _MM_SHUFFLE(3, 1, 3, 1) );
+
+                _mm_storeu_ps( out + x, _mm_max_ps(even, odd) );
+            }
+#endif
+            for (; x < dst.width; ++x) {
+                GLuint sx0 = 2*x;
+                GLuint sx1 = std::min( 2*x + 1, src.width - 1 );
+
+                out[x] = std::max( std::max(row0[sx0], row0[sx1]),
+                                   std::max(row1[sx0], row1[sx1]) );
+            }
+        }
+    }
+}
+
+bool
+OcclusionCuller::isVisible( const AABB &bounds )
+{
+    ++objects_tested;
+
+    GLfloat min_x =  1e30f, min_y =  1e30f, min_z = 1e30f;
+    GLfloat max_x = -1e30f, max_y = -1e30f;
+
+    for (int c = 0; c < 8; ++c) {
+        glm::vec4 corner(
+                (c & 1) ? bounds.max.x : bounds.min.x,
+                (c & 2) ? bounds.max.y : bounds.min.y,
+                (c & 4) ? bounds.max.z : bounds.min.z,
+                1.0f
+        );
+
+        glm::vec4 clip = view_projection * corner;
+
+        // the box reaches behind the eye; no screen rectangle to test.
+        if (clip.w <= NEAR_W)
+            return true;
+
+        GLfloat inv_w = 1.0f / clip.w;
+        GLfloat x = (clip.x * inv_w * 0.5f + 0.5f) * width;
+        GLfloat y = (clip.y * inv_w * 0.5f + 0.5f) * height;
+        GLfloat z =  clip.z * inv_w * 0.5f + 0.5f;
+
+        min_x = std::min( min_x, x ); max_x = std::max( max_x, x );
+        min_y = std::min( min_y, y ); max_y = std::max( max_y, y );
+        min_z = std::min( min_z, z );
+    }
+
+    if (max_x < 0.0f || max_y < 0.0f || min_x >= width || min_y >= height || min_z > 1.0f) {
+        ++objects_offscreen;
+        return false;
+    }
+
+    GLuint x0 = static_cast<GLuint>(std::max( min_x, 0.0f ));
+    GLuint y0 = static_cast<GLuint>(std::max( min_y, 0.0f ));
+    GLuint x1 = static_cast<GLuint>(std::min( max_x, width  - 1.0f ));
+    GLuint y1 = static_cast<GLuint>(std::min( max_y, height - 1.0f ));
+
+    // pick the level where the rectangle spans at most 2x2 texels.
+    GLuint level = 0;
+    while (level + 1 < pyramid.size() &&
+           ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+        ++level;
+
+    const DepthLevel &hiz = pyramid[level];
+    GLfloat farthest = 0.0f;
+    for (GLuint y = (y0 >> level); y <= (y1 >> level); ++y)
+        for (GLuint x = (x0 >> level); x <= (x1 >> level); ++x)
+            farthest = std::max( farthest, hiz.depth[y*hiz.width + x] );
+
+    if (min_z > farthest) {
+        ++objects_rejected;
+        return false;
+    }
+
+    return true;
+}
+
+OcclusionStats
+OcclusionCuller::getStats()
+{
+    OcclusionStats stats;
+
+    stats.occluders = occluders.size();
+    stats.triangles_rasterized = triangles_rasterized;
+    stats.objects_tested = objects_tested;
+    stats.objects_rejected = objects_rejected;
+    stats.objects_offscreen = objects_offscreen;
+
+    return stats;
+}
+
+void
+OcclusionCuller::getDebugImage( GLuint level, std::vector<GLubyte> &pixels )
+{
+    if (level >= pyramid.size())
+        level = pyramid.size() - 1;
+
+    const DepthLevel &hiz = pyramid[level];
+    pixels.resize( hiz.depth.size() );
+
+    // post-projection depth bunches up near 1.0, so stretch the range that
+    // is actually covered by occluders.
+    GLfloat nearest = 1.0f, farthest = 0.0f;
+    for (GLuint i = 0; i < hiz.depth.size(); ++i) {
+        if (hiz.depth[i] < 1.0f) {
+            nearest  = std::min( nearest,  hiz.depth[i] );
+            farthest = std::max( farthest, hiz.depth[i] );
+        }
+    }
+
+    GLfloat range = (farthest > nearest) ? farthest - nearest : 1.0f;
+    for (GLuint i = 0; i < hiz.depth.size(); ++i) {
+        if (hiz.depth[i] >= 1.0f) {
+            pixels[i] = 0;
+        } else {
+            GLfloat t = 1.0f - (hiz.depth[i] - nearest) / range;
+            pixels[i] = static_cast<GLubyte>(32.0f + t * 223.0f);
+        }
+    }
+}
+
+GLuint
+OcclusionCuller::updateDebugTexture( GLuint level )
+{
+    if (level >= pyramid.size())
+        level = pyramid.size() - 1;
+
+    std::vector<GLubyte> pixels;
+    getDebugImage( level, pixels );
+
+    if (debug_texture == 0)
+        debug_texture = textureTraits::Create();
+
+    glBindTexture( GL_TEXTURE_2D, debug_texture );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glTexImage2D(
+            GL_TEXTURE_2D, 0, GL_R8,
+            pyramid[level].width, pyramid[level].height, 0,
+            GL_RED, GL_UNSIGNED_BYTE, &pixels[0]
+    );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    return debug_texture;
+}
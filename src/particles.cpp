@@ -0,0 +1,628 @@
+#include "particles.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+using namespace GearsEngine;
+
+// added to squared attractor distances, so a particle passing through
+// the point isn't flung off at infinite speed.
+static const GLfloat ATTRACTOR_SOFTENING = 0.01f;
+
+static const GLfloat MIN_LIFETIME = 1e-3f;
+
+static const GLchar *vertex_source =
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 corner;\n"
+    "layout (location = 1) in vec4 particle;\n" // position, size
+    "layout (location = 2) in vec4 particle_color;\n"
+    "uniform mat4 view;\n"
+    "uniform mat4 projection;\n"
+    "out vec2 offset;\n"
+    "out vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 eye = view * vec4( particle.xyz, 1.0 );\n"
+    "    eye.xy += corner * particle.w;\n"
+    "    gl_Position = projection * eye;\n"
+    "    offset = corner;\n"
+    "    color = particle_color;\n"
+    "}\n"
+;
+
+static const GLchar *fragment_source =
+    "#version 330 core\n"
+    "in vec2 offset;\n"
+    "in vec4 color;\n"
+    "out vec4 fragment;\n"
+    "void main()\n"
+    "{\n"
+    "    float falloff = 1.0 - dot( offset, offset );\n"
+    "    if (falloff <= 0.0)\n"
+    "        discard;\n"
+    "    fragment = vec4( color.rgb, color.a * falloff );\n"
+    "}\n"
+;
+
+ParticleSystem::ParticleSystem( GLuint max_particles, JobSystem *job_system )
+{
+    jobs = job_system;
+
+    block_count = std::max<GLuint>( (max_particles + GR_PARTICLE_BLOCK - 1) / GR_PARTICLE_BLOCK, 1 );
+    capacity = block_count * GR_PARTICLE_BLOCK;
+
+    position_x.assign( capacity, 0.0f );
+    position_y.assign( capacity, 0.0f );
+    position_z.assign( capacity, 0.0f );
+    velocity_x.assign( capacity, 0.0f );
+    velocity_y.assign( capacity, 0.0f );
+    velocity_z.assign( capacity, 0.0f );
+    ages.assign( capacity, 0.0f );
+    lifetimes.assign( capacity, 0.0f );
+    sizes.assign( capacity, 0.0f );
+    growths.assign( capacity, 0.0f );
+    colors.assign( capacity, 0 );
+
+    live_counts.assign( block_count, 0 );
+    first_instance.assign( block_count, 0 );
+    live_count = 0;
+    fill_block = 0;
+
+    constants.acceleration = glm::vec3( 0.0f );
+    constants.damping = 1.0f;
+    constants.attractor_count = 0;
+    constants.step = 0.0f;
+    random_state = 0x9e3779b9u;
+
+    program = 0;
+    view_location = projection_location = -1;
+    vao = quad_buffer = instance_buffer = 0;
+    segment_size = 0;
+    mapped = instances = NULL;
+    segment = 0;
+    for (int f = 0; f < GR_PARTICLE_FRAMES; ++f)
+        fences[f] = NULL;
+    is_initialized = false;
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    for (int f = 0; f < GR_PARTICLE_FRAMES; ++f)
+        if (fences[f] != NULL)
+            glDeleteSync( fences[f] );
+
+    if (program != 0)         glDeleteProgram( program );
+    if (vao != 0)             vaoTraits::Destroy( vao );
+    if (quad_buffer != 0)     bufferTraits::Destroy( quad_buffer );
+    if (instance_buffer != 0) bufferTraits::Destroy( instance_buffer );
+}
+
+bool
+ParticleSystem::initialize()
+{
+    if (!GLEW_VERSION_3_3 && !GLEW_ARB_instanced_arrays)
+        return false;
+
+    program = buildGLProgram( vertex_source, fragment_source );
+    if (program == 0)
+        return false;
+
+    view_location = glGetUniformLocation( program, "view" );
+    projection_location = glGetUniformLocation( program, "projection" );
+
+    static const GLfloat corners[] = { -1.0f, -1.0f,  1.0f, -1.0f,  -1.0f, 1.0f,  1.0f, 1.0f };
+
+    // whatever the caller has bound is put back afterwards, so a
+    // Renderer's idea of the bound VAO stays true.
+    GLint previous_vao = 0, previous_buffer = 0;
+    glGetIntegerv( GL_VERTEX_ARRAY_BINDING, &previous_vao );
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &previous_buffer );
+
+    vao = vaoTraits::Create();
+    glBindVertexArray( vao );
+
+    quad_buffer = bufferTraits::Create();
+    glBindBuffer( GL_ARRAY_BUFFER, quad_buffer );
+    glBufferData( GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW );
+    glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, 0, 0 );
+    glEnableVertexAttribArray( 0 );
+
+    // the instance pointers move with the segment; draw() sets them.
+    glEnableVertexAttribArray( 1 );
+    glEnableVertexAttribArray( 2 );
+    glVertexAttribDivisor( 1, 1 );
+    glVertexAttribDivisor( 2, 1 );
+
+    glBindVertexArray( previous_vao );
+
+    // a segment is every position and size, then every color.
+    segment_size = (capacity * getInstanceSize() + 255) / 256 * 256;
+
+    instance_buffer = bufferTraits::Create();
+    glBindBuffer( GL_ARRAY_BUFFER, instance_buffer );
+
+    if (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr total = segment_size * GR_PARTICLE_FRAMES;
+
+        glBufferStorage( GL_ARRAY_BUFFER, total, NULL, flags );
+        mapped = static_cast<GLubyte*>(glMapBufferRange( GL_ARRAY_BUFFER, 0, total, flags ));
+    }
+
+    if (mapped == NULL)
+        glBufferData( GL_ARRAY_BUFFER, segment_size, NULL, GL_STREAM_DRAW );
+
+    glBindBuffer( GL_ARRAY_BUFFER, previous_buffer );
+
+    is_initialized = true;
+    return true;
+}
+
+GLuint
+ParticleSystem::addEmitter( const ParticleEmitter &emitter )
+{
+    emitters.push_back( emitter );
+    emitter_debt.push_back( 0.0 );
+    return emitters.size() - 1;
+}
+
+void
+ParticleSystem::setEmitter( GLuint index, const ParticleEmitter &emitter ) { emitters[index] = emitter; }
+
+const ParticleEmitter &
+ParticleSystem::getEmitter( GLuint index ) { return emitters[index]; }
+
+void
+ParticleSystem::burst( GLuint emitter, GLuint count ) { spawn( emitters[emitter], count ); }
+
+GLuint
+ParticleSystem::addForce( const ParticleForce &force )
+{
+    forces.push_back( force );
+    return forces.size() - 1;
+}
+
+void
+ParticleSystem::setForce( GLuint index, const ParticleForce &force ) { forces[index] = force; }
+
+void
+ParticleSystem::clearForces() { forces.clear(); }
+
+GLfloat
+ParticleSystem::random()
+{
+    // xorshift32, mapped to [-1, 1).
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return (random_state >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+void
+ParticleSystem::spawn( const ParticleEmitter &emitter, GLuint count )
+{
+    GLuint searched = 0;
+
+    while (count > 0 && searched < block_count) {
+        GLuint block = fill_block;
+        GLuint room = GR_PARTICLE_BLOCK - live_counts[block];
+
+        if (room == 0) {
+            fill_block = (fill_block + 1) % block_count;
+            ++searched;
+            continue;
+        }
+
+        GLuint spawned = std::min( room, count );
+        GLuint p = block * GR_PARTICLE_BLOCK + live_counts[block];
+
+        for (GLuint s = 0; s < spawned; ++s, ++p) {
+            position_x[p] = emitter.position.x + emitter.position_spread.x * random();
+            position_y[p] = emitter.position.y + emitter.position_spread.y * random();
+            position_z[p] = emitter.position.z + emitter.position_spread.z * random();
+            velocity_x[p] = emitter.velocity.x + emitter.velocity_spread.x * random();
+            velocity_y[p] = emitter.velocity.y + emitter.velocity_spread.y * random();
+            velocity_z[p] = emitter.velocity.z + emitter.velocity_spread.z * random();
+
+            ages[p] = 0.0f;
+            lifetimes[p] = std::max( emitter.lifetime + emitter.lifetime_spread * random(), MIN_LIFETIME );
+            sizes[p] = emitter.size;
+            growths[p] = emitter.growth;
+            colors[p] = emitter.color;
+        }
+
+        live_counts[block] += spawned;
+        live_count += spawned;
+        count -= spawned;
+    }
+}
+
+void
+ParticleSystem::update( GLfloat dt )
+{
+    if (dt <= 0.0f)
+        return;
+
+    for (GLuint e = 0; e < emitters.size(); ++e) {
+        if (!emitters[e].is_enabled || emitters[e].rate <= 0.0f)
+            continue;
+
+        emitter_debt[e] += (GLdouble)emitters[e].rate * dt;
+        GLuint due = (GLuint)emitter_debt[e];
+        emitter_debt[e] -= due;
+
+        spawn( emitters[e], due );
+    }
+
+    if (live_count == 0)
+        return;
+
+    // fold the forces into what the kernels apply per lane.
+    constants.acceleration = glm::vec3( 0.0f );
+    constants.damping = 1.0f;
+    constants.attractor_count = 0;
+    constants.step = dt;
+
+    for (GLuint f = 0; f < forces.size(); ++f) {
+        const ParticleForce &force = forces[f];
+
+        if (force.type == GR_FORCE_ACCELERATION) {
+            constants.acceleration += force.vector;
+        } else if (force.type == GR_FORCE_DRAG) {
+            constants.damping *= std::max( 1.0f - force.strength * dt, 0.0f );
+        } else if (constants.attractor_count < GR_PARTICLE_ATTRACTORS) {
+            constants.attractors[constants.attractor_count++] = glm::vec4( force.vector, force.strength );
+        }
+    }
+
+    if (jobs != NULL) {
+        jobs->parallelFor( block_count, 1, &updateKernel, this );
+    } else updateKernel( 0, block_count, this );
+
+    live_count = 0;
+    for (GLuint b = 0; b < block_count; ++b)
+        live_count += live_counts[b];
+}
+
+void
+ParticleSystem::updateKernel( unsigned int begin, unsigned int end, void *system )
+{
+    ParticleSystem *particles = static_cast<ParticleSystem*>(system);
+
+    for (unsigned int b = begin; b < end; ++b) {
+        if (particles->live_counts[b] == 0)
+            continue;
+
+        particles->simulateBlock( b );
+        particles->compactBlock( b );
+    }
+}
+
+void
+ParticleSystem::simulateBlock( GLuint block )
+{
+    GLuint base = block * GR_PARTICLE_BLOCK;
+
+    GLfloat *x  = &position_x[base], *y  = &position_y[base], *z  = &position_z[base];
+    GLfloat *vx = &velocity_x[base], *vy = &velocity_y[base], *vz = &velocity_z[base];
+    GLfloat *age = &ages[base], *size = &sizes[base], *growth = &growths[base];
+
+    const StepConstants &k = constants;
+
+    // lanes past the live count belong to this block too, so the loop
+    // runs to a whole vector; whatever is there is dead and never read.
+    GLuint count = (live_counts[block] + 7) & ~7u;
+
+#if defined(__AVX__)
+    const __m256 dt = _mm256_set1_ps( k.step );
+    const __m256 damping = _mm256_set1_ps( k.damping );
+    const __m256 softening = _mm256_set1_ps( ATTRACTOR_SOFTENING );
+    const __m256 zero = _mm256_setzero_ps();
+
+    for (GLuint i = 0; i < count; i += 8) {
+        __m256 px = _mm256_loadu_ps( x + i ), py = _mm256_loadu_ps( y + i ), pz = _mm256_loadu_ps( z + i );
+
+        __m256 ax = _mm256_set1_ps( k.acceleration.x );
+        __m256 ay = _mm256_set1_ps( k.acceleration.y );
+        __m256 az = _mm256_set1_ps( k.acceleration.z );
+
+        for (GLuint a = 0; a < k.attractor_count; ++a) {
+            __m256 dx = _mm256_sub_ps( _mm256_set1_ps(k.attractors[a].x), px );
+            __m256 dy = _mm256_sub_ps( _mm256_set1_ps(k.attractors[a].y), py );
+            __m256 dz = _mm256_sub_ps( _mm256_set1_ps(k.attractors[a].z), pz );
+
+            __m256 d2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy) ),
+                                       _mm256_add_ps( _mm256_mul_ps(dz, dz), softening ) );
+            __m256 inv = _mm256_rsqrt_ps( d2 );
+            __m256 pull = _mm256_mul_ps( _mm256_set1_ps(k.attractors[a].w),
+                                         _mm256_mul_ps( inv, _mm256_mul_ps(inv, inv) ) );
+
+            ax = _mm256_add_ps( ax, _mm256_mul_ps(dx, pull) );
+            ay = _mm256_add_ps( ay, _mm256_mul_ps(dy, pull) );
+            az = _mm256_add_ps( az, _mm256_mul_ps(dz, pull) );
+        }
+
+        __m256 nvx = _mm256_mul_ps( _mm256_add_ps( _mm256_loadu_ps(vx + i), _mm256_mul_ps(ax, dt) ), damping );
+        __m256 nvy = _mm256_mul_ps( _mm256_add_ps( _mm256_loadu_ps(vy + i), _mm256_mul_ps(ay, dt) ), damping );
+        __m256 nvz = _mm256_mul_ps( _mm256_add_ps( _mm256_loadu_ps(vz + i), _mm256_mul_ps(az, dt) ), damping );
+
+        _mm256_storeu_ps( vx + i, nvx );
+        _mm256_storeu_ps( vy + i, nvy );
+        _mm256_storeu_ps( vz + i, nvz );
+        _mm256_storeu_ps( x + i, _mm256_add_ps( px, _mm256_mul_ps(nvx, dt) ) );
+        _mm256_storeu_ps( y + i, _mm256_add_ps( py, _mm256_mul_ps(nvy, dt) ) );
+        _mm256_storeu_ps( z + i, _mm256_add_ps( pz, _mm256_mul_ps(nvz, dt) ) );
+
+        _mm256_storeu_ps( age + i, _mm256_add_ps( _mm256_loadu_ps(age + i), dt ) );
+        _mm256_storeu_ps( size + i, _mm256_max_ps( zero,
+                _mm256_add_ps( _mm256_loadu_ps(size + i), _mm256_mul_ps(_mm256_loadu_ps(growth + i), dt) ) ) );
+    }
+#elif defined(__SSE2__)
+    const __m128 dt = _mm_set1_ps( k.step );
+    const __m128 damping = _mm_set1_ps( k.damping );
+    const __m128 softening = _mm_set1_ps( ATTRACTOR_SOFTENING );
+    const __m128 zero = _mm_setzero_ps();
+
+    for (GLuint i = 0; i < count; i += 4) {
+        __m128 px = _mm_loadu_ps( x + i ), py = _mm_loadu_ps( y + i ), pz = _mm_loadu_ps( z + i );
+
+        __m128 ax = _mm_set1_ps( k.acceleration.x );
+        __m128 ay = _mm_set1_ps( k.acceleration.y );
+        __m128 az = _mm_set1_ps( k.acceleration.z );
+
+        for (GLuint a = 0; a < k.attractor_count; ++a) {
+            __m128 dx = _mm_sub_ps( _mm_set1_ps(k.attractors[a].x), px );
+            __m128 dy = _mm_sub_ps( _mm_set1_ps(k.attractors[a].y), py );
+            __m128 dz = _mm_sub_ps( _mm_set1_ps(k.attractors[a].z), pz );
+
+            __m128 d2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy) ),
+                                    _mm_add_ps( _mm_mul_ps(dz, dz), softening ) );
+            __m128 inv = _mm_rsqrt_ps( d2 );
+            __m128 pull = _mm_mul_ps( _mm_set1_ps(k.attractors[a].w), _mm_mul_ps( inv, _mm_mul_ps(inv, inv) ) );
+
+            ax = _mm_add_ps( ax, _mm_mul_ps(dx, pull) );
+            ay = _mm_add_ps( ay, _mm_mul_ps(dy, pull) );
+            az = _mm_add_ps( az, _mm_mul_ps(dz, pull) );
+        }
+
+        __m128 nvx = _mm_mul_ps( _mm_add_ps( _mm_loadu_ps(vx + i), _mm_mul_ps(ax, dt) ), damping );
+        __m128 nvy = _mm_mul_ps( _mm_add_ps( _mm_loadu_ps(vy + i), _mm_mul_ps(ay, dt) ), damping );
+        __m128 nvz = _mm_mul_ps( _mm_add_ps( _mm_loadu_ps(vz + i), _mm_mul_ps(az, dt) ), damping );
+
+        _mm_storeu_ps( vx + i, nvx );
+        _mm_storeu_ps( vy + i, nvy );
+        _mm_storeu_ps( vz + i, nvz );
+        _mm_storeu_ps( x + i, _mm_add_ps( px, _mm_mul_ps(nvx, dt) ) );
+        _mm_storeu_ps( y + i, _mm_add_ps( py, _mm_mul_ps(nvy, dt) ) );
+        _mm_storeu_ps( z + i, _mm_add_ps( pz, _mm_mul_ps(nvz, dt) ) );
+
+        _mm_storeu_ps( age + i, _mm_add_ps( _mm_loadu_ps(age + i), dt ) );
+        _mm_storeu_ps( size + i, _mm_max_ps( zero,
+                _mm_add_ps( _mm_loadu_ps(size + i), _mm_mul_ps(_mm_loadu_ps(growth + i), dt) ) ) );
+    }
+#else
+    for (GLuint i = 0; i < count; ++i) {
+        glm::vec3 acceleration = k.acceleration;
+
+        for (GLuint a = 0; a < k.attractor_count; ++a) {
+            glm::vec3 d( k.attractors[a].x - x[i], k.attractors[a].y - y[i], k.attractors[a].z - z[i] );
+            GLfloat inv = 1.0f / std::sqrt( d.x*d.x + d.y*d.y + d.z*d.z + ATTRACTOR_SOFTENING );
+            acceleration += d * (k.attractors[a].w * inv * inv * inv);
+        }
+
+        vx[i] = (vx[i] + acceleration.x * k.step) * k.damping;
+        vy[i] = (vy[i] + acceleration.y * k.step) * k.damping;
+        vz[i] = (vz[i] + acceleration.z * k.step) * k.damping;
+        x[i] += vx[i] * k.step;
+        y[i] += vy[i] * k.step;
+        z[i] += vz[i] * k.step;
+
+        age[i] += k.step;
+        size[i] = std::max( size[i] + growth[i] * k.step, 0.0f );
+    }
+#endif
+}
+
+void
+ParticleSystem::compactBlock( GLuint block )
+{
+    GLuint base = block * GR_PARTICLE_BLOCK;
+    GLuint count = live_counts[block];
+
+    GLfloat *x  = &position_x[base], *y  = &position_y[base], *z  = &position_z[base];
+    GLfloat *vx = &velocity_x[base], *vy = &velocity_y[base], *vz = &velocity_z[base];
+    GLfloat *age = &ages[base], *lifetime = &lifetimes[base];
+    GLfloat *size = &sizes[base], *growth = &growths[base];
+    GLuint  *color = &colors[base];
+
+    // everything before the first death stays where it is.
+    GLuint live = 0;
+    while (live < count && age[live] < lifetime[live])
+        ++live;
+
+    // from there every particle is copied down to the write cursor,
+    // which only advances past the living: no branch to mispredict when
+    // deaths are scattered, and the order of the survivors is kept.
+    for (GLuint i = live; i < count; ++i) {
+        x[live] = x[i];   y[live] = y[i];   z[live] = z[i];
+        vx[live] = vx[i]; vy[live] = vy[i]; vz[live] = vz[i];
+        age[live] = age[i];
+        lifetime[live] = lifetime[i];
+        size[live] = size[i];
+        growth[live] = growth[i];
+        color[live] = color[i];
+
+        live += (GLuint)(age[i] < lifetime[i]);
+    }
+
+    live_counts[block] = live;
+}
+
+void
+ParticleSystem::writeKernel( unsigned int begin, unsigned int end, void *system )
+{
+    ParticleSystem *particles = static_cast<ParticleSystem*>(system);
+
+    for (unsigned int b = begin; b < end; ++b)
+        if (particles->live_counts[b] > 0)
+            particles->writeBlock( b );
+}
+
+void
+ParticleSystem::writeBlock( GLuint block )
+{
+    GLuint base = block * GR_PARTICLE_BLOCK;
+    GLuint count = live_counts[block];
+
+    const GLfloat *x = &position_x[base], *y = &position_y[base], *z = &position_z[base];
+    const GLfloat *age = &ages[base], *lifetime = &lifetimes[base], *size = &sizes[base];
+    const GLuint  *color = &colors[base];
+
+    GLfloat *out = reinterpret_cast<GLfloat*>(instances) + (size_t)first_instance[block] * 4;
+    GLuint  *out_color = reinterpret_cast<GLuint*>(instances + (size_t)capacity * 4 * sizeof(GLfloat)) + first_instance[block];
+
+    // the next block's instances start right after this one's, so only
+    // whole vectors go through SIMD and the rest one at a time.
+    GLuint i = 0;
+
+#if defined(__SSE2__)
+    const __m128  one = _mm_set1_ps( 1.0f );
+    const __m128i rgb = _mm_set1_epi32( 0x00ffffff );
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps( x + i ), py = _mm_loadu_ps( y + i );
+        __m128 pz = _mm_loadu_ps( z + i ), ps = _mm_loadu_ps( size + i );
+
+        _MM_TRANSPOSE4_PS( px, py, pz, ps );
+        _mm_storeu_ps( out + i*4,      px );
+        _mm_storeu_ps( out + i*4 + 4,  py );
+        _mm_storeu_ps( out + i*4 + 8,  pz );
+        _mm_storeu_ps( out + i*4 + 12, ps );
+
+        __m128 fade = _mm_sub_ps( one, _mm_div_ps( _mm_loadu_ps(age + i), _mm_loadu_ps(lifetime + i) ) );
+        __m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i*>(color + i) );
+        __m128i alpha = _mm_cvttps_epi32( _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32(c, 24) ), fade ) );
+
+        _mm_storeu_si128( reinterpret_cast<__m128i*>(out_color + i),
+                _mm_or_si128( _mm_and_si128(c, rgb), _mm_slli_epi32(alpha, 24) ) );
+    }
+#endif
+
+    for (; i < count; ++i) {
+        out[i*4]     = x[i];
+        out[i*4 + 1] = y[i];
+        out[i*4 + 2] = z[i];
+        out[i*4 + 3] = size[i];
+
+        GLfloat fade = 1.0f - age[i] / lifetime[i];
+        GLuint alpha = (GLuint)((color[i] >> 24) * fade);
+        out_color[i] = (color[i] & 0x00ffffff) | (alpha << 24);
+    }
+}
+
+void
+ParticleSystem::draw( const glm::mat4 &view, const glm::mat4 &projection )
+{
+    if (!is_initialized || live_count == 0)
+        return;
+
+    GLintptr offset = 0;
+    glBindBuffer( GL_ARRAY_BUFFER, instance_buffer );
+
+    if (mapped != NULL) {
+        if (fences[segment] != NULL) {
+            glClientWaitSync( fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull );
+            glDeleteSync( fences[segment] );
+            fences[segment] = NULL;
+        }
+
+        offset = segment * segment_size;
+        instances = mapped + offset;
+    } else {
+        // orphaned on every map, so the driver never has us wait.
+        instances = static_cast<GLubyte*>(glMapBufferRange( GL_ARRAY_BUFFER, 0, segment_size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT ));
+        if (instances == NULL) {
+            glBindBuffer( GL_ARRAY_BUFFER, 0 );
+            return;
+        }
+    }
+
+    GLuint total = 0;
+    for (GLuint b = 0; b < block_count; ++b) {
+        first_instance[b] = total;
+        total += live_counts[b];
+    }
+
+    if (jobs != NULL) {
+        jobs->parallelFor( block_count, 1, &writeKernel, this );
+    } else writeKernel( 0, block_count, this );
+
+    if (mapped == NULL)
+        glUnmapBuffer( GL_ARRAY_BUFFER );
+    instances = NULL;
+
+    glUseProgram( program );
+    glUniformMatrix4fv( view_location, 1, GL_FALSE, &view[0][0] );
+    glUniformMatrix4fv( projection_location, 1, GL_FALSE, &projection[0][0] );
+
+    glBindVertexArray( vao );
+    glVertexAttribPointer( 1, 4, GL_FLOAT, GL_FALSE, 0, (const GLvoid*)offset );
+    glVertexAttribPointer( 2, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+            (const GLvoid*)(offset + (GLintptr)capacity * 4 * sizeof(GLfloat)) );
+
+    // the blend and depth state is the caller's; it gets it back as it was.
+    GLboolean was_depth_tested = glIsEnabled( GL_DEPTH_TEST );
+    GLboolean was_blended = glIsEnabled( GL_BLEND );
+    GLboolean depth_writes = GL_TRUE;
+    GLint blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha;
+    glGetBooleanv( GL_DEPTH_WRITEMASK, &depth_writes );
+    glGetIntegerv( GL_BLEND_SRC_RGB, &blend_src_rgb );
+    glGetIntegerv( GL_BLEND_DST_RGB, &blend_dst_rgb );
+    glGetIntegerv( GL_BLEND_SRC_ALPHA, &blend_src_alpha );
+    glGetIntegerv( GL_BLEND_DST_ALPHA, &blend_dst_alpha );
+
+    glEnable( GL_DEPTH_TEST );
+    glEnable( GL_BLEND );
+    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+    glDepthMask( GL_FALSE );
+
+    glDrawArraysInstanced( GL_TRIANGLE_STRIP, 0, 4, total );
+
+    glDepthMask( depth_writes );
+    glBlendFuncSeparate( blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha );
+    if (!was_blended)      glDisable( GL_BLEND );
+    if (!was_depth_tested) glDisable( GL_DEPTH_TEST );
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+
+    if (mapped != NULL) {
+        fences[segment] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        segment = (segment + 1) % GR_PARTICLE_FRAMES;
+    }
+}
+
+void
+ParticleSystem::clear()
+{
+    std::fill( live_counts.begin(), live_counts.end(), 0 );
+    live_count = 0;
+    fill_block = 0;
+}
+
+GLuint
+ParticleSystem::getCount() { return live_count; }
+
+GLuint
+ParticleSystem::getCapacity() { return capacity; }
+
+GLsizeiptr
+ParticleSystem::getInstanceSize() { return 4 * sizeof(GLfloat) + sizeof(GLuint); }
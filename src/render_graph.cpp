@@ -0,0 +1,553 @@
+#include "render_graph.hpp"
+#include "renderer.hpp"
+
+using namespace GearsEngine;
+
+static bool
+isDepthFormat( GLenum format )
+{
+    switch (format) {
+        case GL_DEPTH_COMPONENT16:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32:
+        case GL_DEPTH_COMPONENT32F:
+        case GL_DEPTH24_STENCIL8:
+        case GL_DEPTH32F_STENCIL8:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool
+hasStencil( GLenum format )
+{
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+static bool
+sameDesc( const AttachmentDesc &a, const AttachmentDesc &b )
+{
+    return a.width == b.width && a.height == b.height && a.format == b.format;
+}
+
+static void
+allocateTexture( GLuint texture, const AttachmentDesc &desc, bool immutable )
+{
+    glBindTexture( GL_TEXTURE_2D, texture );
+
+    if (immutable) {
+        glTexStorage2D( GL_TEXTURE_2D, 1, desc.format, desc.width, desc.height );
+    } else if (hasStencil( desc.format )) {
+        glTexImage2D( GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0,
+                      GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL );
+    } else if (isDepthFormat( desc.format )) {
+        glTexImage2D( GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0,
+                      GL_DEPTH_COMPONENT, GL_FLOAT, NULL );
+    } else {
+        glTexImage2D( GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0,
+                      GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    }
+
+    GLint filter = isDepthFormat( desc.format ) ? GL_NEAREST : GL_LINEAR;
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    glBindTexture( GL_TEXTURE_2D, 0 );
+}
+
+// pass a must run before pass b.
+static void
+addEdge( std::vector< std::vector<GLuint> > &dependents, std::vector<GLuint> &waiting, GLuint a, GLuint b )
+{
+    dependents[a].push_back( b );
+    ++waiting[b];
+}
+
+RenderGraph::RenderGraph()
+{
+    backbuffer_width = backbuffer_height = 0;
+    is_compiled = false;
+    has_invalidate = false;
+    has_texture_storage = false;
+}
+
+void
+RenderGraph::reset()
+{
+    resources.clear();
+    passes.clear();
+    order.clear();
+
+    backbuffer_width = backbuffer_height = 0;
+    is_compiled = false;
+}
+
+RenderResource
+RenderGraph::createAttachment( std::string name, AttachmentDesc desc )
+{
+    GraphResource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resource.is_transient = true;
+    resource.is_backbuffer = false;
+    resource.is_output = false;
+    resource.texture = 0;
+    resource.first_use = resource.last_use = -1;
+
+    resources.push_back( resource );
+    is_compiled = false;
+
+    return resources.size() - 1;
+}
+
+RenderResource
+RenderGraph::importTexture( std::string name, GLuint texture, AttachmentDesc desc )
+{
+    RenderResource handle = createAttachment( name, desc );
+    resources[handle].is_transient = false;
+    resources[handle].is_output = true;
+    resources[handle].texture = texture;
+
+    return handle;
+}
+
+RenderResource
+RenderGraph::importBackbuffer( GLsizei width, GLsizei height )
+{
+    AttachmentDesc desc;
+    desc.width = width;
+    desc.height = height;
+    desc.format = GL_NONE;
+
+    RenderResource handle = importTexture( "backbuffer", 0, desc );
+    resources[handle].is_backbuffer = true;
+
+    backbuffer_width = width;
+    backbuffer_height = height;
+
+    return handle;
+}
+
+void
+RenderGraph::markOutput( RenderResource resource )
+{
+    resources[resource].is_output = true;
+    is_compiled = false;
+}
+
+GLuint
+RenderGraph::addPass( std::string name, PassExecute execute, void *userdata )
+{
+    GraphPass pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.userdata = userdata;
+    pass.has_clear = false;
+    pass.clear_depth = 1.0f;
+    pass.has_side_effect = false;
+    pass.framebuffer = 0;
+    pass.width = pass.height = 0;
+    pass.color_count = 0;
+
+    for (int c = 0; c < 4; ++c)
+        pass.clear_color[c] = 0.0f;
+
+    passes.push_back( pass );
+    is_compiled = false;
+
+    return passes.size() - 1;
+}
+
+void
+RenderGraph::addRead( GLuint pass, RenderResource resource )
+{
+    passes[pass].reads.push_back( resource );
+    is_compiled = false;
+}
+
+void
+RenderGraph::addWrite( GLuint pass, RenderResource resource )
+{
+    passes[pass].writes.push_back( resource );
+    is_compiled = false;
+}
+
+void
+RenderGraph::setClear( GLuint pass, GLfloat r, GLfloat g, GLfloat b, GLfloat a, GLfloat depth )
+{
+    passes[pass].has_clear = true;
+    passes[pass].clear_color[0] = r;
+    passes[pass].clear_color[1] = g;
+    passes[pass].clear_color[2] = b;
+    passes[pass].clear_color[3] = a;
+    passes[pass].clear_depth = depth;
+}
+
+void
+RenderGraph::setSideEffect( GLuint pass )
+{
+    passes[pass].has_side_effect = true;
+    is_compiled = false;
+}
+
+void
+RenderGraph::cullPasses( std::vector<bool> &alive )
+{
+    alive.assign( passes.size(), false );
+
+    std::vector<GLuint> pending;
+    for (GLuint p = 0; p < passes.size(); ++p) {
+        bool needed = passes[p].has_side_effect;
+        for (GLuint w = 0; w < passes[p].writes.size(); ++w)
+            needed = needed || resources[passes[p].writes[w]].is_output;
+
+        if (needed) {
+            alive[p] = true;
+            pending.push_back( p );
+        }
+    }
+
+    // walk back from the outputs: whoever writes what a live pass reads
+    // is live too. everything never reached is culled.
+    while (!pending.empty()) {
+        GraphPass &pass = passes[pending.back()];
+        pending.pop_back();
+
+        for (GLuint r = 0; r < pass.reads.size(); ++r) {
+            for (GLuint p = 0; p < passes.size(); ++p) {
+                if (alive[p])
+                    continue;
+
+                for (GLuint w = 0; w < passes[p].writes.size(); ++w) {
+                    if (passes[p].writes[w] == pass.reads[r]) {
+                        alive[p] = true;
+                        pending.push_back( p );
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int
+RenderGraph::findWriter( RenderResource resource, GLuint before, const std::vector<bool> &alive )
+{
+    for (int p = (int)before - 1; p >= 0; --p) {
+        if (!alive[p])
+            continue;
+        for (GLuint w = 0; w < passes[p].writes.size(); ++w)
+            if (passes[p].writes[w] == resource)
+                return p;
+    }
+
+    return -1;
+}
+
+bool
+RenderGraph::sortPasses( const std::vector<bool> &alive )
+{
+    GLuint pass_count = passes.size();
+    std::vector< std::vector<GLuint> > dependents( pass_count );
+    std::vector<GLuint> waiting( pass_count, 0 );
+
+    for (GLuint p = 0; p < pass_count; ++p) {
+        if (!alive[p])
+            continue;
+
+        const GraphPass &pass = passes[p];
+
+        // read after write: the closest earlier writer, or every writer
+        // when the producer was declared after its consumer.
+        for (GLuint r = 0; r < pass.reads.size(); ++r) {
+            int writer = findWriter( pass.reads[r], p, alive );
+            if (writer >= 0) {
+                addEdge( dependents, waiting, writer, p );
+                continue;
+            }
+
+            for (GLuint q = p + 1; q < pass_count; ++q) {
+                if (!alive[q])
+                    continue;
+                for (GLuint w = 0; w < passes[q].writes.size(); ++w)
+                    if (passes[q].writes[w] == pass.reads[r]) {
+                        addEdge( dependents, waiting, q, p );
+                        break;
+                    }
+            }
+        }
+
+        // write after write, and write after a read of the previous
+        // contents, keep declaration order.
+        for (GLuint w = 0; w < pass.writes.size(); ++w) {
+            RenderResource resource = pass.writes[w];
+
+            int writer = findWriter( resource, p, alive );
+            if (writer >= 0)
+                addEdge( dependents, waiting, writer, p );
+
+            for (GLuint q = 0; q < p; ++q) {
+                if (!alive[q] || findWriter( resource, q, alive ) < 0)
+                    continue;
+
+                for (GLuint x = 0; x < passes[q].reads.size(); ++x)
+                    if (passes[q].reads[x] == resource) {
+                        addEdge( dependents, waiting, q, p );
+                        break;
+                    }
+            }
+        }
+    }
+
+    // kahn's algorithm, always taking the earliest declared ready pass so
+    // independent passes keep the order they were written in.
+    order.clear();
+    std::vector<bool> done( pass_count, false );
+    GLuint alive_count = 0;
+    for (GLuint p = 0; p < pass_count; ++p)
+        if (alive[p]) ++alive_count;
+
+    while (order.size() < alive_count) {
+        int next = -1;
+        for (GLuint p = 0; p < pass_count && next < 0; ++p)
+            if (alive[p] && !done[p] && waiting[p] == 0)
+                next = p;
+
+        if (next < 0)
+            return false; // cycle
+
+        done[next] = true;
+        order.push_back( next );
+
+        for (GLuint d = 0; d < dependents[next].size(); ++d)
+            --waiting[dependents[next][d]];
+    }
+
+    return true;
+}
+
+void
+RenderGraph::assignTextures()
+{
+    for (GLuint r = 0; r < resources.size(); ++r) {
+        resources[r].first_use = resources[r].last_use = -1;
+        if (resources[r].is_transient)
+            resources[r].texture = 0;
+    }
+
+    for (GLuint o = 0; o < order.size(); ++o) {
+        const GraphPass &pass = passes[order[o]];
+
+        for (int list = 0; list < 2; ++list) {
+            const std::vector<RenderResource> &used = list ? pass.writes : pass.reads;
+
+            for (GLuint u = 0; u < used.size(); ++u) {
+                GraphResource &resource = resources[used[u]];
+                if (resource.first_use < 0)
+                    resource.first_use = o;
+                resource.last_use = o;
+            }
+        }
+    }
+
+    for (GLuint t = 0; t < physical_textures.size(); ++t)
+        physical_textures[t].last_use = -1;
+
+    // hand out textures in order of first use; one whose previous user is
+    // finished by then is reused instead of allocating another.
+    for (GLuint o = 0; o < order.size(); ++o) {
+        for (GLuint r = 0; r < resources.size(); ++r) {
+            GraphResource &resource = resources[r];
+            if (!resource.is_transient || resource.first_use != (int)o)
+                continue;
+
+            int match = -1;
+            for (GLuint t = 0; t < physical_textures.size() && match < 0; ++t) {
+                if (physical_textures[t].last_use < (int)o &&
+                    sameDesc(physical_textures[t].desc, resource.desc))
+                    match = t;
+            }
+
+            if (match < 0) {
+                PhysicalTexture physical;
+                physical.desc = resource.desc;
+                allocateTexture( physical.texture, resource.desc, has_texture_storage );
+
+                physical_textures.push_back( std::move(physical) );
+                match = physical_textures.size() - 1;
+            }
+
+            physical_textures[match].last_use = resource.last_use;
+            resource.texture = physical_textures[match].texture;
+        }
+    }
+}
+
+bool
+RenderGraph::buildFramebuffers()
+{
+    for (GLuint o = 0; o < order.size(); ++o) {
+        GraphPass &pass = passes[order[o]];
+
+        pass.framebuffer = 0;
+        pass.color_count = 0;
+        pass.discard_before.clear();
+        pass.discard_after.clear();
+        pass.release_textures.clear();
+
+        // inputs nobody needs after this pass can be dropped once it ran.
+        for (GLuint r = 0; r < pass.reads.size(); ++r) {
+            const GraphResource &resource = resources[pass.reads[r]];
+            if (resource.is_transient && !resource.is_output && resource.last_use == (int)o)
+                pass.release_textures.push_back( resource.texture );
+        }
+
+        if (pass.writes.empty())
+            continue;
+
+        if (resources[pass.writes[0]].is_backbuffer) {
+            pass.width = backbuffer_width;
+            pass.height = backbuffer_height;
+            pass.color_count = 1;
+            continue;
+        }
+
+        pass.width = resources[pass.writes[0]].desc.width;
+        pass.height = resources[pass.writes[0]].desc.height;
+
+        std::vector<GLuint> key;
+        std::vector<GLenum> attachments;
+        GLenum draw_buffers[16];
+
+        for (GLuint w = 0; w < pass.writes.size(); ++w) {
+            const GraphResource &resource = resources[pass.writes[w]];
+
+            GLenum attachment;
+            if (hasStencil( resource.desc.format ))
+                attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+            else if (isDepthFormat( resource.desc.format ))
+                attachment = GL_DEPTH_ATTACHMENT;
+            else {
+                attachment = GL_COLOR_ATTACHMENT0 + pass.color_count;
+                draw_buffers[pass.color_count++] = attachment;
+            }
+
+            key.push_back( resource.texture );
+            attachments.push_back( attachment );
+
+            if (!resource.is_transient)
+                continue;
+
+            // nothing from before the first write is worth loading, and
+            // nothing after the last use is worth storing.
+            if (resource.first_use == (int)o)
+                pass.discard_before.push_back( attachment );
+            if (resource.last_use == (int)o && !resource.is_output)
+                pass.discard_after.push_back( attachment );
+        }
+
+        FramebufferCache::iterator cached = framebuffers.find( key );
+        if (cached != framebuffers.end()) {
+            pass.framebuffer = cached->second;
+            continue;
+        }
+
+        glObject<framebufferTraits> framebuffer;
+        glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+
+        for (GLuint a = 0; a < attachments.size(); ++a)
+            glFramebufferTexture2D( GL_FRAMEBUFFER, attachments[a], GL_TEXTURE_2D, key[a], 0 );
+
+        if (pass.color_count > 0)
+            glDrawBuffers( pass.color_count, draw_buffers );
+        else
+            glDrawBuffer( GL_NONE );
+
+        GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+            return false;
+
+        pass.framebuffer = framebuffer;
+        framebuffers.insert( std::make_pair(key, std::move(framebuffer)) );
+    }
+
+    return true;
+}
+
+bool
+RenderGraph::compile()
+{
+    has_invalidate = GLEW_ARB_invalidate_subdata || GLEW_VERSION_4_3;
+    has_texture_storage = GLEW_ARB_texture_storage || GLEW_VERSION_4_2;
+
+    std::vector<bool> alive;
+    cullPasses( alive );
+
+    if (!sortPasses( alive ))
+        return false;
+
+    assignTextures();
+
+    is_compiled = buildFramebuffers();
+    return is_compiled;
+}
+
+void
+RenderGraph::execute( Renderer *renderer )
+{
+    if (!is_compiled && !compile())
+        return;
+
+    for (GLuint o = 0; o < order.size(); ++o) {
+        GraphPass &pass = passes[order[o]];
+
+        glBindFramebuffer( GL_FRAMEBUFFER, pass.framebuffer );
+        if (!pass.writes.empty())
+            glViewport( 0, 0, pass.width, pass.height );
+
+        if (has_invalidate && !pass.discard_before.empty())
+            glInvalidateFramebuffer( GL_FRAMEBUFFER, pass.discard_before.size(), &pass.discard_before[0] );
+
+        if (pass.has_clear && !pass.writes.empty()) {
+            for (GLsizei c = 0; c < pass.color_count; ++c)
+                glClearBufferfv( GL_COLOR, c, pass.clear_color );
+
+            glDepthMask( GL_TRUE );
+            glClearBufferfv( GL_DEPTH, 0, &pass.clear_depth );
+        }
+
+        if (pass.execute != NULL)
+            pass.execute( renderer, this, pass.userdata );
+
+        if (has_invalidate) {
+            if (!pass.discard_after.empty())
+                glInvalidateFramebuffer( GL_FRAMEBUFFER, pass.discard_after.size(), &pass.discard_after[0] );
+
+            for (GLuint t = 0; t < pass.release_textures.size(); ++t)
+                glInvalidateTexImage( pass.release_textures[t], 0 );
+        }
+    }
+
+    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    if (backbuffer_width > 0)
+        glViewport( 0, 0, backbuffer_width, backbuffer_height );
+
+    renderer->getDiagnostics().check( "render graph" );
+}
+
+GLuint
+RenderGraph::getTexture( RenderResource resource ) { return resources[resource].texture; }
+
+GLuint
+RenderGraph::getPassCount() { return passes.size(); }
+
+GLuint
+RenderGraph::getCulledPassCount() { return passes.size() - order.size(); }
+
+GLuint
+RenderGraph::getTextureCount() { return physical_textures.size(); }
@@ -0,0 +1,344 @@
+#include "render_stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace GearsEngine;
+
+static const GLuint DEFAULT_SINK_INTERVAL = 60;
+
+static const char *STAT_NAMES[GR_STAT_COUNT] = {
+    "draw_calls",
+    "triangles",
+    "program_binds",
+    "vao_binds",
+    "buffer_binds",
+    "uniform_uploads",
+    "uploaded_bytes",
+    "live_buffers",
+    "buffer_bytes"
+};
+
+static const char *STAT_HELP[GR_STAT_COUNT] = {
+    "Draw calls per frame.",
+    "Triangles submitted per frame.",
+    "glUseProgram calls per frame.",
+    "Vertex array binds per frame.",
+    "Vertex and element buffers attached for drawing per frame.",
+    "Uniform values and uniform blocks uploaded per frame.",
+    "Bytes uploaded to buffers per frame.",
+    "Vertex and element buffers alive.",
+    "Estimated bytes of buffer memory on the GPU."
+};
+
+// the quantiles the sinks write; 0 and 1 are the window's min and max.
+static const double QUANTILES[] = { 0.0, 0.5, 0.95, 0.99, 1.0 };
+static const GLuint QUANTILE_COUNT = sizeof(QUANTILES) / sizeof(QUANTILES[0]);
+
+static GLuint64
+quantileOf( const StatSummary &summary, GLuint q )
+{
+    switch (q) {
+        case 0:  return summary.min;
+        case 1:  return summary.p50;
+        case 2:  return summary.p95;
+        case 3:  return summary.p99;
+        default: return summary.max;
+    }
+}
+
+RenderStats::RenderStats()
+{
+    std::memset( &current, 0, sizeof(current) );
+    std::memset( &history, 0, sizeof(history) );
+
+    sink_interval = DEFAULT_SINK_INTERVAL;
+    scratch.reserve( GR_STATS_HISTORY );
+
+    has_pending = false;
+    is_shutting_down = false;
+}
+
+RenderStats::~RenderStats()
+{
+    if (!writer.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( writer_mutex );
+        is_shutting_down = true;
+    }
+    writer_wake.notify_all();
+    writer.join();
+}
+
+void
+RenderStats::endFrame()
+{
+    bool is_writing = false;
+
+    {
+        std::lock_guard<std::mutex> lock( history_mutex );
+
+        history.frames[history.head] = current;
+        history.head = (history.head + 1) % GR_STATS_HISTORY;
+        history.size = std::min<GLuint>( history.size + 1, GR_STATS_HISTORY );
+        ++history.frame_count;
+
+        for (int s = 0; s < GR_STAT_COUNT; ++s)
+            history.totals[s] += current.values[s];
+
+        // a copy of the window is all the writer needs; a window it
+        // hasn't got to yet is simply replaced by this one.
+        if (!sinks.empty() && history.frame_count % sink_interval == 0) {
+            std::lock_guard<std::mutex> writer_lock( writer_mutex );
+            pending = history;
+            pending_sinks = sinks;
+            has_pending = true;
+            is_writing = true;
+        }
+    }
+
+    for (int s = 0; s < GR_STAT_COUNT; ++s)
+        if (!isGauge( (RenderStat)s ))
+            current.values[s] = 0;
+
+    if (is_writing)
+        writer_wake.notify_one();
+}
+
+void
+RenderStats::writerLoop()
+{
+    std::vector<GLuint64> writer_scratch;
+    writer_scratch.reserve( GR_STATS_HISTORY );
+
+    StatsWindow window;
+    std::vector<StatsSink> targets;
+
+    std::unique_lock<std::mutex> lock( writer_mutex );
+
+    for (;;) {
+        while (!has_pending && !is_shutting_down)
+            writer_wake.wait( lock );
+
+        if (!has_pending)
+            break;
+
+        window = pending;
+        targets.swap( pending_sinks );
+        has_pending = false;
+
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> file_lock( file_mutex );
+            for (unsigned int s = 0; s < targets.size(); ++s)
+                writeSink( targets[s], window, writer_scratch );
+        }
+        lock.lock();
+    }
+}
+
+FrameStats
+RenderStats::getFrame( GLuint frames_ago )
+{
+    std::lock_guard<std::mutex> lock( history_mutex );
+
+    FrameStats frame;
+    if (frames_ago >= history.size) {
+        std::memset( &frame, 0, sizeof(frame) );
+        return frame;
+    }
+
+    return history.frames[(history.head + GR_STATS_HISTORY - 1 - frames_ago) % GR_STATS_HISTORY];
+}
+
+StatSummary
+RenderStats::summarize( RenderStat stat )
+{
+    std::lock_guard<std::mutex> lock( history_mutex );
+    return summarizeWindow( history, stat, scratch );
+}
+
+StatSummary
+RenderStats::summarizeWindow( const StatsWindow &window, RenderStat stat, std::vector<GLuint64> &scratch )
+{
+    StatSummary summary;
+    std::memset( &summary, 0, sizeof(summary) );
+
+    summary.frames = window.size;
+    if (window.size == 0)
+        return summary;
+
+    scratch.clear();
+    double total = 0.0;
+    for (GLuint f = 0; f < window.size; ++f) {
+        GLuint64 value = window.frames[(window.head + GR_STATS_HISTORY - window.size + f) % GR_STATS_HISTORY].values[stat];
+        scratch.push_back( value );
+        total += (double)value;
+    }
+
+    summary.last = scratch.back();
+    summary.mean = total / window.size;
+
+    // nearest rank; a 240 frame window is small enough to sort.
+    std::sort( scratch.begin(), scratch.end() );
+    summary.min = scratch.front();
+    summary.max = scratch.back();
+    summary.p50 = scratch[(window.size - 1) * 50 / 100];
+    summary.p95 = scratch[(window.size - 1) * 95 / 100];
+    summary.p99 = scratch[(window.size - 1) * 99 / 100];
+
+    return summary;
+}
+
+unsigned long long
+RenderStats::getFrameCount()
+{
+    std::lock_guard<std::mutex> lock( history_mutex );
+    return history.frame_count;
+}
+
+const char *
+RenderStats::getName( RenderStat stat ) { return STAT_NAMES[stat]; }
+
+bool
+RenderStats::isGauge( RenderStat stat )
+{
+    return stat == GR_STAT_LIVE_BUFFERS || stat == GR_STAT_BUFFER_BYTES;
+}
+
+bool
+RenderStats::addSink( const std::string &path, StatsFormat format )
+{
+    StatsSink sink;
+    sink.path = path;
+    sink.format = format;
+
+    // write straight away, so a bad path shows up here and not later.
+    std::vector<StatsSink> targets( 1, sink );
+    if (!writeNow( targets ))
+        return false;
+
+    std::lock_guard<std::mutex> lock( history_mutex );
+    sinks.push_back( sink );
+
+    if (!writer.joinable())
+        writer = std::thread( &RenderStats::writerLoop, this );
+
+    return true;
+}
+
+void
+RenderStats::clearSinks()
+{
+    std::lock_guard<std::mutex> lock( history_mutex );
+    sinks.clear();
+}
+
+void
+RenderStats::setSinkInterval( GLuint frames )
+{
+    std::lock_guard<std::mutex> lock( history_mutex );
+    sink_interval = std::max<GLuint>( frames, 1 );
+}
+
+bool
+RenderStats::flushSinks()
+{
+    std::vector<StatsSink> targets;
+    {
+        std::lock_guard<std::mutex> lock( history_mutex );
+        targets = sinks;
+    }
+
+    return writeNow( targets );
+}
+
+bool
+RenderStats::writeNow( const std::vector<StatsSink> &targets )
+{
+    // a copy, so the frame isn't held up while the files are written.
+    StatsWindow window;
+    {
+        std::lock_guard<std::mutex> lock( history_mutex );
+        window = history;
+    }
+
+    std::vector<GLuint64> local_scratch;
+    local_scratch.reserve( GR_STATS_HISTORY );
+
+    // the writer thread may be on the same files.
+    std::lock_guard<std::mutex> file_lock( file_mutex );
+
+    bool is_written = true;
+    for (unsigned int s = 0; s < targets.size(); ++s)
+        is_written = writeSink( targets[s], window, local_scratch ) && is_written;
+
+    return is_written;
+}
+
+bool
+RenderStats::writeSink( const StatsSink &sink, const StatsWindow &window, std::vector<GLuint64> &scratch )
+{
+    // written next to the target and renamed over it, so readers only
+    // ever see a complete file.
+    std::string temporary = sink.path + ".tmp";
+    std::ofstream file( temporary.c_str(), std::ios::trunc );
+    if (!file.is_open())
+        return false;
+
+    if (sink.format == GR_STATS_PROMETHEUS) {
+        file << "# HELP gears_renderer_frames_total Frames the renderer finished.\n"
+             << "# TYPE gears_renderer_frames_total counter\n"
+             << "gears_renderer_frames_total " << window.frame_count << "\n";
+
+        for (int s = 0; s < GR_STAT_COUNT; ++s) {
+            StatSummary summary = summarizeWindow( window, (RenderStat)s, scratch );
+            std::string name = std::string( "gears_renderer_" ) + STAT_NAMES[s];
+
+            file << "# HELP " << name << " " << STAT_HELP[s] << "\n";
+
+            if (isGauge( (RenderStat)s )) {
+                file << "# TYPE " << name << " gauge\n"
+                     << name << " " << summary.last << "\n";
+                continue;
+            }
+
+            // quantiles over the window; sum and count over every frame
+            // since the start, so they only ever go up, as rate() expects.
+            file << "# TYPE " << name << " summary\n";
+            for (GLuint q = 0; q < QUANTILE_COUNT; ++q)
+                file << name << "{quantile=\"" << QUANTILES[q] << "\"} " << quantileOf( summary, q ) << "\n";
+            file << name << "_sum " << window.totals[s] << "\n"
+                 << name << "_count " << window.frame_count << "\n";
+        }
+    } else {
+        file << "{\n  \"frame\": " << window.frame_count
+             << ",\n  \"window\": " << window.size
+             << ",\n  \"stats\": {";
+
+        for (int s = 0; s < GR_STAT_COUNT; ++s) {
+            StatSummary summary = summarizeWindow( window, (RenderStat)s, scratch );
+
+            file << (s == 0 ? "\n" : ",\n")
+                 << "    \"" << STAT_NAMES[s] << "\": { "
+                 << "\"last\": " << summary.last
+                 << ", \"min\": " << summary.min
+                 << ", \"mean\": " << summary.mean
+                 << ", \"p50\": " << summary.p50
+                 << ", \"p95\": " << summary.p95
+                 << ", \"p99\": " << summary.p99
+                 << ", \"max\": " << summary.max << " }";
+        }
+
+        file << "\n  }\n}\n";
+    }
+
+    file.close();
+    if (file.fail())
+        return false;
+
+    return std::rename( temporary.c_str(), sink.path.c_str() ) == 0;
+}
@@ -0,0 +1,114 @@
+#include "render_thread.hpp"
+
+using namespace GearsEngine;
+
+RenderThread::RenderThread( RenderWindow *target )
+{
+    window = target;
+    renderer = NULL;
+
+    setup_function = NULL;
+    setup_userdata = NULL;
+
+    is_ready = false;
+    frames_rendered = 0;
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+void
+RenderThread::start( RenderSetup setup, void *userdata )
+{
+    if (isRunning())
+        return;
+
+    setup_function = setup;
+    setup_userdata = userdata;
+    is_ready = false;
+
+    mailbox.reopen();
+
+    // a context can only be current on one thread at a time.
+    SDL_GL_MakeCurrent( window->getWindowHandle(), NULL );
+
+    thread = std::thread( &RenderThread::run, this );
+
+    std::unique_lock<std::mutex> lock( ready_mutex );
+    while (!is_ready)
+        ready_changed.wait( lock );
+}
+
+void
+RenderThread::stop()
+{
+    if (!isRunning())
+        return;
+
+    mailbox.close();
+    thread.join();
+
+    SDL_GL_MakeCurrent( window->getWindowHandle(), window->getGLContext() );
+}
+
+bool
+RenderThread::isRunning() { return thread.joinable(); }
+
+FramePacket *
+RenderThread::beginFrame()
+{
+    FramePacket *packet = mailbox.beginWrite();
+
+    // the game thread builds this frame from the events it has polled
+    // so far; the swap, a frame later on the render thread, measures
+    // its latency from there.
+    if (packet != NULL)
+        packet->input_time = window->getInputTime();
+
+    return packet;
+}
+
+void
+RenderThread::submitFrame( FramePacket *packet )
+{
+    mailbox.endWrite( packet );
+}
+
+unsigned long long
+RenderThread::getFramesRendered() { return frames_rendered; }
+
+void
+RenderThread::run()
+{
+    SDL_GL_MakeCurrent( window->getWindowHandle(), window->getGLContext() );
+
+    renderer = new Renderer( window );
+    if (setup_function != NULL)
+        setup_function( renderer, setup_userdata );
+
+    {
+        std::lock_guard<std::mutex> lock( ready_mutex );
+        is_ready = true;
+    }
+    ready_changed.notify_all();
+
+    for (FramePacket *packet = mailbox.beginRead(); packet != NULL; packet = mailbox.beginRead()) {
+        renderer->execute( packet );
+        renderer->endFrame();
+
+        // the packet isn't needed past execute(); let the game thread
+        // have it back before blocking on the swap.
+        Uint64 input_time = packet->input_time;
+        mailbox.endRead( packet );
+        window->swapBuffers( input_time );
+
+        ++frames_rendered;
+    }
+
+    delete renderer;
+    renderer = NULL;
+
+    SDL_GL_MakeCurrent( window->getWindowHandle(), NULL );
+}
@@ -1,14 +1,100 @@
 #include "renderer.hpp"
-#include <cassert>
+#include "occlusion.hpp"
+#include "gpu_culling.hpp"
+#include "gl_capture.hpp"
+#include "dynamic_resolution.hpp"
+#include "frame_readback.hpp"
+#include "particles.hpp"
+#include "sprite_batch.hpp"
+#include <cstdlib>
 #include <iostream>
+#include <stdint.h>
 
 using namespace GearsEngine;
 
+// uniform data one frame can push. every push starts on a
+// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT boundary, commonly 256 bytes, so a
+// 64-byte block per draw fits about 1024 draws, 4096 only where the
+// alignment is 64 or less.
+static const GLsizeiptr UNIFORM_SEGMENT_BYTES = 256 * 1024;
+
+GLsizei
+GearsEngine::attributeTypeSize( GLenum type )
+{
+    switch (type) {
+        case GL_BYTE:  case GL_UNSIGNED_BYTE:  return 1;
+        case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return 2;
+        case GL_DOUBLE: return 8;
+        default: return 4;
+    }
+}
+
+// stride 0 means "tightly packed" to glVertexAttribPointer but "no
+// stride" to glBindVertexBuffer, so resolve it up front.
+static GLsizei
+effectiveStride( const VAPconfig &attribute )
+{
+    if (attribute.stride != 0)
+        return attribute.stride;
+
+    return attribute.size * attributeTypeSize( attribute.type );
+}
+
+static size_t
+hashLayout( const VAPMap &attributes )
+{
+    // FNV-1a over the fields, not the struct, so padding never matters.
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned int a = 0; a < attributes.size(); ++a) {
+        uint64_t fields[5] = {
+            attributes[a].index,
+            (uint64_t)attributes[a].size,
+            attributes[a].type,
+            (uint64_t)((attributes[a].normalized << 24) ^ (uint32_t)effectiveStride(attributes[a])),
+            (uint64_t)(uintptr_t)attributes[a].pointer
+        };
+
+        for (unsigned int f = 0; f < 5; ++f) {
+            hash ^= fields[f];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    return hash;
+}
+
+static bool
+sameLayout( const VAPMap &a, const VAPMap &b )
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (unsigned int i = 0; i < a.size(); ++i) {
+        if (a[i].index != b[i].index || a[i].size != b[i].size ||
+            a[i].type != b[i].type || a[i].normalized != b[i].normalized ||
+            effectiveStride(a[i]) != effectiveStride(b[i]) ||
+            a[i].pointer != b[i].pointer)
+            return false;
+    }
+
+    return true;
+}
+
 Renderer::Renderer( Window *target )
 {
     current_active_vao = 0;
     current_active_shader = 0;
 
+    has_attrib_binding = false;
+    has_dsa = false;
+    bound_vao = 0;
+
+    occlusion_culler = NULL;
+    capture = NULL;
+    dynamic_resolution = NULL;
+    readback = NULL;
+    buffer_bytes = 0;
+
     if (target != NULL && target->isHardwareCapable()) {
 
         glewExperimental = true;
@@ -18,17 +104,68 @@ Renderer::Renderer( Window *target )
             // TODO: produce an error of some sorts...
         }
 
+        // glewInit trips GL_INVALID_ENUM on core contexts; don't report it.
+        glGetError();
+
+        diagnostics.addRoute(
+                GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_LOW,
+                &GLDiagnostics::logSink, NULL
+        );
+#ifdef NDEBUG
+        diagnostics.setMode( GR_DEBUG_ASYNC );
+#else
+        diagnostics.setMode( GR_DEBUG_SYNC );
+#endif
+        diagnostics.setFilter( GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, false );
+
+        has_attrib_binding = GLEW_ARB_vertex_attrib_binding || GLEW_VERSION_4_3;
+        has_dsa = GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access;
+        useCreatedGLNames( has_dsa );
+
+        uniform_ring.initialize( UNIFORM_SEGMENT_BYTES );
+        buffer_bytes = UNIFORM_SEGMENT_BYTES * GR_UNIFORM_FRAMES;
+
         glViewport( 0, 0, target->getWidth(), target->getHeight() );
         setActiveVertexArray( generateVAO("VAO_DEFAULT") );
+
+        const char *capture_path = std::getenv( "GEARS_CAPTURE" );
+        if (capture_path != NULL && *capture_path != '\0')
+            startCapture( capture_path );
     }
 }
 
+Renderer::~Renderer()
+{
+    stopCapture();
+
+    vao_names.clear();
+    vbo_names.clear();
+    ebo_names.clear();
+    layout_vaos.clear();
+    uniform_ring.release();
+
+    // nothing draws after this, so rather than leave the pools to the
+    // next frame, delete the spare names and pending releases now.
+    retireGLObjects();
+    purgeGLObjects();
+}
+
+GLDiagnostics &
+Renderer::getDiagnostics() { return diagnostics; }
+
+RenderStats &
+Renderer::getStats() { return stats; }
+
 int
 Renderer::linkVAPModule()
 {
     vap_modules.push_back( vap_configurations );
+    vap_layouts.push_back( internLayout(vap_configurations) );
     vap_configurations.clear();
 
+    if (capture != NULL)
+        capture->recordLinkVAPModule();
+
     return vap_modules.size() - 1;
 }
 
@@ -36,6 +173,9 @@ void
 Renderer::addVAPConfiguration( VAPconfig new_configuration )
 {
     vap_configurations.push_back( new_configuration );
+
+    if (capture != NULL)
+        capture->recordVAPConfiguration( new_configuration );
 }
 
 VAPconfig
@@ -44,47 +184,202 @@ Renderer::getVAPConfiguration( unsigned int index )
     return vap_configurations[index];
 }
 
+GLuint
+Renderer::internLayout( const VAPMap &attributes )
+{
+    size_t hash = hashLayout( attributes );
+
+    std::pair<LayoutIndex::iterator, LayoutIndex::iterator> range =
+        layout_index.equal_range( hash );
+    for (LayoutIndex::iterator it = range.first; it != range.second; ++it) {
+        if (sameLayout(vertex_layouts[it->second].attributes, attributes))
+            return it->second;
+    }
+
+    VertexLayout layout;
+    layout.hash = hash;
+    layout.attributes = attributes;
+    layout.vao = 0;
+
+    // one binding point per stride and base offset. the relative offset
+    // has to stay under GL_MAX_VERTEX_ATTRIB_RELATIVE_OFFSET, so the
+    // base takes whole strides of the pointer: interleaved attributes
+    // share a binding, and a planar block (normals after every position)
+    // gets one of its own starting where it starts.
+    for (unsigned int a = 0; a < attributes.size(); ++a) {
+        GLsizei stride = effectiveStride( attributes[a] );
+        GLintptr pointer = (GLintptr)(uintptr_t)attributes[a].pointer;
+        GLintptr base = (stride > 0) ? pointer - pointer % stride : pointer;
+        GLuint binding = 0;
+
+        while (binding < layout.binding_strides.size() &&
+               (layout.binding_strides[binding] != stride || layout.binding_offsets[binding] != base))
+            ++binding;
+        if (binding == layout.binding_strides.size()) {
+            layout.binding_strides.push_back( stride );
+            layout.binding_offsets.push_back( base );
+        }
+
+        layout.attribute_bindings.push_back( binding );
+        layout.relative_offsets.push_back( (GLuint)(pointer - base) );
+    }
+
+    vertex_layouts.push_back( layout );
+    layout_index.insert( std::make_pair(hash, (GLuint)(vertex_layouts.size() - 1)) );
+
+    return vertex_layouts.size() - 1;
+}
+
+void
+Renderer::buildLayoutVAO( VertexLayout &layout )
+{
+    glObject<vaoTraits> vao;
+    layout.vao = vao;
+    layout_vaos.push_back( std::move(vao) );
+
+    if (has_dsa) {
+        for (unsigned int a = 0; a < layout.attributes.size(); ++a) {
+            const VAPconfig &attribute = layout.attributes[a];
+
+            glVertexArrayAttribFormat(
+                    layout.vao,
+                    attribute.index,
+                    attribute.size,
+                    attribute.type,
+                    attribute.normalized,
+                    layout.relative_offsets[a]
+            );
+            glVertexArrayAttribBinding( layout.vao, attribute.index, layout.attribute_bindings[a] );
+            glEnableVertexArrayAttrib( layout.vao, attribute.index );
+        }
+        return;
+    }
+
+    glBindVertexArray( layout.vao );
+    bound_vao = layout.vao;
+    stats.add( GR_STAT_VAO_BINDS, 1 );
+
+    for (unsigned int a = 0; a < layout.attributes.size(); ++a) {
+        const VAPconfig &attribute = layout.attributes[a];
+
+        glVertexAttribFormat(
+                attribute.index,
+                attribute.size,
+                attribute.type,
+                attribute.normalized,
+                layout.relative_offsets[a]
+        );
+        glVertexAttribBinding( attribute.index, layout.attribute_bindings[a] );
+        glEnableVertexAttribArray( attribute.index );
+    }
+}
+
+const VAPMap &
+Renderer::getVAPModule( int vap ) { return vap_modules[vap]; }
+
+GLuint
+Renderer::getVertexLayout( int vap ) { return vap_layouts[vap]; }
+
+GLuint
+Renderer::getVertexLayoutCount() { return vertex_layouts.size(); }
+
 VertexArray
-Renderer::generateVAO( std::string identifier )
+Renderer::generateVAO( const std::string &identifier )
 {
     VertexArray vao;
 
-    glGenVertexArrays( 1, &vao.uid );
-    assert( glGetError() == GL_NO_ERROR );
+    glObject<vaoTraits> name;
+    vao.uid = name;
+    vao_names.erase( identifier );
+    vao_names.insert( std::make_pair(identifier, std::move(name)) );
+    diagnostics.check( "generateVAO" );
     vao.identifier = identifier;
     vertex_arrays[identifier] = vao;
 
+    if (capture != NULL)
+        capture->recordGenerate( GR_TRACE_GENERATE_VAO, identifier, vao.uid );
+
     return vao;
 }
 
 VertexBuffer
-Renderer::generateVBO( std::string identifier )
+Renderer::generateVBO( const std::string &identifier )
 {
     VertexBuffer vbo;
 
-    glGenBuffers( 1, &vbo.uid );
-    assert( glGetError() == GL_NO_ERROR );
+    glObject<bufferTraits> name;
+    vbo.uid = name;
+    vbo_names.erase( identifier );
+    vbo_names.insert( std::make_pair(identifier, std::move(name)) );
+    diagnostics.check( "generateVBO" );
     vbo.identifier = identifier;
     vertex_buffers[identifier] = vbo;
 
+    if (capture != NULL)
+        capture->recordGenerate( GR_TRACE_GENERATE_VBO, identifier, vbo.uid );
+
     return vbo;
 }
 
 ElementBuffer
-Renderer::generateEBO( std::string identifier )
+Renderer::generateEBO( const std::string &identifier )
 {
     ElementBuffer ebo;
 
-    glGenBuffers( 1, &ebo.uid );
-    assert( glGetError() == GL_NO_ERROR );
+    glObject<bufferTraits> name;
+    ebo.uid = name;
+    ebo_names.erase( identifier );
+    ebo_names.insert( std::make_pair(identifier, std::move(name)) );
+    diagnostics.check( "generateEBO" );
     ebo.identifier = identifier;
     element_buffers[identifier] = ebo;
 
+    if (capture != NULL)
+        capture->recordGenerate( GR_TRACE_GENERATE_EBO, identifier, ebo.uid );
+
     return ebo;
 }
 
+void
+Renderer::destroyVAO( const std::string &identifier )
+{
+    vao_names.erase( identifier );
+    vertex_arrays.erase( identifier );
+
+    if (capture != NULL)
+        capture->recordDestroy( GR_TRACE_DESTROY_VAO, identifier );
+}
+
+void
+Renderer::destroyVBO( const std::string &identifier )
+{
+    BufferNameMap::iterator name = vbo_names.find( identifier );
+    if (name != vbo_names.end())
+        trackBufferSize( name->second, 0 );
+
+    vbo_names.erase( identifier );
+    vertex_buffers.erase( identifier );
+
+    if (capture != NULL)
+        capture->recordDestroy( GR_TRACE_DESTROY_VBO, identifier );
+}
+
+void
+Renderer::destroyEBO( const std::string &identifier )
+{
+    BufferNameMap::iterator name = ebo_names.find( identifier );
+    if (name != ebo_names.end())
+        trackBufferSize( name->second, 0 );
+
+    ebo_names.erase( identifier );
+    element_buffers.erase( identifier );
+
+    if (capture != NULL)
+        capture->recordDestroy( GR_TRACE_DESTROY_EBO, identifier );
+}
+
 VertexArray
-Renderer::getVAO( std::string identifier )
+Renderer::getVAO( const std::string &identifier )
 {
     if (vertex_arrays.find(identifier) != vertex_arrays.end())
         return vertex_arrays[identifier];
@@ -96,7 +391,7 @@ Renderer::getVAO( std::string identifier )
 }
 
 VertexBuffer
-Renderer::getVBO( std::string identifier )
+Renderer::getVBO( const std::string &identifier )
 {
     if (vertex_buffers.find(identifier) != vertex_buffers.end())
         return vertex_buffers[identifier];
@@ -108,7 +403,7 @@ Renderer::getVBO( std::string identifier )
 }
 
 ElementBuffer
-Renderer::getEBO( std::string identifier )
+Renderer::getEBO( const std::string &identifier )
 {
     if (element_buffers.find(identifier) != element_buffers.end())
         return element_buffers[identifier];
@@ -121,7 +416,7 @@ Renderer::getEBO( std::string identifier )
 
 ShaderProgram
 Renderer::createShaderProgram(
-        std::string identifier,
+        const std::string &identifier,
         VertexShader *vertex_shader,
         FragmentShader *fragment_shader )
 {
@@ -153,6 +448,10 @@ Renderer::createShaderProgram(
 
     glLinkProgram( shader_program.uid );
 
+    // the program keeps what it needs; the shader objects go with it.
+    glDeleteShader( vertex_shader->uid );
+    glDeleteShader( fragment_shader->uid );
+
     shader_program.vertex_shader = *vertex_shader;
     shader_program.fragment_shader = *fragment_shader;
 
@@ -160,19 +459,94 @@ Renderer::createShaderProgram(
 
     current_active_shader = shader_program.uid;
 
+    diagnostics.check( "createShaderProgram" );
+
+    if (capture != NULL)
+        capture->recordShaderProgram( shader_program, vertex_shader, fragment_shader );
+
     return shader_program;
 }
 
+void
+Renderer::destroyShaderProgram( const std::string &identifier )
+{
+    PGMMap::iterator program = shader_programs.find( identifier );
+    if (program == shader_programs.end())
+        return;
+
+    if (current_active_shader == program->second.uid)
+        current_active_shader = 0;
+
+    glDeleteProgram( program->second.uid );
+    shader_programs.erase( program );
+
+    if (capture != NULL)
+        capture->recordDestroy( GR_TRACE_DESTROY_PROGRAM, identifier );
+}
+
+bool
+Renderer::setFrameUniforms( const GLvoid *data, GLsizeiptr size )
+{
+    if (capture != NULL)
+        capture->recordUniformBlock( GR_TRACE_FRAME_UNIFORMS, data, size );
+
+    GLintptr offset = uniform_ring.push( data, size );
+    if (offset < 0)
+        return false;
+
+    uniform_ring.bindRange( GR_FRAME_UNIFORM_BINDING, offset, size );
+    stats.add( GR_STAT_UNIFORM_UPLOADS, 1 );
+    stats.add( GR_STAT_UPLOADED_BYTES, size );
+    return true;
+}
+
+bool
+Renderer::setDrawUniforms( const GLvoid *data, GLsizeiptr size )
+{
+    if (capture != NULL)
+        capture->recordUniformBlock( GR_TRACE_DRAW_UNIFORMS, data, size );
+
+    GLintptr offset = uniform_ring.push( data, size );
+    if (offset < 0)
+        return false;
+
+    uniform_ring.bindRange( GR_DRAW_UNIFORM_BINDING, offset, size );
+    stats.add( GR_STAT_UNIFORM_UPLOADS, 1 );
+    stats.add( GR_STAT_UPLOADED_BYTES, size );
+    return true;
+}
+
+void
+Renderer::bindUniformBlock( const ShaderProgram &program, const std::string &block, GLuint binding )
+{
+    GLuint index = glGetUniformBlockIndex( program.uid, block.c_str() );
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding( program.uid, index, binding );
+
+    diagnostics.check( "bindUniformBlock" );
+
+    if (capture != NULL)
+        capture->recordBindUniformBlock( program.uid, block, binding );
+}
+
 void
 Renderer::setUniform( GLuint v0, GLint location )
 {
     glUniform1ui( location, v0 );
+    stats.add( GR_STAT_UNIFORM_UPLOADS, 1 );
+
+    if (capture != NULL)
+        capture->recordUniform( current_active_shader, location, v0 );
 }
 
 void
 Renderer::setUniform( GLfloat v0, GLint location )
 {
     glUniform1f( location, v0 );
+    stats.add( GR_STAT_UNIFORM_UPLOADS, 1 );
+
+    if (capture != NULL)
+        capture->recordUniform( current_active_shader, location, v0 );
 }
 
 void
@@ -183,29 +557,87 @@ Renderer::setUniform(
         GLuint location )
 {
     glUniformMatrix4fv( location, count, transpose, v0 );
+    stats.add( GR_STAT_UNIFORM_UPLOADS, 1 );
+
+    if (capture != NULL)
+        capture->recordUniform( current_active_shader, (GLint)location, v0, count, transpose );
 }
 
 GLint
-Renderer::getUniform( std::string uniform, ShaderProgram program )
+Renderer::getUniform( const std::string &uniform, const ShaderProgram &program )
 {
-    return glGetUniformLocation( program.uid, uniform.c_str() );
+    GLint location = glGetUniformLocation( program.uid, uniform.c_str() );
+
+    // replay looks the name up again; locations needn't match across drivers.
+    if (capture != NULL)
+        capture->recordUniformLocation( program.uid, uniform, location );
+
+    return location;
 }
 
 
 void
-Renderer::setActiveVertexArray( VertexArray vao )
+Renderer::setActiveVertexArray( const VertexArray &vao )
 {
     current_active_vao = vao.uid;
+
+    if (capture != NULL)
+        capture->recordActive( GR_TRACE_ACTIVE_VERTEX_ARRAY, vao.uid );
 }
 
 void
 Renderer::initializeVertexBuffer( 
-        VertexBuffer vbo,
-        ElementBuffer ebo,
+        const VertexBuffer &vbo,
+        const ElementBuffer &ebo,
         int vap )
 {
-    glBindVertexArray( current_active_vao );
+    // the data is only read during this call; keeping the pointer would
+    // hand out a dangling one through getVBO().
     vertex_buffers[vbo.identifier] = vbo;
+    vertex_buffers[vbo.identifier].data = NULL;
+
+    if (capture != NULL)
+        capture->recordInitializeVertexBuffer( vbo, ebo, vap );
+
+    trackBufferSize( vbo.uid, vbo.size );
+    if (vbo.data != NULL)
+        stats.add( GR_STAT_UPLOADED_BYTES, vbo.size );
+
+    if (ebo.uid > 0) {
+        trackBufferSize( ebo.uid, ebo.size );
+        if (ebo.data != NULL)
+            stats.add( GR_STAT_UPLOADED_BYTES, ebo.size );
+    }
+
+    if (has_dsa) {
+        glNamedBufferData( vbo.uid, vbo.size, vbo.data, GL_STATIC_DRAW );
+        if (ebo.uid > 0)
+            glNamedBufferData( ebo.uid, ebo.size, ebo.data, GL_STATIC_DRAW );
+
+        attachVertexBuffer( vbo, ebo, vap );
+        diagnostics.check( "initializeVertexBuffer" );
+        return;
+    }
+
+    if (has_attrib_binding) {
+        // upload through the copy target so no VAO's element binding is
+        // touched, then point the layout's VAO at the new buffers.
+        glBindBuffer( GL_COPY_WRITE_BUFFER, vbo.uid );
+        glBufferData( GL_COPY_WRITE_BUFFER, vbo.size, vbo.data, GL_STATIC_DRAW );
+
+        if (ebo.uid > 0) {
+            glBindBuffer( GL_COPY_WRITE_BUFFER, ebo.uid );
+            glBufferData( GL_COPY_WRITE_BUFFER, ebo.size, ebo.data, GL_STATIC_DRAW );
+        }
+
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+
+        attachVertexBuffer( vbo, ebo, vap );
+        diagnostics.check( "initializeVertexBuffer" );
+        return;
+    }
+
+    glBindVertexArray( current_active_vao );
 
     glBindBuffer( GL_ARRAY_BUFFER, vbo.uid );
 
@@ -226,6 +658,21 @@ Renderer::initializeVertexBuffer(
         );
     }
 
+    specifyLegacyAttributes( vap );
+
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glBindVertexArray( 0 );
+    bound_vao = 0;
+
+    stats.add( GR_STAT_VAO_BINDS, 1 );
+    stats.add( GR_STAT_BUFFER_BINDS, (ebo.uid > 0) ? 2 : 1 );
+
+    diagnostics.check( "initializeVertexBuffer" );
+}
+
+void
+Renderer::specifyLegacyAttributes( int vap )
+{
     for (int c = 0; c < vap_modules[vap].size(); ++c ) {
         glVertexAttribPointer(
                 vap_modules[vap][c].index,
@@ -238,16 +685,109 @@ Renderer::initializeVertexBuffer(
 
         glEnableVertexAttribArray( vap_modules[vap][c].index );
     }
+}
 
-    glBindBuffer( GL_ARRAY_BUFFER, 0 );
-    glBindVertexArray( 0 );
+void
+Renderer::bindVertexBuffer(
+        const VertexBuffer &vbo,
+        const ElementBuffer &ebo,
+        int vap )
+{
+    if (capture != NULL)
+        capture->recordBindVertexBuffer( vbo.uid, ebo.uid, vap );
+
+    attachVertexBuffer( vbo, ebo, vap );
 }
 
 void
-Renderer::initializeElementBuffer( ElementBuffer ebo )
+Renderer::attachVertexBuffer(
+        const VertexBuffer &vbo,
+        const ElementBuffer &ebo,
+        int vap )
 {
+    if (!has_attrib_binding) {
+        // without separate formats the attribute pointers have to be
+        // re-specified against the new buffer.
+        glBindVertexArray( current_active_vao );
+        glBindBuffer( GL_ARRAY_BUFFER, vbo.uid );
+        if (ebo.uid > 0)
+            glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo.uid );
+
+        specifyLegacyAttributes( vap );
+
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        bound_vao = current_active_vao;
+
+        stats.add( GR_STAT_VAO_BINDS, 1 );
+        stats.add( GR_STAT_BUFFER_BINDS, (ebo.uid > 0) ? 2 : 1 );
+        return;
+    }
+
+    VertexLayout &layout = vertex_layouts[vap_layouts[vap]];
+
+    if (layout.vao == 0)
+        buildLayoutVAO( layout );
+
+    stats.add( GR_STAT_BUFFER_BINDS, layout.binding_strides.size() + ((ebo.uid > 0) ? 1 : 0) );
+
+    if (has_dsa) {
+        // attach straight to the VAO; draw() binds it when it's needed.
+        for (GLuint b = 0; b < layout.binding_strides.size(); ++b)
+            glVertexArrayVertexBuffer( layout.vao, b, vbo.uid, layout.binding_offsets[b], layout.binding_strides[b] );
+
+        if (ebo.uid > 0) {
+            glVertexArrayElementBuffer( layout.vao, ebo.uid );
+            current_active_ebo = ebo.uid;
+        }
+
+        current_active_vao = layout.vao;
+        return;
+    }
+
+    if (bound_vao != layout.vao) {
+        glBindVertexArray( layout.vao );
+        bound_vao = layout.vao;
+        stats.add( GR_STAT_VAO_BINDS, 1 );
+    }
+
+    for (GLuint b = 0; b < layout.binding_strides.size(); ++b)
+        glBindVertexBuffer( b, vbo.uid, layout.binding_offsets[b], layout.binding_strides[b] );
+
+    if (ebo.uid > 0) {
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo.uid );
+        current_active_ebo = ebo.uid;
+    }
+
+    current_active_vao = layout.vao;
+}
+
+void
+Renderer::initializeElementBuffer( const ElementBuffer &ebo )
+{
+    if (capture != NULL)
+        capture->recordInitializeElementBuffer( ebo );
+
+    trackBufferSize( ebo.uid, ebo.size );
+    if (ebo.data != NULL)
+        stats.add( GR_STAT_UPLOADED_BYTES, ebo.size );
+    stats.add( GR_STAT_BUFFER_BINDS, 1 );
+
+    if (has_dsa) {
+        element_buffers[ebo.identifier] = ebo;
+        element_buffers[ebo.identifier].data = NULL;
+
+        glNamedBufferData( ebo.uid, ebo.size, ebo.data, GL_STATIC_DRAW );
+        glVertexArrayElementBuffer( current_active_vao, ebo.uid );
+
+        current_active_ebo = ebo.uid;
+
+        diagnostics.check( "initializeElementBuffer" );
+        return;
+    }
+
     glBindVertexArray( current_active_vao );
     element_buffers[ebo.identifier] = ebo;
+    element_buffers[ebo.identifier].data = NULL;
     glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, ebo.uid );
 
     glBufferData(
@@ -259,31 +799,354 @@ Renderer::initializeElementBuffer( ElementBuffer ebo )
 
     glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
     glBindVertexArray( 0 );
+    bound_vao = 0;
+    stats.add( GR_STAT_VAO_BINDS, 1 );
 
     current_active_ebo = ebo.uid;
+
+    diagnostics.check( "initializeElementBuffer" );
+}
+
+void
+Renderer::updateVertexBuffer(
+        const VertexBuffer &vbo,
+        GLintptr offset,
+        GLsizeiptr size,
+        const GLvoid *data )
+{
+    if (capture != NULL)
+        capture->recordUpdateBuffer( GR_TRACE_UPDATE_VERTEX_BUFFER, vbo.uid, offset, size, data );
+
+    if (has_dsa) {
+        glNamedBufferSubData( vbo.uid, offset, size, data );
+    } else {
+        // the copy target isn't used for drawing, so nothing needs
+        // restoring afterwards.
+        glBindBuffer( GL_COPY_WRITE_BUFFER, vbo.uid );
+        glBufferSubData( GL_COPY_WRITE_BUFFER, offset, size, data );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+    }
+
+    stats.add( GR_STAT_UPLOADED_BYTES, size );
+
+    diagnostics.check( "updateVertexBuffer" );
+}
+
+void
+Renderer::updateElementBuffer(
+        const ElementBuffer &ebo,
+        GLintptr offset,
+        GLsizeiptr size,
+        const GLvoid *data )
+{
+    if (capture != NULL)
+        capture->recordUpdateBuffer( GR_TRACE_UPDATE_ELEMENT_BUFFER, ebo.uid, offset, size, data );
+
+    if (has_dsa) {
+        glNamedBufferSubData( ebo.uid, offset, size, data );
+    } else {
+        glBindBuffer( GL_COPY_WRITE_BUFFER, ebo.uid );
+        glBufferSubData( GL_COPY_WRITE_BUFFER, offset, size, data );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+    }
+
+    stats.add( GR_STAT_UPLOADED_BYTES, size );
+
+    diagnostics.check( "updateElementBuffer" );
 }
 
+bool
+Renderer::isUsingDSA() { return has_dsa; }
+
 void
-Renderer::setActiveShaderProgram( ShaderProgram shader_program )
+Renderer::setActiveShaderProgram( const ShaderProgram &shader_program )
 {
     current_active_shader = shader_program.uid;
+
+    if (capture != NULL)
+        capture->recordActive( GR_TRACE_ACTIVE_SHADER_PROGRAM, shader_program.uid );
+}
+
+ShaderProgram
+Renderer::getActiveShaderProgram()
+{
+    for (PGMMap::iterator it = shader_programs.begin(); it != shader_programs.end(); ++it)
+        if (it->second.uid == current_active_shader)
+            return it->second;
+
+    // set from a frame packet, or never set at all.
+    ShaderProgram program;
+    program.uid = current_active_shader;
+    program.vertex_shader.source_code = NULL;
+    program.fragment_shader.source_code = NULL;
+    return program;
+}
+
+void
+Renderer::endFrame()
+{
+    if (capture != NULL)
+        capture->recordEndFrame();
+
+    if (dynamic_resolution != NULL && dynamic_resolution->isInScene()) {
+        dynamic_resolution->endScene();
+        dynamic_resolution->present( 0 );
+    }
+
+    if (readback != NULL) {
+        readback->endFrame();
+        diagnostics.check( "readback" );
+    }
+
+    stats.set( GR_STAT_LIVE_BUFFERS, vbo_names.size() + ebo_names.size() );
+    stats.set( GR_STAT_BUFFER_BYTES, buffer_bytes );
+    stats.endFrame();
+
+    uniform_ring.endFrame();
+    retireGLObjects();
 }
 
 void
 Renderer::clear( GLclampf r, GLclampf g, GLclampf b, GLclampf a )
 {
+    if (capture != NULL)
+        capture->recordClear( r, g, b, a );
+
+    if (dynamic_resolution != NULL && !dynamic_resolution->isInScene())
+        dynamic_resolution->beginScene();
+
     glClearColor( r, g, b, a );
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 }
 
 void
-Renderer::draw( RenderType mode )
+Renderer::prepareDraw()
 {
     glUseProgram( current_active_shader );
-    glBindVertexArray( current_active_vao );
+    stats.add( GR_STAT_PROGRAM_BINDS, 1 );
+
+    // the VAO stays bound between draws; consecutive meshes with the same
+    // layout then cost no VAO switch at all.
+    if (bound_vao != current_active_vao) {
+        glBindVertexArray( current_active_vao );
+        bound_vao = current_active_vao;
+        stats.add( GR_STAT_VAO_BINDS, 1 );
+    }
 
     glEnable( GL_DEPTH_TEST );
-    glDrawElements( GL_TRIANGLES, 12*3, GL_UNSIGNED_INT, 0 );
+}
 
-    glBindVertexArray( 0 );
+void
+Renderer::drawElements( GLsizei count )
+{
+    prepareDraw();
+    glDrawElements( GL_TRIANGLES, count, GL_UNSIGNED_INT, 0 );
+
+    stats.add( GR_STAT_DRAW_CALLS, 1 );
+    stats.add( GR_STAT_TRIANGLES, count / 3 );
+}
+
+void
+Renderer::draw( RenderType mode )
+{
+    if (capture != NULL)
+        capture->recordDraw( mode );
+
+    drawElements( 12*3 );
+    diagnostics.check( "draw" );
+}
+
+void
+Renderer::execute( const FramePacket *packet )
+{
+    // the packet is the record; what it does here needn't be.
+    GLCapture *recording = capture;
+    if (recording != NULL)
+        recording->recordExecute( packet );
+    capture = NULL;
+
+    clear( packet->clear_color[0], packet->clear_color[1],
+           packet->clear_color[2], packet->clear_color[3] );
+
+    GLuint last_program = 0;
+
+    for (GLuint d = 0; d < packet->draws.size(); ++d) {
+        const DrawItem &item = packet->draws[d];
+
+        current_active_shader = item.program;
+        glUseProgram( item.program );
+        stats.add( GR_STAT_PROGRAM_BINDS, 1 );
+
+        // uniforms live in the program, so the camera only needs setting
+        // when the program changes.
+        if (item.program != last_program) {
+            if (item.view_location >= 0)
+                glUniformMatrix4fv( item.view_location, 1, GL_FALSE, &packet->view[0][0] );
+            if (item.projection_location >= 0)
+                glUniformMatrix4fv( item.projection_location, 1, GL_FALSE, &packet->projection[0][0] );
+            last_program = item.program;
+            stats.add( GR_STAT_UNIFORM_UPLOADS, (item.view_location >= 0) + (item.projection_location >= 0) );
+        }
+
+        for (GLuint u = item.first_uniform; u < item.first_uniform + item.uniform_count; ++u) {
+            const UniformValue &value = packet->uniforms[u];
+            const GLfloat *data = &packet->uniform_data[value.offset];
+
+            switch (value.type) {
+                case GL_FLOAT_MAT4:    glUniformMatrix4fv( value.location, value.count, GL_FALSE, data ); break;
+                case GL_FLOAT_VEC4:    glUniform4fv( value.location, value.count, data ); break;
+                case GL_FLOAT:         glUniform1fv( value.location, value.count, data ); break;
+                case GL_UNSIGNED_INT:  glUniform1uiv( value.location, value.count, (const GLuint*)data ); break;
+            }
+        }
+        stats.add( GR_STAT_UNIFORM_UPLOADS, item.uniform_count );
+
+        VertexBuffer vbo;
+        ElementBuffer ebo;
+        vbo.uid = item.vbo;
+        ebo.uid = item.ebo;
+        attachVertexBuffer( vbo, ebo, item.vap );
+
+        drawElements( item.element_count );
+    }
+
+    capture = recording;
+
+    diagnostics.check( "execute" );
+}
+
+void
+Renderer::setOcclusionCuller( OcclusionCuller *culler )
+{
+    occlusion_culler = culler;
+}
+
+bool
+Renderer::draw( RenderType mode, AABB bounds )
+{
+    if (occlusion_culler != NULL && !occlusion_culler->isVisible(bounds))
+        return false;
+
+    draw( mode );
+    return true;
+}
+
+void
+Renderer::setDynamicResolution( DynamicResolution *resolution )
+{
+    // don't leave a half finished scene in the old target: put what was
+    // drawn so far on the window, which also binds it again at its full
+    // size for the rest of the frame.
+    if (dynamic_resolution != NULL && dynamic_resolution->isInScene()) {
+        dynamic_resolution->endScene();
+        dynamic_resolution->present( 0 );
+    }
+
+    dynamic_resolution = resolution;
+}
+
+void
+Renderer::setFrameReadback( FrameReadback *frame_readback ) { readback = frame_readback; }
+
+void
+Renderer::drawIndirect( GPUCuller *culler )
+{
+    prepareDraw();
+    culler->submit();
+
+    // what the GPU draws is decided on the GPU; count the submission.
+    stats.add( GR_STAT_DRAW_CALLS, 1 );
+
+    diagnostics.check( "drawIndirect" );
+}
+
+void
+Renderer::drawParticles( ParticleSystem *particles, const glm::mat4 &view, const glm::mat4 &projection )
+{
+    GLuint count = particles->getCount();
+    particles->draw( view, projection );
+
+    // the system binds a VAO of its own and leaves none bound.
+    bound_vao = 0;
+
+    if (count > 0) {
+        stats.add( GR_STAT_DRAW_CALLS, 1 );
+        stats.add( GR_STAT_PROGRAM_BINDS, 1 );
+        stats.add( GR_STAT_TRIANGLES, count * 2 );
+        stats.add( GR_STAT_UPLOADED_BYTES, count * ParticleSystem::getInstanceSize() );
+    }
+
+    diagnostics.check( "drawParticles" );
 }
+
+void
+Renderer::drawSprites( SpriteBatch *sprites )
+{
+    GLuint quads = sprites->getQueuedCount();
+    GLuint draws = sprites->flush();
+
+    bound_vao = 0;
+
+    if (draws > 0) {
+        stats.add( GR_STAT_DRAW_CALLS, draws );
+        stats.add( GR_STAT_PROGRAM_BINDS, 1 );
+        stats.add( GR_STAT_TRIANGLES, quads * 2 );
+        stats.add( GR_STAT_UPLOADED_BYTES, quads * SpriteBatch::getQuadSize() );
+    }
+
+    diagnostics.check( "drawSprites" );
+}
+
+void
+Renderer::trackBufferSize( GLuint uid, GLsizeiptr size )
+{
+    // glBufferData on a live buffer replaces its storage.
+    std::map<GLuint, GLsizeiptr>::iterator tracked = buffer_sizes.find( uid );
+    if (tracked != buffer_sizes.end()) {
+        buffer_bytes -= tracked->second;
+        buffer_sizes.erase( tracked );
+    }
+
+    if (size > 0) {
+        buffer_sizes[uid] = size;
+        buffer_bytes += size;
+    }
+}
+
+bool
+Renderer::startCapture( const std::string &path )
+{
+    stopCapture();
+
+    GLint viewport[4] = { 0, 0, 0, 0 };
+    glGetIntegerv( GL_VIEWPORT, viewport );
+
+    capture = new GLCapture();
+    if (!capture->open( path, viewport[2], viewport[3] )) {
+        stopCapture();
+        return false;
+    }
+
+    // names that exist already are declared so the replay has them too;
+    // what was uploaded into them before now isn't in the trace.
+    for (VAOMap::iterator it = vertex_arrays.begin(); it != vertex_arrays.end(); ++it)
+        capture->recordGenerate( GR_TRACE_GENERATE_VAO, it->first, it->second.uid );
+    for (VBOMap::iterator it = vertex_buffers.begin(); it != vertex_buffers.end(); ++it)
+        capture->recordGenerate( GR_TRACE_GENERATE_VBO, it->first, it->second.uid );
+    for (EBOMap::iterator it = element_buffers.begin(); it != element_buffers.end(); ++it)
+        capture->recordGenerate( GR_TRACE_GENERATE_EBO, it->first, it->second.uid );
+
+    capture->recordActive( GR_TRACE_ACTIVE_VERTEX_ARRAY, current_active_vao );
+
+    return true;
+}
+
+void
+Renderer::stopCapture()
+{
+    delete capture;
+    capture = NULL;
+}
+
+bool
+Renderer::isCapturing() { return capture != NULL; }
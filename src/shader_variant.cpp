@@ -0,0 +1,217 @@
+#include "shader_variant.hpp"
+#include <fstream>
+#include <sstream>
+
+using namespace GearsEngine;
+
+ShaderVariants::ShaderVariants(
+        Renderer *target,
+        std::string name,
+        const GLchar *vertex,
+        const GLchar *fragment )
+{
+    renderer = target;
+    identifier = name;
+    vertex_source = vertex;
+    fragment_source = fragment;
+}
+
+VariantKey
+ShaderVariants::addKeyword( std::string name )
+{
+    VariantKey existing = getKeyword( name );
+    if (existing != 0)
+        return existing;
+
+    if (keywords.size() >= GR_MAX_SHADER_KEYWORDS)
+        return 0;
+
+    keywords.push_back( name );
+    return 1ull << (keywords.size() - 1);
+}
+
+VariantKey
+ShaderVariants::getKeyword( std::string name )
+{
+    for (GLuint k = 0; k < keywords.size(); ++k)
+        if (keywords[k] == name)
+            return 1ull << k;
+
+    return 0;
+}
+
+std::string
+ShaderVariants::specialize( const std::string &source, VariantKey key )
+{
+    std::string defines;
+    for (GLuint k = 0; k < keywords.size(); ++k)
+        if (key & (1ull << k))
+            defines += "#define " + keywords[k] + " 1\n";
+
+    // #version has to stay the first statement, so the defines go right
+    // after its line.
+    size_t insert_at = 0;
+    size_t version = source.find( "#version" );
+    if (version != std::string::npos) {
+        size_t line_end = source.find( '\n', version );
+        insert_at = (line_end == std::string::npos) ? source.size() : line_end + 1;
+    }
+
+    std::string result = source;
+    if (insert_at > 0 && result[insert_at - 1] != '\n') {
+        result += '\n';
+        ++insert_at;
+    }
+
+    return result.insert( insert_at, defines );
+}
+
+std::string
+ShaderVariants::describe( VariantKey key )
+{
+    std::string names;
+    for (GLuint k = 0; k < keywords.size(); ++k) {
+        if (key & (1ull << k)) {
+            if (!names.empty())
+                names += ' ';
+            names += keywords[k];
+        }
+    }
+
+    return names.empty() ? "-" : names;
+}
+
+ShaderProgram
+ShaderVariants::compile( VariantKey key )
+{
+    const std::string &vertex = *sources.insert( sources.end(), specialize(vertex_source, key) );
+    const std::string &fragment = *sources.insert( sources.end(), specialize(fragment_source, key) );
+
+    VertexShader vertex_shader;
+    FragmentShader fragment_shader;
+    vertex_shader.identifier = identifier + ".vert";
+    fragment_shader.identifier = identifier + ".frag";
+    vertex_shader.source_code = vertex.c_str();
+    fragment_shader.source_code = fragment.c_str();
+
+    // creating a program makes it the active one; a variant compiled on
+    // first use in the middle of a frame mustn't change what later draws
+    // use.
+    ShaderProgram previous = renderer->getActiveShaderProgram();
+
+    std::string name = identifier + "[" + describe(key) + "]";
+    ShaderProgram program = renderer->createShaderProgram( name, &vertex_shader, &fragment_shader );
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv( program.uid, GL_LINK_STATUS, &linked );
+
+    if (linked != GL_TRUE) {
+        GLchar log[1024] = "";
+        glGetProgramInfoLog( program.uid, sizeof(log), NULL, log );
+
+        std::string call = "ShaderVariants " + name;
+
+        DebugMessage message;
+        message.source = GL_DEBUG_SOURCE_SHADER_COMPILER;
+        message.type = GL_DEBUG_TYPE_ERROR;
+        message.severity = GL_DEBUG_SEVERITY_HIGH;
+        message.id = 0;
+        message.text = log;
+        message.call = call.c_str();
+        renderer->getDiagnostics().dispatch( &message );
+
+        renderer->destroyShaderProgram( name );
+        sources.pop_back();
+        sources.pop_back();
+
+        program.uid = 0;
+        program.vertex_shader.source_code = NULL;
+        program.fragment_shader.source_code = NULL;
+    }
+
+    renderer->setActiveShaderProgram( previous );
+    return program;
+}
+
+ShaderProgram
+ShaderVariants::getVariant( VariantKey key )
+{
+    VariantCache::iterator cached = variants.find( key );
+    if (cached != variants.end())
+        return cached->second;
+
+    ShaderProgram program = compile( key );
+    variants[key] = program;
+    used_variants.push_back( key );
+
+    return program;
+}
+
+bool
+ShaderVariants::isCompiled( VariantKey key )
+{
+    return variants.find( key ) != variants.end();
+}
+
+GLuint
+ShaderVariants::getVariantCount() { return variants.size(); }
+
+void
+ShaderVariants::prewarm( const std::vector<VariantKey> &keys )
+{
+    for (GLuint k = 0; k < keys.size(); ++k)
+        getVariant( keys[k] );
+}
+
+const std::vector<VariantKey> &
+ShaderVariants::getUsedVariants() { return used_variants; }
+
+bool
+ShaderVariants::saveUsage( std::string path )
+{
+    std::ofstream file( path.c_str() );
+    if (!file)
+        return false;
+
+    for (GLuint v = 0; v < used_variants.size(); ++v)
+        file << describe( used_variants[v] ) << '\n';
+
+    return file.good();
+}
+
+bool
+ShaderVariants::prewarm( std::string path )
+{
+    std::ifstream file( path.c_str() );
+    if (!file)
+        return false;
+
+    std::vector<VariantKey> keys;
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (line.empty())
+            continue;
+
+        std::istringstream names( line );
+        std::string name;
+        VariantKey key = 0;
+        bool known = true;
+
+        while (names >> name) {
+            if (name == "-")
+                continue;
+
+            // keywords the shader no longer has make the entry stale.
+            VariantKey bit = getKeyword( name );
+            known = known && bit != 0;
+            key |= bit;
+        }
+
+        if (known)
+            keys.push_back( key );
+    }
+
+    prewarm( keys );
+    return true;
+}
@@ -0,0 +1,727 @@
+#include "sprite_batch.hpp"
+#include "gl_object.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+using namespace GearsEngine;
+
+// distance between baselines, in pixel sizes.
+static const GLfloat LINE_SPACING = 1.25f;
+
+typedef struct {
+    GLfloat x, y;
+    GLfloat u, v;
+    GLuint  color;
+} SpriteVertex;
+
+static const GLchar *vertex_source =
+    "#version 330 core\n"
+    "layout (location = 0) in vec2 position;\n"
+    "layout (location = 1) in vec2 uv;\n"
+    "layout (location = 2) in vec4 color;\n"
+    "uniform mat4 projection;\n"
+    "out vec2 texcoord;\n"
+    "out vec4 tint;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = projection * vec4( position, 0.0, 1.0 );\n"
+    "    texcoord = uv;\n"
+    "    tint = color;\n"
+    "}\n"
+;
+
+static const GLchar *fragment_source =
+    "#version 330 core\n"
+    "uniform sampler2D sprite;\n"
+    "in vec2 texcoord;\n"
+    "in vec4 tint;\n"
+    "out vec4 fragment;\n"
+    "void main()\n"
+    "{\n"
+    "    fragment = texture( sprite, texcoord ) * tint;\n"
+    "}\n"
+;
+
+// decode the UTF-8 sequence at text[i] and step past it. malformed
+// bytes come out as U+FFFD, one at a time.
+static GLuint
+nextCodepoint( const std::string &text, size_t &i )
+{
+    unsigned char lead = text[i++];
+    if (lead < 0x80)
+        return lead;
+
+    GLuint length = (lead >= 0xf0) ? 3 : (lead >= 0xe0) ? 2 : (lead >= 0xc0) ? 1 : 0;
+    if (length == 0 || i + length > text.size())
+        return 0xfffd;
+
+    GLuint codepoint = lead & (0x3f >> length);
+    for (GLuint c = 0; c < length; ++c) {
+        unsigned char next = text[i + c];
+        if ((next & 0xc0) != 0x80)
+            return 0xfffd;
+        codepoint = (codepoint << 6) | (next & 0x3f);
+    }
+
+    i += length;
+    return codepoint;
+}
+
+//===========
+//skyline
+//===========
+SkylineAtlas::SkylineAtlas( GLint atlas_width, GLint atlas_height )
+{
+    width = atlas_width;
+    height = atlas_height;
+    clear();
+}
+
+void
+SkylineAtlas::clear()
+{
+    SkylineNode ground = { 0, 0, width };
+
+    skyline.clear();
+    skyline.push_back( ground );
+    used_area = 0;
+}
+
+GLint
+SkylineAtlas::fitAt( GLuint node, GLint rectangle_width, GLint rectangle_height )
+{
+    // the rectangle rests on the highest node below its span.
+    if (skyline[node].x + rectangle_width > width)
+        return -1;
+
+    GLint y = 0;
+    GLint remaining = rectangle_width;
+
+    for (GLuint n = node; remaining > 0; ++n) {
+        y = std::max( y, skyline[n].y );
+        if (y + rectangle_height > height)
+            return -1;
+
+        remaining -= skyline[n].width;
+    }
+
+    return y;
+}
+
+bool
+SkylineAtlas::insert( GLint rectangle_width, GLint rectangle_height, GLint &x, GLint &y )
+{
+    GLint best_node = -1;
+    GLint best_top = INT_MAX, best_width = INT_MAX, best_y = 0;
+
+    for (GLuint n = 0; n < skyline.size(); ++n) {
+        GLint fit = fitAt( n, rectangle_width, rectangle_height );
+        if (fit < 0)
+            continue;
+
+        GLint top = fit + rectangle_height;
+        if (top < best_top || (top == best_top && skyline[n].width < best_width)) {
+            best_node = n;
+            best_top = top;
+            best_width = skyline[n].width;
+            best_y = fit;
+        }
+    }
+
+    if (best_node < 0)
+        return false;
+
+    x = skyline[best_node].x;
+    y = best_y;
+
+    SkylineNode roof = { x, best_y + rectangle_height, rectangle_width };
+    skyline.insert( skyline.begin() + best_node, roof );
+
+    // the nodes under the new one shrink or go.
+    for (GLuint n = best_node + 1; n < skyline.size(); ++n) {
+        GLint covered = skyline[n-1].x + skyline[n-1].width - skyline[n].x;
+        if (covered <= 0)
+            break;
+
+        skyline[n].x += covered;
+        skyline[n].width -= covered;
+        if (skyline[n].width > 0)
+            break;
+
+        skyline.erase( skyline.begin() + n );
+        --n;
+    }
+
+    for (GLuint n = 0; n + 1 < skyline.size(); ++n) {
+        if (skyline[n].y == skyline[n+1].y) {
+            skyline[n].width += skyline[n+1].width;
+            skyline.erase( skyline.begin() + n + 1 );
+            --n;
+        }
+    }
+
+    used_area += (GLuint64)rectangle_width * rectangle_height;
+    return true;
+}
+
+GLfloat
+SkylineAtlas::getOccupancy() { return (GLfloat)((double)used_area / ((double)width * height)); }
+
+//===========
+//glyph cache
+//===========
+GlyphCache::GlyphCache( GLsizei atlas_size )
+    : packer( atlas_size, atlas_size )
+{
+    page = 0;
+    used_pages = 1;
+    is_full = false;
+    size = atlas_size;
+}
+
+GlyphCache::~GlyphCache()
+{
+    for (GLuint p = 0; p < pages.size(); ++p)
+        textureTraits::Destroy( pages[p] );
+}
+
+bool
+GlyphCache::initialize()
+{
+    if (pages.empty())
+        pages.push_back( createPage() );
+
+    return pages[0] != 0;
+}
+
+GLuint
+GlyphCache::createPage()
+{
+    GLuint texture = textureTraits::Create();
+    glBindTexture( GL_TEXTURE_2D, texture );
+
+    // nothing is sampled outside the glyphs, which are uploaded with
+    // their padding, so the rest can stay undefined.
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_R8, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, NULL );
+
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    // coverage goes to alpha; color comes from the quad.
+    GLint swizzle[] = { GL_ONE, GL_ONE, GL_ONE, GL_RED };
+    glTexParameteriv( GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle );
+
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    return texture;
+}
+
+GLuint
+GlyphCache::addFont( GlyphRasterizer rasterizer, void *userdata )
+{
+    Font font = { rasterizer, userdata };
+    fonts.push_back( font );
+    return fonts.size() - 1;
+}
+
+const Glyph *
+GlyphCache::getGlyph( GLuint font, GLuint pixel_size, GLuint codepoint )
+{
+    GLuint64 key = ((GLuint64)font << 48) | ((GLuint64)(pixel_size & 0xffff) << 32) | codepoint;
+
+    std::map<GLuint64, Glyph>::iterator cached = glyphs.find( key );
+    if (cached != glyphs.end())
+        return &cached->second;
+
+    Glyph glyph;
+    std::memset( &glyph, 0, sizeof(glyph) );
+
+    GlyphBitmap bitmap;
+    std::memset( &bitmap, 0, sizeof(bitmap) );
+
+    bool is_found = font < fonts.size() &&
+            fonts[font].rasterizer( codepoint, pixel_size, &bitmap, fonts[font].userdata );
+
+    if (is_found) {
+        glyph.bearing_x = bitmap.bearing_x;
+        glyph.bearing_y = bitmap.bearing_y;
+        glyph.advance = bitmap.advance;
+    }
+
+    if (is_found && bitmap.width > 0 && bitmap.height > 0 && bitmap.pixels != NULL) {
+        GLint padded_width = bitmap.width + 2 * GR_GLYPH_PADDING;
+        GLint padded_height = bitmap.height + 2 * GR_GLYPH_PADDING;
+
+        if (pages.empty())
+            pages.push_back( createPage() );
+
+        // a full page keeps what's on it, since queued quads may still
+        // sample it; the glyph goes on the next unused one, if any.
+        GLint x, y;
+        while (!packer.insert( padded_width, padded_height, x, y )) {
+            if (packer.getOccupancy() == 0.0f)
+                return NULL;
+
+            if (used_pages == GR_GLYPH_PAGES) {
+                is_full = true;
+                return NULL;
+            }
+
+            page = used_pages++;
+            if (page == pages.size())
+                pages.push_back( createPage() );
+            packer.clear();
+        }
+
+        // uploaded with its border, which clears whatever an earlier
+        // glyph left there before a reset() or evict().
+        scratch.assign( (size_t)padded_width * padded_height, 0 );
+        for (GLsizei row = 0; row < bitmap.height; ++row)
+            std::memcpy( &scratch[(row + GR_GLYPH_PADDING) * padded_width + GR_GLYPH_PADDING],
+                         bitmap.pixels + (size_t)row * bitmap.pitch, bitmap.width );
+
+        glBindTexture( GL_TEXTURE_2D, pages[page] );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+        glTexSubImage2D( GL_TEXTURE_2D, 0, x, y, padded_width, padded_height, GL_RED, GL_UNSIGNED_BYTE, &scratch[0] );
+        glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+        glBindTexture( GL_TEXTURE_2D, 0 );
+
+        glyph.texture = pages[page];
+        glyph.width = bitmap.width;
+        glyph.height = bitmap.height;
+        glyph.u0 = (GLfloat)(x + GR_GLYPH_PADDING) / size;
+        glyph.v0 = (GLfloat)(y + GR_GLYPH_PADDING) / size;
+        glyph.u1 = (GLfloat)(x + GR_GLYPH_PADDING + bitmap.width) / size;
+        glyph.v1 = (GLfloat)(y + GR_GLYPH_PADDING + bitmap.height) / size;
+    }
+
+    return &(glyphs[key] = glyph);
+}
+
+GLfloat
+GlyphCache::measureText( GLuint font, GLuint pixel_size, const std::string &text )
+{
+    GLfloat widest = 0.0f, line = 0.0f;
+
+    for (size_t i = 0; i < text.size(); ) {
+        GLuint codepoint = nextCodepoint( text, i );
+
+        if (codepoint == '\n') {
+            widest = std::max( widest, line );
+            line = 0.0f;
+            continue;
+        }
+
+        const Glyph *glyph = getGlyph( font, pixel_size, codepoint );
+        if (glyph != NULL)
+            line += glyph->advance;
+    }
+
+    return std::max( widest, line );
+}
+
+void
+GlyphCache::reset()
+{
+    glyphs.clear();
+    packer.clear();
+    page = 0;
+    used_pages = 1;
+    is_full = false;
+}
+
+void
+GlyphCache::evict()
+{
+    if (!is_full)
+        return;
+
+    // pages fill in ring order, so the one after the page being packed
+    // holds the oldest glyphs.
+    GLuint oldest = (page + 1) % GR_GLYPH_PAGES;
+
+    std::map<GLuint64, Glyph>::iterator glyph = glyphs.begin();
+    while (glyph != glyphs.end()) {
+        if (glyph->second.texture == pages[oldest])
+            glyphs.erase( glyph++ );
+        else
+            ++glyph;
+    }
+
+    page = oldest;
+    packer.clear();
+    is_full = false;
+}
+
+bool
+GlyphCache::isFull() { return is_full; }
+
+GLuint
+GlyphCache::getTexture( GLuint index ) { return index < pages.size() ? pages[index] : 0; }
+
+GLuint
+GlyphCache::getPageCount() { return pages.size(); }
+
+GLuint
+GlyphCache::getGlyphCount() { return glyphs.size(); }
+
+GLfloat
+GlyphCache::getOccupancy() { return packer.getOccupancy(); }
+
+//===========
+//sprite batch
+//===========
+SpriteBatch::SpriteBatch()
+{
+    projection = glm::mat4( 1.0f );
+
+    max_quads = 0;
+    program = 0;
+    projection_location = -1;
+    vao = vertex_buffer = index_buffer = white_texture = 0;
+
+    segment_size = 0;
+    mapped = NULL;
+    segment = 0;
+    for (int f = 0; f < GR_SPRITE_FRAMES; ++f)
+        fences[f] = NULL;
+    is_initialized = false;
+
+    draw_count = quad_count = 0;
+}
+
+SpriteBatch::~SpriteBatch()
+{
+    for (int f = 0; f < GR_SPRITE_FRAMES; ++f)
+        if (fences[f] != NULL)
+            glDeleteSync( fences[f] );
+
+    if (program != 0)       glDeleteProgram( program );
+    if (vao != 0)           vaoTraits::Destroy( vao );
+    if (index_buffer != 0)  bufferTraits::Destroy( index_buffer );
+    if (white_texture != 0) textureTraits::Destroy( white_texture );
+    if (vertex_buffer != 0) bufferTraits::Destroy( vertex_buffer );
+}
+
+bool
+SpriteBatch::initialize( GLuint quads_per_segment )
+{
+    program = buildGLProgram( vertex_source, fragment_source );
+    if (program == 0)
+        return false;
+
+    max_quads = std::max<GLuint>( quads_per_segment, 1 );
+
+    // whatever the caller has bound is put back afterwards, so a
+    // Renderer's idea of the bound VAO stays true.
+    GLint previous_program = 0, previous_vao = 0, previous_buffer = 0;
+    glGetIntegerv( GL_CURRENT_PROGRAM, &previous_program );
+    glGetIntegerv( GL_VERTEX_ARRAY_BINDING, &previous_vao );
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &previous_buffer );
+
+    projection_location = glGetUniformLocation( program, "projection" );
+    glUseProgram( program );
+    glUniform1i( glGetUniformLocation( program, "sprite" ), 0 );
+    glUseProgram( previous_program );
+
+    // corners go top left, top right, bottom left, bottom right.
+    std::vector<GLuint> indices( max_quads * 6 );
+    for (GLuint q = 0; q < max_quads; ++q) {
+        GLuint *quad = &indices[q * 6];
+        quad[0] = q*4;     quad[1] = q*4 + 2; quad[2] = q*4 + 1;
+        quad[3] = q*4 + 1; quad[4] = q*4 + 2; quad[5] = q*4 + 3;
+    }
+
+    vao = vaoTraits::Create();
+    glBindVertexArray( vao );
+
+    index_buffer = bufferTraits::Create();
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW );
+
+    // the vertex pointers move with the segment; flush() sets them.
+    glEnableVertexAttribArray( 0 );
+    glEnableVertexAttribArray( 1 );
+    glEnableVertexAttribArray( 2 );
+
+    // the index buffer binding went into our VAO; the caller's has its own.
+    glBindVertexArray( previous_vao );
+
+    segment_size = (max_quads * getQuadSize() + 255) / 256 * 256;
+
+    vertex_buffer = bufferTraits::Create();
+    glBindBuffer( GL_ARRAY_BUFFER, vertex_buffer );
+
+    if (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr total = segment_size * GR_SPRITE_FRAMES;
+
+        glBufferStorage( GL_ARRAY_BUFFER, total, NULL, flags );
+        mapped = static_cast<GLubyte*>(glMapBufferRange( GL_ARRAY_BUFFER, 0, total, flags ));
+    }
+
+    if (mapped == NULL)
+        glBufferData( GL_ARRAY_BUFFER, segment_size, NULL, GL_STREAM_DRAW );
+
+    glBindBuffer( GL_ARRAY_BUFFER, previous_buffer );
+
+    // solid rectangles sample this, so one program serves every quad.
+    static const GLubyte white[] = { 255, 255, 255, 255 };
+
+    white_texture = textureTraits::Create();
+    glBindTexture( GL_TEXTURE_2D, white_texture );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    is_initialized = true;
+    return true;
+}
+
+void
+SpriteBatch::begin( GLsizei width, GLsizei height )
+{
+    dropQueued();
+
+    // pixels, origin top left, y down.
+    projection = glm::mat4( 1.0f );
+    projection[0][0] = 2.0f / std::max<GLsizei>( width, 1 );
+    projection[1][1] = -2.0f / std::max<GLsizei>( height, 1 );
+    projection[3][0] = -1.0f;
+    projection[3][1] = 1.0f;
+
+    draw_count = 0;
+    quad_count = 0;
+}
+
+void
+SpriteBatch::queue( GLuint texture, GLint layer, const SpriteQuad &quad )
+{
+    SortKey key;
+    key.key = ((GLuint64)((GLuint)layer ^ 0x80000000u) << 32) | texture;
+    key.quad = quads.size();
+
+    keys.push_back( key );
+    quads.push_back( quad );
+    quads.back().texture = texture;
+}
+
+void
+SpriteBatch::drawSprite( GLuint texture, const glm::vec4 &rect, const glm::vec4 &uv, GLuint color, GLint layer )
+{
+    SpriteQuad quad;
+    quad.x0 = rect.x;
+    quad.y0 = rect.y;
+    quad.x1 = rect.x + rect.z;
+    quad.y1 = rect.y + rect.w;
+    quad.u0 = uv.x;
+    quad.v0 = uv.y;
+    quad.u1 = uv.z;
+    quad.v1 = uv.w;
+    quad.color = color;
+
+    queue( texture != 0 ? texture : white_texture, layer, quad );
+}
+
+void
+SpriteBatch::drawRect( const glm::vec4 &rect, GLuint color, GLint layer )
+{
+    drawSprite( white_texture, rect, glm::vec4( 0.0f, 0.0f, 1.0f, 1.0f ), color, layer );
+}
+
+GLfloat
+SpriteBatch::drawText(
+        GlyphCache *glyphs,
+        GLuint font,
+        GLuint pixel_size,
+        const std::string &text,
+        const glm::vec2 &pen,
+        GLuint color,
+        GLint layer )
+{
+    GLfloat x = pen.x, baseline = pen.y;
+    GLfloat widest = 0.0f;
+
+    for (size_t i = 0; i < text.size(); ) {
+        GLuint codepoint = nextCodepoint( text, i );
+
+        if (codepoint == '\n') {
+            widest = std::max( widest, x - pen.x );
+            x = pen.x;
+            baseline += pixel_size * LINE_SPACING;
+            continue;
+        }
+
+        // NULL past the last page, or bigger than a whole page.
+        const Glyph *glyph = glyphs->getGlyph( font, pixel_size, codepoint );
+        if (glyph == NULL)
+            continue;
+
+        if (glyph->width > 0) {
+            // whole pixels, so glyphs map texel for texel.
+            SpriteQuad quad;
+            quad.x0 = std::floor( x + glyph->bearing_x + 0.5f );
+            quad.y0 = std::floor( baseline - glyph->bearing_y + 0.5f );
+            quad.x1 = quad.x0 + glyph->width;
+            quad.y1 = quad.y0 + glyph->height;
+            quad.u0 = glyph->u0;
+            quad.v0 = glyph->v0;
+            quad.u1 = glyph->u1;
+            quad.v1 = glyph->v1;
+            quad.color = color;
+
+            queue( glyph->texture, layer, quad );
+        }
+
+        x += glyph->advance;
+    }
+
+    // no page can be evicted while quads still sample it; that waits for
+    // the flush.
+    if (glyphs->isFull() &&
+        std::find( filled.begin(), filled.end(), glyphs ) == filled.end())
+        filled.push_back( glyphs );
+
+    return std::max( widest, x - pen.x );
+}
+
+GLuint
+SpriteBatch::flush()
+{
+    if (!is_initialized || quads.empty()) {
+        dropQueued();
+        return 0;
+    }
+
+    std::sort( keys.begin(), keys.end(), SortOrder() );
+
+    // the blend and depth state is the caller's; it gets it back as it was.
+    GLboolean was_depth_tested = glIsEnabled( GL_DEPTH_TEST );
+    GLboolean was_blended = glIsEnabled( GL_BLEND );
+    GLint blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha;
+    glGetIntegerv( GL_BLEND_SRC_RGB, &blend_src_rgb );
+    glGetIntegerv( GL_BLEND_DST_RGB, &blend_dst_rgb );
+    glGetIntegerv( GL_BLEND_SRC_ALPHA, &blend_src_alpha );
+    glGetIntegerv( GL_BLEND_DST_ALPHA, &blend_dst_alpha );
+
+    glUseProgram( program );
+    glUniformMatrix4fv( projection_location, 1, GL_FALSE, &projection[0][0] );
+    glActiveTexture( GL_TEXTURE0 );
+    glBindVertexArray( vao );
+
+    glDisable( GL_DEPTH_TEST );
+    glEnable( GL_BLEND );
+    glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+    GLuint draws = 0;
+    for (GLuint first = 0; first < quads.size(); first += max_quads)
+        draws += drawRange( first, std::min<GLuint>( max_quads, quads.size() - first ) );
+
+    glBlendFuncSeparate( blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha );
+    if (!was_blended)     glDisable( GL_BLEND );
+    if (was_depth_tested) glEnable( GL_DEPTH_TEST );
+    glBindVertexArray( 0 );
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    dropQueued();
+
+    draw_count += draws;
+    return draws;
+}
+
+void
+SpriteBatch::dropQueued()
+{
+    quads.clear();
+    keys.clear();
+
+    // nothing queued samples the full caches' pages any more.
+    for (GLuint c = 0; c < filled.size(); ++c)
+        filled[c]->evict();
+    filled.clear();
+}
+
+GLuint
+SpriteBatch::drawRange( GLuint first, GLuint count )
+{
+    GLintptr offset = 0;
+    SpriteVertex *vertices = NULL;
+
+    glBindBuffer( GL_ARRAY_BUFFER, vertex_buffer );
+
+    if (mapped != NULL) {
+        if (fences[segment] != NULL) {
+            glClientWaitSync( fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull );
+            glDeleteSync( fences[segment] );
+            fences[segment] = NULL;
+        }
+
+        offset = segment * segment_size;
+        vertices = reinterpret_cast<SpriteVertex*>(mapped + offset);
+    } else {
+        // invalidating the whole buffer gets us fresh storage rather
+        // than a stall behind the last draw that read it.
+        vertices = static_cast<SpriteVertex*>(glMapBufferRange( GL_ARRAY_BUFFER, 0, segment_size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT ));
+        if (vertices == NULL)
+            return 0;
+    }
+
+    for (GLuint q = 0; q < count; ++q) {
+        const SpriteQuad &quad = quads[keys[first + q].quad];
+        SpriteVertex *corner = vertices + q*4;
+
+        corner[0].x = quad.x0; corner[0].y = quad.y0; corner[0].u = quad.u0; corner[0].v = quad.v0;
+        corner[1].x = quad.x1; corner[1].y = quad.y0; corner[1].u = quad.u1; corner[1].v = quad.v0;
+        corner[2].x = quad.x0; corner[2].y = quad.y1; corner[2].u = quad.u0; corner[2].v = quad.v1;
+        corner[3].x = quad.x1; corner[3].y = quad.y1; corner[3].u = quad.u1; corner[3].v = quad.v1;
+        corner[0].color = corner[1].color = corner[2].color = corner[3].color = quad.color;
+    }
+
+    if (mapped == NULL)
+        glUnmapBuffer( GL_ARRAY_BUFFER );
+
+    glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (const GLvoid*)offset );
+    glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, sizeof(SpriteVertex), (const GLvoid*)(offset + 2 * sizeof(GLfloat)) );
+    glVertexAttribPointer( 2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(SpriteVertex), (const GLvoid*)(offset + 4 * sizeof(GLfloat)) );
+
+    // sorted, so every texture is one contiguous run.
+    GLuint draws = 0;
+    GLuint run = 0;
+    for (GLuint q = 1; q <= count; ++q) {
+        if (q < count && quads[keys[first + q].quad].texture == quads[keys[first + run].quad].texture)
+            continue;
+
+        glBindTexture( GL_TEXTURE_2D, quads[keys[first + run].quad].texture );
+        glDrawElements( GL_TRIANGLES, (q - run) * 6, GL_UNSIGNED_INT, (const GLvoid*)(run * 6 * sizeof(GLuint)) );
+
+        ++draws;
+        run = q;
+    }
+
+    if (mapped != NULL) {
+        fences[segment] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+        segment = (segment + 1) % GR_SPRITE_FRAMES;
+    }
+
+    quad_count += count;
+    return draws;
+}
+
+GLuint
+SpriteBatch::getQueuedCount() { return quads.size(); }
+
+GLuint
+SpriteBatch::getDrawCount() { return draw_count; }
+
+GLuint
+SpriteBatch::getQuadCount() { return quad_count; }
+
+GLsizeiptr
+SpriteBatch::getQuadSize() { return 4 * sizeof(SpriteVertex); }
@@ -0,0 +1,367 @@
+#include "static_batch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <utility>
+
+using namespace GearsEngine;
+
+// bits per axis of the Morton codes chunks are cut along.
+static const GLuint MORTON_BITS = 10;
+
+// spread the low 10 bits of v so there are two zero bits between each.
+static GLuint
+spreadBits( GLuint v )
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8))  & 0x0300f00f;
+    v = (v | (v << 4))  & 0x030c30c3;
+    v = (v | (v << 2))  & 0x09249249;
+    return v;
+}
+
+static GLuint
+mortonCode( const AABB &box, const AABB &space )
+{
+    glm::vec3 center = (box.min + box.max) * 0.5f;
+    glm::vec3 size = space.max - space.min;
+
+    GLuint code = 0;
+    for (int i = 0; i < 3; ++i) {
+        float t = size[i] > 0.0f ? (center[i] - space.min[i]) / size[i] : 0.0f;
+        GLuint cell = (GLuint)(std::min( std::max( t, 0.0f ), 1.0f ) * ((1 << MORTON_BITS) - 1) + 0.5f);
+        code |= spreadBits( cell ) << i;
+    }
+
+    return code;
+}
+
+static const VAPconfig *
+findAttribute( const VAPMap &layout, GLint index )
+{
+    for (unsigned int a = 0; a < layout.size(); ++a)
+        if ((GLint)layout[a].index == index)
+            return &layout[a];
+
+    return NULL;
+}
+
+// a float vector baking can rewrite in place: its first three floats
+// have to sit inside the vertex.
+static bool
+isTransformable( const VAPconfig *attribute, GLsizei stride )
+{
+    if (attribute == NULL || attribute->type != GL_FLOAT || attribute->size < 3)
+        return false;
+
+    uintptr_t offset = (uintptr_t)attribute->pointer;
+    return offset + 3 * sizeof(GLfloat) <= (uintptr_t)stride;
+}
+
+// bytes between vertices, or 0 when they aren't interleaved in one array.
+static GLsizei
+vertexStride( const VAPMap &layout )
+{
+    if (layout.empty())
+        return 0;
+
+    if (layout.size() == 1 && layout[0].stride == 0)
+        return layout[0].size * attributeTypeSize( layout[0].type );
+
+    for (unsigned int a = 0; a < layout.size(); ++a)
+        if (layout[a].stride == 0 || layout[a].stride != layout[0].stride)
+            return 0;
+
+    return layout[0].stride;
+}
+
+StaticBatcher::StaticBatcher( GLuint max_vertices, GLfloat max_extent )
+{
+    max_chunk_vertices = std::max<GLuint>( max_vertices, 1 );
+    max_chunk_extent = max_extent;
+    normal_attribute = -1;
+    baked_mesh_count = 0;
+}
+
+void
+StaticBatcher::setNormalAttribute( GLint index ) { normal_attribute = index; }
+
+GLuint
+StaticBatcher::add( const StaticMesh &mesh )
+{
+    meshes.push_back( mesh );
+    return meshes.size() - 1;
+}
+
+bool
+StaticBatcher::bake( Renderer *renderer, const std::string &prefix )
+{
+    // one group per program and vertex format; only those can share a draw.
+    typedef std::map< std::pair<GLuint, GLuint>, std::vector<GLuint> > GroupMap;
+    GroupMap groups;
+
+    for (GLuint m = 0; m < meshes.size(); ++m) {
+        const StaticMesh &mesh = meshes[m];
+        groups[std::make_pair( mesh.program, renderer->getVertexLayout(mesh.vap) )].push_back( m );
+    }
+
+    GLuint queued = meshes.size();
+    GLuint baked_before = baked_mesh_count;
+
+    for (GroupMap::iterator group = groups.begin(); group != groups.end(); ++group)
+        bakeGroup( renderer, prefix, group->second );
+
+    meshes.clear();
+    return baked_mesh_count - baked_before == queued;
+}
+
+bool
+StaticBatcher::bakeMesh( const StaticMesh &mesh, const VAPMap &layout, GLsizei stride, BakedMesh &baked )
+{
+    const VAPconfig *position = findAttribute( layout, GR_BAKE_POSITION_ATTRIBUTE );
+    if (!isTransformable( position, stride ) || mesh.vertices == NULL || mesh.vertex_count == 0)
+        return false;
+
+    if (mesh.indices != NULL)
+        for (GLuint i = 0; i < mesh.index_count; ++i)
+            if (mesh.indices[i] >= mesh.vertex_count)
+                return false;
+
+    const VAPconfig *normal = NULL;
+    if (normal_attribute >= 0 && normal_attribute != GR_BAKE_POSITION_ATTRIBUTE) {
+        normal = findAttribute( layout, normal_attribute );
+        if (!isTransformable( normal, stride ))
+            normal = NULL;
+    }
+
+    // the upper 3x3 of this is the inverse transpose of the model's.
+    glm::mat4 normal_matrix = glm::transpose( glm::inverse( mesh.model ) );
+
+    const unsigned char *source = (const unsigned char*)mesh.vertices;
+    baked.vertices.assign( source, source + (size_t)mesh.vertex_count * stride );
+
+    GLuint position_offset = (GLuint)(uintptr_t)position->pointer;
+    GLuint normal_offset = normal != NULL ? (GLuint)(uintptr_t)normal->pointer : 0;
+
+    for (GLuint v = 0; v < mesh.vertex_count; ++v) {
+        unsigned char *vertex = &baked.vertices[(size_t)v * stride];
+
+        // memcpy, since nothing says the attributes are float aligned.
+        GLfloat p[3];
+        std::memcpy( p, vertex + position_offset, sizeof(p) );
+
+        glm::vec4 world = mesh.model * glm::vec4( p[0], p[1], p[2], 1.0f );
+        p[0] = world.x; p[1] = world.y; p[2] = world.z;
+        std::memcpy( vertex + position_offset, p, sizeof(p) );
+
+        glm::vec3 point( p[0], p[1], p[2] );
+        if (v == 0) {
+            baked.bounds.min = baked.bounds.max = point;
+        } else {
+            baked.bounds.min = glm::min( baked.bounds.min, point );
+            baked.bounds.max = glm::max( baked.bounds.max, point );
+        }
+
+        if (normal == NULL)
+            continue;
+
+        GLfloat n[3];
+        std::memcpy( n, vertex + normal_offset, sizeof(n) );
+
+        glm::vec4 turned = normal_matrix * glm::vec4( n[0], n[1], n[2], 0.0f );
+        float length = std::sqrt( turned.x*turned.x + turned.y*turned.y + turned.z*turned.z );
+        if (length > 0.0f) {
+            n[0] = turned.x / length; n[1] = turned.y / length; n[2] = turned.z / length;
+            std::memcpy( vertex + normal_offset, n, sizeof(n) );
+        }
+    }
+
+    return true;
+}
+
+void
+StaticBatcher::bakeGroup( Renderer *renderer, const std::string &prefix, const std::vector<GLuint> &group )
+{
+    const StaticMesh &first = meshes[group[0]];
+    const VAPMap &layout = renderer->getVAPModule( first.vap );
+
+    GLsizei stride = vertexStride( layout );
+    if (stride == 0)
+        return;
+
+    std::vector<BakedMesh> baked;
+    baked.reserve( group.size() );
+
+    for (unsigned int g = 0; g < group.size(); ++g) {
+        baked.push_back( BakedMesh() );
+        baked.back().mesh = group[g];
+
+        if (!bakeMesh( meshes[group[g]], layout, stride, baked.back() ))
+            baked.pop_back();
+    }
+
+    if (baked.empty())
+        return;
+
+    AABB space = baked[0].bounds;
+    for (unsigned int b = 1; b < baked.size(); ++b)
+        space = mergeBounds( space, baked[b].bounds );
+
+    // along a Morton curve, neighbours in the list are neighbours in the
+    // world, so cutting the list in runs gives compact chunks.
+    std::vector< std::pair<GLuint, GLuint> > codes;
+    codes.reserve( baked.size() );
+    for (unsigned int b = 0; b < baked.size(); ++b)
+        codes.push_back( std::make_pair( mortonCode( baked[b].bounds, space ), b ) );
+    std::sort( codes.begin(), codes.end() );
+
+    std::vector<GLuint> order;
+    order.reserve( codes.size() );
+    for (unsigned int c = 0; c < codes.size(); ++c)
+        order.push_back( codes[c].second );
+
+    GLuint begin = 0;
+    GLuint vertices = meshes[baked[order[0]].mesh].vertex_count;
+    AABB bounds = baked[order[0]].bounds;
+
+    for (GLuint o = 1; o < order.size(); ++o) {
+        const BakedMesh &next = baked[order[o]];
+        GLuint next_vertices = meshes[next.mesh].vertex_count;
+        AABB merged = mergeBounds( bounds, next.bounds );
+        glm::vec3 extent = merged.max - merged.min;
+
+        bool is_full = vertices + next_vertices > max_chunk_vertices;
+        bool is_wide = max_chunk_extent > 0.0f &&
+                (extent.x > max_chunk_extent || extent.y > max_chunk_extent || extent.z > max_chunk_extent);
+
+        if (is_full || is_wide) {
+            uploadChunk( renderer, prefix, baked, order, begin, o, stride );
+            begin = o;
+            vertices = next_vertices;
+            bounds = next.bounds;
+        } else {
+            vertices += next_vertices;
+            bounds = merged;
+        }
+    }
+
+    uploadChunk( renderer, prefix, baked, order, begin, order.size(), stride );
+}
+
+void
+StaticBatcher::uploadChunk(
+        Renderer *renderer,
+        const std::string &prefix,
+        const std::vector<BakedMesh> &baked,
+        const std::vector<GLuint> &order,
+        GLuint begin, GLuint end,
+        GLsizei stride )
+{
+    const StaticMesh &first = meshes[baked[order[begin]].mesh];
+
+    std::vector<unsigned char> vertices;
+    std::vector<GLuint> indices;
+
+    StaticChunk chunk;
+    chunk.program = first.program;
+    chunk.vap = first.vap;
+    chunk.model_location = first.model_location;
+    chunk.view_location = first.view_location;
+    chunk.projection_location = first.projection_location;
+    chunk.bounds = baked[order[begin]].bounds;
+    chunk.mesh_count = end - begin;
+
+    for (GLuint o = begin; o < end; ++o) {
+        const BakedMesh &part = baked[order[o]];
+        const StaticMesh &mesh = meshes[part.mesh];
+        GLuint base = vertices.size() / stride;
+
+        vertices.insert( vertices.end(), part.vertices.begin(), part.vertices.end() );
+
+        // no indices means the vertices are the triangle list.
+        if (mesh.indices != NULL) {
+            for (GLuint i = 0; i < mesh.index_count; ++i)
+                indices.push_back( base + mesh.indices[i] );
+        } else {
+            for (GLuint i = 0; i < mesh.vertex_count; ++i)
+                indices.push_back( base + i );
+        }
+
+        chunk.bounds = mergeBounds( chunk.bounds, part.bounds );
+    }
+
+    std::string number = std::to_string( chunks.size() );
+
+    chunk.vbo = renderer->generateVBO( prefix + "_VBO_" + number );
+    chunk.vbo.size = vertices.size();
+    chunk.vbo.attrib_count = renderer->getVAPModule( first.vap ).size();
+    chunk.vbo.data = &vertices[0];
+
+    chunk.ebo = renderer->generateEBO( prefix + "_EBO_" + number );
+    chunk.ebo.size = indices.size() * sizeof(GLuint);
+    chunk.ebo.attrib_count = 0;
+    chunk.ebo.data = indices.empty() ? NULL : &indices[0];
+
+    renderer->initializeVertexBuffer( chunk.vbo, chunk.ebo, chunk.vap );
+
+    // the data is on the GPU now and goes out of scope with this call.
+    chunk.vbo.data = NULL;
+    chunk.ebo.data = NULL;
+    chunk.element_count = indices.size();
+
+    chunks.push_back( chunk );
+    baked_mesh_count += chunk.mesh_count;
+}
+
+GLuint
+StaticBatcher::submit( FramePacket *packet, const Frustum &frustum )
+{
+    GLuint submitted = 0;
+
+    for (unsigned int c = 0; c < chunks.size(); ++c) {
+        const StaticChunk &chunk = chunks[c];
+        if (classify( frustum, chunk.bounds ) == GR_OUTSIDE)
+            continue;
+
+        if (chunk.model_location >= 0)
+            pushUniform( packet, chunk.model_location, glm::mat4( 1.0f ) );
+
+        DrawItem item;
+        item.program = chunk.program;
+        item.vbo = chunk.vbo.uid;
+        item.ebo = chunk.ebo.uid;
+        item.vap = chunk.vap;
+        item.element_count = chunk.element_count;
+        item.view_location = chunk.view_location;
+        item.projection_location = chunk.projection_location;
+
+        addDrawItem( packet, item );
+        ++submitted;
+    }
+
+    return submitted;
+}
+
+void
+StaticBatcher::clear( Renderer *renderer )
+{
+    for (unsigned int c = 0; c < chunks.size(); ++c) {
+        renderer->destroyVBO( chunks[c].vbo.identifier );
+        renderer->destroyEBO( chunks[c].ebo.identifier );
+    }
+
+    chunks.clear();
+    baked_mesh_count = 0;
+}
+
+const std::vector<StaticChunk> &
+StaticBatcher::getChunks() { return chunks; }
+
+GLuint
+StaticBatcher::getChunkCount() { return chunks.size(); }
+
+GLuint
+StaticBatcher::getBakedMeshCount() { return baked_mesh_count; }
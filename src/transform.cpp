@@ -0,0 +1,423 @@
+#include "transform.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+
+using namespace GearsEngine;
+
+static const unsigned char LOCAL_DIRTY = 1 << 0; // local matrix needs rebuilding
+static const unsigned char WORLD_DIRTY = 1 << 1; // world matrix needs rebuilding
+static const unsigned char CHANGED     = 1 << 2; // world rebuilt by the last update()
+static const unsigned char DESTROYED   = 1 << 3; // waiting for sortSlots() to drop it
+
+static glm::mat4
+composeLocal( const glm::vec3 &position, const glm::vec3 &rotation, const glm::vec3 &scale )
+{
+    glm::mat4 local = glm::translate( glm::mat4(), position );
+
+    local = glm::rotate( local, rotation.y, glm::vec3( 0.0f, 1.0f, 0.0f ) );
+    local = glm::rotate( local, rotation.x, glm::vec3( 1.0f, 0.0f, 0.0f ) );
+    local = glm::rotate( local, rotation.z, glm::vec3( 0.0f, 0.0f, 1.0f ) );
+
+    return glm::scale( local, scale );
+}
+
+TransformHierarchy::TransformHierarchy()
+{
+    is_dirty = false;
+    needs_sort = false;
+    changed_count = 0;
+}
+
+void
+TransformHierarchy::clear()
+{
+    slots.clear();
+    free_handles.clear();
+
+    handles.clear();
+    parents.clear();
+    depths.clear();
+    positions.clear();
+    rotations.clear();
+    scales.clear();
+    locals.clear();
+    worlds.clear();
+    flags.clear();
+
+    is_dirty = false;
+    needs_sort = false;
+    changed_count = 0;
+}
+
+GLint
+TransformHierarchy::create( GLint parent )
+{
+    GLint handle;
+    if (!free_handles.empty()) {
+        handle = free_handles.back();
+        free_handles.pop_back();
+    } else {
+        handle = slots.size();
+        slots.push_back( GR_NULL_TRANSFORM );
+    }
+
+    GLint parent_slot = (parent != GR_NULL_TRANSFORM) ? slots[parent] : GR_NULL_TRANSFORM;
+    GLuint depth = (parent_slot != GR_NULL_TRANSFORM) ? depths[parent_slot] + 1 : 0;
+
+    // appending keeps parents ahead of children; only the depth order can
+    // break, and only if this node is shallower than the last one.
+    if (!depths.empty() && depth < depths.back())
+        needs_sort = true;
+
+    slots[handle] = handles.size();
+
+    handles.push_back( handle );
+    parents.push_back( parent_slot );
+    depths.push_back( depth );
+    positions.push_back( glm::vec3( 0.0f ) );
+    rotations.push_back( glm::vec3( 0.0f ) );
+    scales.push_back( glm::vec3( 1.0f ) );
+    locals.push_back( glm::mat4() );
+    worlds.push_back( glm::mat4() );
+    flags.push_back( WORLD_DIRTY );
+
+    is_dirty = true;
+
+    return handle;
+}
+
+void
+TransformHierarchy::destroy( GLint handle )
+{
+    // descendants are found in one pass below, which needs the order.
+    if (needs_sort)
+        sortSlots();
+
+    GLint slot = slots[handle];
+    flags[slot] |= DESTROYED;
+
+    for (GLuint s = slot + 1; s < handles.size(); ++s) {
+        if (parents[s] != GR_NULL_TRANSFORM && (flags[parents[s]] & DESTROYED))
+            flags[s] |= DESTROYED;
+    }
+
+    for (GLuint s = slot; s < handles.size(); ++s) {
+        if ((flags[s] & DESTROYED) && slots[handles[s]] != GR_NULL_TRANSFORM) {
+            slots[handles[s]] = GR_NULL_TRANSFORM;
+            free_handles.push_back( handles[s] );
+        }
+    }
+
+    needs_sort = true;
+}
+
+bool
+TransformHierarchy::setParent( GLint handle, GLint parent )
+{
+    GLint slot = slots[handle];
+    GLint parent_slot = (parent != GR_NULL_TRANSFORM) ? slots[parent] : GR_NULL_TRANSFORM;
+
+    for (GLint s = parent_slot; s != GR_NULL_TRANSFORM; s = parents[s])
+        if (s == slot)
+            return false;
+
+    parents[slot] = parent_slot;
+    flags[slot] |= WORLD_DIRTY;
+
+    is_dirty = true;
+    needs_sort = true;
+
+    return true;
+}
+
+GLint
+TransformHierarchy::getParent( GLint handle )
+{
+    GLint parent_slot = parents[slots[handle]];
+    return (parent_slot != GR_NULL_TRANSFORM) ? handles[parent_slot] : GR_NULL_TRANSFORM;
+}
+
+void
+TransformHierarchy::markLocal( GLint handle )
+{
+    flags[slots[handle]] |= LOCAL_DIRTY;
+    is_dirty = true;
+}
+
+void
+TransformHierarchy::setPosition( GLint handle, const glm::vec3 &position )
+{
+    positions[slots[handle]] = position;
+    markLocal( handle );
+}
+
+void
+TransformHierarchy::setRotation( GLint handle, const glm::vec3 &rotation )
+{
+    rotations[slots[handle]] = rotation;
+    markLocal( handle );
+}
+
+void
+TransformHierarchy::setScale( GLint handle, const glm::vec3 &scale )
+{
+    scales[slots[handle]] = scale;
+    markLocal( handle );
+}
+
+const glm::vec3 &
+TransformHierarchy::getPosition( GLint handle ) { return positions[slots[handle]]; }
+
+const glm::vec3 &
+TransformHierarchy::getRotation( GLint handle ) { return rotations[slots[handle]]; }
+
+const glm::vec3 &
+TransformHierarchy::getScale( GLint handle ) { return scales[slots[handle]]; }
+
+void
+TransformHierarchy::sortSlots()
+{
+    // reparenting can leave depths stale and a child ahead of its parent,
+    // so they come from the parent chains. structural changes are rare
+    // next to update(), which is what the order is for.
+    std::vector<GLint> live;
+    live.reserve( handles.size() );
+    GLuint max_depth = 0;
+
+    for (GLuint s = 0; s < handles.size(); ++s) {
+        if (flags[s] & DESTROYED)
+            continue;
+
+        GLuint depth = 0;
+        for (GLint p = parents[s]; p != GR_NULL_TRANSFORM; p = parents[p])
+            ++depth;
+
+        depths[s] = depth;
+        max_depth = std::max( max_depth, depth );
+        live.push_back( s );
+    }
+
+    // counting sort by depth; stable, so siblings keep their order.
+    std::vector<GLuint> starts( max_depth + 2, 0 );
+    for (GLuint i = 0; i < live.size(); ++i)
+        ++starts[depths[live[i]] + 1];
+    for (GLuint d = 1; d < starts.size(); ++d)
+        starts[d] += starts[d - 1];
+
+    std::vector<GLint> order( live.size() );
+    for (GLuint i = 0; i < live.size(); ++i)
+        order[starts[depths[live[i]]]++] = live[i];
+
+    std::vector<GLint> remap( handles.size(), GR_NULL_TRANSFORM );
+    for (GLuint i = 0; i < order.size(); ++i)
+        remap[order[i]] = i;
+
+    std::vector<GLint>         sorted_handles( order.size() );
+    std::vector<GLint>         sorted_parents( order.size() );
+    std::vector<GLuint>        sorted_depths( order.size() );
+    std::vector<glm::vec3>     sorted_positions( order.size() );
+    std::vector<glm::vec3>     sorted_rotations( order.size() );
+    std::vector<glm::vec3>     sorted_scales( order.size() );
+    std::vector<glm::mat4>     sorted_locals( order.size() );
+    std::vector<glm::mat4>     sorted_worlds( order.size() );
+    std::vector<unsigned char> sorted_flags( order.size() );
+
+    for (GLuint i = 0; i < order.size(); ++i) {
+        GLint s = order[i];
+
+        sorted_handles[i]   = handles[s];
+        sorted_parents[i]   = (parents[s] != GR_NULL_TRANSFORM) ? remap[parents[s]] : GR_NULL_TRANSFORM;
+        sorted_depths[i]    = depths[s];
+        sorted_positions[i] = positions[s];
+        sorted_rotations[i] = rotations[s];
+        sorted_scales[i]    = scales[s];
+        sorted_locals[i]    = locals[s];
+        sorted_worlds[i]    = worlds[s];
+        sorted_flags[i]     = flags[s];
+
+        slots[handles[s]] = i;
+    }
+
+    handles.swap( sorted_handles );
+    parents.swap( sorted_parents );
+    depths.swap( sorted_depths );
+    positions.swap( sorted_positions );
+    rotations.swap( sorted_rotations );
+    scales.swap( sorted_scales );
+    locals.swap( sorted_locals );
+    worlds.swap( sorted_worlds );
+    flags.swap( sorted_flags );
+
+    needs_sort = false;
+}
+
+GLuint
+TransformHierarchy::update()
+{
+    if (needs_sort)
+        sortSlots();
+
+    // with nothing flagged the only work would be clearing last update's
+    // CHANGED bits, and there are none of those either.
+    if (!is_dirty && changed_count == 0)
+        return 0;
+
+    GLuint changed = 0;
+
+    for (GLuint s = 0; s < handles.size(); ++s) {
+        unsigned char state = flags[s];
+        GLint parent = parents[s];
+
+        if (state & LOCAL_DIRTY)
+            locals[s] = composeLocal( positions[s], rotations[s], scales[s] );
+
+        // the parent went first, so its CHANGED bit is already this pass's.
+        bool is_changed = (state & (LOCAL_DIRTY | WORLD_DIRTY)) ||
+                          (parent != GR_NULL_TRANSFORM && (flags[parent] & CHANGED));
+
+        if (is_changed) {
+            worlds[s] = (parent != GR_NULL_TRANSFORM) ? worlds[parent] * locals[s] : locals[s];
+            ++changed;
+        }
+
+        flags[s] = is_changed ? CHANGED : 0;
+    }
+
+    is_dirty = false;
+    changed_count = changed;
+
+    return changed;
+}
+
+const glm::mat4 &
+TransformHierarchy::getWorldMatrix( GLint handle ) { return worlds[slots[handle]]; }
+
+const glm::mat4 &
+TransformHierarchy::getLocalMatrix( GLint handle ) { return locals[slots[handle]]; }
+
+bool
+TransformHierarchy::hasChanged( GLint handle ) { return (flags[slots[handle]] & CHANGED) != 0; }
+
+const glm::mat4 *
+TransformHierarchy::getWorldMatrices() { return worlds.empty() ? NULL : &worlds[0]; }
+
+GLint
+TransformHierarchy::getSlot( GLint handle ) { return slots[handle]; }
+
+GLuint
+TransformHierarchy::getCount() { return slots.size() - free_handles.size(); }
+
+GLuint
+TransformHierarchy::getChangedCount() { return changed_count; }
+
+Camera::Camera()
+{
+    position = glm::vec3( 0.0f );
+    rotation = glm::vec3( 0.0f );
+
+    fovy = 45.0f;
+    aspect = 1.0f;
+    near_plane = 0.1f;
+    far_plane = 100.0f;
+
+    is_view_dirty = true;
+    is_projection_dirty = true;
+    revision = 0;
+}
+
+void
+Camera::setPosition( const glm::vec3 &eye )
+{
+    if (eye == position)
+        return;
+
+    position = eye;
+    is_view_dirty = true;
+}
+
+void
+Camera::setRotation( const glm::vec3 &angles )
+{
+    if (angles == rotation)
+        return;
+
+    rotation = angles;
+    is_view_dirty = true;
+}
+
+void
+Camera::setPerspective( GLfloat field_of_view, GLfloat ratio, GLfloat near_distance, GLfloat far_distance )
+{
+    if (field_of_view == fovy && ratio == aspect &&
+        near_distance == near_plane && far_distance == far_plane)
+        return;
+
+    fovy = field_of_view;
+    aspect = ratio;
+    near_plane = near_distance;
+    far_plane = far_distance;
+    is_projection_dirty = true;
+}
+
+void
+Camera::setAspect( GLfloat ratio )
+{
+    setPerspective( fovy, ratio, near_plane, far_plane );
+}
+
+void
+Camera::refresh()
+{
+    if (!is_view_dirty && !is_projection_dirty)
+        return;
+
+    if (is_view_dirty) {
+        glm::mat4 view = glm::rotate( glm::mat4(), rotation.x, glm::vec3( 1.0f, 0.0f, 0.0f ) );
+        view = glm::rotate( view, rotation.y, glm::vec3( 0.0f, 1.0f, 0.0f ) );
+        matrices.view = glm::translate( view, -position );
+    }
+
+    if (is_projection_dirty)
+        matrices.projection = glm::perspective( fovy, aspect, near_plane, far_plane );
+
+    view_projection = matrices.projection * matrices.view;
+
+    is_view_dirty = false;
+    is_projection_dirty = false;
+    ++revision;
+}
+
+const glm::mat4 &
+Camera::getView()
+{
+    refresh();
+    return matrices.view;
+}
+
+const glm::mat4 &
+Camera::getProjection()
+{
+    refresh();
+    return matrices.projection;
+}
+
+const glm::mat4 &
+Camera::getViewProjection()
+{
+    refresh();
+    return view_projection;
+}
+
+const CameraMatrices &
+Camera::getMatrices()
+{
+    refresh();
+    return matrices;
+}
+
+GLuint
+Camera::getRevision()
+{
+    refresh();
+    return revision;
+}
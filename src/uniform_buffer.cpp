@@ -0,0 +1,135 @@
+#include "uniform_buffer.hpp"
+#include "gl_object.hpp"
+#include <cstring>
+
+using namespace GearsEngine;
+
+UniformRing::UniformRing()
+{
+    buffer = 0;
+    segment_size = 0;
+    alignment = 256;
+    mapped = NULL;
+
+    segment = 0;
+    head = 0;
+
+    for (int f = 0; f < GR_UNIFORM_FRAMES; ++f)
+        fences[f] = NULL;
+}
+
+UniformRing::~UniformRing()
+{
+    release();
+}
+
+void
+UniformRing::release()
+{
+    for (int f = 0; f < GR_UNIFORM_FRAMES; ++f) {
+        if (fences[f] != NULL)
+            glDeleteSync( fences[f] );
+        fences[f] = NULL;
+    }
+
+    // a mapped buffer is unmapped when it's deleted.
+    if (buffer != 0)
+        bufferTraits::Destroy( buffer );
+
+    buffer = 0;
+    mapped = NULL;
+    segment = 0;
+    head = 0;
+    bound.clear();
+}
+
+void
+UniformRing::initialize( GLsizeiptr segment_bytes )
+{
+    glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment );
+    if (alignment < 1)
+        alignment = 256;
+
+    segment_size = (segment_bytes + alignment - 1) / alignment * alignment;
+    GLsizeiptr capacity = segment_size * GR_UNIFORM_FRAMES;
+
+    buffer = bufferTraits::Create();
+    glBindBuffer( GL_UNIFORM_BUFFER, buffer );
+
+    if (GLEW_ARB_buffer_storage || GLEW_VERSION_4_4) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glBufferStorage( GL_UNIFORM_BUFFER, capacity, NULL, flags );
+        mapped = static_cast<GLubyte*>(glMapBufferRange( GL_UNIFORM_BUFFER, 0, capacity, flags ));
+    }
+
+    if (mapped == NULL)
+        glBufferData( GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW );
+
+    glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+}
+
+GLintptr
+UniformRing::push( const GLvoid *data, GLsizeiptr size )
+{
+    GLintptr aligned = (head + alignment - 1) / alignment * alignment;
+    if (buffer == 0 || aligned + size > segment_size)
+        return -1;
+
+    GLintptr offset = segment * segment_size + aligned;
+    head = aligned + size;
+
+    if (mapped != NULL) {
+        std::memcpy( mapped + offset, data, size );
+    } else {
+        glBindBuffer( GL_UNIFORM_BUFFER, buffer );
+        glBufferSubData( GL_UNIFORM_BUFFER, offset, size, data );
+    }
+
+    return offset;
+}
+
+void
+UniformRing::bindRange( GLuint binding, GLintptr offset, GLsizeiptr size )
+{
+    if (binding >= bound.size()) {
+        BoundRange unbound = { -1, 0 };
+        bound.resize( binding + 1, unbound );
+    }
+
+    if (bound[binding].offset == offset && bound[binding].size == size)
+        return;
+
+    glBindBufferRange( GL_UNIFORM_BUFFER, binding, buffer, offset, size );
+
+    bound[binding].offset = offset;
+    bound[binding].size = size;
+}
+
+void
+UniformRing::endFrame()
+{
+    if (buffer == 0)
+        return;
+
+    fences[segment] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+
+    segment = (segment + 1) % GR_UNIFORM_FRAMES;
+    head = 0;
+
+    // only the mapped path can overwrite what the GPU is still reading;
+    // glBufferSubData orders itself.
+    if (fences[segment] != NULL) {
+        if (mapped != NULL)
+            glClientWaitSync( fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull );
+
+        glDeleteSync( fences[segment] );
+        fences[segment] = NULL;
+    }
+}
+
+GLint
+UniformRing::getAlignment() { return alignment; }
+
+GLsizeiptr
+UniformRing::getUsedBytes() { return head; }
@@ -1,9 +1,22 @@
 #include "window.hpp"
+#include <cstdlib>
 
 using namespace GearsEngine;
 
-SDL_Window *Window::getWindowHandle() { return window; }
-SDL_Event  *Window::getWindowEvent()  { return &event; }
+// a latency limiter wait longer than this means the GPU is lost or hung.
+static const GLuint64 FENCE_TIMEOUT_NS = 1000000000ull;
+
+Window::Window()
+{
+    last_dispatch = 0;
+    frame_delta = 0.0;
+}
+
+Window::~Window() {}
+
+SDL_Window   *Window::getWindowHandle() { return window; }
+SDL_Event    *Window::getWindowEvent()  { return &event; }
+SDL_GLContext Window::getGLContext()    { return gl_context; }
 
 void
 Window::isCreated( bool new_switch ) { is_created = new_switch; }
@@ -80,6 +93,8 @@ Window::getHeight() { return height; }
 void
 Window::create()
 {
+    gl_context = NULL;
+
     if (title_set && dimensions_set && flags_set) {
         if (SDL_WasInit(SDL_INIT_VIDEO) == 0)
             SDL_Init( SDL_INIT_VIDEO );
@@ -103,8 +118,19 @@ Window::create()
         isHardwareCapable( true );
 
         if (isHardwareCapable()) {
-            SDL_GL_CreateContext( getWindowHandle() );
-            SDL_GL_SetSwapInterval( 0 ); // don't wait for vertical-sync
+            gl_context = SDL_GL_CreateContext( getWindowHandle() );
+        }
+
+        const char *record_path = std::getenv( "GEARS_INPUT_RECORD" );
+        if (record_path != NULL && *record_path != '\0')
+            startRecording( record_path );
+
+        const char *replay_path = std::getenv( "GEARS_INPUT_REPLAY" );
+        if (replay_path != NULL && *replay_path != '\0') {
+            const char *step = std::getenv( "GEARS_INPUT_STEP" );
+            double fixed_step = (step != NULL) ? std::atof( step ) : 0.0;
+
+            startReplay( replay_path, (fixed_step > 0.0) ? GR_REPLAY_FIXED_STEP : GR_REPLAY_REAL_TIME, fixed_step );
         }
     } else {
         // TODO: report an error of some sorts...
@@ -145,13 +171,16 @@ Window::setKeyState( SDL_KeyboardEvent event )
 bool
 Window::isPressed( SDL_Keycode code )
 {
-    return (key_states[code] == SDL_PRESSED);
+    KeyStateMap::iterator state = key_states.find( code );
+    return (state != key_states.end() && state->second == SDL_PRESSED);
 }
 
 bool
 Window::isReleased( SDL_Keycode code )
 {
-    return (key_states[code] == SDL_RELEASED);
+    // keys never seen count as released, without adding an entry.
+    KeyStateMap::iterator state = key_states.find( code );
+    return (state == key_states.end() || state->second == SDL_RELEASED);
 }
 
 void
@@ -162,6 +191,83 @@ Window::invokeKeyboardAction( SDL_Keycode trigger, KeyMode mode )
             key_actions[trigger][mode](key_usrdata[trigger][mode]);
 }
 
+void
+Window::dispatchEvent( const SDL_Event &event )
+{
+    if (event.type == SDL_KEYDOWN)
+        invokeKeyboardAction( event.key.keysym.sym, KEY_DOWN );
+    else if (event.type == SDL_KEYUP)
+        invokeKeyboardAction( event.key.keysym.sym, KEY_UP );
+    else invokeAction( event );
+}
+
+void
+Window::dispatchEvents()
+{
+    Uint64 now = SDL_GetPerformanceCounter();
+    frame_delta = (last_dispatch != 0) ?
+        (double)(now - last_dispatch) / SDL_GetPerformanceFrequency() : 0.0;
+    last_dispatch = now;
+
+    if (input_player.isOpen()) {
+        if (input_player.getMode() == GR_REPLAY_FIXED_STEP)
+            frame_delta = input_player.getStep();
+
+        // live input would fight the trace; only a quit gets through, so
+        // a replay can still be cut short.
+        while (SDL_PollEvent( &event ))
+            if (event.type == SDL_QUIT)
+                invokeAction( event );
+
+        input_player.advance( now );
+        while (input_player.poll( &event ))
+            dispatchEvent( event );
+
+        if (input_player.isFinished()) {
+            input_player.close();
+            close();
+        }
+        return;
+    }
+
+    bool is_recorded = false;
+    while (SDL_PollEvent( &event )) {
+        if (input_recorder.isOpen()) {
+            input_recorder.record( event, now );
+            is_recorded = true;
+        }
+
+        dispatchEvent( event );
+    }
+
+    if (is_recorded)
+        input_recorder.flush();
+}
+
+bool
+Window::startRecording( const std::string &path ) { return input_recorder.open( path ); }
+
+void
+Window::stopRecording() { input_recorder.close(); }
+
+bool
+Window::isRecording() { return input_recorder.isOpen(); }
+
+bool
+Window::startReplay( const std::string &path, ReplayMode mode, double step )
+{
+    return input_player.open( path, mode, step );
+}
+
+void
+Window::stopReplay() { input_player.close(); }
+
+bool
+Window::isReplaying() { return input_player.isOpen(); }
+
+double
+Window::getFrameDelta() { return frame_delta; }
+
 RenderWindow::RenderWindow()
 {
     isTitleSet( false );
@@ -171,20 +277,183 @@ RenderWindow::RenderWindow()
     setFlags( SDL_WINDOW_OPENGL );
 
     isHardwareCapable( true );
+
+    requested_mode = GR_PRESENT_UNCAPPED;
+    present_mode = GR_PRESENT_UNCAPPED;
+    is_mode_pending = true;
+
+    max_frames_in_flight = 0;
+    input_sampled = SDL_GetPerformanceCounter();
+
+    latency.last = 0.0;
+    latency.average = 0.0;
+    latency.peak = 0.0;
+    latency.frames_in_flight = 0;
+    has_latency_sample = false;
+}
+
+RenderWindow::~RenderWindow()
+{
+    // the context outlives the window object, so the fences can still go.
+    while (!frame_fences.empty()) {
+        glDeleteSync( frame_fences.front().fence );
+        frame_fences.pop_front();
+    }
+}
+
+void
+RenderWindow::create()
+{
+    Window::create();
+
+    // the context is current here, so the mode can go in right away.
+    if (getGLContext() != NULL)
+        applyPresentMode();
 }
 
 void
 RenderWindow::update()
 {
-    while (SDL_PollEvent(getWindowEvent())) {
-        if (getWindowEvent()->type == SDL_KEYDOWN)
-            invokeKeyboardAction( getWindowEvent()->key.keysym.sym, KEY_DOWN );
-        else if (getWindowEvent()->type == SDL_KEYUP)
-            invokeKeyboardAction( getWindowEvent()->key.keysym.sym, KEY_UP );
-        else invokeAction( *getWindowEvent() );
-    }
+    // update() comes at the end of a frame, so the frame about to be
+    // swapped was built from the previous update()'s events.
+    Uint64 input_time = input_sampled;
+
+    pollEvents();
+    swapBuffers( input_time );
+}
+
+void
+RenderWindow::pollEvents()
+{
+    input_sampled = SDL_GetPerformanceCounter();
+    dispatchEvents();
+}
+
+void
+RenderWindow::swapBuffers() { swapBuffers( input_sampled ); }
+
+Uint64
+RenderWindow::getInputTime() { return input_sampled; }
+
+void
+RenderWindow::swapBuffers( Uint64 input_time )
+{
+    if (is_mode_pending || requested_mode != present_mode)
+        applyPresentMode();
 
     SDL_GL_SwapWindow( getWindowHandle() );
+
+    GLuint max_frames = max_frames_in_flight;
+    if (max_frames == 0 || !GLEW_ARB_sync) {
+        while (!frame_fences.empty())
+            retireFence( false );
+        return;
+    }
+
+    FrameFence frame;
+    frame.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    frame.started = input_time;
+    frame_fences.push_back( frame );
+
+    // frames that finished on their own are retired without waiting, so
+    // their latency is taken close to when they finished.
+    while (!frame_fences.empty()) {
+        GLenum result = glClientWaitSync( frame_fences.front().fence, 0, 0 );
+        if (result == GL_TIMEOUT_EXPIRED)
+            break;
+        retireFence( result != GL_WAIT_FAILED );
+    }
+
+    // a wait that timed out still drops the fence, so a lost GPU can't
+    // hold the swap forever, but it isn't a latency sample.
+    while (frame_fences.size() > max_frames) {
+        GLenum result = glClientWaitSync( frame_fences.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT_NS );
+        retireFence( result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED );
+    }
+
+    std::lock_guard<std::mutex> lock( latency_mutex );
+    latency.frames_in_flight = frame_fences.size();
+}
+
+void
+RenderWindow::setPresentMode( PresentMode mode ) { requested_mode = mode; }
+
+PresentMode
+RenderWindow::getPresentMode() { return (PresentMode)(int)requested_mode; }
+
+void
+RenderWindow::applyPresentMode()
+{
+    PresentMode mode = (PresentMode)(int)requested_mode;
+    int interval = 0;
+
+    switch (mode) {
+        case GR_PRESENT_UNCAPPED:       interval = 0; break;
+        case GR_PRESENT_VSYNC:          interval = 1; break;
+        case GR_PRESENT_ADAPTIVE_VSYNC: interval = -1; break;
+    }
+
+    // without EXT_swap_control_tear, -1 is refused; settle for vsync.
+    if (SDL_GL_SetSwapInterval( interval ) != 0 && interval == -1) {
+        SDL_GL_SetSwapInterval( 1 );
+        requested_mode = GR_PRESENT_VSYNC;
+        mode = GR_PRESENT_VSYNC;
+    }
+
+    present_mode = mode;
+    is_mode_pending = false;
+}
+
+void
+RenderWindow::setMaxFramesInFlight( GLuint frames ) { max_frames_in_flight = frames; }
+
+GLuint
+RenderWindow::getMaxFramesInFlight() { return max_frames_in_flight; }
+
+PresentLatency
+RenderWindow::getPresentLatency()
+{
+    std::lock_guard<std::mutex> lock( latency_mutex );
+    return latency;
+}
+
+void
+RenderWindow::resetPresentLatency()
+{
+    std::lock_guard<std::mutex> lock( latency_mutex );
+    latency.last = 0.0;
+    latency.average = 0.0;
+    latency.peak = 0.0;
+    has_latency_sample = false;
+}
+
+void
+RenderWindow::retireFence( bool is_finished )
+{
+    FrameFence &frame = frame_fences.front();
+
+    // a fence dropped without being seen to signal gives no sample.
+    if (is_finished) {
+        double elapsed = (double)(SDL_GetPerformanceCounter() - frame.started) * 1000.0 /
+                         (double)SDL_GetPerformanceFrequency();
+
+        std::lock_guard<std::mutex> lock( latency_mutex );
+        latency.last = elapsed;
+
+        // seeded with the first sample rather than climbing up from 0.
+        if (!has_latency_sample) {
+            latency.average = elapsed;
+            latency.peak = elapsed;
+            has_latency_sample = true;
+        } else {
+            latency.average += (elapsed - latency.average) / 16.0;
+            if (elapsed > latency.peak)
+                latency.peak = elapsed;
+        }
+    }
+
+    glDeleteSync( frame.fence );
+    frame_fences.pop_front();
 }
 
 /*
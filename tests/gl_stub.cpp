@@ -0,0 +1,55 @@
+#include "gl_stub.hpp"
+
+static GLuint next_name = 1;
+
+// any non-null pointer will do, nothing looks inside.
+static int fence_token;
+
+static void APIENTRY
+stubGenNames( GLsizei n, GLuint *names )
+{
+    for (GLsizei i = 0; i < n; ++i)
+        names[i] = next_name++;
+}
+
+static void APIENTRY
+stubDeleteNames( GLsizei, const GLuint* ) {}
+
+static void APIENTRY
+stubBindBuffer( GLenum, GLuint ) {}
+
+static void APIENTRY
+stubBindVertexArray( GLuint ) {}
+
+static GLsync APIENTRY
+stubFenceSync( GLenum, GLbitfield ) { return reinterpret_cast<GLsync>(&fence_token); }
+
+static GLenum APIENTRY
+stubClientWaitSync( GLsync, GLbitfield, GLuint64 ) { return GL_ALREADY_SIGNALED; }
+
+static void APIENTRY
+stubDeleteSync( GLsync ) {}
+
+void
+installGLStub()
+{
+    glGenBuffers = &stubGenNames;
+    glCreateBuffers = &stubGenNames;
+    glDeleteBuffers = &stubDeleteNames;
+    glGenVertexArrays = &stubGenNames;
+    glCreateVertexArrays = &stubGenNames;
+    glDeleteVertexArrays = &stubDeleteNames;
+    glGenFramebuffers = &stubGenNames;
+    glCreateFramebuffers = &stubGenNames;
+    glDeleteFramebuffers = &stubDeleteNames;
+
+    glBindBuffer = &stubBindBuffer;
+    glBindVertexArray = &stubBindVertexArray;
+
+    glFenceSync = &stubFenceSync;
+    glClientWaitSync = &stubClientWaitSync;
+    glDeleteSync = &stubDeleteSync;
+}
+
+GLuint
+getStubNameCount() { return next_name - 1; }
@@ -0,0 +1,16 @@
+#ifndef _GEARS_GL_STUB_HPP_
+#define _GEARS_GL_STUB_HPP_
+
+#include <GL/glew.h>
+
+//===========
+//points the GLEW entry points that the CPU-side engine paths touch at
+//fakes, so those paths run without a window or context. names count up
+//from 1, fences are signalled as soon as they're made, and nothing is
+//ever drawn. call before creating a Renderer on a window that isn't
+//hardware capable, so glewInit() never runs and overwrites them.
+//===========
+void   installGLStub();
+GLuint getStubNameCount();
+
+#endif // _GEARS_GL_STUB_HPP_
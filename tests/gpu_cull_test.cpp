@@ -0,0 +1,202 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cstdlib>
+#include <iostream>
+
+#include "window.hpp"
+#include "renderer.hpp"
+#include "gpu_culling.hpp"
+
+using namespace GearsEngine;
+
+//===========
+//draws a row of quads through GPUCuller and Renderer::drawIndirect in a
+//hidden window and checks what came out: only the instances inside the
+//culling frustum reach the target, and the shared layout VAO doesn't
+//keep the instance attribute afterwards. runs under ctest on llvmpipe
+//(SDL's offscreen driver, LIBGL_ALWAYS_SOFTWARE); exits 77, skipped,
+//where there is no 4.3 context.
+//===========
+
+static const int SKIPPED = 77;
+
+static const GLsizei TARGET_SIZE = 64;
+
+// ten quads at x = -9, -7, ... 9; the drawing camera sees x in [-10, 10],
+// the culling camera only [-2, 2], so just the two in the middle survive.
+static const int   INSTANCE_COUNT = 10;
+static const float DRAW_EXTENT = 10.0f;
+static const float CULL_EXTENT = 2.0f;
+
+static float
+instanceX( int instance ) { return -9.0f + 2.0f * instance; }
+
+static const GLchar *vertex_source =
+    "#version 430\n"
+    "layout (location = 0) in vec3 position;\n"
+    "layout (location = 15) in uint instance_id;\n"
+    "struct Instance { mat4 model; vec4 bounds_min; vec4 bounds_max; uvec4 mesh; };\n"
+    "layout (std430, binding = 0) readonly buffer Instances { Instance instances[]; };\n"
+    "layout (std140) uniform Camera { mat4 view_projection; };\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = view_projection * instances[instance_id].model * vec4( position, 1.0 );\n"
+    "}\n"
+;
+
+static const GLchar *fragment_source =
+    "#version 430\n"
+    "out vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    color = vec4( 1.0 );\n"
+    "}\n"
+;
+
+int main()
+{
+    setenv( "SDL_VIDEODRIVER", "offscreen", 0 );
+    unsetenv( "GEARS_CAPTURE" );
+
+    SDL_Init( SDL_INIT_VIDEO );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 4 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+
+    RenderWindow window;
+    window.setTitle( "GPU culling" );
+    window.setDimensions( TARGET_SIZE, TARGET_SIZE );
+    window.setFlags( SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN );
+    window.create();
+
+    if (window.getGLContext() == NULL) {
+        std::cout << "skipped: no GL 4.3 context: " << SDL_GetError() << std::endl;
+        return SKIPPED;
+    }
+
+    int failures = 0;
+    {
+        Renderer renderer( &window );
+
+        GPUCuller culler;
+        if (!culler.initialize( INSTANCE_COUNT )) {
+            std::cout << "skipped: no compute shaders or indirect draws" << std::endl;
+            return SKIPPED;
+        }
+
+        // a target of our own, so the result doesn't depend on how the
+        // window system backs the default framebuffer.
+        GLuint color, depth, framebuffer;
+        glGenRenderbuffers( 1, &color );
+        glBindRenderbuffer( GL_RENDERBUFFER, color );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, TARGET_SIZE, TARGET_SIZE );
+        glGenRenderbuffers( 1, &depth );
+        glBindRenderbuffer( GL_RENDERBUFFER, depth );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, TARGET_SIZE, TARGET_SIZE );
+        glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+        glGenFramebuffers( 1, &framebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth );
+        glViewport( 0, 0, TARGET_SIZE, TARGET_SIZE );
+
+        GLfloat vertices[] = {
+            -0.5f, -0.5f, 0.0f,
+             0.5f, -0.5f, 0.0f,
+             0.5f,  0.5f, 0.0f,
+            -0.5f,  0.5f, 0.0f
+        };
+        GLuint indices[] = { 0, 1, 2, 2, 3, 0 };
+
+        VAPconfig position;
+        position.index = 0;
+        position.size = 3;
+        position.type = GL_FLOAT;
+        position.normalized = GL_FALSE;
+        position.stride = 3 * sizeof(GLfloat);
+        position.pointer = (GLvoid*)0;
+
+        renderer.addVAPConfiguration( position );
+        int vap = renderer.linkVAPModule();
+
+        VertexBuffer vbo = renderer.generateVBO( "VBO_QUAD" );
+        ElementBuffer ebo = renderer.generateEBO( "EBO_QUAD" );
+        vbo.data = vertices;
+        vbo.size = sizeof(vertices);
+        ebo.data = indices;
+        ebo.size = sizeof(indices);
+        renderer.initializeVertexBuffer( vbo, ebo, vap );
+        renderer.bindVertexBuffer( vbo, ebo, vap );
+
+        VertexShader vertex_shader;
+        FragmentShader fragment_shader;
+        vertex_shader.source_code = vertex_source;
+        fragment_shader.source_code = fragment_source;
+
+        ShaderProgram program = renderer.createShaderProgram( "SHADER_CULLED", &vertex_shader, &fragment_shader );
+        renderer.bindUniformBlock( program, "Camera", GR_FRAME_UNIFORM_BINDING );
+        renderer.setActiveShaderProgram( program );
+
+        // two meshes over the same quad, so the draw goes through more
+        // than one indirect command.
+        GLuint meshes[2] = { culler.addMesh( 6, 0, 0 ), culler.addMesh( 6, 0, 0 ) };
+
+        AABB bounds;
+        bounds.min = glm::vec3( -0.5f, -0.5f, -0.1f );
+        bounds.max = glm::vec3(  0.5f,  0.5f,  0.1f );
+
+        for (int i = 0; i < INSTANCE_COUNT; ++i)
+            culler.addInstance( meshes[i % 2], glm::translate( glm::mat4(1.0f), glm::vec3(instanceX(i), 0.0f, 0.0f) ), bounds );
+
+        glm::mat4 draw_camera = glm::ortho( -DRAW_EXTENT, DRAW_EXTENT, -DRAW_EXTENT, DRAW_EXTENT, -1.0f, 1.0f );
+        glm::mat4 cull_camera = glm::ortho( -CULL_EXTENT, CULL_EXTENT, -DRAW_EXTENT, DRAW_EXTENT, -1.0f, 1.0f );
+
+        renderer.clear( 0.0f, 0.0f, 0.0f, 1.0f );
+        renderer.setFrameUniforms( &draw_camera[0][0], sizeof(draw_camera) );
+
+        culler.cull( cull_camera );
+        renderer.drawIndirect( &culler );
+
+        // the layout VAO is still bound; plain draws through it mustn't
+        // see the instance attribute.
+        GLint enabled = 1, divisor = 1;
+        glGetVertexAttribiv( GR_CULL_INSTANCE_ATTRIBUTE, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled );
+        glGetVertexAttribiv( GR_CULL_INSTANCE_ATTRIBUTE, GL_VERTEX_ATTRIB_ARRAY_DIVISOR, &divisor );
+        if (enabled != 0 || divisor != 0) {
+            std::cout << "instance attribute left on the layout VAO: enabled " << enabled
+                      << " divisor " << divisor << std::endl;
+            ++failures;
+        }
+
+        for (int i = 0; i < INSTANCE_COUNT; ++i) {
+            GLint x = (GLint)((instanceX( i ) / DRAW_EXTENT * 0.5f + 0.5f) * TARGET_SIZE);
+            GLubyte pixel[4] = { 0, 0, 0, 0 };
+            glReadPixels( x, TARGET_SIZE / 2, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel );
+
+            bool is_visible = instanceX( i ) > -CULL_EXTENT && instanceX( i ) < CULL_EXTENT;
+            bool is_drawn = pixel[0] > 128;
+
+            if (is_drawn != is_visible) {
+                std::cout << "instance " << i << " at x " << instanceX( i )
+                          << (is_drawn ? " drawn, should be culled" : " culled, should be drawn") << std::endl;
+                ++failures;
+            }
+        }
+
+        if (renderer.getDiagnostics().getMessageCount( GL_DEBUG_SEVERITY_HIGH ) > 0) {
+            std::cout << "GL errors during the test" << std::endl;
+            ++failures;
+        }
+
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+        glDeleteFramebuffers( 1, &framebuffer );
+        glDeleteRenderbuffers( 1, &color );
+        glDeleteRenderbuffers( 1, &depth );
+    }
+
+    std::cout << (failures == 0 ? "passed" : "failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,471 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "window.hpp"
+#include "renderer.hpp"
+#include "transform.hpp"
+#include "bounds.hpp"
+#include "allocator.hpp"
+#include "particles.hpp"
+#include "light_clusters.hpp"
+#include "gl_stub.hpp"
+
+using namespace GearsEngine;
+
+//===========
+//micro-benchmarks for the CPU side of the engine's hot paths. GL calls
+//go to gl_stub, so this runs anywhere, with no window or context.
+//output is JSON unless --benchmark_format says otherwise; build with
+//GEARS_TRACK_ALLOCATIONS to get an allocations-per-iteration counter.
+//===========
+
+// a window that never opens: Renderer skips everything context bound.
+class HeadlessWindow : public Window {
+    public:
+        HeadlessWindow()
+        {
+            isHardwareCapable( false );
+            setDimensions( 640, 480 );
+        }
+
+        void update() {}
+};
+
+class AllocationCounter {
+    private:
+        AllocationStats start;
+
+    public:
+        AllocationCounter() { start = getAllocationStats(); }
+
+        void report( benchmark::State &state )
+        {
+            if (!isTrackingAllocations())
+                return;
+
+            AllocationStats end = getAllocationStats();
+            state.counters["allocations"] = benchmark::Counter(
+                    (double)(end.allocations - start.allocations),
+                    benchmark::Counter::kAvgIterations );
+            state.counters["allocated_bytes"] = benchmark::Counter(
+                    (double)(end.bytes - start.bytes),
+                    benchmark::Counter::kAvgIterations );
+        }
+};
+
+static void noAction( void* ) {}
+
+static VAPconfig
+attribute( GLuint index, GLint size, GLsizei stride, GLuint offset )
+{
+    VAPconfig configuration;
+    configuration.index = index;
+    configuration.size = size;
+    configuration.type = GL_FLOAT;
+    configuration.normalized = GL_FALSE;
+    configuration.stride = stride;
+    configuration.pointer = (GLvoid*)(uintptr_t)offset;
+
+    return configuration;
+}
+
+//===========
+//renderer
+//===========
+static void
+BM_RendererLookup( benchmark::State &state )
+{
+    HeadlessWindow window;
+    Renderer renderer( &window );
+
+    std::vector<std::string> identifiers;
+    for (int i = 0; i < state.range(0); ++i) {
+        identifiers.push_back( "VBO_" + std::to_string(i) );
+        renderer.generateVBO( identifiers.back() );
+    }
+
+    size_t next = 0;
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        VertexBuffer vbo = renderer.getVBO( identifiers[next] );
+        benchmark::DoNotOptimize( vbo.uid );
+
+        if (++next == identifiers.size())
+            next = 0;
+    }
+
+    allocations.report( state );
+}
+BENCHMARK( BM_RendererLookup )->Arg( 16 )->Arg( 256 )->Arg( 4096 );
+
+static void
+BM_RendererLookupMiss( benchmark::State &state )
+{
+    HeadlessWindow window;
+    Renderer renderer( &window );
+
+    for (int i = 0; i < state.range(0); ++i)
+        renderer.generateVBO( "VBO_" + std::to_string(i) );
+
+    const std::string missing( "VBO_MISSING" );
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        VertexBuffer vbo = renderer.getVBO( missing );
+        benchmark::DoNotOptimize( vbo.uid );
+    }
+
+    allocations.report( state );
+}
+BENCHMARK( BM_RendererLookupMiss )->Arg( 256 );
+
+// a renderer per iteration, so the module list doesn't grow without
+// bound; every fourth module brings a new layout, the rest are interned.
+static void
+BM_LinkVAPModule( benchmark::State &state )
+{
+    HeadlessWindow window;
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        Renderer renderer( &window );
+
+        for (int m = 0; m < state.range(0); ++m) {
+            GLsizei stride = (6 + (m % 4)) * sizeof(GLfloat);
+
+            renderer.addVAPConfiguration( attribute( 0, 3, stride, 0 ) );
+            renderer.addVAPConfiguration( attribute( 1, 3, stride, 3 * sizeof(GLfloat) ) );
+            benchmark::DoNotOptimize( renderer.linkVAPModule() );
+        }
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+    allocations.report( state );
+}
+BENCHMARK( BM_LinkVAPModule )->Arg( 64 );
+
+//===========
+//window input dispatch
+//===========
+static void
+BM_InvokeKeyboardAction( benchmark::State &state )
+{
+    HeadlessWindow window;
+
+    std::vector<SDL_Keycode> keys;
+    for (int k = 0; k < state.range(0); ++k) {
+        keys.push_back( 'a' + k );
+        window.addKeyboardAction( keys.back(), KEY_DOWN, &noAction, NULL );
+        window.addKeyboardAction( keys.back(), KEY_UP, &noAction, NULL );
+    }
+
+    size_t next = 0;
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        window.invokeKeyboardAction( keys[next], (next & 1) ? KEY_UP : KEY_DOWN );
+
+        if (++next == keys.size())
+            next = 0;
+    }
+
+    allocations.report( state );
+}
+BENCHMARK( BM_InvokeKeyboardAction )->Arg( 8 )->Arg( 26 );
+
+static void
+BM_IsPressed( benchmark::State &state )
+{
+    HeadlessWindow window;
+
+    std::vector<SDL_Keycode> keys;
+    for (int k = 0; k < state.range(0); ++k) {
+        SDL_KeyboardEvent event;
+        std::memset( &event, 0, sizeof(event) );
+        event.keysym.sym = 'a' + k;
+        event.state = (k & 1) ? SDL_PRESSED : SDL_RELEASED;
+
+        window.setKeyState( event );
+        keys.push_back( event.keysym.sym );
+    }
+
+    size_t next = 0;
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize( window.isPressed( keys[next] ) );
+
+        if (++next == keys.size())
+            next = 0;
+    }
+
+    allocations.report( state );
+}
+BENCHMARK( BM_IsPressed )->Arg( 8 )->Arg( 26 );
+
+//===========
+//transforms
+//===========
+
+// a four-way tree; one node in range(1) moves per frame, picked from
+// the back, where the leaves are, so each move dirties only itself.
+static void
+BM_TransformUpdate( benchmark::State &state )
+{
+    TransformHierarchy transforms;
+
+    std::vector<GLint> nodes;
+    for (int n = 0; n < state.range(0); ++n) {
+        GLint parent = (n == 0) ? GR_NULL_TRANSFORM : nodes[(n - 1) / 4];
+        nodes.push_back( transforms.create( parent ) );
+        transforms.setPosition( nodes.back(), glm::vec3( (float)n, 0.0f, 0.0f ) );
+    }
+    transforms.update();
+
+    float offset = 0.0f;
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        offset += 1.0f;
+        for (size_t n = nodes.size(); n > 0; n -= std::min<size_t>( n, state.range(1) ))
+            transforms.setPosition( nodes[n - 1], glm::vec3( offset, 0.0f, 0.0f ) );
+
+        benchmark::DoNotOptimize( transforms.update() );
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+    allocations.report( state );
+}
+BENCHMARK( BM_TransformUpdate )
+    ->Args( {4096, 1} )->Args( {4096, 64} )->Args( {4096, 4096} )
+    ->Args( {65536, 64} );
+
+static void
+BM_CameraMatrices( benchmark::State &state )
+{
+    Camera camera;
+    camera.setPerspective( 45.0f, 640.0f/480.0f, 0.1f, 100.0f );
+
+    bool is_moving = state.range(0) != 0;
+    float z = -10.0f;
+
+    for (auto _ : state) {
+        if (is_moving)
+            z += 0.01f;
+
+        camera.setPosition( glm::vec3( 0.0f, 0.0f, z ) );
+        benchmark::DoNotOptimize( camera.getMatrices() );
+    }
+}
+BENCHMARK( BM_CameraMatrices )->Arg( 0 )->Arg( 1 );
+
+static void
+BM_FrustumClassify( benchmark::State &state )
+{
+    Camera camera;
+    camera.setPerspective( 45.0f, 640.0f/480.0f, 0.1f, 100.0f );
+    camera.setPosition( glm::vec3( 0.0f, 0.0f, -20.0f ) );
+
+    Frustum frustum = extractFrustum( camera.getViewProjection() );
+
+    std::vector<AABB> boxes( state.range(0) );
+    std::vector<glm::mat4> models( state.range(0) );
+    for (size_t b = 0; b < boxes.size(); ++b) {
+        boxes[b].min = glm::vec3( -0.5f );
+        boxes[b].max = glm::vec3( 0.5f );
+        models[b][3] = glm::vec4( (float)(b % 64) - 32.0f, (float)(b / 64) - 8.0f, 0.0f, 1.0f );
+    }
+
+    for (auto _ : state) {
+        GLuint visible = 0;
+        for (size_t b = 0; b < boxes.size(); ++b)
+            visible += classify( frustum, transformBounds( boxes[b], models[b] ) ) != GR_OUTSIDE;
+
+        benchmark::DoNotOptimize( visible );
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+}
+BENCHMARK( BM_FrustumClassify )->Arg( 1024 );
+
+//===========
+//particles
+//===========
+static void
+BM_ParticleUpdate( benchmark::State &state )
+{
+    // serial, so the number is per core; a steady state where about one
+    // particle in 120 dies and is replaced each step.
+    ParticleSystem particles( state.range(0), NULL );
+
+    ParticleEmitter emitter;
+    emitter.position = glm::vec3( 0.0f );
+    emitter.position_spread = glm::vec3( 10.0f );
+    emitter.velocity = glm::vec3( 0.0f, 2.0f, 0.0f );
+    emitter.velocity_spread = glm::vec3( 1.0f );
+    emitter.rate = state.range(0) / 2.0f;
+    emitter.lifetime = 2.0f;
+    emitter.lifetime_spread = 1.0f;
+    emitter.size = 0.1f;
+    emitter.growth = 0.0f;
+    emitter.color = 0xffffffff;
+    emitter.is_enabled = true;
+
+    GLuint source = particles.addEmitter( emitter );
+    particles.burst( source, state.range(0) );
+
+    ParticleForce gravity = { GR_FORCE_ACCELERATION, glm::vec3( 0.0f, -9.8f, 0.0f ), 0.0f };
+    ParticleForce drag = { GR_FORCE_DRAG, glm::vec3( 0.0f ), 0.1f };
+    particles.addForce( gravity );
+    particles.addForce( drag );
+
+    for (auto _ : state) {
+        particles.update( 1.0f / 60.0f );
+        benchmark::DoNotOptimize( particles.getCount() );
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+}
+BENCHMARK( BM_ParticleUpdate )->Arg( 1 << 16 )->Arg( 1 << 20 )->Unit( benchmark::kMillisecond );
+
+//===========
+//lights
+//===========
+static void
+BM_LightClusterAssign( benchmark::State &state )
+{
+    // serial; lights scattered through the view up to 200 units out, a
+    // few units in radius each.
+    LightClusters clusters( state.range(0), NULL );
+
+    GLuint random_state = 1;
+    for (int i = 0; i < state.range(0); ++i) {
+        PointLight light;
+        random_state = random_state * 1664525u + 1013904223u;
+        light.position.x = (GLfloat)((random_state >> 8) % 2000) / 10.0f - 100.0f;
+        random_state = random_state * 1664525u + 1013904223u;
+        light.position.y = (GLfloat)((random_state >> 8) % 800) / 100.0f - 4.0f;
+        random_state = random_state * 1664525u + 1013904223u;
+        light.position.z = -(GLfloat)((random_state >> 8) % 2000) / 10.0f;
+        light.radius = 0.5f + (GLfloat)(i % 6);
+        light.color = glm::vec3( 1.0f );
+        light.intensity = 1.0f;
+        clusters.addLight( light );
+    }
+
+    // a 60 degree, 16:9 perspective from 0.5 to 200.
+    glm::mat4 projection( 0.0f );
+    projection[0][0] = 0.974f;
+    projection[1][1] = 1.732f;
+    projection[2][2] = -200.5f / 199.5f;
+    projection[2][3] = -1.0f;
+    projection[3][2] = -200.0f / 199.5f;
+
+    glm::mat4 view;
+    for (auto _ : state) {
+        view[3][0] += 0.01f; // a moving camera, but the same projection
+        clusters.update( view, projection, 1920, 1080 );
+        benchmark::DoNotOptimize( clusters.getIndexCount() );
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+}
+BENCHMARK( BM_LightClusterAssign )->Arg( 256 )->Arg( 4096 );
+
+//===========
+//allocation
+//===========
+static void
+BM_FrameArenaAllocate( benchmark::State &state )
+{
+    FrameArena arena( 64 * 1024 );
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        for (int a = 0; a < state.range(0); ++a)
+            benchmark::DoNotOptimize( arena.allocate( 64 ) );
+        arena.reset();
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+    allocations.report( state );
+}
+BENCHMARK( BM_FrameArenaAllocate )->Arg( 512 );
+
+static void
+BM_HeapAllocate( benchmark::State &state )
+{
+    std::vector<void*> blocks( state.range(0) );
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        for (int a = 0; a < state.range(0); ++a) {
+            blocks[a] = ::operator new( 64 );
+            benchmark::DoNotOptimize( blocks[a] );
+        }
+        for (int a = 0; a < state.range(0); ++a)
+            ::operator delete( blocks[a] );
+    }
+
+    state.SetItemsProcessed( state.iterations() * state.range(0) );
+    allocations.report( state );
+}
+BENCHMARK( BM_HeapAllocate )->Arg( 512 );
+
+// key state churn, pooled (as Window keeps it) and on the plain heap.
+template<typename Map>
+static void
+BM_KeyMapChurn( benchmark::State &state )
+{
+    Map keys;
+    AllocationCounter allocations;
+
+    for (auto _ : state) {
+        for (SDL_Keycode k = 0; k < 16; ++k)
+            keys[k] = SDL_PRESSED;
+        for (SDL_Keycode k = 0; k < 16; ++k)
+            keys.erase( k );
+    }
+
+    allocations.report( state );
+}
+BENCHMARK_TEMPLATE( BM_KeyMapChurn, KeyStateMap );
+BENCHMARK_TEMPLATE( BM_KeyMapChurn, std::map<SDL_Keycode, Uint8> );
+
+int main( int argc, char *argv[] )
+{
+    installGLStub();
+
+    // JSON by default, so every run can be kept and diffed.
+    static char json_format[] = "--benchmark_format=json";
+
+    std::vector<char*> arguments( argv, argv + argc );
+    bool has_format = false;
+    for (int a = 1; a < argc; ++a)
+        if (std::strncmp( argv[a], "--benchmark_format", 18 ) == 0)
+            has_format = true;
+
+    if (!has_format)
+        arguments.push_back( json_format );
+
+    int count = arguments.size();
+    arguments.push_back( NULL );
+
+    benchmark::Initialize( &count, &arguments[0] );
+    if (benchmark::ReportUnrecognizedArguments( count, &arguments[0] ))
+        return 1;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <boost/chrono/include.hpp>
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "window.hpp"
+#include "renderer.hpp"
+#include "gl_capture.hpp"
+
+using namespace GearsEngine;
+
+typedef boost::chrono::high_resolution_clock Clock;
+typedef boost::chrono::duration<double, boost::milli> Milliseconds;
+
+//===========
+//plays a trace written with GEARS_CAPTURE back in a hidden window, as
+//fast as the driver goes, and reports CPU and GPU time per frame:
+//
+//    gears_replay trace [--frames N]
+//
+//SDL's offscreen video driver is used unless SDL_VIDEODRIVER says
+//otherwise, so no display is needed where EGL is available.
+//===========
+
+static double
+percentile( std::vector<double> times, double fraction )
+{
+    if (times.empty())
+        return 0.0;
+
+    std::sort( times.begin(), times.end() );
+    size_t index = (size_t)(fraction * (times.size() - 1) + 0.5);
+
+    return times[index];
+}
+
+static void
+summarize( const char *name, const std::vector<double> &times )
+{
+    if (times.empty())
+        return;
+
+    std::cout << name
+              << " min " << percentile( times, 0.0 )
+              << " median " << percentile( times, 0.5 )
+              << " p99 " << percentile( times, 0.99 )
+              << " max " << percentile( times, 1.0 )
+              << " ms" << std::endl;
+}
+
+int main( int argc, char **argv )
+{
+    if (argc < 2) {
+        std::cerr << "usage: gears_replay trace [--frames N]" << std::endl;
+        return 1;
+    }
+
+    unsigned long long frame_limit = 0;
+    for (int a = 2; a < argc; ++a)
+        if (std::strcmp( argv[a], "--frames" ) == 0 && a + 1 < argc)
+            frame_limit = std::strtoull( argv[++a], NULL, 10 );
+
+    GLReplay replay;
+    if (!replay.open( argv[1] )) {
+        std::cerr << argv[1] << ": not a trace" << std::endl;
+        return 1;
+    }
+
+    // the replay itself must not end up in a trace.
+    unsetenv( "GEARS_CAPTURE" );
+    setenv( "SDL_VIDEODRIVER", "offscreen", 0 );
+
+    RenderWindow *window = new RenderWindow();
+    window->setTitle( "Replay" );
+    window->setDimensions( replay.getWidth(), replay.getHeight() );
+    window->setFlags( SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN );
+    window->create();
+
+    if (window->getGLContext() == NULL) {
+        std::cerr << "no GL context: " << SDL_GetError() << std::endl;
+        delete window;
+        return 1;
+    }
+
+    Renderer *renderer = new Renderer( window );
+
+    GLuint query = 0;
+    bool has_timer = GLEW_ARB_timer_query || GLEW_VERSION_3_3;
+    if (has_timer)
+        glGenQueries( 1, &query );
+
+    std::vector<double> cpu_times, gpu_times;
+
+    while (frame_limit == 0 || replay.getFrame() < frame_limit) {
+        if (has_timer)
+            glBeginQuery( GL_TIME_ELAPSED, query );
+
+        Clock::time_point start = Clock::now();
+        bool is_frame = replay.replayFrame( renderer );
+        Clock::time_point submitted = Clock::now();
+
+        if (has_timer)
+            glEndQuery( GL_TIME_ELAPSED );
+
+        // wait for the GPU, so frames don't pile up and the timings are
+        // for this frame alone.
+        glFinish();
+
+        if (!is_frame)
+            break;
+
+        double cpu = boost::chrono::duration_cast<Milliseconds>( submitted - start ).count();
+        cpu_times.push_back( cpu );
+
+        std::cout << "frame " << replay.getFrame() - 1 << " cpu " << cpu << " ms";
+
+        if (has_timer) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v( query, GL_QUERY_RESULT, &elapsed );
+
+            gpu_times.push_back( elapsed / 1.0e6 );
+            std::cout << " gpu " << gpu_times.back() << " ms";
+        }
+
+        std::cout << std::endl;
+    }
+
+    std::cout << cpu_times.size() << " frames" << std::endl;
+    summarize( "cpu", cpu_times );
+    summarize( "gpu", gpu_times );
+
+    if (has_timer)
+        glDeleteQueries( 1, &query );
+
+    delete renderer;
+    delete window;
+
+    return 0;
+}
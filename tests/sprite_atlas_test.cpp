@@ -0,0 +1,110 @@
+#include <GL/glew.h>
+#include <iostream>
+#include <vector>
+
+#include "sprite_batch.hpp"
+
+using namespace GearsEngine;
+
+//===========
+//the skyline packer on its own: rectangles land inside the atlas and
+//never overlap, a full atlas says so instead of packing anyway, and
+//clear() gives all the room back. no window or GL needed; runs under
+//ctest.
+//===========
+
+static const GLint ATLAS_SIZE = 64;
+
+static int failures = 0;
+
+static void
+expect( bool condition, const char *what )
+{
+    if (!condition) {
+        std::cout << "failed: " << what << std::endl;
+        ++failures;
+    }
+}
+
+typedef struct {
+    GLint x, y, width, height;
+} Placed;
+
+static bool
+overlaps( const Placed &a, const Placed &b )
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+// packs rectangles of cycling sizes until the atlas refuses one; checks
+// every placement on the way and returns how many went in.
+static GLuint
+fill( SkylineAtlas &atlas, std::vector<Placed> &placed )
+{
+    static const GLint sizes[][2] = { {10, 12}, {7, 7}, {16, 5}, {3, 14}, {9, 9} };
+
+    placed.clear();
+    for (GLuint i = 0; ; ++i) {
+        Placed rectangle;
+        rectangle.width = sizes[i % 5][0];
+        rectangle.height = sizes[i % 5][1];
+
+        if (!atlas.insert( rectangle.width, rectangle.height, rectangle.x, rectangle.y ))
+            return placed.size();
+
+        bool is_inside = rectangle.x >= 0 && rectangle.y >= 0 &&
+                         rectangle.x + rectangle.width <= ATLAS_SIZE &&
+                         rectangle.y + rectangle.height <= ATLAS_SIZE;
+        expect( is_inside, "rectangle inside the atlas" );
+
+        for (GLuint p = 0; p < placed.size(); ++p)
+            if (overlaps( rectangle, placed[p] )) {
+                expect( false, "rectangles don't overlap" );
+                break;
+            }
+
+        placed.push_back( rectangle );
+    }
+}
+
+int main()
+{
+    SkylineAtlas atlas( ATLAS_SIZE, ATLAS_SIZE );
+    std::vector<Placed> placed;
+
+    expect( atlas.getOccupancy() == 0.0f, "starts empty" );
+
+    // the first rectangle goes in the corner.
+    GLint x = -1, y = -1;
+    expect( atlas.insert( 20, 10, x, y ) && x == 0 && y == 0, "first rectangle at the origin" );
+
+    // the next one sits beside it rather than on top.
+    expect( atlas.insert( 20, 10, x, y ) && x == 20 && y == 0, "second rectangle beside the first" );
+
+    // a third goes where its top ends up lowest: the rest of the bottom
+    // row, not on top of the first two.
+    expect( atlas.insert( 24, 4, x, y ) && x == 40 && y == 0, "third fills the rest of the bottom row" );
+
+    // one too wide for the gap rests on the highest node under its span.
+    expect( atlas.insert( 30, 4, x, y ) && x == 0 && y == 10, "wide one on top of the first two" );
+
+    expect( !atlas.insert( ATLAS_SIZE + 1, 1, x, y ), "wider than the atlas refused" );
+    expect( !atlas.insert( 1, ATLAS_SIZE, x, y ), "taller than the room left refused" );
+
+    atlas.clear();
+    expect( atlas.getOccupancy() == 0.0f, "clear() empties it" );
+
+    GLuint packed = fill( atlas, placed );
+    GLfloat occupancy = atlas.getOccupancy();
+    expect( packed > 20, "packs a fair number of rectangles" );
+    expect( occupancy > 0.6f && occupancy <= 1.0f, "occupancy of a full atlas" );
+
+    // after a clear the same sequence packs the same way again.
+    atlas.clear();
+    std::vector<Placed> repacked;
+    expect( fill( atlas, repacked ) == packed, "clear() gives every texel back" );
+
+    std::cout << (failures == 0 ? "passed" : "failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "window.hpp"
+#include "renderer.hpp"
+#include "sprite_batch.hpp"
+
+using namespace GearsEngine;
+
+//===========
+//SpriteBatch and GlyphCache in a hidden window:
+// - 320 quads over three layers, text included, go out in 4 draws;
+// - text that overflows a small atlas spills into more pages without
+//   drawing early, and drawing it again rasterizes nothing new;
+// - glyphs past the last page are left out, and the flush evicts the
+//   oldest page to make room;
+// - the batch leaves the caller's VAO, blend and depth state as it was.
+//runs under ctest on llvmpipe (SDL's offscreen driver,
+//LIBGL_ALWAYS_SOFTWARE); exits 77, skipped, where there is no 3.3 context.
+//===========
+
+static const int SKIPPED = 77;
+
+static const GLsizei TARGET_WIDTH = 256;
+static const GLsizei TARGET_HEIGHT = 64;
+
+// every glyph is a solid 8x8 box on the baseline, 10 pixels apart.
+static const GLsizei GLYPH_SIZE = 8;
+static const GLfloat GLYPH_ADVANCE = 10.0f;
+
+static const GLuint WHITE = 0xffffffff;
+
+static int failures = 0;
+
+typedef struct {
+    std::vector<unsigned char> box;
+    GLuint rasterized;
+} BoxFont;
+
+static void
+expect( bool condition, const char *what )
+{
+    if (!condition) {
+        std::cout << "failed: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static bool
+boxGlyph( GLuint codepoint, GLuint, GlyphBitmap *bitmap, void *userdata )
+{
+    BoxFont *font = static_cast<BoxFont*>(userdata);
+    ++font->rasterized;
+
+    bitmap->advance = GLYPH_ADVANCE;
+    if (codepoint == ' ')
+        return true;
+
+    bitmap->width = GLYPH_SIZE;
+    bitmap->height = GLYPH_SIZE;
+    bitmap->bearing_x = 0;
+    bitmap->bearing_y = GLYPH_SIZE;
+    bitmap->pixels = &font->box[0];
+    bitmap->pitch = GLYPH_SIZE;
+    return true;
+}
+
+// white at pixel x, y, measured from the top left like the batch.
+static bool
+isLit( GLint x, GLint y )
+{
+    GLubyte pixel[4] = { 0, 0, 0, 0 };
+    glReadPixels( x, TARGET_HEIGHT - 1 - y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel );
+    return pixel[0] > 128;
+}
+
+int main()
+{
+    setenv( "SDL_VIDEODRIVER", "offscreen", 0 );
+    unsetenv( "GEARS_CAPTURE" );
+
+    SDL_Init( SDL_INIT_VIDEO );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+    SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+
+    RenderWindow window;
+    window.setTitle( "sprite batch" );
+    window.setDimensions( TARGET_WIDTH, TARGET_HEIGHT );
+    window.setFlags( SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN );
+    window.create();
+
+    if (window.getGLContext() == NULL) {
+        std::cout << "skipped: no GL 3.3 context: " << SDL_GetError() << std::endl;
+        return SKIPPED;
+    }
+
+    {
+        Renderer renderer( &window );
+
+        // a target of our own, so the result doesn't depend on how the
+        // window system backs the default framebuffer.
+        GLuint color, framebuffer;
+        glGenRenderbuffers( 1, &color );
+        glBindRenderbuffer( GL_RENDERBUFFER, color );
+        glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, TARGET_WIDTH, TARGET_HEIGHT );
+        glBindRenderbuffer( GL_RENDERBUFFER, 0 );
+
+        glGenFramebuffers( 1, &framebuffer );
+        glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+        glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color );
+        glViewport( 0, 0, TARGET_WIDTH, TARGET_HEIGHT );
+
+        // initialize() puts back whatever VAO was bound.
+        GLuint caller_vao;
+        glGenVertexArrays( 1, &caller_vao );
+        glBindVertexArray( caller_vao );
+
+        SpriteBatch sprites;
+        if (!sprites.initialize( 1024 )) {
+            std::cout << "skipped: sprite program doesn't build" << std::endl;
+            return SKIPPED;
+        }
+
+        GLint bound = 0;
+        glGetIntegerv( GL_VERTEX_ARRAY_BINDING, &bound );
+        expect( bound == (GLint)caller_vao, "initialize() keeps the caller's VAO bound" );
+        glBindVertexArray( 0 );
+        glDeleteVertexArrays( 1, &caller_vao );
+
+        BoxFont box;
+        box.box.assign( GLYPH_SIZE * GLYPH_SIZE, 255 );
+        box.rasterized = 0;
+
+        // three layers: rectangles; sprites on a texture of their own;
+        // rectangles and text. one draw per texture in each layer.
+        {
+            GlyphCache glyphs;
+            glyphs.initialize();
+            GLuint font = glyphs.addFont( &boxGlyph, &box );
+
+            GLuint texture;
+            static const GLubyte texel[] = { 255, 255, 255, 255 };
+            glGenTextures( 1, &texture );
+            glBindTexture( GL_TEXTURE_2D, texture );
+            glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+            glBindTexture( GL_TEXTURE_2D, 0 );
+
+            sprites.begin( TARGET_WIDTH, TARGET_HEIGHT );
+
+            // submitted out of layer order, so the sort has to put them back.
+            for (int i = 0; i < 50; ++i)
+                sprites.drawRect( glm::vec4( i * 4.0f, 40.0f, 3.0f, 3.0f ), WHITE, 2 );
+            for (int i = 0; i < 150; ++i)
+                sprites.drawRect( glm::vec4( (i % 64) * 4.0f, (i / 64) * 4.0f, 3.0f, 3.0f ), WHITE, 0 );
+            for (int i = 0; i < 100; ++i)
+                sprites.drawSprite( texture, glm::vec4( (i % 64) * 4.0f, 16.0f + (i / 64) * 4.0f, 3.0f, 3.0f ),
+                                    glm::vec4( 0.0f, 0.0f, 1.0f, 1.0f ), WHITE, 1 );
+            sprites.drawText( &glyphs, font, GLYPH_SIZE, "ABCDEFGHIJKLMNOPQRST", glm::vec2( 0.0f, 60.0f ), WHITE, 2 );
+
+            expect( sprites.getQueuedCount() == 320, "320 quads queued" );
+
+            renderer.clear( 0.0f, 0.0f, 0.0f, 1.0f );
+            renderer.drawSprites( &sprites );
+
+            expect( sprites.getQuadCount() == 320, "320 quads drawn" );
+            expect( sprites.getDrawCount() == 4, "in 4 draws" );
+
+            glDeleteTextures( 1, &texture );
+        }
+
+        // an atlas that holds 9 glyphs a page, and text with 20 different
+        // ones: it spills over three pages without drawing anything early.
+        {
+            GlyphCache glyphs( 32 );
+            glyphs.initialize();
+            GLuint font = glyphs.addFont( &boxGlyph, &box );
+            box.rasterized = 0;
+
+            sprites.begin( TARGET_WIDTH, TARGET_HEIGHT );
+            sprites.drawRect( glm::vec4( 0.0f, 0.0f, 4.0f, 4.0f ), WHITE, 0 );
+            sprites.drawText( &glyphs, font, GLYPH_SIZE, "ABCDEFGHIJKLMNOPQRST", glm::vec2( 0.0f, 40.0f ), WHITE, 1 );
+
+            expect( sprites.getDrawCount() == 0, "nothing drawn before the flush" );
+            expect( sprites.getQueuedCount() == 21, "every glyph queued" );
+            expect( !glyphs.isFull() && glyphs.getPageCount() == 3, "glyphs spilled into three pages" );
+
+            // the caller's blend and depth state comes back as it was;
+            // drawSprites() doesn't go through the renderer's own state.
+            glDisable( GL_BLEND );
+            glBlendFunc( GL_ONE, GL_ZERO );
+
+            renderer.clear( 0.0f, 0.0f, 0.0f, 1.0f );
+            glEnable( GL_DEPTH_TEST );
+            renderer.drawSprites( &sprites );
+
+            GLint blend_src = 0;
+            glGetIntegerv( GL_BLEND_SRC_RGB, &blend_src );
+            expect( !glIsEnabled( GL_BLEND ) && glIsEnabled( GL_DEPTH_TEST ) && blend_src == GL_ONE,
+                    "flush() restores blend and depth state" );
+            glDisable( GL_DEPTH_TEST );
+
+            // the rectangle, then one draw per page in the text's layer.
+            expect( sprites.getDrawCount() == 4, "text over three pages in three draws" );
+            expect( glyphs.getGlyphCount() == 20 && glyphs.getPageCount() == 3, "glyphs kept after the flush" );
+
+            for (int g = 0; g < 20; ++g)
+                if (!isLit( (GLint)(g * GLYPH_ADVANCE) + GLYPH_SIZE / 2, 40 - GLYPH_SIZE / 2 )) {
+                    std::cout << "glyph " << g << " missing" << std::endl;
+                    ++failures;
+                }
+            expect( !isLit( (GLint)(20 * GLYPH_ADVANCE) + GLYPH_SIZE / 2, 40 - GLYPH_SIZE / 2 ), "nothing past the text" );
+
+            // the same text next frame comes straight from the cache.
+            GLuint rasterized = box.rasterized;
+
+            sprites.begin( TARGET_WIDTH, TARGET_HEIGHT );
+            sprites.drawText( &glyphs, font, GLYPH_SIZE, "ABCDEFGHIJKLMNOPQRST", glm::vec2( 0.0f, 40.0f ), WHITE, 1 );
+            renderer.clear( 0.0f, 0.0f, 0.0f, 1.0f );
+            renderer.drawSprites( &sprites );
+
+            expect( box.rasterized == rasterized, "no glyph rasterized twice" );
+            expect( glyphs.getGlyphCount() == 20 && glyphs.getPageCount() == 3, "no churn on the second frame" );
+            expect( sprites.getDrawCount() == 3, "second frame in three draws" );
+            expect( isLit( (GLint)(19 * GLYPH_ADVANCE) + GLYPH_SIZE / 2, 40 - GLYPH_SIZE / 2 ), "last glyph drawn again" );
+
+            // 20 more: 16 fill the last two pages, the other 4 are left
+            // out, and the flush frees the first page for them.
+            sprites.begin( TARGET_WIDTH, TARGET_HEIGHT );
+            sprites.drawText( &glyphs, font, GLYPH_SIZE, "abcdefghijklmnopqrst", glm::vec2( 0.0f, 20.0f ), WHITE, 1 );
+
+            expect( glyphs.isFull() && glyphs.getPageCount() == GR_GLYPH_PAGES, "every page full" );
+            expect( sprites.getQueuedCount() == 16, "glyphs past the last page left out" );
+
+            renderer.drawSprites( &sprites );
+
+            expect( !glyphs.isFull() && glyphs.getGlyphCount() == 36 - 9, "the oldest page evicted after the flush" );
+            expect( glyphs.getPageCount() == GR_GLYPH_PAGES, "no page allocated past the limit" );
+
+            sprites.begin( TARGET_WIDTH, TARGET_HEIGHT );
+            sprites.drawText( &glyphs, font, GLYPH_SIZE, "qrst", glm::vec2( 0.0f, 20.0f ), WHITE, 1 );
+            expect( sprites.getQueuedCount() == 4 && !glyphs.isFull(), "the rest fit on the evicted page" );
+        }
+
+        if (renderer.getDiagnostics().getMessageCount( GL_DEBUG_SEVERITY_HIGH ) > 0) {
+            std::cout << "GL errors during the test" << std::endl;
+            ++failures;
+        }
+
+        glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+        glDeleteFramebuffers( 1, &framebuffer );
+        glDeleteRenderbuffers( 1, &color );
+    }
+
+    std::cout << (failures == 0 ? "passed" : "failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
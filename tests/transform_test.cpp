@@ -0,0 +1,88 @@
+#include <glm/glm.hpp>
+#include <cmath>
+#include <iostream>
+
+#include "transform.hpp"
+
+using namespace GearsEngine;
+
+//===========
+//a sun, a planet and its moon in a TransformHierarchy: children follow
+//their parents, update() only redoes what moved and what hangs below
+//it, and reparenting and destroying keep the tree consistent. no
+//window or GL needed; runs under ctest.
+//===========
+
+static int failures = 0;
+
+static void
+expect( bool condition, const char *what )
+{
+    if (!condition) {
+        std::cout << "failed: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static bool
+isAt( TransformHierarchy &transforms, GLint node, const glm::vec3 &position )
+{
+    const glm::mat4 &world = transforms.getWorldMatrix( node );
+
+    return std::fabs( world[3][0] - position.x ) < 1e-5f &&
+           std::fabs( world[3][1] - position.y ) < 1e-5f &&
+           std::fabs( world[3][2] - position.z ) < 1e-5f;
+}
+
+int main()
+{
+    TransformHierarchy transforms;
+
+    // created moon first, so the depth sort has something to do.
+    GLint moon   = transforms.create();
+    GLint sun    = transforms.create();
+    GLint planet = transforms.create( sun );
+    transforms.setParent( moon, planet );
+
+    transforms.setPosition( sun, glm::vec3( 10.0f, 0.0f, 0.0f ) );
+    transforms.setPosition( planet, glm::vec3( 3.0f, 0.0f, 0.0f ) );
+    transforms.setPosition( moon, glm::vec3( 1.0f, 0.0f, 0.0f ) );
+
+    expect( transforms.update() == 3, "first update computes every node" );
+    expect( isAt( transforms, sun, glm::vec3( 10.0f, 0.0f, 0.0f ) ), "sun at its own position" );
+    expect( isAt( transforms, planet, glm::vec3( 13.0f, 0.0f, 0.0f ) ), "planet carried by the sun" );
+    expect( isAt( transforms, moon, glm::vec3( 14.0f, 0.0f, 0.0f ) ), "moon carried by the planet" );
+    expect( transforms.getSlot( sun ) < transforms.getSlot( planet ) &&
+            transforms.getSlot( planet ) < transforms.getSlot( moon ), "parents sorted before children" );
+
+    expect( transforms.update() == 0, "nothing flagged, nothing recomputed" );
+
+    // moving the planet moves the moon, but leaves the sun alone.
+    transforms.setPosition( planet, glm::vec3( 0.0f, 2.0f, 0.0f ) );
+    expect( transforms.update() == 2, "planet and moon recomputed" );
+    expect( !transforms.hasChanged( sun ) && transforms.hasChanged( moon ), "only the moved branch changed" );
+    expect( isAt( transforms, moon, glm::vec3( 11.0f, 2.0f, 0.0f ) ), "moon follows the planet" );
+
+    // a parent can't go below its own child.
+    expect( !transforms.setParent( sun, moon ), "cycle refused" );
+    expect( transforms.getParent( sun ) == GR_NULL_TRANSFORM, "sun still a root" );
+
+    // the moon moves over to the sun and keeps its local offset.
+    expect( transforms.setParent( moon, sun ), "reparented" );
+    transforms.update();
+    expect( isAt( transforms, moon, glm::vec3( 11.0f, 0.0f, 0.0f ) ), "moon follows its new parent" );
+
+    // destroying the planet takes only the planet now.
+    transforms.destroy( planet );
+    transforms.update();
+    expect( transforms.getCount() == 2, "planet destroyed alone" );
+    expect( isAt( transforms, moon, glm::vec3( 11.0f, 0.0f, 0.0f ) ), "moon untouched by the destroy" );
+
+    // and destroying the sun takes the moon with it.
+    transforms.destroy( sun );
+    transforms.update();
+    expect( transforms.getCount() == 0, "sun destroyed with its moon" );
+
+    std::cout << (failures == 0 ? "passed" : "failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -11,6 +11,8 @@
 
 #include "window.hpp"
 #include "renderer.hpp"
+#include "entity.hpp"
+#include "transform.hpp"
 
 #define degreesToRadians(x) x*(3.141592f/180.0f)
 #define sqr(x) pow(x, 2)
@@ -38,237 +40,175 @@ glm::vec3 normalize( glm::vec3 input )
     } else return glm::vec3();
 }
 
-class Object {
-    private:
-        bool is_moving_forward;
-        bool is_moving_backward;
-        bool is_moving_left;
-        bool is_moving_right;
+//===========
+//components: the camera gets a Transform and a Motion, every cube a
+//Node in the transform hierarchy and a Spin. systems stream through
+//them chunk by chunk.
+//===========
+typedef enum {
+    MOVE_FORWARD  = 1 << 0,
+    MOVE_BACKWARD = 1 << 1,
+    MOVE_LEFT     = 1 << 2,
+    MOVE_RIGHT    = 1 << 3,
+    ROTATE_UP     = 1 << 4,
+    ROTATE_DOWN   = 1 << 5,
+    ROTATE_LEFT   = 1 << 6,
+    ROTATE_RIGHT  = 1 << 7
+} MotionFlag;
+
+typedef struct {
+    glm::vec3 position;
+    glm::vec3 rotation;
+} Transform;
+
+typedef struct {
+    Uint32 flags;
+} Motion;
+
+typedef struct {
+    GLint transform;
+} Node;
+
+typedef struct {
+    GLfloat degree;
+    GLfloat speed; // degrees per second around y
+    GLfloat tilt;  // fixed extra rotation around x
+} Spin;
+
+typedef struct {
+    EntityWorld *world;
+    Entity       entity;
+} CameraHandle;
+
+ComponentType transform_type;
+ComponentType motion_type;
+ComponentType spin_type;
+ComponentType node_type;
+
+void motion_system( ChunkView *chunk, void *data )
+{
+    float dt = *static_cast<float*>(data);
 
-        bool is_rotating_up;
-        bool is_rotating_down;
-        bool is_rotating_left;
-        bool is_rotating_right;
+    Transform *transform = static_cast<Transform*>(chunk->components[transform_type]);
+    Motion    *motion    = static_cast<Motion*>(chunk->components[motion_type]);
 
-        glm::vec3 position;
+    for (unsigned int i = 0; i < chunk->count; ++i) {
+        Uint32 flags = motion[i].flags;
+        glm::vec3 &rotate = transform[i].rotation;
         glm::vec3 translate;
-        glm::vec3 rotate;
-
-    public:
-        bool isRotatingLeft() { return is_rotating_left; }
-        void isRotatingLeft( bool b ) { is_rotating_left = b; }
-
-        bool isRotatingRight() { return is_rotating_right; }
-        void isRotatingRight( bool b ) { is_rotating_right = b; }
-
-        bool isRotatingUp() { return is_rotating_up; }
-        void isRotatingUp( bool b ) { is_rotating_up = b; }
-
-        bool isRotatingDown() { return is_rotating_down; }
-        void isRotatingDown( bool b ) { is_rotating_down = b; }
-
-        bool isMovingForward() { return is_moving_forward; }
-        void isMovingForward( bool b ) { is_moving_forward = b; }
-
-        bool isMovingBackward() { return is_moving_backward; }
-        void isMovingBackward( bool b ) { is_moving_backward = b; }
-
-        bool isMovingLeft() { return is_moving_left; }
-        void isMovingLeft( bool b ) { is_moving_left = b; }
-
-        bool isMovingRight() { return is_moving_right; }
-        void isMovingRight( bool b ) { is_moving_right = b; }
-
-        double xPosition() { return position.x; }
-        double yPosition() { return position.y; }
-        double zPosition() { return position.z; }
-
-        double xOrientation() { return rotate.x; }
-        double yOrientation() { return rotate.y; }
-        double zOrientation() { return rotate.z; }
-
-        void update( Nanoseconds time )
-        {
-            float dt =
-                boost::chrono::duration_cast<Seconds>
-                (time).count();
-
-            if (isRotatingLeft()) {
-                rotate.y += degreesToRadians( dPS * dt );
-            }
-
-            if (isRotatingRight()) {
-                rotate.y -= degreesToRadians( dPS * dt );
-            }
-
-            if (isRotatingUp()) {
-                rotate.x += degreesToRadians( dPS * dt );
-            }
-
-            if (isRotatingDown()) {
-                rotate.x -= degreesToRadians( dPS * dt );
-            }
-
-            if (isMovingForward()) {
-                double magnitude = 0.0f;
-
-                translate.y += sin( rotate.x );
-                magnitude = cos( rotate.x );
 
-                translate.x += -1.0f * (magnitude * sin( rotate.y ));
-                translate.z += magnitude * cos( rotate.y );
-            }
+        if (flags & ROTATE_LEFT)  rotate.y += degreesToRadians( dPS * dt );
+        if (flags & ROTATE_RIGHT) rotate.y -= degreesToRadians( dPS * dt );
+        if (flags & ROTATE_UP)    rotate.x += degreesToRadians( dPS * dt );
+        if (flags & ROTATE_DOWN)  rotate.x -= degreesToRadians( dPS * dt );
 
-            if (isMovingBackward()) {
-                double magnitude = 0.0f;
+        if (flags & MOVE_FORWARD) {
+            double magnitude = cos( rotate.x );
 
-                translate.y += -1.0f * sin( rotate.x );
-                magnitude = cos( rotate.x );
-
-                translate.x += (magnitude * sin( rotate.y ));
-                translate.z += -1.0f * (magnitude * cos( rotate.y ));
-            }
-            
-            if (isMovingLeft()) {
-                translate.x += -1.0f * cos( rotate.y );
-                translate.z += -1.0f * sin( rotate.y );
-            }
+            translate.y += sin( rotate.x );
+            translate.x += -1.0f * (magnitude * sin( rotate.y ));
+            translate.z += magnitude * cos( rotate.y );
+        }
 
-            if (isMovingRight()) {
-                translate.x += cos( rotate.y );
-                translate.z += sin( rotate.y );
-            }
+        if (flags & MOVE_BACKWARD) {
+            double magnitude = cos( rotate.x );
 
-            glm::vec3 normal = normalize( translate );
-            
-            position.x += normal.x * (mPS * dt);
-            position.y += normal.y * (mPS * dt);
-            position.z += normal.z * (mPS * dt);
+            translate.y += -1.0f * sin( rotate.x );
+            translate.x += (magnitude * sin( rotate.y ));
+            translate.z += -1.0f * (magnitude * cos( rotate.y ));
+        }
 
-            translate = glm::vec3();
+        if (flags & MOVE_LEFT) {
+            translate.x += -1.0f * cos( rotate.y );
+            translate.z += -1.0f * sin( rotate.y );
         }
-                        
-        Object()
-        {
-            position.x =  0.0f;
-            position.y =  0.0f;
-            position.z = -10.f;
-
-            translate.x =  0.0f;
-            translate.y =  0.0f;
-            translate.z =  0.0f;
-
-            rotate.x = 0.0f;
-            rotate.y = 0.0f;
-            rotate.z = 0.0f;
-
-            isRotatingLeft( false );
-            isRotatingRight( false );
-            isRotatingUp( false );
-            isRotatingDown( false );
-            isMovingForward( false );
-            isMovingBackward( false );
-            isMovingLeft( false );
-            isMovingRight( false );
+
+        if (flags & MOVE_RIGHT) {
+            translate.x += cos( rotate.y );
+            translate.z += sin( rotate.y );
         }
-};
 
-class Camera : public Object {};
+        glm::vec3 normal = normalize( translate );
 
-void move_forward( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingForward( true );
+        transform[i].position.x += normal.x * (mPS * dt);
+        transform[i].position.y += normal.y * (mPS * dt);
+        transform[i].position.z += normal.z * (mPS * dt);
+    }
 }
 
-void stop_move_forward( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingForward( false );
-}
+typedef struct {
+    float               dt;
+    TransformHierarchy *transforms;
+} SpinContext;
 
-void move_backward( void* data )
+void spin_system( ChunkView *chunk, void *data )
 {
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingBackward( true );
-}
+    SpinContext *context = static_cast<SpinContext*>(data);
 
-void stop_move_backward( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingBackward( false );
-}
+    Spin *spin = static_cast<Spin*>(chunk->components[spin_type]);
+    Node *node = static_cast<Node*>(chunk->components[node_type]);
 
-void move_left( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingLeft( true );
-}
+    for (unsigned int i = 0; i < chunk->count; ++i) {
+        // a cube that doesn't spin never gets its matrices rebuilt.
+        if (spin[i].speed == 0.0f)
+            continue;
 
-void stop_move_left( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingLeft( false );
-}
+        spin[i].degree += spin[i].speed * context->dt;
 
-void move_right( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingRight( true );
-}
-
-void stop_move_right( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isMovingRight( false );
+        glm::vec3 rotation( degreesToRadians(spin[i].tilt), degreesToRadians(spin[i].degree), 0.0f );
+        context->transforms->setRotation( node[i].transform, rotation );
+    }
 }
 
-void rotate_left( void* data )
+void set_motion( void* data, Uint32 flag, bool enabled )
 {
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingLeft( true );
-}
+    CameraHandle *camera = static_cast<CameraHandle*>(data);
+    Motion *motion = camera->world->getComponent<Motion>( camera->entity, motion_type );
 
-void stop_rotate_left( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingLeft( false );
+    if (enabled) motion->flags |= flag;
+    else motion->flags &= ~flag;
 }
 
-void rotate_right( void* data )
+void move_forward( void* data )       { set_motion( data, MOVE_FORWARD, true ); }
+void stop_move_forward( void* data )  { set_motion( data, MOVE_FORWARD, false ); }
+void move_backward( void* data )      { set_motion( data, MOVE_BACKWARD, true ); }
+void stop_move_backward( void* data ) { set_motion( data, MOVE_BACKWARD, false ); }
+void move_left( void* data )          { set_motion( data, MOVE_LEFT, true ); }
+void stop_move_left( void* data )     { set_motion( data, MOVE_LEFT, false ); }
+void move_right( void* data )         { set_motion( data, MOVE_RIGHT, true ); }
+void stop_move_right( void* data )    { set_motion( data, MOVE_RIGHT, false ); }
+void rotate_left( void* data )        { set_motion( data, ROTATE_LEFT, true ); }
+void stop_rotate_left( void* data )   { set_motion( data, ROTATE_LEFT, false ); }
+void rotate_right( void* data )       { set_motion( data, ROTATE_RIGHT, true ); }
+void stop_rotate_right( void* data )  { set_motion( data, ROTATE_RIGHT, false ); }
+void rotate_up( void* data )          { set_motion( data, ROTATE_UP, true ); }
+void stop_rotate_up( void* data )     { set_motion( data, ROTATE_UP, false ); }
+void rotate_down( void* data )        { set_motion( data, ROTATE_DOWN, true ); }
+void stop_rotate_down( void* data )   { set_motion( data, ROTATE_DOWN, false ); }
+
+// std140 block matching the shader; the camera's is a CameraMatrices.
+typedef struct {
+    glm::mat4 model;
+} ObjectBlock;
+
+typedef struct {
+    Renderer           *renderer;
+    TransformHierarchy *transforms;
+} DrawContext;
+
+void draw_system( ChunkView *chunk, void *data )
 {
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingRight( true );
-}
+    DrawContext *context = static_cast<DrawContext*>(data);
 
-void stop_rotate_right( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingRight( false );
-}
+    Node *node = static_cast<Node*>(chunk->components[node_type]);
 
-void rotate_up( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingUp( true );
-}
-
-void stop_rotate_up( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingUp( false );
-}
+    for (unsigned int i = 0; i < chunk->count; ++i) {
+        ObjectBlock object;
+        object.model = context->transforms->getWorldMatrix( node[i].transform );
 
-void rotate_down( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingDown( true );
-}
-
-void stop_rotate_down( void* data )
-{
-    Camera *camera = static_cast<Camera*>(data);
-    camera->isRotatingDown( false );
+        context->renderer->setDrawUniforms( &object, sizeof(object) );
+        context->renderer->draw( GR_RENDER_ELEMENTS );
+    }
 }
 
 void close_window( void* window )
@@ -344,9 +284,8 @@ int main( int argc, char *argv[] )
         "layout (location = 0) in vec3 position;\n"
         "layout (location = 1) in vec3 color;\n"
         "out vec3 outColor;\n"
-        "uniform mat4 model;\n"
-        "uniform mat4 view;\n"
-        "uniform mat4 projection;\n"
+        "layout (std140) uniform Camera { mat4 view; mat4 projection; };\n"
+        "layout (std140) uniform Object { mat4 model; };\n"
         "void main()\n"
         "{\n"
         "   gl_Position = projection * view * model * vec4( position.x, position.y, position.z, 1.0 );\n"
@@ -401,17 +340,23 @@ int main( int argc, char *argv[] )
     ShaderProgram shaderProgram =
         renderer.createShaderProgram( "SHADER_FIRST", &vShader, &fShader );
 
-    GLuint modelL =
-        glGetUniformLocation( shaderProgram.uid, "model" );
-    GLuint viewL =
-        glGetUniformLocation( shaderProgram.uid, "view" );
-    GLuint projectionL = 
-        glGetUniformLocation( shaderProgram.uid, "projection" );
+    renderer.bindUniformBlock( shaderProgram, "Camera", GR_FRAME_UNIFORM_BINDING );
+    renderer.bindUniformBlock( shaderProgram, "Object", GR_DRAW_UNIFORM_BINDING );
 
     GLfloat xDegree = 0.0f;
     GLfloat yDegree = 0.0f;
 
-    Camera camera;
+    EntityWorld world;
+    transform_type = world.registerComponent<Transform>();
+    motion_type    = world.registerComponent<Motion>();
+    spin_type      = world.registerComponent<Spin>();
+    node_type      = world.registerComponent<Node>();
+
+    CameraHandle camera;
+    camera.world  = &world;
+    camera.entity = world.createEntity(
+            GR_COMPONENT_BIT(transform_type) | GR_COMPONENT_BIT(motion_type) );
+    world.getComponent<Transform>( camera.entity, transform_type )->position.z = -10.0f;
 
     window->addAction( SDL_QUIT, &close_window, static_cast<void*>(window) );
     window->addKeyboardAction( SDLK_ESCAPE, KEY_UP, &close_window, static_cast<void*>(window) );
@@ -432,7 +377,8 @@ int main( int argc, char *argv[] )
     window->addKeyboardAction( SDLK_c, KEY_DOWN, &rotate_up, static_cast<void*>(&camera) );
     window->addKeyboardAction( SDLK_c, KEY_UP, &stop_rotate_up, static_cast<void*>(&camera) );
 
-    glm::mat4 model, view, projection;
+    Camera view_camera;
+    view_camera.setPerspective( -45.0f, 640.0f/480.0f, 0.1f, 100.0f );
 
     lastTime = clock.now().time_since_epoch();
 
@@ -472,6 +418,33 @@ int main( int argc, char *argv[] )
         0
     };
 
+    TransformHierarchy transforms;
+
+    for (GLuint i = 0; i < sizeof(cubes)/sizeof(glm::vec3); i++) {
+        Entity cube = world.createEntity(
+                GR_COMPONENT_BIT(node_type) | GR_COMPONENT_BIT(spin_type) );
+
+        Spin *spin = world.getComponent<Spin>( cube, spin_type );
+        spin->degree = cubeDegree[i];
+        spin->speed  = 10.0f*i;
+        spin->tilt   = xDegree+(25*i);
+
+        GLint transform = transforms.create();
+
+        transforms.setPosition( transform, cubes[i] );
+        transforms.setRotation( transform, glm::vec3( degreesToRadians(spin->tilt), degreesToRadians(spin->degree), 0.0f ) );
+        transforms.setScale( transform, glm::vec3( 0.5f, 0.5f, 0.5f ) );
+
+        world.getComponent<Node>( cube, node_type )->transform = transform;
+    }
+
+    SpinContext spin_context;
+    spin_context.transforms = &transforms;
+
+    DrawContext context;
+    context.renderer = &renderer;
+    context.transforms = &transforms;
+
     timer -= timer;
     long long int frames = 0;
     bool goingUp = true;
@@ -491,60 +464,31 @@ int main( int argc, char *argv[] )
             timer -= Nanoseconds(1000000000);
         }
 
-        camera.update( accumulator );
+        // from the window rather than the clock, so a fixed step input
+        // replay (GEARS_INPUT_REPLAY, GEARS_INPUT_STEP) flies the same
+        // path every run, however fast the frames go.
+        float dt = (float)window->getFrameDelta();
+
+        world.query( GR_COMPONENT_BIT(transform_type) | GR_COMPONENT_BIT(motion_type), &motion_system, &dt );
+        spin_context.dt = dt;
+        world.query( GR_COMPONENT_BIT(spin_type) | GR_COMPONENT_BIT(node_type), &spin_system, &spin_context );
+        transforms.update();
 
         renderer.clear( 0.0, 1.0, 1.0, 1.0 );
 
-        for (GLuint i = 0; i < sizeof(cubes)/sizeof(glm::vec3); i++) {
-            model =
-                glm::translate(
-                        model,
-                        cubes[i] );
-
-            cubeDegree[i] += static_cast<GLfloat>(10.0f*i*(accumulator.count()/1000000000.0f));
-
-            model =
-                glm::rotate( 
-                        model,
-                        degreesToRadians(cubeDegree[i]),
-                        glm::vec3(0.0f, 1.0f, 0.0f) );
-
-            model =
-                glm::rotate(
-                        model,
-                        degreesToRadians(xDegree+(25*i)),
-                        glm::vec3(1.0f, 0.0f, 0.0f)
-                );
-
-            model =
-                glm::scale(
-                        model,
-                        glm::vec3( 0.5f, 0.5f, 0.5f )
-                );
-
-            view =
-                glm::rotate(
-                        view,
-                        degreesToRadians(0.0f),
-                        glm::vec3(1.0f, 0.0f, 0.0f) );
-
-            view  = glm::rotate( view, (GLfloat)camera.xOrientation(), glm::vec3(1.0f, 0.0f, 0.0f) );
-            view  = glm::rotate( view, (GLfloat)camera.yOrientation(), glm::vec3( 0.0f, 1.0f, 0.0f ) );
-            view  = glm::translate( view, glm::vec3(camera.xPosition(), camera.yPosition(), camera.zPosition()) );
-
-            projection = glm::perspective( -45.0f, 640.0f/480.0f, 0.1f, 100.0f );
-
-            glUniformMatrix4fv( modelL, 1, GL_FALSE, glm::value_ptr(model) );
-            glUniformMatrix4fv( viewL, 1, GL_FALSE, glm::value_ptr(view) );
-            glUniformMatrix4fv( projectionL, 1, GL_FALSE, glm::value_ptr(projection) );
-
-            renderer.draw( GR_RENDER_ELEMENTS );
-
-            model = glm::mat4();
-            view = glm::mat4();
-            projection = glm::mat4();
-        }
-        
+        Transform *eye = world.getComponent<Transform>( camera.entity, transform_type );
+
+        // the motion system moves the world around the eye, so the eye
+        // itself sits at the opposite offset.
+        view_camera.setPosition( -eye->position );
+        view_camera.setRotation( glm::vec3( eye->rotation.x, eye->rotation.y, 0.0f ) );
+
+        const CameraMatrices &camera_matrices = view_camera.getMatrices();
+        renderer.setFrameUniforms( &camera_matrices, sizeof(camera_matrices) );
+
+        world.query( GR_COMPONENT_BIT(node_type), &draw_system, &context );
+
+        renderer.endFrame();
         window->update();
         frames++;
     } while (!window->isClosed());